@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * The appTasks which make up the Cellular Tracking Application
+ *
+ */
+
+#ifndef _APP_TASKS_H_
+#define _APP_TASKS_H_
+
+/* ----------------------------------------------------------------
+ * Task Runner Definitions for each appTask. These define the
+ * application: what tasks are to run, and what configuration and
+ * resources they use.
+ *
+ * The tasks which subscribe to their control topic when they are
+ * initialised depend on the MQTT task.
+ *
+ * Remove a task from the list to leave it out of this application.
+ * Its functions are then not referenced and are removed by the linker.
+ *
+ * APP_TASK(id, func, name, explicitStop, initDependsOn, dwellTime,
+ *          taskStack, taskPriority, queueLength)
+ *
+ *  id:             The task's taskTypeId_t
+ *  func:           The task's functions are init<func>Task(), start<func>TaskLoop(),
+ *                  stop<func>TaskLoop() and finalize<func>Task()
+ *  name:           Name used in the logging and the MQTT topics
+ *  explicitStop:   The task loop must be stopped with stopAndWait()
+ *  initDependsOn:  The TASK_BIT()s of the tasks which must be initialised before
+ *                  this one. Tasks without a dependency between them are
+ *                  initialised at the same time.
+ *  dwellTime:      The default task loop dwell time in seconds, -1 for no loop
+ *  taskStack:      Stack size of the task loop's thread, 0 if it has no thread
+ *  taskPriority:   Priority of the task loop's thread
+ *  queueLength:    Number of messages the task's queue on the message bus can hold.
+ *                  The queue has no thread of its own, the messages are handled
+ *                  on the shared message bus workers.
+ * -------------------------------------------------------------- */
+#define APP_TASK_LIST(APP_TASK)                                                                     \
+    /* Registration - Looks after the cellular registration process */                             \
+    APP_TASK(NETWORK_REG_TASK, NetworkRegistration, "Registration", true,                           \
+                NO_TASK_DEPENDENCIES, 30,                                                           \
+                1024, 5, 5)                                                                         \
+                                                                                                    \
+    /* MQTT - Handles the MQTT broker connection, publishing messages and downlink messages */      \
+    APP_TASK(MQTT_TASK, MQTT, "MQTT", false,                                                        \
+                NO_TASK_DEPENDENCIES, 30,                                                           \
+                1024, 5, 10)                                                                        \
+                                                                                                    \
+    /* CellScan - Performs the +COPS=? Query and publishes the results */                           \
+    APP_TASK(CELL_SCAN_TASK, CellScan, "CellScan", false,                                           \
+                TASK_BIT(MQTT_TASK), -1,                                                            \
+                0, 0, 2)                                                                            \
+                                                                                                    \
+    /* SignalQuality - Measures the Signal Quality and other network parameters */                  \
+    APP_TASK(SIGNAL_QUALITY_TASK, SignalQuality, "SignalQuality", false,                            \
+                TASK_BIT(MQTT_TASK), 30,                                                            \
+                0, 0, 5)                                                                            \
+                                                                                                    \
+    /* Location - Periodically gets the GNSS location of the device */                              \
+    APP_TASK(LOCATION_TASK, Location, "Location", false,                                            \
+                TASK_BIT(MQTT_TASK), 30,                                                            \
+                0, 0, 5)                                                                            \
+                                                                                                    \
+    /* Example - Simple example task that does "nothing" */                                         \
+    APP_TASK(EXAMPLE_TASK, Example, "Example", false,                                               \
+                TASK_BIT(MQTT_TASK), 30,                                                            \
+                0, 0, 1)
+
+#endif
@@ -24,10 +24,12 @@
  *
  */
 #include <signal.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "appInit.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
 #include "cellInit.h"
 
 #include "mqttTask.h"
@@ -83,7 +85,8 @@ uPortMutexHandle_t appMutex;
 static callbackCommand_t callbacks[] = {
     {"SET_DWELL_TIME", setAppDwellTime},
     {"SET_LOG_LEVEL", setAppLogLevel},
-    {"EXIT_APP", exitApplication}
+    {"EXIT_APP", exitApplication},
+    {"DUMP_METRICS", dumpMetrics}
 };
 
 void networkUpBackUpHandler(void)
@@ -128,9 +131,18 @@ bool mqttConnectionIsUp(void)
 /// @param value    not used.
 static void intControlC(int value)
 {
-    printf("*** CTRL-C **********************************\n");
-    printf("*** Press CTRL-C again for immediate exit ***\n");
-    printf("*********************************************\n");
+    static const char message[] = "*** CTRL-C **********************************\n"
+                                  "*** Press CTRL-C again for immediate exit ***\n"
+                                  "*********************************************\n";
+
+    // write() is async-signal-safe, printf() isn't
+    if (write(STDOUT_FILENO, message, sizeof(message) - 1) < 0) {
+        // nothing can be done about it here
+    }
+
+    // only set the flag, as nothing else here is async-signal-safe. The
+    // exit check timer wakes up the main thread within APP_EXIT_CHECK_MS,
+    // which signals the tasks once it has left the application loop
     gExitApp = true;
 
     // reset the control-c interrupt so it 
@@ -33,4 +33,14 @@ target_sources(${APP_NAME} PRIVATE ${APP_COMMONS} ${APP_TASKS})
 
 file(REAL_PATH "${CMAKE_SOURCE_DIR}/config/" APP_CONFIG)
 
-target_include_directories(${APP_NAME} PRIVATE ${APP_COMMON_DIR} ${APP_TASKS_DIR} ${APP_CONFIG})
\ No newline at end of file
+target_include_directories(${APP_NAME} PRIVATE ${APP_COMMON_DIR} ${APP_TASKS_DIR} ${APP_CONFIG})
+
+# Put each function and variable in its own section so the linker can remove
+# the code of any appTasks which are not in the application's task list
+if (MSVC)
+    target_compile_options(${APP_NAME} PRIVATE /Gy)
+    target_link_options(${APP_NAME} PRIVATE /OPT:REF)
+else()
+    target_compile_options(${APP_NAME} PRIVATE -ffunction-sections -fdata-sections)
+    target_link_options(${APP_NAME} PRIVATE -Wl,--gc-sections)
+endif()
@@ -15,7 +15,9 @@
  */
 
 #include "common.h"
+#include "appInit.h"
 #include "taskControl.h"
+#include "taskScheduler.h"
 #include "cellInit.h"
 
 #ifdef BUILD_TARGET_WINDOWS
@@ -33,7 +35,6 @@
 // Dwell time of the main loop activity, pause period until the loop runs again
 #define APP_DWELL_TIME_MS_MINIMUM 5000
 #define APP_DWELL_TIME_MS_DEFAULT APP_DWELL_TIME_MS_MINIMUM;
-#define APP_DWELL_TICK_MS 50
 
 // MQTT Topic will be of this format: <APP_TOPIC_NAME>/<IMEI>/<APP_TASK>
 #define MAX_APP_TOPIC_NAME 30
@@ -44,6 +45,9 @@
 // Default App dwell time in milliseconds
 #define APP_DWELL_TIME_DEFAULT 5000
 
+// How often gExitApp is checked, as a signal handler can only set it
+#define APP_EXIT_CHECK_MS 100
+
 /* ----------------------------------------------------------------
  * STATIC VARIABLES
  * -------------------------------------------------------------- */
@@ -66,6 +70,16 @@ static int32_t appDwellTimeMS = APP_DWELL_TIME_DEFAULT;
 // This flag will pause the main application loop
 static bool pauseMainLoopIndicator = false;
 
+// The app function is run by the scheduler every appDwellTimeMS
+static bool (*appLoopFunc)(void) = NULL;
+static int32_t appLoopHandle = U_ERROR_COMMON_NOT_INITIALISED;
+
+// Wakes the main thread soon after gExitApp is set, whatever the dwell time
+static int32_t exitCheckHandle = U_ERROR_COMMON_NOT_INITIALISED;
+
+// The main thread waits on this semaphore until the application exits
+static uPortSemaphoreHandle_t appExitSemaphore = NULL;
+
 // The code value to use when exiting the application with exit(exitcode);
 static int32_t exitCode = 0;
 
@@ -189,19 +203,33 @@ static int32_t initCellularDevice(void)
     return configureCellularModule();
 }
 
-/// @brief Dwells for appDwellTimeMS time, and exits if this time changes or Exit App
-static void dwellAppLoop(void)
+/// @brief Scheduler callback which wakes up the main thread once gExitApp
+///        is set, as the Control-C handler can't do it itself
+static void checkExitApp(void *pParam)
+{
+    if (gExitApp)
+        wakeApplicationLoop();
+}
+
+/// @brief Scheduler callback which runs the app function every appDwellTimeMS
+static void appLoopTick(void *pParam)
 {
-    int32_t tick = 0;
-    int32_t previousDwellTimeMS = appDwellTimeMS;
-
-    do
-    {
-        uPortTaskBlock(APP_DWELL_TICK_MS);
-        tick = tick + APP_DWELL_TICK_MS;
-    } while((tick < previousDwellTimeMS) &&
-            (previousDwellTimeMS == appDwellTimeMS) &&
-            (!gExitApp));
+    if (gExitApp) {
+        wakeApplicationLoop();
+        return;
+    }
+
+    if (pauseMainLoopIndicator) {
+        writeDebug("Application loop paused.");
+        return;
+    }
+
+    printDebug("*** Application Tick ***\n");
+    if (!appLoopFunc()) {
+        gExitApp = true;
+        writeInfo("Application function stopped the app loop");
+        wakeApplicationLoop();
+    }
 }
 
 static int32_t closeCellularDevice(void)
@@ -393,6 +421,9 @@ int32_t setAppDwellTime(commandParamsList_t *params)
     appDwellTimeMS = timeMS;
     writeInfo("Setting App Dwell Time to: %d\n", timeMS);
 
+    if (appLoopHandle >= 0)
+        schedulerSetPeriod(appLoopHandle, appDwellTimeMS);
+
     return U_ERROR_COMMON_SUCCESS;
 }
 
@@ -419,6 +450,7 @@ int32_t exitApplication(commandParamsList_t *params)
     printWarn("Application exiting with code: %d", exitCode);
 
     gExitApp = true;
+    signalAllTasks();
 
     return U_ERROR_COMMON_SUCCESS;
 }
@@ -433,28 +465,56 @@ void pauseMainLoop(bool state)
     printInfo("Main application loop %s", state ? "is paused" : "is unpaused");
 }
 
+/// @brief Wakes up the main thread waiting in runApplicationLoop() so it
+///        can check gExitApp. Giving the semaphore isn't async-signal-safe,
+///        so don't call this from a signal handler: a handler only sets
+///        gExitApp, and the exit check timer wakes the thread.
+void wakeApplicationLoop(void)
+{
+    if (appExitSemaphore != NULL)
+        uPortSemaphoreGive(appExitSemaphore);
+}
+
 /// @brief This is the main application loop which runs the appFunc which is 
-///        defined in the application main.c module.
+///        defined in the application main.c module. The appFunc is run by
+///        the scheduler every appDwellTimeMS, while the main thread waits
+///        here for the application to exit.
 /// @param appFunc The function pointer of the app event code
 void runApplicationLoop(bool (*appFunc)(void))
 {
+    appLoopFunc = appFunc;
+
+    int32_t errorCode = uPortSemaphoreCreate(&appExitSemaphore, 0, 1);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the application exit semaphore (%d)", errorCode);
+        return;
+    }
+
+    appLoopHandle = schedulerAdd("AppLoop", appLoopTick, NULL, appDwellTimeMS, appDwellTimeMS);
+    if (appLoopHandle < 0) {
+        writeFatal("Failed to schedule the application loop (%d)", appLoopHandle);
+        return;
+    }
+
+    exitCheckHandle = schedulerAdd("AppExitCheck", checkExitApp, NULL, APP_EXIT_CHECK_MS, APP_EXIT_CHECK_MS);
+    if (exitCheckHandle < 0)
+        writeWarn("Failed to schedule the exit check, Control-C can take up to %d ms (%d)",
+                  appDwellTimeMS, exitCheckHandle);
+
     printDebug("Application Loop now starting");
     while(!gExitApp) {
-        printDebug("*** Application Tick ***\n");
-        dwellAppLoop();
+        uPortSemaphoreTake(appExitSemaphore);
+    }
 
-        if (gExitApp) return;
+    schedulerRemove(appLoopHandle);
+    appLoopHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
-        if (pauseMainLoopIndicator) {
-            writeDebug("Application loop paused.");
-            continue;
-        }
-
-        if (!appFunc()) {
-            gExitApp = true;
-            writeInfo("Application function stopped the app loop");
-        }
+    if (exitCheckHandle >= 0) {
+        schedulerRemove(exitCheckHandle);
+        exitCheckHandle = U_ERROR_COMMON_NOT_INITIALISED;
     }
+
+    signalAllTasks();
 }
 
 /// @brief Sets the application status, waits for the tasks and closes the log
@@ -463,11 +523,12 @@ void finalize(applicationStates_t appState)
 {
     gAppStatus = appState;
     gExitApp = true;
+    signalAllTasks();
 
     waitForAllTasksToStop();
 
     // now stop the network registration task.
-    if (stopAndWait(NETWORK_REG_TASK, 15) < 0 && appState != ERROR)
+    if (stopAndWait(NETWORK_REG_TASK, 30) < 0 && appState != ERROR)
         printWarn("Did not stop the registration task properly");
 
     finalizeAllTasks();
@@ -31,6 +31,7 @@ int32_t exitApplication(commandParamsList_t *params);
  * APPLICATION LOOP FUNCTIONS
  * -------------------------------------------------------------- */
 void runApplicationLoop(bool (*appFunc)(void));
+void wakeApplicationLoop(void);
 void pauseMainLoop(bool state);
 
 /* ----------------------------------------------------------------
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * CBOR - encodes the few CBOR (RFC 8949) types the tasks publish in to a
+ * buffer the caller owns, with no allocation. Each item is a major type
+ * in the top 3 bits of its first byte and an argument, the value or the
+ * length, in the fewest bytes which hold it. Once an item doesn't fit the
+ * encoder stops writing, and cborLength() returns 0, so a message is
+ * never published cut short.
+ *
+ */
+
+#include <string.h>
+
+#include "cbor.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define MAJOR_UNSIGNED              0
+#define MAJOR_NEGATIVE              1
+#define MAJOR_TEXT                  3
+#define MAJOR_ARRAY                 4
+#define MAJOR_MAP                   5
+#define MAJOR_TAG                   6
+
+#define TAG_DECIMAL_FRACTION        4
+
+// The argument of an item follows in the next 1, 2, 4 or 8 bytes
+#define ARGUMENT_1_BYTE             24
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static bool reserve(cborEncoder_t *pEncoder, size_t length)
+{
+    if (pEncoder->overflow || pEncoder->size - pEncoder->length < length) {
+        pEncoder->overflow = true;
+        return false;
+    }
+
+    return true;
+}
+
+/// @brief Writes the first byte of an item and its argument
+static void writeHead(cborEncoder_t *pEncoder, uint8_t major, uint64_t argument)
+{
+    size_t argumentLength = argument < ARGUMENT_1_BYTE ? 0 :
+                            argument <= UINT8_MAX ? 1 :
+                            argument <= UINT16_MAX ? 2 :
+                            argument <= UINT32_MAX ? 4 : 8;
+
+    if (!reserve(pEncoder, 1 + argumentLength))
+        return;
+
+    uint8_t *pHead = pEncoder->pBuffer + pEncoder->length;
+    if (argumentLength == 0) {
+        pHead[0] = (uint8_t)(major << 5 | argument);
+    } else {
+        // 1, 2, 4 and 8 bytes are the additional information 24 to 27
+        uint8_t info = ARGUMENT_1_BYTE + (argumentLength == 1 ? 0 : argumentLength == 2 ? 1 :
+                                          argumentLength == 4 ? 2 : 3);
+        pHead[0] = (uint8_t)(major << 5 | info);
+
+        // most significant byte first
+        for (size_t i=0; i<argumentLength; i++)
+            pHead[argumentLength - i] = (uint8_t)(argument >> (8 * i));
+    }
+
+    pEncoder->length += 1 + argumentLength;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Starts encoding in to a buffer
+/// @param pEncoder The encoder
+/// @param pBuffer The buffer
+/// @param size The size of the buffer
+void cborInit(cborEncoder_t *pEncoder, uint8_t *pBuffer, size_t size)
+{
+    pEncoder->pBuffer = pBuffer;
+    pEncoder->size = pBuffer == NULL ? 0 : size;
+    pEncoder->length = 0;
+    pEncoder->overflow = false;
+}
+
+/// @brief Starts a map, followed by its keys and values
+/// @param pEncoder The encoder
+/// @param pairs The number of keys
+void cborMap(cborEncoder_t *pEncoder, size_t pairs)
+{
+    writeHead(pEncoder, MAJOR_MAP, pairs);
+}
+
+/// @brief Starts an array, followed by its items
+/// @param pEncoder The encoder
+/// @param items The number of items
+void cborArray(cborEncoder_t *pEncoder, size_t items)
+{
+    writeHead(pEncoder, MAJOR_ARRAY, items);
+}
+
+/// @brief Encodes an integer
+/// @param pEncoder The encoder
+/// @param value The value
+void cborInt(cborEncoder_t *pEncoder, int64_t value)
+{
+    // a negative value is encoded as -1 - value, which can't overflow
+    if (value < 0)
+        writeHead(pEncoder, MAJOR_NEGATIVE, (uint64_t)(-1 - value));
+    else
+        writeHead(pEncoder, MAJOR_UNSIGNED, (uint64_t)value);
+}
+
+/// @brief Encodes a decimal fraction, as tag 4, so a value like a latitude
+///        keeps its exact decimal digits
+/// @param pEncoder The encoder
+/// @param mantissa The value times 10 to the power of -exponent
+/// @param exponent The power of 10, negative for the fraction digits
+void cborDecimal(cborEncoder_t *pEncoder, int64_t mantissa, int32_t exponent)
+{
+    writeHead(pEncoder, MAJOR_TAG, TAG_DECIMAL_FRACTION);
+    cborArray(pEncoder, 2);
+    cborInt(pEncoder, exponent);
+    cborInt(pEncoder, mantissa);
+}
+
+/// @brief Encodes a text string
+/// @param pEncoder The encoder
+/// @param pText The UTF-8 text, NULL is encoded as the empty string
+void cborText(cborEncoder_t *pEncoder, const char *pText)
+{
+    size_t length = pText == NULL ? 0 : strlen(pText);
+
+    writeHead(pEncoder, MAJOR_TEXT, length);
+    if (length > 0 && reserve(pEncoder, length)) {
+        memcpy(pEncoder->pBuffer + pEncoder->length, pText, length);
+        pEncoder->length += length;
+    }
+}
+
+/// @brief Encodes a key of a map and a map as its value
+/// @param pEncoder The encoder
+/// @param pKey The key
+/// @param pairs The number of keys of the value
+void cborKeyMap(cborEncoder_t *pEncoder, const char *pKey, size_t pairs)
+{
+    cborText(pEncoder, pKey);
+    cborMap(pEncoder, pairs);
+}
+
+/// @brief Encodes a key of a map and an integer value
+/// @param pEncoder The encoder
+/// @param pKey The key
+/// @param value The value
+void cborKeyInt(cborEncoder_t *pEncoder, const char *pKey, int64_t value)
+{
+    cborText(pEncoder, pKey);
+    cborInt(pEncoder, value);
+}
+
+/// @brief Encodes a key of a map and a decimal fraction value
+/// @param pEncoder The encoder
+/// @param pKey The key
+/// @param mantissa The value times 10 to the power of -exponent
+/// @param exponent The power of 10, negative for the fraction digits
+void cborKeyDecimal(cborEncoder_t *pEncoder, const char *pKey, int64_t mantissa, int32_t exponent)
+{
+    cborText(pEncoder, pKey);
+    cborDecimal(pEncoder, mantissa, exponent);
+}
+
+/// @brief Encodes a key of a map and a text string value
+/// @param pEncoder The encoder
+/// @param pKey The key
+/// @param pText The UTF-8 text, NULL is encoded as the empty string
+void cborKeyText(cborEncoder_t *pEncoder, const char *pKey, const char *pText)
+{
+    cborText(pEncoder, pKey);
+    cborText(pEncoder, pText);
+}
+
+/// @brief Gets the length of the encoding
+/// @param pEncoder The encoder
+/// @return The length, or 0 if it didn't fit in the buffer
+size_t cborLength(const cborEncoder_t *pEncoder)
+{
+    return pEncoder->overflow ? 0 : pEncoder->length;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * CBOR header - encodes CBOR (RFC 8949) in to a caller's buffer
+ *
+ */
+
+#ifndef _CBOR_H_
+#define _CBOR_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Starts and ends an array of items not counted up front
+#define CBOR_INDEFINITE_ARRAY       0x9F
+#define CBOR_BREAK                  0xFF
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    uint8_t *pBuffer;
+    size_t size;
+    size_t length;
+    bool overflow;              // An item didn't fit, so the encoding isn't valid
+} cborEncoder_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Starts encoding in to a buffer
+/// @param pEncoder     The encoder
+/// @param pBuffer      The buffer
+/// @param size         The size of the buffer
+void cborInit(cborEncoder_t *pEncoder, uint8_t *pBuffer, size_t size);
+
+/// @brief              Starts a map, followed by its keys and values
+/// @param pEncoder     The encoder
+/// @param pairs        The number of keys
+void cborMap(cborEncoder_t *pEncoder, size_t pairs);
+
+/// @brief              Starts an array, followed by its items
+/// @param pEncoder     The encoder
+/// @param items        The number of items
+void cborArray(cborEncoder_t *pEncoder, size_t items);
+
+/// @brief              Encodes an integer
+/// @param pEncoder     The encoder
+/// @param value        The value
+void cborInt(cborEncoder_t *pEncoder, int64_t value);
+
+/// @brief              Encodes a decimal fraction, as tag 4, so a value like
+///                     a latitude keeps its exact decimal digits
+/// @param pEncoder     The encoder
+/// @param mantissa     The value times 10 to the power of -exponent
+/// @param exponent     The power of 10, negative for the fraction digits
+void cborDecimal(cborEncoder_t *pEncoder, int64_t mantissa, int32_t exponent);
+
+/// @brief              Encodes a text string
+/// @param pEncoder     The encoder
+/// @param pText        The UTF-8 text, NULL is encoded as the empty string
+void cborText(cborEncoder_t *pEncoder, const char *pText);
+
+/// @brief              Encodes a key of a map and a map as its value
+/// @param pEncoder     The encoder
+/// @param pKey         The key
+/// @param pairs        The number of keys of the value
+void cborKeyMap(cborEncoder_t *pEncoder, const char *pKey, size_t pairs);
+
+/// @brief              Encodes a key of a map and an integer value
+/// @param pEncoder     The encoder
+/// @param pKey         The key
+/// @param value        The value
+void cborKeyInt(cborEncoder_t *pEncoder, const char *pKey, int64_t value);
+
+/// @brief              Encodes a key of a map and a decimal fraction value
+/// @param pEncoder     The encoder
+/// @param pKey         The key
+/// @param mantissa     The value times 10 to the power of -exponent
+/// @param exponent     The power of 10, negative for the fraction digits
+void cborKeyDecimal(cborEncoder_t *pEncoder, const char *pKey, int64_t mantissa, int32_t exponent);
+
+/// @brief              Encodes a key of a map and a text string value
+/// @param pEncoder     The encoder
+/// @param pKey         The key
+/// @param pText        The UTF-8 text, NULL is encoded as the empty string
+void cborKeyText(cborEncoder_t *pEncoder, const char *pKey, const char *pText);
+
+/// @brief              Gets the length of the encoding
+/// @param pEncoder     The encoder
+/// @return             The length, or 0 if it didn't fit in the buffer
+size_t cborLength(const cborEncoder_t *pEncoder);
+
+#endif
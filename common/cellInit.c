@@ -19,6 +19,7 @@
 #include "cellInit.h"
 
 #include "mqttTask.h"
+#include "mqttEncode.h"
 
 /* ----------------------------------------------------------------
  * DEFINES
@@ -43,6 +44,7 @@ char gCCID[U_CELL_INFO_IMSI_SIZE+1];
  * -------------------------------------------------------------- */
 // The topic name for CellInit messaing
 static char topicName[MAX_TOPIC_NAME_SIZE];
+static mqttTopicHandle_t topicHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
@@ -174,12 +176,10 @@ void getCellularModuleInfo(void)
         writeWarn("Cellular Module CCID: Failed to get: %d", errorCode);
 }
 
-/// @brief Publishes the module information acquired by getCellularModuleInfo()
-/// over the main module's MQTT 'Information' topic
-int32_t publishCellularModuleInfo()
+/// @brief Encodes the module information as JSON, with its timestamp
+static size_t encodeModuleInfoJson(const void *pData, uint8_t *pBuffer, size_t size)
 {
-    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
-    getTimeStamp(timestamp);
+    const char *timestamp = (const char *)pData;
 
     char format[] = "{"                     \
             "\"Timestamp\":\"%s\", "        \
@@ -194,16 +194,56 @@ int32_t publishCellularModuleInfo()
                 "\"NetworkUpCounter\":%d}"  \
         "}";
 
-    char jsonBuffer[300];
-    snprintf(jsonBuffer, 300, format, timestamp,
+    int length = snprintf((char *)pBuffer, size, format, timestamp,
             gModuleManufacturer,
             gModuleModel,
             gModuleVersion,
             gIMSI, gCCID,
             networkUpCounter);
 
-    snprintf(topicName, MAX_TOPIC_NAME_SIZE, "%s/%s/%s", gAppTopicHeader, gModuleSerial, "Information");
-    writeAlways(jsonBuffer);
+    return length < 0 || (size_t)length >= size ? 0 : length;
+}
+
+/// @brief Encodes the module information as CBOR, with the same keys and
+///        values as the JSON
+static size_t encodeModuleInfoCbor(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const char *timestamp = (const char *)pData;
+
+    cborEncoder_t encoder;
+    cborInit(&encoder, pBuffer, size);
+    cborMap(&encoder, 4);
+    cborKeyText(&encoder, "Timestamp", timestamp);
+    cborKeyMap(&encoder, "Module", 3);
+        cborKeyText(&encoder, "Manufacturer", gModuleManufacturer);
+        cborKeyText(&encoder, "Model", gModuleModel);
+        cborKeyText(&encoder, "Version", gModuleVersion);
+    cborKeyMap(&encoder, "SIM", 2);
+        cborKeyText(&encoder, "IMSI", gIMSI);
+        cborKeyText(&encoder, "CCID", gCCID);
+    cborKeyMap(&encoder, "Application", 1);
+        cborKeyInt(&encoder, "NetworkUpCounter", networkUpCounter);
+
+    return cborLength(&encoder);
+}
+
+static const mqttEncoders_t moduleInfoEncoders = {encodeModuleInfoJson, encodeModuleInfoCbor};
 
-    return publishMQTTMessage(topicName, jsonBuffer, U_MQTT_QOS_AT_MOST_ONCE, true);    
-}
\ No newline at end of file
+/// @brief Publishes the module information acquired by getCellularModuleInfo()
+/// over the main module's MQTT 'Information' topic
+int32_t publishCellularModuleInfo()
+{
+    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
+    getTimeStamp(timestamp);
+
+    if (topicHandle < 0) {
+        snprintf(topicName, MAX_TOPIC_NAME_SIZE, "%s/%s/%s", gAppTopicHeader, gModuleSerial, "Information");
+        topicHandle = mqttTopicRegister(topicName);
+        mqttTopicSetPolicy(topicHandle, MQTT_POLICY_KEEP_LATEST);
+        mqttTopicSetQoS(topicHandle, U_MQTT_QOS_AT_LEAST_ONCE);
+    }
+
+    uint8_t payloadBuffer[300];
+    return mqttPublishEncoded(topicHandle, &moduleInfoEncoders, timestamp, payloadBuffer, sizeof(payloadBuffer),
+                                true, MQTT_LANE_CONTROL);
+}
@@ -35,6 +35,65 @@
  * -------------------------------------------------------------- */
 #define PARAM_DELIMITERS " ,:"
 
+// Number of threads which can block in waitForCondition() at once.
+// Any more than this fall back to polling.
+#define MAX_STATE_WAITERS       8
+
+// Conditions are re-checked at least this often, for state which is
+// changed without calling notifyStateChange() (e.g. Control-C)
+#define STATE_WAIT_MAX_MS       1000
+#define STATE_WAIT_POLL_MS      100
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t stateWaitMutex = NULL;
+static uPortSemaphoreHandle_t stateWaiters[MAX_STATE_WAITERS];
+static bool stateWaiterInUse[MAX_STATE_WAITERS];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+static int32_t acquireStateWaiter(void)
+{
+    int32_t slot = -1;
+
+    if (stateWaitMutex == NULL)
+        return slot;
+
+    U_PORT_MUTEX_LOCK(stateWaitMutex);
+    for (int i=0; i<MAX_STATE_WAITERS; i++) {
+        if (!stateWaiterInUse[i]) {
+            stateWaiterInUse[i] = true;
+
+            // clear out a notification left over from the last waiter
+            uPortSemaphoreTryTake(stateWaiters[i], 0);
+            slot = i;
+            break;
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(stateWaitMutex);
+
+    return slot;
+}
+
+static void releaseStateWaiter(int32_t slot)
+{
+    if (slot < 0)
+        return;
+
+    U_PORT_MUTEX_LOCK(stateWaitMutex);
+    stateWaiterInUse[slot] = false;
+    U_PORT_MUTEX_UNLOCK(stateWaitMutex);
+}
+
+static bool runCheckFunction(void *pParam)
+{
+    bool (**checkFunction)(void) = (bool (**)(void))pParam;
+
+    return (*checkFunction)();
+}
+
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
@@ -192,6 +251,21 @@ void getTimeStamp(char *timeStamp)
     }
 }
 
+/// @brief Gets a time in microseconds, for timing something shorter than the
+///        millisecond tick time can measure
+/// @return The time in microseconds, from an arbitrary start
+int64_t getTimeUs(void)
+{
+    struct timespec now;
+#ifdef BUILD_TARGET_WINDOWS
+    timespec_get(&now, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
 void runTaskAndDelete(void *pParams)
 {
     if (pParams != NULL) {
@@ -205,13 +279,86 @@ void runTaskAndDelete(void *pParams)
     uPortTaskBlock(2);
 }
 
+/// @brief Creates the waiter semaphores used by waitForCondition()
+/// @return 0 on success, negative on failure
+int32_t initStateNotify(void)
+{
+    if (stateWaitMutex != NULL)
+        return U_ERROR_COMMON_SUCCESS;
+
+    int32_t errorCode = uPortMutexCreate(&stateWaitMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the state wait mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    for (int i=0; i<MAX_STATE_WAITERS; i++) {
+        errorCode = uPortSemaphoreCreate(&stateWaiters[i], 0, 1);
+        if (errorCode < 0) {
+            writeFatal("Failed to create the state waiter semaphore (%d)", errorCode);
+            return errorCode;
+        }
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Wakes up every thread blocked in waitForCondition() so they
+///        re-check their condition. Call this after changing any state
+///        which is waited on.
+void notifyStateChange(void)
+{
+    if (stateWaitMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(stateWaitMutex);
+    for (int i=0; i<MAX_STATE_WAITERS; i++) {
+        if (stateWaiterInUse[i])
+            uPortSemaphoreGive(stateWaiters[i]);
+    }
+    U_PORT_MUTEX_UNLOCK(stateWaitMutex);
+}
+
+/// @brief Blocks until the check function returns true, or the timeout
+/// @param checkFunction The condition to wait for
+/// @param pParam The parameter passed to the check function
+/// @param timeoutMs How long to wait, or negative to wait forever
+/// @return true if the condition was met, false on timeout
+bool waitForCondition(bool (*checkFunction)(void *), void *pParam, int32_t timeoutMs)
+{
+    // take a waiter slot before checking, so a notification between
+    // the check and the wait is not lost
+    int32_t slot = acquireStateWaiter();
+    int32_t startTime = uPortGetTickTimeMs();
+    bool result;
+
+    while (!(result = checkFunction(pParam))) {
+        int32_t waitMs = slot >= 0 ? STATE_WAIT_MAX_MS : STATE_WAIT_POLL_MS;
+        if (timeoutMs >= 0) {
+            int32_t remainingMs = timeoutMs - (uPortGetTickTimeMs() - startTime);
+            if (remainingMs <= 0)
+                break;
+
+            if (remainingMs < waitMs)
+                waitMs = remainingMs;
+        }
+
+        if (slot >= 0)
+            uPortSemaphoreTryTake(stateWaiters[slot], waitMs);
+        else
+            uPortTaskBlock(waitMs);
+    }
+
+    releaseStateWaiter(slot);
+
+    return result;
+}
+
 bool waitFor(bool (*checkFunction)(void))
 {
     while(!gExitApp) {
-        if (checkFunction())
+        if (waitForCondition(runCheckFunction, &checkFunction, STATE_WAIT_MAX_MS))
             return true;
-        
-        uPortTaskBlock(1000);
     }
 
     return false;
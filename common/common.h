@@ -164,9 +164,14 @@ void freeParams(commandParamsList_t *head);
 int32_t getParamValue(commandParamsList_t *params, size_t index, int32_t minValue, int32_t maxValue, int32_t defValue);
 
 void getTimeStamp(char *timeStamp);
+int64_t getTimeUs(void);
 
 void runTaskAndDelete(void *pParams);
 
 bool waitFor(bool (*checkFunction)(void));
 
+int32_t initStateNotify(void);
+void notifyStateChange(void);
+bool waitForCondition(bool (*checkFunction)(void *), void *pParam, int32_t timeoutMs);
+
 #endif
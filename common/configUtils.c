@@ -35,6 +35,8 @@
 /* ----------------------------------------------------------------
  * DEFINES
  * -------------------------------------------------------------- */
+// The characters which end an entry of a list, like MQTT_CBOR_TOPICS
+#define LIST_SEPARATORS ", \t\r"
 
 /* ----------------------------------------------------------------
  * TYPE DEFINITIONS
@@ -330,6 +332,27 @@ bool setBoolParamFromConfig(const char *key, const char *compare, bool *param)
     return true;
 }
 
+/// @brief Gets the next entry of a comma separated list from the
+///        configuration, skipping the empty entries
+/// @param ppList The rest of the list, moved past the entry
+/// @param pLength Set to the length of the entry
+/// @return The entry, which isn't terminated, or NULL at the end of the list
+const char *nextListEntry(const char **ppList, size_t *pLength)
+{
+    const char *pEntry = *ppList;
+    if (pEntry == NULL)
+        return NULL;
+
+    // the list may end with a carriage return
+    pEntry += strspn(pEntry, LIST_SEPARATORS);
+    size_t length = strcspn(pEntry, LIST_SEPARATORS);
+
+    *ppList = pEntry + length;
+    *pLength = length;
+
+    return length > 0 ? pEntry : NULL;
+}
+
 /// @brief      Checks if a parameter exists in the configuration
 /// @param key  The parameter to check for
 /// @return     A valude indicating whether the parameter is in the config
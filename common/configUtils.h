@@ -60,6 +60,15 @@ bool setIntParamFromConfig(const char *key, int32_t *param);
 /// @return         True if the bool value was set, False otherwise
 bool setBoolParamFromConfig(const char *key, const char *value, bool *param);
 
+/// @brief          Gets the next entry of a comma separated list from the
+///                 configuration, which may end with a carriage return.
+///                 Empty entries are skipped.
+/// @param ppList   The rest of the list, moved past the entry. Can be NULL.
+/// @param pLength  Set to the length of the entry
+/// @return         The entry, which isn't terminated, or NULL at the end
+///                 of the list
+const char *nextListEntry(const char **ppList, size_t *pLength);
+
 /// @brief          Checks if a parameter exists in the configuration
 /// @param key      The parameter to check for
 /// @return         A valude indicating whether the parameter is in the config
@@ -0,0 +1,676 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Journal - a ring of records in a fixed size file. Records are only
+ * ever appended at the tail, each with a sequence number and a CRC, so
+ * after a crash the records are found again by following them from the
+ * head. The head is kept in two alternate header slots, and is moved on
+ * before the space of an evicted record is written over.
+ *
+ * On Linux the file is memory-mapped, elsewhere it is read and written
+ * with stdio.
+ *
+ */
+
+#include <stddef.h>
+#include "common.h"
+#include "fileSystem.h"
+#include "journal.h"
+
+#ifdef BUILD_TARGET_RASPBERRY_PI
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define JOURNAL_HEADER_MAGIC        0x524E524A      // "JRNR"
+#define JOURNAL_RECORD_MAGIC        0x4345524A      // "JREC"
+#define JOURNAL_WRAP_MAGIC          0x5052574A      // "JWRP"
+
+#define JOURNAL_HEADER_SLOT_SIZE    32
+#define JOURNAL_DATA_OFFSET         (2 * JOURNAL_HEADER_SLOT_SIZE)
+
+#define RECORD_HEADER_SIZE          sizeof(journalRecordHeader_t)
+#define RECORD_SIZE(length)         (RECORD_HEADER_SIZE + (((length) + 3) & ~3))
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct JOURNAL_HEADER {
+    uint32_t magic;
+    uint32_t generation;        // The slot with the highest generation is the current one
+    uint32_t capacity;
+    uint32_t head;              // Offset of the oldest record
+    uint32_t headSeq;           // Sequence number of the oldest record
+    uint32_t crc;
+} journalHeader_t;
+
+typedef struct JOURNAL_RECORD_HEADER {
+    uint32_t magic;             // A record, or a marker that the next record is at the start
+    uint32_t seq;
+    uint32_t length;
+    uint32_t crc;               // Over the sequence number, length and the record
+} journalRecordHeader_t;
+
+struct Journal {
+    uPortMutexHandle_t mutex;
+
+#ifdef BUILD_TARGET_RASPBERRY_PI
+    int fd;
+    uint8_t *pMap;
+    size_t mapSize;
+#else
+    FILE *pFile;
+#endif
+
+    uint32_t capacity;
+    uint32_t generation;
+    uint32_t head;
+    uint32_t headSeq;
+    uint32_t tail;
+
+    journalStats_t stats;
+};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS - file access
+ * -------------------------------------------------------------- */
+#ifdef BUILD_TARGET_RASPBERRY_PI
+
+static int32_t storageOpen(journal_t *pJournal, const char *pFileName, size_t size)
+{
+    pJournal->fd = open(pFileName, O_RDWR | O_CREAT, 0644);
+    if (pJournal->fd < 0)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    // a file of a different size was made for another capacity, so start again
+    struct stat fileStat;
+    if (fstat(pJournal->fd, &fileStat) != 0 || (size_t)fileStat.st_size != size) {
+        if (ftruncate(pJournal->fd, 0) != 0 || ftruncate(pJournal->fd, size) != 0) {
+            close(pJournal->fd);
+            return U_ERROR_COMMON_NO_MEMORY;
+        }
+    }
+
+    pJournal->pMap = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pJournal->fd, 0);
+    if (pJournal->pMap == MAP_FAILED) {
+        close(pJournal->fd);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    pJournal->mapSize = size;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+static void storageClose(journal_t *pJournal)
+{
+    msync(pJournal->pMap, pJournal->mapSize, MS_SYNC);
+    munmap(pJournal->pMap, pJournal->mapSize);
+    close(pJournal->fd);
+}
+
+static bool storageRead(journal_t *pJournal, uint32_t offset, void *pData, size_t length)
+{
+    memcpy(pData, pJournal->pMap + offset, length);
+    return true;
+}
+
+static bool storageWrite(journal_t *pJournal, uint32_t offset, const void *pData, size_t length)
+{
+    memcpy(pJournal->pMap + offset, pData, length);
+    return true;
+}
+
+static bool storageSync(journal_t *pJournal, uint32_t offset, size_t length)
+{
+    // msync needs a page aligned address
+    uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(pJournal->pMap + offset) & ~(pageSize - 1);
+    uintptr_t end = (uintptr_t)(pJournal->pMap + offset + length);
+
+    return msync((void *)start, end - start, MS_SYNC) == 0;
+}
+
+#else
+
+static int32_t storageOpen(journal_t *pJournal, const char *pFileName, size_t size)
+{
+    int32_t fileSize;
+    if (fsFileExists(pFileName) && fsFileSize(pFileName, &fileSize) && (size_t)fileSize == size) {
+        pJournal->pFile = fopen(pFileName, "r+b");
+        return pJournal->pFile == NULL ? U_ERROR_COMMON_NOT_FOUND : U_ERROR_COMMON_SUCCESS;
+    }
+
+    // a file of a different size was made for another capacity, so start again
+    pJournal->pFile = fopen(pFileName, "w+b");
+    if (pJournal->pFile == NULL)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    char zeros[256] = {0};
+    for (size_t written = 0; written < size; written += sizeof(zeros)) {
+        size_t length = size - written < sizeof(zeros) ? size - written : sizeof(zeros);
+        if (fwrite(zeros, 1, length, pJournal->pFile) != length) {
+            fclose(pJournal->pFile);
+            return U_ERROR_COMMON_NO_MEMORY;
+        }
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+static void storageClose(journal_t *pJournal)
+{
+    fclose(pJournal->pFile);
+}
+
+static bool storageRead(journal_t *pJournal, uint32_t offset, void *pData, size_t length)
+{
+    return fseek(pJournal->pFile, offset, SEEK_SET) == 0 &&
+           fread(pData, 1, length, pJournal->pFile) == length;
+}
+
+static bool storageWrite(journal_t *pJournal, uint32_t offset, const void *pData, size_t length)
+{
+    return fseek(pJournal->pFile, offset, SEEK_SET) == 0 &&
+           fwrite(pData, 1, length, pJournal->pFile) == length;
+}
+
+static bool storageSync(journal_t *pJournal, uint32_t offset, size_t length)
+{
+    return fflush(pJournal->pFile) == 0;
+}
+
+#endif
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS - records, called with the journal mutex locked
+ * -------------------------------------------------------------- */
+static uint32_t crc32(uint32_t crc, const void *pData, size_t length)
+{
+    const uint8_t *pByte = (const uint8_t *)pData;
+
+    crc = ~crc;
+    while (length-- > 0) {
+        crc ^= *pByte++;
+        for (int32_t bit=0; bit<8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+
+    return ~crc;
+}
+
+static uint32_t recordCrc(const journalRecordHeader_t *pHeader, const void *pData)
+{
+    uint32_t crc = crc32(0, &pHeader->seq, sizeof(pHeader->seq));
+    crc = crc32(crc, &pHeader->length, sizeof(pHeader->length));
+
+    return crc32(crc, pData, pHeader->length);
+}
+
+/// @brief The CRC of a record being added in pieces, the same as recordCrc()
+///        of the pieces one after the other
+static uint32_t partsCrc(const journalRecordHeader_t *pHeader, const journalPart_t *pParts, int32_t count)
+{
+    uint32_t crc = crc32(0, &pHeader->seq, sizeof(pHeader->seq));
+    crc = crc32(crc, &pHeader->length, sizeof(pHeader->length));
+
+    for (int32_t i=0; i<count; i++)
+        crc = crc32(crc, pParts[i].pData, pParts[i].length);
+
+    return crc;
+}
+
+static bool writeHeader(journal_t *pJournal)
+{
+    journalHeader_t header;
+    header.magic = JOURNAL_HEADER_MAGIC;
+    header.generation = ++pJournal->generation;
+    header.capacity = pJournal->capacity;
+    header.head = pJournal->head;
+    header.headSeq = pJournal->headSeq;
+    header.crc = crc32(0, &header, offsetof(journalHeader_t, crc));
+
+    // the other slot still has the last header if this write is torn
+    uint32_t offset = (header.generation % 2) * JOURNAL_HEADER_SLOT_SIZE;
+
+    return storageWrite(pJournal, offset, &header, sizeof(header)) &&
+           storageSync(pJournal, offset, sizeof(header));
+}
+
+static bool readHeader(journal_t *pJournal)
+{
+    bool found = false;
+
+    for (int32_t slot=0; slot<2; slot++) {
+        journalHeader_t header;
+        if (!storageRead(pJournal, slot * JOURNAL_HEADER_SLOT_SIZE, &header, sizeof(header)))
+            continue;
+
+        if (header.magic != JOURNAL_HEADER_MAGIC ||
+                header.crc != crc32(0, &header, offsetof(journalHeader_t, crc)) ||
+                header.capacity != pJournal->capacity ||
+                header.head >= pJournal->capacity)
+            continue;
+
+        if (!found || header.generation > pJournal->generation) {
+            pJournal->generation = header.generation;
+            pJournal->head = header.head;
+            pJournal->headSeq = header.headSeq;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+/// @brief Reads and checks the record at an offset
+/// @return True if it is a record or wrap marker with the expected sequence number
+static bool readRecordHeader(journal_t *pJournal, uint32_t offset, uint32_t seq,
+                             journalRecordHeader_t *pHeader, void *pBuffer)
+{
+    if (offset + RECORD_HEADER_SIZE > pJournal->capacity ||
+            !storageRead(pJournal, JOURNAL_DATA_OFFSET + offset, pHeader, RECORD_HEADER_SIZE))
+        return false;
+
+    if ((pHeader->magic != JOURNAL_RECORD_MAGIC && pHeader->magic != JOURNAL_WRAP_MAGIC) ||
+            pHeader->seq != seq ||
+            offset + RECORD_SIZE(pHeader->length) > pJournal->capacity)
+        return false;
+
+    // the record itself is only checked when it is read into a buffer
+    if (pBuffer != NULL) {
+        if (!storageRead(pJournal, JOURNAL_DATA_OFFSET + offset + RECORD_HEADER_SIZE, pBuffer, pHeader->length))
+            return false;
+
+        return pHeader->crc == recordCrc(pHeader, pBuffer);
+    }
+
+    return true;
+}
+
+/// @brief Moves an offset past a wrap marker, or a gap too small for a
+///        record header, to the start of the ring
+static uint32_t skipWrap(journal_t *pJournal, uint32_t offset, uint32_t seq)
+{
+    journalRecordHeader_t header;
+
+    if (offset + RECORD_HEADER_SIZE > pJournal->capacity)
+        return 0;
+
+    if (readRecordHeader(pJournal, offset, seq, &header, NULL) && header.magic == JOURNAL_WRAP_MAGIC)
+        return 0;
+
+    return offset;
+}
+
+/// @brief Follows the records from the head to find the tail
+static void recoverRecords(journal_t *pJournal, void *pBuffer)
+{
+    uint32_t offset = pJournal->head;
+    uint32_t seq = pJournal->headSeq;
+    bool wrapped = false;
+
+    pJournal->stats.records = 0;
+    pJournal->stats.bytes = 0;
+
+    while (true) {
+        journalRecordHeader_t header;
+
+        uint32_t next = skipWrap(pJournal, offset, seq);
+        if (next != offset) {
+            // only wrap if there is a valid record at the start
+            if (wrapped || next >= pJournal->head || !readRecordHeader(pJournal, next, seq, &header, pBuffer) ||
+                    header.magic != JOURNAL_RECORD_MAGIC)
+                break;
+
+            wrapped = true;
+            offset = next;
+        } else if (!readRecordHeader(pJournal, offset, seq, &header, pBuffer) ||
+                        header.magic != JOURNAL_RECORD_MAGIC) {
+            break;
+        }
+
+        // after the wrap the records must end before the head
+        uint32_t size = RECORD_SIZE(header.length);
+        if (wrapped && offset + size >= pJournal->head)
+            break;
+
+        offset += size;
+        seq++;
+
+        pJournal->stats.records++;
+        pJournal->stats.bytes += size;
+    }
+
+    pJournal->tail = offset;
+    pJournal->stats.recovered = pJournal->stats.records;
+}
+
+/// @brief Removes the oldest record
+static void removeOldest(journal_t *pJournal)
+{
+    journalRecordHeader_t header;
+
+    pJournal->head = skipWrap(pJournal, pJournal->head, pJournal->headSeq);
+    if (!readRecordHeader(pJournal, pJournal->head, pJournal->headSeq, &header, NULL)) {
+        // the records can't be followed, so drop them all
+        writeWarn("Journal record #%u is not valid, dropping %d records",
+                    pJournal->headSeq, pJournal->stats.records);
+        pJournal->head = pJournal->tail;
+        pJournal->headSeq += pJournal->stats.records;
+        pJournal->stats.records = 0;
+        pJournal->stats.bytes = 0;
+        return;
+    }
+
+    uint32_t size = RECORD_SIZE(header.length);
+    pJournal->head += size;
+    pJournal->headSeq++;
+    pJournal->stats.records--;
+    pJournal->stats.bytes -= size;
+
+    if (pJournal->stats.records == 0)
+        pJournal->head = pJournal->tail;
+    else
+        pJournal->head = skipWrap(pJournal, pJournal->head, pJournal->headSeq);
+}
+
+/// @brief Finds where a record of this size can be written, removing the
+///        oldest records until there is room
+/// @param pHeadMoved Set if the head has moved, so the header must be written
+/// @param pWrap Set if the record goes at the start, after a wrap marker
+/// @return The offset to write the record at
+static uint32_t makeRoom(journal_t *pJournal, uint32_t size, bool *pHeadMoved, bool *pWrap)
+{
+    *pHeadMoved = false;
+    *pWrap = false;
+
+    while (true) {
+        if (pJournal->stats.records == 0) {
+            // empty, so the ring can start again from the beginning
+            if (pJournal->head != 0) {
+                pJournal->head = pJournal->tail = 0;
+                *pHeadMoved = true;
+            }
+
+            return 0;
+        }
+
+        if (pJournal->tail >= pJournal->head) {
+            if (pJournal->tail + size <= pJournal->capacity)
+                return pJournal->tail;
+
+            // the tail is kept apart from the head, so a full ring isn't
+            // mistaken for an empty one
+            if (size < pJournal->head) {
+                *pWrap = true;
+                return 0;
+            }
+        } else if (pJournal->tail + size < pJournal->head) {
+            return pJournal->tail;
+        }
+
+        removeOldest(pJournal);
+        pJournal->stats.evicted++;
+        *pHeadMoved = true;
+    }
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Opens a journal file, recovering the records in it, or creates it
+///        if it doesn't exist or isn't valid
+/// @param ppJournal Where to put the pointer to the journal
+/// @param pFileName The journal file
+/// @param capacity Bytes available for records
+/// @return 0 on success, negative on failure
+int32_t journalOpen(journal_t **ppJournal, const char *pFileName, int32_t capacity)
+{
+    if (ppJournal == NULL || pFileName == NULL || capacity < (int32_t)(4 * RECORD_HEADER_SIZE))
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    journal_t *pJournal = (journal_t *)pUPortMalloc(sizeof(journal_t));
+    if (pJournal == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    memset(pJournal, 0, sizeof(journal_t));
+    pJournal->capacity = capacity & ~3;
+    pJournal->stats.capacity = pJournal->capacity;
+
+    int32_t errorCode = uPortMutexCreate(&pJournal->mutex);
+    if (errorCode < 0) {
+        uPortFree(pJournal);
+        return errorCode;
+    }
+
+    errorCode = storageOpen(pJournal, pFileName, JOURNAL_DATA_OFFSET + pJournal->capacity);
+    if (errorCode < 0) {
+        writeError("Failed to open the journal file %s (%d)", pFileName, errorCode);
+        uPortMutexDelete(pJournal->mutex);
+        uPortFree(pJournal);
+        return errorCode;
+    }
+
+    // the records are checked as they are recovered, so need a buffer
+    void *pBuffer = pUPortMalloc(pJournal->capacity);
+    if (pBuffer == NULL) {
+        storageClose(pJournal);
+        uPortMutexDelete(pJournal->mutex);
+        uPortFree(pJournal);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    if (readHeader(pJournal)) {
+        recoverRecords(pJournal, pBuffer);
+    } else {
+        pJournal->head = pJournal->tail = 0;
+        pJournal->headSeq = 0;
+        writeHeader(pJournal);
+    }
+
+    uPortFree(pBuffer);
+
+    *ppJournal = pJournal;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Closes the journal, leaving its records in the file
+/// @param pJournal The journal
+void journalClose(journal_t *pJournal)
+{
+    if (pJournal == NULL)
+        return;
+
+    storageClose(pJournal);
+    uPortMutexDelete(pJournal->mutex);
+    uPortFree(pJournal);
+}
+
+/// @brief Adds a record, removing the oldest records if there isn't room.
+///        The record is in the file when this returns.
+/// @param pJournal The journal
+/// @param pData The record
+/// @param length The length of the record
+/// @return 0 on success, negative on failure
+int32_t journalAppend(journal_t *pJournal, const void *pData, size_t length)
+{
+    journalPart_t part = {pData, length};
+
+    return journalAppendParts(pJournal, &part, 1);
+}
+
+/// @brief Adds a record made of pieces, written one after the other, so the
+///        caller doesn't copy them in to one buffer
+/// @param pJournal The journal
+/// @param pParts The pieces of the record, in order
+/// @param count The number of pieces
+/// @return 0 on success, negative on failure
+int32_t journalAppendParts(journal_t *pJournal, const journalPart_t *pParts, int32_t count)
+{
+    if (pJournal == NULL || pParts == NULL || count <= 0)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    size_t length = 0;
+    for (int32_t i=0; i<count; i++) {
+        if (pParts[i].pData == NULL && pParts[i].length > 0)
+            return U_ERROR_COMMON_INVALID_PARAMETER;
+
+        length += pParts[i].length;
+    }
+
+    uint32_t size = RECORD_SIZE(length);
+    if (size + RECORD_HEADER_SIZE >= pJournal->capacity)
+        return U_ERROR_COMMON_TOO_BIG;
+
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+
+    U_PORT_MUTEX_LOCK(pJournal->mutex);
+    bool headMoved;
+    bool wrap;
+    uint32_t offset = makeRoom(pJournal, size, &headMoved, &wrap);
+
+    // the head moves on before the evicted records are written over
+    if (headMoved && !writeHeader(pJournal))
+        errorCode = U_ERROR_COMMON_DEVICE_ERROR;
+
+    journalRecordHeader_t header;
+    header.seq = pJournal->headSeq + pJournal->stats.records;
+
+    if (errorCode == 0 && wrap && pJournal->tail + RECORD_HEADER_SIZE <= pJournal->capacity) {
+        header.magic = JOURNAL_WRAP_MAGIC;
+        header.length = 0;
+        header.crc = recordCrc(&header, NULL);
+        if (!storageWrite(pJournal, JOURNAL_DATA_OFFSET + pJournal->tail, &header, RECORD_HEADER_SIZE))
+            errorCode = U_ERROR_COMMON_DEVICE_ERROR;
+    }
+
+    if (errorCode == 0) {
+        header.magic = JOURNAL_RECORD_MAGIC;
+        header.length = length;
+        header.crc = partsCrc(&header, pParts, count);
+
+        uint32_t padding = 0;
+        uint32_t dataOffset = JOURNAL_DATA_OFFSET + offset + RECORD_HEADER_SIZE;
+        bool written = storageWrite(pJournal, JOURNAL_DATA_OFFSET + offset, &header, RECORD_HEADER_SIZE);
+        for (int32_t i=0; written && i<count; i++) {
+            written = storageWrite(pJournal, dataOffset, pParts[i].pData, pParts[i].length);
+            dataOffset += pParts[i].length;
+        }
+
+        if (!written ||
+                !storageWrite(pJournal, dataOffset, &padding, size - RECORD_HEADER_SIZE - length) ||
+                !storageSync(pJournal, JOURNAL_DATA_OFFSET + offset, size) ||
+                (wrap && !storageSync(pJournal, JOURNAL_DATA_OFFSET + pJournal->tail, RECORD_HEADER_SIZE)))
+            errorCode = U_ERROR_COMMON_DEVICE_ERROR;
+    }
+
+    if (errorCode == 0) {
+        pJournal->tail = offset + size;
+        pJournal->stats.records++;
+        pJournal->stats.bytes += size;
+        pJournal->stats.appended++;
+    }
+    U_PORT_MUTEX_UNLOCK(pJournal->mutex);
+
+    return errorCode;
+}
+
+/// @brief Copies the oldest record, without removing it
+/// @param pJournal The journal
+/// @param pBuffer Where to copy the record
+/// @param size The size of the buffer
+/// @return The length of the record, 0 if the journal is empty, or negative on failure
+int32_t journalPeek(journal_t *pJournal, void *pBuffer, size_t size)
+{
+    if (pJournal == NULL || pBuffer == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t length = 0;
+
+    U_PORT_MUTEX_LOCK(pJournal->mutex);
+    if (pJournal->stats.records > 0) {
+        journalRecordHeader_t header;
+        uint32_t offset = skipWrap(pJournal, pJournal->head, pJournal->headSeq);
+
+        if (!readRecordHeader(pJournal, offset, pJournal->headSeq, &header, NULL))
+            length = U_ERROR_COMMON_DEVICE_ERROR;
+        else if (header.length > size)
+            length = U_ERROR_COMMON_TOO_BIG;
+        else if (!readRecordHeader(pJournal, offset, pJournal->headSeq, &header, pBuffer))
+            length = U_ERROR_COMMON_DEVICE_ERROR;
+        else
+            length = header.length;
+    }
+    U_PORT_MUTEX_UNLOCK(pJournal->mutex);
+
+    return length;
+}
+
+/// @brief Removes the oldest record
+/// @param pJournal The journal
+/// @return 0 on success, negative on failure
+int32_t journalConsume(journal_t *pJournal)
+{
+    if (pJournal == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+
+    U_PORT_MUTEX_LOCK(pJournal->mutex);
+    if (pJournal->stats.records == 0) {
+        errorCode = U_ERROR_COMMON_EMPTY;
+    } else {
+        removeOldest(pJournal);
+        pJournal->stats.consumed++;
+
+        if (!writeHeader(pJournal))
+            errorCode = U_ERROR_COMMON_DEVICE_ERROR;
+    }
+    U_PORT_MUTEX_UNLOCK(pJournal->mutex);
+
+    return errorCode;
+}
+
+/// @brief Gets the number of records in the journal
+/// @param pJournal The journal
+/// @return The number of records
+int32_t journalCount(journal_t *pJournal)
+{
+    if (pJournal == NULL)
+        return 0;
+
+    return pJournal->stats.records;
+}
+
+/// @brief Gets a copy of the journal statistics
+/// @param pJournal The journal
+/// @param pStats Where to copy the statistics
+void journalGetStats(journal_t *pJournal, journalStats_t *pStats)
+{
+    U_PORT_MUTEX_LOCK(pJournal->mutex);
+    *pStats = pJournal->stats;
+    U_PORT_MUTEX_UNLOCK(pJournal->mutex);
+}
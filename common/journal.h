@@ -0,0 +1,106 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Journal header - a crash-safe ring of records in a file, which are
+ * taken out in the order they were added
+ *
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// The journal, opened with journalOpen()
+typedef struct Journal journal_t;
+
+/// @brief A piece of a record, for journalAppendParts()
+typedef struct JournalPart {
+    const void *pData;
+    size_t length;
+} journalPart_t;
+
+/// @brief Journal statistics
+typedef struct JournalStats {
+    int32_t records;            // Records in the journal now
+    int32_t bytes;              // Bytes used by the records now
+    int32_t capacity;           // Bytes available for records
+    int32_t recovered;          // Records found in the file when it was opened
+    int32_t appended;           // Records added since it was opened
+    int32_t evicted;            // Oldest records removed to make room for new ones
+    int32_t consumed;           // Records taken out since it was opened
+} journalStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Opens a journal file, recovering the records in it,
+///                     or creates it if it doesn't exist or isn't valid
+/// @param ppJournal    Where to put the pointer to the journal
+/// @param pFileName    The journal file
+/// @param capacity     Bytes available for records, including a 16 byte header
+///                     each. A file with a different capacity is recreated.
+/// @return             0 on success, negative on failure
+int32_t journalOpen(journal_t **ppJournal, const char *pFileName, int32_t capacity);
+
+/// @brief              Closes the journal, leaving its records in the file
+/// @param pJournal     The journal
+void journalClose(journal_t *pJournal);
+
+/// @brief              Adds a record, removing the oldest records if there
+///                     isn't room. The record is in the file when this returns.
+/// @param pJournal     The journal
+/// @param pData        The record
+/// @param length       The length of the record
+/// @return             0 on success, negative on failure
+int32_t journalAppend(journal_t *pJournal, const void *pData, size_t length);
+
+/// @brief              Adds a record made of pieces, written one after the
+///                     other, so the caller doesn't copy them in to one buffer
+/// @param pJournal     The journal
+/// @param pParts       The pieces of the record, in order
+/// @param count        The number of pieces
+/// @return             0 on success, negative on failure
+int32_t journalAppendParts(journal_t *pJournal, const journalPart_t *pParts, int32_t count);
+
+/// @brief              Copies the oldest record, without removing it
+/// @param pJournal     The journal
+/// @param pBuffer      Where to copy the record
+/// @param size         The size of the buffer
+/// @return             The length of the record, 0 if the journal is empty,
+///                     or negative on failure
+int32_t journalPeek(journal_t *pJournal, void *pBuffer, size_t size);
+
+/// @brief              Removes the oldest record
+/// @param pJournal     The journal
+/// @return             0 on success, negative on failure
+int32_t journalConsume(journal_t *pJournal);
+
+/// @brief              Gets the number of records in the journal
+/// @param pJournal     The journal
+/// @return             The number of records
+int32_t journalCount(journal_t *pJournal);
+
+/// @brief              Gets a copy of the journal statistics
+/// @param pJournal     The journal
+/// @param pStats       Where to copy the statistics
+void journalGetStats(journal_t *pJournal, journalStats_t *pStats);
+
+#endif
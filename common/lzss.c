@@ -0,0 +1,238 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * LZSS - an LZ77 codec in the style of heatshrink. The data is a flag
+ * byte followed by up to 8 items, a bit each, lowest first. A clear bit
+ * is a literal byte, a set bit is a 2 byte match: 12 bits of the offset
+ * back, less 1, then 4 bits of the length, less LZSS_MIN_MATCH. The
+ * dictionary is treated as the data before the start, so even a short
+ * message can refer back to the JSON keys it holds.
+ *
+ * This only uses the C library, so the compression benchmark can build
+ * it on its own.
+ *
+ */
+
+#include <string.h>
+
+#include "lzss.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define WINDOW_MASK                 (LZSS_WINDOW_SIZE - 1)
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The dictionary and the data, as one run of bytes
+typedef struct {
+    const uint8_t *pDict;
+    size_t dictLength;
+    const uint8_t *pIn;
+    size_t total;
+} lzssSource_t;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static inline uint8_t byteAt(const lzssSource_t *pSource, size_t pos)
+{
+    return pos < pSource->dictLength ? pSource->pDict[pos] : pSource->pIn[pos - pSource->dictLength];
+}
+
+static inline uint32_t hashAt(const lzssSource_t *pSource, size_t pos)
+{
+    uint32_t key = ((uint32_t)byteAt(pSource, pos) << 16) |
+                   ((uint32_t)byteAt(pSource, pos + 1) << 8) |
+                   byteAt(pSource, pos + 2);
+
+    return (key * 2654435761u) >> 22 & (LZSS_HASH_SIZE - 1);
+}
+
+/// @brief Adds a position to its hash chain, if it has a whole match after it
+static inline void insertPosition(lzssWork_t *pWork, const lzssSource_t *pSource, size_t pos)
+{
+    if (pos + LZSS_MIN_MATCH > pSource->total)
+        return;
+
+    uint32_t hash = hashAt(pSource, pos);
+    pWork->prev[pos & WINDOW_MASK] = pWork->head[hash];
+    pWork->head[hash] = (uint16_t)(pos + 1);
+}
+
+/// @brief Finds the longest earlier match for a position
+/// @return The length of the match, 0 if there isn't one
+static size_t findMatch(const lzssWork_t *pWork, const lzssSource_t *pSource, size_t pos, size_t *pOffset)
+{
+    if (pos + LZSS_MIN_MATCH > pSource->total)
+        return 0;
+
+    size_t longest = pSource->total - pos;
+    if (longest > LZSS_MAX_MATCH)
+        longest = LZSS_MAX_MATCH;
+
+    size_t best = 0;
+    uint16_t candidate = pWork->head[hashAt(pSource, pos)];
+    for (int32_t chain=0; candidate != 0 && chain<LZSS_MAX_CHAIN; chain++) {
+        size_t start = candidate - 1;
+
+        // a chain entry written over by a later position ends the chain
+        if (start >= pos || pos - start > LZSS_WINDOW_SIZE)
+            break;
+
+        size_t length = 0;
+        while (length < longest && byteAt(pSource, start + length) == byteAt(pSource, pos + length))
+            length++;
+
+        if (length > best) {
+            best = length;
+            *pOffset = pos - start;
+            if (best == longest)
+                break;
+        }
+
+        candidate = pWork->prev[start & WINDOW_MASK];
+    }
+
+    return best >= LZSS_MIN_MATCH ? best : 0;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Compresses data, with the dictionary as the history before it
+/// @param pWork The memory to work in
+/// @param pDict The dictionary, or NULL
+/// @param dictLength The length of the dictionary, at most LZSS_WINDOW_SIZE
+/// @param pIn The data to compress
+/// @param inLength The length of the data
+/// @param pOut Where to put the compressed data
+/// @param outSize The size of pOut
+/// @return The compressed length, or 0 if it doesn't fit in pOut
+size_t lzssCompress(lzssWork_t *pWork,
+                    const uint8_t *pDict, size_t dictLength,
+                    const uint8_t *pIn, size_t inLength,
+                    uint8_t *pOut, size_t outSize)
+{
+    if (pWork == NULL || pIn == NULL || pOut == NULL || dictLength > LZSS_WINDOW_SIZE ||
+            dictLength + inLength > LZSS_MAX_INPUT)
+        return 0;
+
+    lzssSource_t source = {pDict, pDict == NULL ? 0 : dictLength, pIn, 0};
+    source.total = source.dictLength + inLength;
+
+    memset(pWork->head, 0, sizeof(pWork->head));
+    for (size_t pos=0; pos<source.dictLength; pos++)
+        insertPosition(pWork, &source, pos);
+
+    size_t outLength = 0;
+    size_t flagPos = 0;
+    uint8_t flagBit = 0;
+
+    size_t pos = source.dictLength;
+    while (pos < source.total) {
+        if (flagBit == 0) {
+            if (outLength == outSize)
+                return 0;
+
+            flagPos = outLength++;
+            pOut[flagPos] = 0;
+            flagBit = 1;
+        }
+
+        size_t offset = 0;
+        size_t length = findMatch(pWork, &source, pos, &offset);
+        if (length > 0) {
+            if (outLength + 2 > outSize)
+                return 0;
+
+            pOut[flagPos] |= flagBit;
+            pOut[outLength++] = (uint8_t)((offset - 1) >> 4);
+            pOut[outLength++] = (uint8_t)(((offset - 1) & 0x0F) << 4 | (length - LZSS_MIN_MATCH));
+        } else {
+            if (outLength == outSize)
+                return 0;
+
+            pOut[outLength++] = byteAt(&source, pos);
+            length = 1;
+        }
+
+        for (size_t i=0; i<length; i++)
+            insertPosition(pWork, &source, pos + i);
+
+        pos += length;
+        flagBit <<= 1;
+    }
+
+    return outLength;
+}
+
+/// @brief Decompresses data compressed with the same dictionary
+/// @param pDict The dictionary, or NULL
+/// @param dictLength The length of the dictionary
+/// @param pIn The compressed data
+/// @param inLength The length of the compressed data
+/// @param pOut Where to put the data
+/// @param outSize The size of pOut
+/// @return The length of the data, or 0 if it isn't valid or doesn't fit in pOut
+size_t lzssDecompress(const uint8_t *pDict, size_t dictLength,
+                      const uint8_t *pIn, size_t inLength,
+                      uint8_t *pOut, size_t outSize)
+{
+    if (pIn == NULL || pOut == NULL)
+        return 0;
+
+    if (pDict == NULL)
+        dictLength = 0;
+
+    size_t inPos = 0;
+    size_t outLength = 0;
+    while (inPos < inLength) {
+        uint8_t flags = pIn[inPos++];
+        for (int32_t bit=0; bit<8 && inPos<inLength; bit++) {
+            if ((flags & (1 << bit)) == 0) {
+                if (outLength == outSize)
+                    return 0;
+
+                pOut[outLength++] = pIn[inPos++];
+                continue;
+            }
+
+            if (inPos + 2 > inLength)
+                return 0;
+
+            size_t offset = ((size_t)pIn[inPos] << 4 | pIn[inPos + 1] >> 4) + 1;
+            size_t length = (pIn[inPos + 1] & 0x0F) + LZSS_MIN_MATCH;
+            inPos += 2;
+
+            if (offset > outLength + dictLength || outLength + length > outSize)
+                return 0;
+
+            // the match may start in the dictionary, and may overlap itself
+            for (size_t i=0; i<length; i++, outLength++) {
+                pOut[outLength] = offset > outLength ? pDict[dictLength - (offset - outLength)] :
+                                                       pOut[outLength - offset];
+            }
+        }
+    }
+
+    return outLength;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * LZSS header - a small LZ77 codec with a preset dictionary
+ *
+ */
+
+#ifndef _LZSS_H_
+#define _LZSS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// A match refers back at most this far, over the dictionary and the data
+#define LZSS_WINDOW_SIZE            4096
+
+// The shortest and longest match, a shorter match is sent as literals
+#define LZSS_MIN_MATCH              3
+#define LZSS_MAX_MATCH              18
+
+// The number of hash chain heads, a power of 2
+#define LZSS_HASH_SIZE              1024
+
+// The most earlier positions tried for each match
+#define LZSS_MAX_CHAIN              32
+
+// The longest dictionary and data together
+#define LZSS_MAX_INPUT              0xFFFE
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The memory the compressor works in, which is too large for a
+///        small task stack
+typedef struct {
+    uint16_t head[LZSS_HASH_SIZE];      // Latest position of each hash, plus 1
+    uint16_t prev[LZSS_WINDOW_SIZE];    // Earlier position of the same hash, plus 1
+} lzssWork_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Compresses data, with the dictionary as the history
+///                     before it
+/// @param pWork        The memory to work in
+/// @param pDict        The dictionary, or NULL
+/// @param dictLength   The length of the dictionary, at most LZSS_WINDOW_SIZE
+/// @param pIn          The data to compress
+/// @param inLength     The length of the data
+/// @param pOut         Where to put the compressed data
+/// @param outSize      The size of pOut
+/// @return             The compressed length, or 0 if it doesn't fit in pOut
+size_t lzssCompress(lzssWork_t *pWork,
+                    const uint8_t *pDict, size_t dictLength,
+                    const uint8_t *pIn, size_t inLength,
+                    uint8_t *pOut, size_t outSize);
+
+/// @brief              Decompresses data compressed with the same dictionary
+/// @param pDict        The dictionary, or NULL
+/// @param dictLength   The length of the dictionary
+/// @param pIn          The compressed data
+/// @param inLength     The length of the compressed data
+/// @param pOut         Where to put the data
+/// @param outSize      The size of pOut
+/// @return             The length of the data, or 0 if it isn't valid or
+///                     doesn't fit in pOut
+size_t lzssDecompress(const uint8_t *pDict, size_t dictLength,
+                      const uint8_t *pIn, size_t inLength,
+                      uint8_t *pOut, size_t outSize);
+
+#endif
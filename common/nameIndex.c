@@ -0,0 +1,133 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Name Index - an open addressed hash index of the items of an array by
+ * their names, built once so finding an item hashes its name and usually
+ * compares one string, instead of comparing the name with every item.
+ * The index is at most half full, so a name which isn't there soon meets
+ * an empty slot. The caller owns the slots, so the index makes no
+ * allocations.
+ *
+ */
+
+#include <string.h>
+
+#include "nameIndex.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define SLOT_EMPTY                  0
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief FNV-1a hash of a name
+static uint32_t hashName(const char *pName)
+{
+    uint32_t hash = 2166136261u;
+    while (*pName != '\0')
+        hash = (hash ^ (uint8_t)*pName++) * 16777619u;
+
+    return hash;
+}
+
+/// @brief Gets the name of an item, the const char * it starts with
+static const char *itemName(const nameIndex_t *pIndex, size_t position)
+{
+    const char *pName;
+    memcpy(&pName, pIndex->pItems + position * pIndex->itemSize, sizeof(pName));
+
+    return pName;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Gets the number of slots an index of the items needs, so it is
+///        at most half full
+/// @param count The number of items
+/// @return The number of slots, a power of 2
+size_t nameIndexSlots(size_t count)
+{
+    size_t slots = 2;
+    while (slots < count * 2)
+        slots *= 2;
+
+    return slots;
+}
+
+/// @brief Builds an index of the items. Where two items have the same name
+///        the first is found.
+/// @param pIndex The index
+/// @param pSlots The slots, nameIndexSlots(count) of them
+/// @param pItems The array of the items
+/// @param itemSize The size of an item
+/// @param count The number of items, at most NAME_INDEX_MAX_ITEMS
+/// @return True if the index was built
+bool nameIndexBuild(nameIndex_t *pIndex, uint8_t *pSlots, const void *pItems, size_t itemSize, size_t count)
+{
+    if (pIndex == NULL || pSlots == NULL || (pItems == NULL && count > 0) ||
+            itemSize < sizeof(const char *) || count > NAME_INDEX_MAX_ITEMS)
+        return false;
+
+    size_t slots = nameIndexSlots(count);
+    memset(pSlots, SLOT_EMPTY, slots);
+
+    pIndex->pItems = (const uint8_t *)pItems;
+    pIndex->itemSize = itemSize;
+    pIndex->pSlots = pSlots;
+    pIndex->mask = (uint32_t)(slots - 1);
+
+    for (size_t i=0; i<count; i++) {
+        const char *pName = itemName(pIndex, i);
+        if (pName == NULL || nameIndexFind(pIndex, pName) >= 0)
+            continue;
+
+        uint32_t slot = hashName(pName) & pIndex->mask;
+        while (pSlots[slot] != SLOT_EMPTY)
+            slot = (slot + 1) & pIndex->mask;
+
+        pSlots[slot] = (uint8_t)(i + 1);
+    }
+
+    return true;
+}
+
+/// @brief Finds an item by its name
+/// @param pIndex The index
+/// @param pName The name
+/// @return The item's position in the array, or negative if no item has
+///         the name
+int32_t nameIndexFind(const nameIndex_t *pIndex, const char *pName)
+{
+    if (pIndex == NULL || pIndex->pSlots == NULL || pName == NULL)
+        return -1;
+
+    for (uint32_t slot = hashName(pName) & pIndex->mask;
+            pIndex->pSlots[slot] != SLOT_EMPTY;
+            slot = (slot + 1) & pIndex->mask) {
+        size_t position = pIndex->pSlots[slot] - 1;
+        if (strcmp(itemName(pIndex, position), pName) == 0)
+            return (int32_t)position;
+    }
+
+    return -1;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Name Index header - finds an item of an array by its name with a hash
+ *
+ */
+
+#ifndef _NAME_INDEX_H_
+#define _NAME_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The most items an index can hold, as the slots hold the item's position + 1
+#define NAME_INDEX_MAX_ITEMS        255
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief An index of the items of an array by their names. Each item
+///        starts with its name, a const char *, like a callbackCommand_t.
+///        The items aren't copied, so must last as long as the index.
+typedef struct {
+    const uint8_t *pItems;
+    size_t itemSize;
+    uint8_t *pSlots;            // Position + 1 of an item, 0 for an empty slot
+    uint32_t mask;              // The number of slots - 1
+} nameIndex_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Gets the number of slots an index of the items needs,
+///                     so it is at most half full
+/// @param count        The number of items
+/// @return             The number of slots, a power of 2
+size_t nameIndexSlots(size_t count);
+
+/// @brief              Builds an index of the items. Where two items have
+///                     the same name the first is found.
+/// @param pIndex       The index
+/// @param pSlots       The slots, nameIndexSlots(count) of them
+/// @param pItems       The array of the items
+/// @param itemSize     The size of an item
+/// @param count        The number of items, at most NAME_INDEX_MAX_ITEMS
+/// @return             True if the index was built
+bool nameIndexBuild(nameIndex_t *pIndex, uint8_t *pSlots, const void *pItems, size_t itemSize, size_t count);
+
+/// @brief              Finds an item by its name
+/// @param pIndex       The index
+/// @param pName        The name
+/// @return             The item's position in the array, or negative if
+///                     no item has the name
+int32_t nameIndexFind(const nameIndex_t *pIndex, const char *pName);
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Slab Pool - the blocks of each size class are allocated as one slab
+ * when the pool is created, and the free blocks are kept on a stack of
+ * block indexes. Allocating and freeing a block is then a push or pop
+ * under the pool's mutex, with no heap calls. A handle is the size
+ * class in the top bits and the block index in the bottom 16 bits.
+ *
+ */
+
+#include "common.h"
+#include "slabPool.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define HANDLE(sizeClass, index)    (((sizeClass) << 16) | (index))
+#define HANDLE_CLASS(handle)        ((handle) >> 16)
+#define HANDLE_INDEX(handle)        ((handle) & 0xFFFF)
+
+// blocks are aligned for any type, so a block can hold a struct
+#define BLOCK_ALIGNMENT             8
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct SLAB_POOL_CLASS {
+    size_t blockSize;           // The size rounded up to the alignment
+    int32_t blocks;
+    uint8_t *pSlab;
+    uint16_t *pFreeStack;       // Indexes of the free blocks
+    int32_t freeCount;
+    bool *pAllocated;           // Catches a block being freed twice
+
+    slabPoolStats_t stats;
+} slabPoolClass_t;
+
+struct SlabPool {
+    uPortMutexHandle_t mutex;
+
+    slabPoolClass_t classes[SLAB_MAX_CLASSES];
+    int32_t classCount;
+};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static void freeClasses(slabPool_t *pPool)
+{
+    for (int32_t i=0; i<pPool->classCount; i++) {
+        uPortFree(pPool->classes[i].pSlab);
+        uPortFree(pPool->classes[i].pFreeStack);
+        uPortFree(pPool->classes[i].pAllocated);
+    }
+}
+
+/// @brief Allocates a class's slab and fills its free stack
+static int32_t createClass(slabPoolClass_t *pClass, const slabClass_t *pConfig)
+{
+    memset(pClass, 0, sizeof(slabPoolClass_t));
+
+    pClass->blockSize = (pConfig->size + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+    pClass->blocks = pConfig->blocks;
+
+    pClass->pSlab = (uint8_t *)pUPortMalloc(pClass->blockSize * pClass->blocks);
+    pClass->pFreeStack = (uint16_t *)pUPortMalloc(sizeof(uint16_t) * pClass->blocks);
+    pClass->pAllocated = (bool *)pUPortMalloc(sizeof(bool) * pClass->blocks);
+    if (pClass->pSlab == NULL || pClass->pFreeStack == NULL || pClass->pAllocated == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    // the lowest blocks are at the top of the stack, so are used first
+    for (int32_t i=0; i<pClass->blocks; i++) {
+        pClass->pFreeStack[i] = (uint16_t)(pClass->blocks - 1 - i);
+        pClass->pAllocated[i] = false;
+    }
+    pClass->freeCount = pClass->blocks;
+
+    pClass->stats.size = (int32_t)pConfig->size;
+    pClass->stats.blocks = pClass->blocks;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Checks a handle is an allocated block of the pool
+static bool isValidHandle(slabPool_t *pPool, slabHandle_t handle)
+{
+    if (handle < 0 || HANDLE_CLASS(handle) >= pPool->classCount)
+        return false;
+
+    return HANDLE_INDEX(handle) < pPool->classes[HANDLE_CLASS(handle)].blocks;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates a pool, allocating all its blocks
+/// @param ppPool Where to put the pointer to the pool
+/// @param pClasses The size classes, in any order
+/// @param count The number of size classes
+/// @return 0 on success, negative on failure
+int32_t slabPoolCreate(slabPool_t **ppPool, const slabClass_t *pClasses, int32_t count)
+{
+    if (ppPool == NULL || pClasses == NULL || count <= 0 || count > SLAB_MAX_CLASSES)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    for (int32_t i=0; i<count; i++) {
+        if (pClasses[i].size == 0 || pClasses[i].blocks <= 0 || pClasses[i].blocks > SLAB_MAX_BLOCKS)
+            return U_ERROR_COMMON_INVALID_PARAMETER;
+    }
+
+    slabPool_t *pPool = (slabPool_t *)pUPortMalloc(sizeof(slabPool_t));
+    if (pPool == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    memset(pPool, 0, sizeof(slabPool_t));
+
+    int32_t errorCode = uPortMutexCreate(&pPool->mutex);
+    if (errorCode < 0) {
+        uPortFree(pPool);
+        return errorCode;
+    }
+
+    // keep the classes smallest first, so an allocation takes the first it fits
+    slabClass_t sorted[SLAB_MAX_CLASSES];
+    memcpy(sorted, pClasses, sizeof(slabClass_t) * count);
+    for (int32_t i=1; i<count; i++) {
+        for (int32_t j=i; j>0 && sorted[j].size < sorted[j-1].size; j--) {
+            slabClass_t swap = sorted[j];
+            sorted[j] = sorted[j-1];
+            sorted[j-1] = swap;
+        }
+    }
+
+    for (int32_t i=0; i<count; i++) {
+        errorCode = createClass(&pPool->classes[i], &sorted[i]);
+        pPool->classCount++;
+        if (errorCode < 0) {
+            freeClasses(pPool);
+            uPortMutexDelete(pPool->mutex);
+            uPortFree(pPool);
+            return errorCode;
+        }
+    }
+
+    *ppPool = pPool;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Frees the pool and all its blocks
+/// @param pPool The pool
+void slabPoolDelete(slabPool_t *pPool)
+{
+    if (pPool == NULL)
+        return;
+
+    freeClasses(pPool);
+    uPortMutexDelete(pPool->mutex);
+    uPortFree(pPool);
+}
+
+/// @brief Allocates a block from the smallest class it fits in, or a
+///        larger class if that class is full
+/// @param pPool The pool
+/// @param size The bytes needed
+/// @return The block's handle, or negative if no block is free
+slabHandle_t slabAlloc(slabPool_t *pPool, size_t size)
+{
+    if (pPool == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    slabHandle_t handle = U_ERROR_COMMON_NO_MEMORY;
+
+    U_PORT_MUTEX_LOCK(pPool->mutex);
+    int32_t fits = 0;
+    while (fits < pPool->classCount && (size_t)pPool->classes[fits].stats.size < size)
+        fits++;
+
+    for (int32_t i=fits; i<pPool->classCount; i++) {
+        slabPoolClass_t *pClass = &pPool->classes[i];
+        if (pClass->freeCount == 0)
+            continue;
+
+        int32_t index = pClass->pFreeStack[--pClass->freeCount];
+        pClass->pAllocated[index] = true;
+
+        pClass->stats.allocs++;
+        pClass->stats.inUse++;
+        if (pClass->stats.inUse > pClass->stats.highWater)
+            pClass->stats.highWater = pClass->stats.inUse;
+
+        if (i > fits)
+            pPool->classes[fits].stats.spilled++;
+
+        handle = HANDLE(i, index);
+        break;
+    }
+
+    // a size larger than every class is counted against the largest
+    if (handle < 0) {
+        int32_t sizeClass = fits < pPool->classCount ? fits : pPool->classCount - 1;
+        pPool->classes[sizeClass].stats.failures++;
+    }
+    U_PORT_MUTEX_UNLOCK(pPool->mutex);
+
+    return handle;
+}
+
+/// @brief Gets the memory of a block
+/// @param pPool The pool
+/// @param handle The block's handle
+/// @return The block's memory, or NULL if the handle isn't valid
+void *slabGet(slabPool_t *pPool, slabHandle_t handle)
+{
+    if (pPool == NULL || !isValidHandle(pPool, handle))
+        return NULL;
+
+    slabPoolClass_t *pClass = &pPool->classes[HANDLE_CLASS(handle)];
+
+    return pClass->pSlab + pClass->blockSize * HANDLE_INDEX(handle);
+}
+
+/// @brief Frees a block. A negative handle is ignored.
+/// @param pPool The pool
+/// @param handle The block's handle
+void slabFree(slabPool_t *pPool, slabHandle_t handle)
+{
+    if (pPool == NULL || handle < 0)
+        return;
+
+    if (!isValidHandle(pPool, handle)) {
+        writeWarn("Slab pool handle 0x%08X is not valid", handle);
+        return;
+    }
+
+    slabPoolClass_t *pClass = &pPool->classes[HANDLE_CLASS(handle)];
+    int32_t index = HANDLE_INDEX(handle);
+    bool freedTwice = false;
+
+    U_PORT_MUTEX_LOCK(pPool->mutex);
+    if (pClass->pAllocated[index]) {
+        pClass->pAllocated[index] = false;
+        pClass->pFreeStack[pClass->freeCount++] = (uint16_t)index;
+        pClass->stats.inUse--;
+    } else {
+        freedTwice = true;
+    }
+    U_PORT_MUTEX_UNLOCK(pPool->mutex);
+
+    if (freedTwice)
+        writeWarn("Slab pool block 0x%08X was already free", handle);
+}
+
+/// @brief Gets the number of size classes
+/// @param pPool The pool
+/// @return The number of size classes
+int32_t slabPoolGetClassCount(slabPool_t *pPool)
+{
+    return pPool == NULL ? 0 : pPool->classCount;
+}
+
+/// @brief Gets a copy of a size class's statistics
+/// @param pPool The pool
+/// @param sizeClass The size class, smallest first
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t slabPoolGetStats(slabPool_t *pPool, int32_t sizeClass, slabPoolStats_t *pStats)
+{
+    if (pPool == NULL || pStats == NULL || sizeClass < 0 || sizeClass >= pPool->classCount)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(pPool->mutex);
+    *pStats = pPool->classes[sizeClass].stats;
+    U_PORT_MUTEX_UNLOCK(pPool->mutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Slab Pool header - fixed size blocks in a few size classes, allocated
+ * up front and handed out by handle
+ *
+ */
+
+#ifndef _SLAB_POOL_H_
+#define _SLAB_POOL_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+#define SLAB_MAX_CLASSES            4
+
+// The most blocks a class can have, as the block index is 16 bits of the handle
+#define SLAB_MAX_BLOCKS             0xFFFF
+
+// A handle which isn't a block, like a NULL pointer
+#define SLAB_NO_HANDLE              (-1)
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// The pool, created with slabPoolCreate()
+typedef struct SlabPool slabPool_t;
+
+/// A block in the pool, or negative if it isn't one
+typedef int32_t slabHandle_t;
+
+/// @brief A size class of the pool
+typedef struct SlabClass {
+    size_t size;                // Bytes in each block
+    int32_t blocks;             // Number of blocks
+} slabClass_t;
+
+/// @brief Statistics of a size class
+typedef struct SlabPoolStats {
+    int32_t size;               // Bytes in each block
+    int32_t blocks;             // Number of blocks
+    int32_t inUse;              // Blocks allocated now
+    int32_t highWater;          // Most blocks allocated at once
+    int32_t allocs;             // Blocks allocated from this class
+    int32_t spilled;            // Allocations which fitted this class but were full, so used a larger class
+    int32_t failures;           // Allocations which fitted this class but no block was free
+} slabPoolStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Creates a pool, allocating all its blocks
+/// @param ppPool       Where to put the pointer to the pool
+/// @param pClasses     The size classes, in any order
+/// @param count        The number of size classes, up to SLAB_MAX_CLASSES
+/// @return             0 on success, negative on failure
+int32_t slabPoolCreate(slabPool_t **ppPool, const slabClass_t *pClasses, int32_t count);
+
+/// @brief              Frees the pool and all its blocks
+/// @param pPool        The pool
+void slabPoolDelete(slabPool_t *pPool);
+
+/// @brief              Allocates a block from the smallest class it fits
+///                     in, or a larger class if that class is full
+/// @param pPool        The pool
+/// @param size         The bytes needed
+/// @return             The block's handle, or negative if no block is free
+slabHandle_t slabAlloc(slabPool_t *pPool, size_t size);
+
+/// @brief              Gets the memory of a block
+/// @param pPool        The pool
+/// @param handle       The block's handle
+/// @return             The block's memory, or NULL if the handle isn't valid
+void *slabGet(slabPool_t *pPool, slabHandle_t handle);
+
+/// @brief              Frees a block. A negative handle is ignored.
+/// @param pPool        The pool
+/// @param handle       The block's handle
+void slabFree(slabPool_t *pPool, slabHandle_t handle);
+
+/// @brief              Gets the number of size classes
+/// @param pPool        The pool
+/// @return             The number of size classes
+int32_t slabPoolGetClassCount(slabPool_t *pPool);
+
+/// @brief              Gets a copy of a size class's statistics
+/// @param pPool        The pool
+/// @param sizeClass    The size class, smallest first, from 0 to
+///                     slabPoolGetClassCount()-1
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t slabPoolGetStats(slabPool_t *pPool, int32_t sizeClass, slabPoolStats_t *pStats);
+
+#endif
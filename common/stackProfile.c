@@ -0,0 +1,207 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Stack Profile - measures the stack high-water mark of the
+ * application's threads with the port's uPortTaskStackMinFree(), and
+ * recommends a stack size for each of them. Each thread measures its
+ * own stack, at points where it has just finished a piece of work.
+ *
+ */
+
+#include "common.h"
+#include "stackProfile.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define MAX_STACK_PROFILES      16
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static bool profileEnabled = false;
+
+static uPortMutexHandle_t profileMutex = NULL;
+
+static stackProfileEntry_t profiles[MAX_STACK_PROFILES];
+static int32_t profileCount = 0;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Enables stack profiling if STACK_PROFILE is set in the app.conf
+/// @return 0 on success, negative on failure
+int32_t initStackProfile(void)
+{
+    int32_t enabled = STACK_PROFILE_DEFAULT;
+    setIntParamFromConfig("STACK_PROFILE", &enabled);
+    if (enabled == 0)
+        return U_ERROR_COMMON_SUCCESS;
+
+    int32_t errorCode = uPortMutexCreate(&profileMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the stack profile mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    profileEnabled = true;
+    writeInfo("Stack profiling is enabled");
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the stack sizing report
+void finalizeStackProfile(void)
+{
+    if (!profileEnabled)
+        return;
+
+    stackProfilePrintReport();
+}
+
+/// @brief Checks if stack profiling is enabled
+/// @return True if the stack high-water marks are being measured
+bool stackProfileEnabled(void)
+{
+    return profileEnabled;
+}
+
+/// @brief Registers a thread to be profiled. Threads with the same name
+///        share a profile entry.
+/// @param pName Name of the thread, which must stay valid
+/// @param stackSize The stack size the thread is created with
+/// @return The profile handle, or negative if profiling is disabled
+int32_t stackProfileRegister(const char *pName, int32_t stackSize)
+{
+    if (!profileEnabled)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t handle = U_ERROR_COMMON_NO_MEMORY;
+
+    U_PORT_MUTEX_LOCK(profileMutex);
+    for (int32_t i=0; i<profileCount; i++) {
+        if (profiles[i].stackSize == stackSize && strcmp(profiles[i].pName, pName) == 0) {
+            handle = i;
+            break;
+        }
+    }
+
+    if (handle < 0 && profileCount < MAX_STACK_PROFILES) {
+        handle = profileCount++;
+        profiles[handle].pName = pName;
+        profiles[handle].stackSize = stackSize;
+        profiles[handle].threads = 0;
+        profiles[handle].samples = 0;
+        profiles[handle].minFree = -1;
+    }
+
+    if (handle >= 0)
+        profiles[handle].threads++;
+    U_PORT_MUTEX_UNLOCK(profileMutex);
+
+    if (handle < 0)
+        writeWarn("Not profiling the %s stack, already %d profiles", pName, MAX_STACK_PROFILES);
+
+    return handle;
+}
+
+/// @brief Measures the calling thread's stack high-water mark. Does nothing
+///        if the handle is negative.
+/// @param handle The profile handle of the calling thread
+void stackProfileSample(int32_t handle)
+{
+    if (!profileEnabled || handle < 0 || handle >= profileCount)
+        return;
+
+    int32_t minFree = uPortTaskStackMinFree(NULL);
+    if (minFree < 0) {
+        writeWarn("Stack profiling is not supported on this platform (%d), disabling it", minFree);
+        profileEnabled = false;
+        return;
+    }
+
+    U_PORT_MUTEX_LOCK(profileMutex);
+    stackProfileEntry_t *pEntry = &profiles[handle];
+    pEntry->samples++;
+    if (pEntry->minFree < 0 || minFree < pEntry->minFree)
+        pEntry->minFree = minFree;
+    U_PORT_MUTEX_UNLOCK(profileMutex);
+}
+
+/// @brief Gets the number of profile entries
+/// @return The number of registered entries
+int32_t stackProfileGetCount(void)
+{
+    return profileCount;
+}
+
+/// @brief Gets a copy of a profile entry
+/// @param index The index of the entry, from 0 to stackProfileGetCount()-1
+/// @param pEntry Where to copy the entry
+/// @return 0 on success, negative on failure
+int32_t stackProfileGet(int32_t index, stackProfileEntry_t *pEntry)
+{
+    if (profileMutex == NULL || index < 0 || index >= profileCount || pEntry == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(profileMutex);
+    *pEntry = profiles[index];
+    U_PORT_MUTEX_UNLOCK(profileMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Gets the recommended stack size of a profile entry
+/// @param pEntry The profile entry
+/// @return The recommended stack size, or -1 if not measured yet
+int32_t stackProfileRecommendedSize(const stackProfileEntry_t *pEntry)
+{
+    if (pEntry->minFree < 0)
+        return -1;
+
+    int32_t used = pEntry->stackSize - pEntry->minFree;
+    int32_t size = used + (used * STACK_PROFILE_HEADROOM_PERCENT) / 100;
+
+    return ((size + STACK_PROFILE_ROUNDING - 1) / STACK_PROFILE_ROUNDING) * STACK_PROFILE_ROUNDING;
+}
+
+/// @brief Logs each entry's stack use and its recommended size
+void stackProfilePrintReport(void)
+{
+    writeInfo("Stack profile, recommended size is the most used +%d%%, rounded up to %d bytes:",
+                STACK_PROFILE_HEADROOM_PERCENT, STACK_PROFILE_ROUNDING);
+    writeInfo("    %-16s %7s %7s %7s %7s %11s", "Thread", "Threads", "Size", "Used", "MinFree", "Recommended");
+
+    for (int32_t i=0; i<stackProfileGetCount(); i++) {
+        stackProfileEntry_t entry;
+        if (stackProfileGet(i, &entry) < 0)
+            continue;
+
+        if (entry.minFree < 0) {
+            writeInfo("    %-16s %7d %7d %7s %7s %11s", entry.pName, entry.threads, entry.stackSize,
+                        "-", "-", "not run");
+            continue;
+        }
+
+        writeInfo("    %-16s %7d %7d %7d %7d %11d", entry.pName, entry.threads, entry.stackSize,
+                    entry.stackSize - entry.minFree,
+                    entry.minFree,
+                    stackProfileRecommendedSize(&entry));
+    }
+}
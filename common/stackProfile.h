@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Stack Profile header - measures the stack high-water mark of the
+ * application's threads and recommends their stack sizes
+ *
+ */
+
+#ifndef _STACK_PROFILE_H_
+#define _STACK_PROFILE_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Stack profiling is off unless STACK_PROFILE is set to 1 in the app.conf
+// file, as measuring the high-water mark can mean scanning the stack
+#define STACK_PROFILE_DEFAULT               0
+
+// The recommended stack size is the most used plus this headroom,
+// rounded up to the next STACK_PROFILE_ROUNDING bytes
+#define STACK_PROFILE_HEADROOM_PERCENT      25
+#define STACK_PROFILE_ROUNDING              256
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The stack profile of a thread, or a group of threads which
+///        share a name and stack size, like the workers of a pool
+typedef struct StackProfileEntry {
+    const char *pName;
+    int32_t stackSize;          // The stack size the threads were created with
+    int32_t threads;            // Number of threads registered with this name
+    int32_t samples;            // Number of times the high-water mark was measured
+    int32_t minFree;            // The least free stack seen, -1 if not measured yet
+} stackProfileEntry_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Enables stack profiling if STACK_PROFILE is set in the app.conf
+/// @return         0 on success, negative on failure
+int32_t initStackProfile(void);
+
+/// @brief          Logs the stack sizing report
+void finalizeStackProfile(void);
+
+/// @brief          Checks if stack profiling is enabled
+/// @return         True if the stack high-water marks are being measured
+bool stackProfileEnabled(void);
+
+/// @brief              Registers a thread to be profiled. Threads with the same
+///                     name share a profile entry.
+/// @param pName        Name of the thread, which must stay valid
+/// @param stackSize    The stack size the thread is created with
+/// @return             The profile handle, or negative if profiling is disabled
+int32_t stackProfileRegister(const char *pName, int32_t stackSize);
+
+/// @brief              Measures the calling thread's stack high-water mark.
+///                     Does nothing if the handle is negative.
+/// @param handle       The profile handle of the calling thread
+void stackProfileSample(int32_t handle);
+
+/// @brief              Gets the number of profile entries
+/// @return             The number of registered entries
+int32_t stackProfileGetCount(void);
+
+/// @brief              Gets a copy of a profile entry
+/// @param index        The index of the entry, from 0 to stackProfileGetCount()-1
+/// @param pEntry       Where to copy the entry
+/// @return             0 on success, negative on failure
+int32_t stackProfileGet(int32_t index, stackProfileEntry_t *pEntry);
+
+/// @brief              Gets the recommended stack size of a profile entry
+/// @param pEntry       The profile entry
+/// @return             The recommended stack size, or -1 if not measured yet
+int32_t stackProfileRecommendedSize(const stackProfileEntry_t *pEntry);
+
+/// @brief              Logs each entry's stack use and its recommended size
+void stackProfilePrintReport(void);
+
+#endif
@@ -0,0 +1,330 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Worker Pool - a fixed set of worker threads which run one-shot jobs
+ * from a bounded job queue, so a burst of jobs does not create a burst
+ * of threads.
+ *
+ */
+
+#include "common.h"
+#include "workerPool.h"
+#include "stackProfile.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+// How long workerPoolDestroy() waits for the workers to finish their jobs
+#define WORKER_EXIT_TIMEOUT_MS  5000
+#define WORKER_EXIT_CHECK_MS    100
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    const char *pName;
+    workerJob_t job;
+    void *pParam;
+    int32_t submitTime;
+} workerPoolJob_t;
+
+struct WorkerPool {
+    const char *pName;
+    int32_t workers;
+    int32_t workersRunning;
+    bool exitPool;
+
+    // ring buffer of jobs waiting for a worker
+    workerPoolJob_t *pJobs;
+    int32_t queueSize;
+    int32_t head;
+    int32_t count;
+
+    workerPoolStats_t stats;
+
+    // the workers share a stack profile entry
+    int32_t stackProfileHandle;
+
+    uPortMutexHandle_t mutex;
+    uPortSemaphoreHandle_t jobSemaphore;
+};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+static void updateStats(workerPool_t *pPool, int32_t waitMs, int32_t runMs)
+{
+    workerPoolStats_t *stats = &pPool->stats;
+
+    stats->completed++;
+    stats->totalWaitMs += waitMs;
+    stats->totalRunMs += runMs;
+    if (waitMs > stats->maxWaitMs)
+        stats->maxWaitMs = waitMs;
+    if (runMs > stats->maxRunMs)
+        stats->maxRunMs = runMs;
+}
+
+static void workerTask(void *pParam)
+{
+    workerPool_t *pPool = (workerPool_t *)pParam;
+    workerPoolJob_t job;
+
+    while (true) {
+        uPortSemaphoreTake(pPool->jobSemaphore);
+
+        uPortMutexLock(pPool->mutex);
+        if (pPool->exitPool) {
+            uPortMutexUnlock(pPool->mutex);
+            break;
+        }
+
+        if (pPool->count == 0) {
+            uPortMutexUnlock(pPool->mutex);
+            continue;
+        }
+
+        job = pPool->pJobs[pPool->head];
+        pPool->head = (pPool->head + 1) % pPool->queueSize;
+        pPool->count--;
+        uPortMutexUnlock(pPool->mutex);
+
+        int32_t startTime = uPortGetTickTimeMs();
+        int32_t waitMs = startTime - job.submitTime;
+
+        job.job(job.pParam);
+
+        int32_t runMs = uPortGetTickTimeMs() - startTime;
+        printDebug("%s job waited %d ms, ran for %d ms", job.pName, waitMs, runMs);
+
+        uPortMutexLock(pPool->mutex);
+        updateStats(pPool, waitMs, runMs);
+        uPortMutexUnlock(pPool->mutex);
+
+        stackProfileSample(pPool->stackProfileHandle);
+    }
+
+    uPortMutexLock(pPool->mutex);
+    pPool->workersRunning--;
+    uPortMutexUnlock(pPool->mutex);
+
+    uPortTaskDelete(NULL);
+}
+
+static void freePool(workerPool_t *pPool)
+{
+    if (pPool->jobSemaphore != NULL)
+        uPortSemaphoreDelete(pPool->jobSemaphore);
+
+    if (pPool->mutex != NULL)
+        uPortMutexDelete(pPool->mutex);
+
+    uPortFree(pPool->pJobs);
+    uPortFree(pPool);
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates a worker pool and starts its workers
+/// @param ppPool Where to put the pointer to the new pool
+/// @param pName Name of the pool, used for the worker threads and logging
+/// @param workers The number of worker threads
+/// @param queueSize The maximum number of jobs waiting to run
+/// @param stackSize The stack size of each worker, which must suit the largest job
+/// @param priority The priority of the workers
+/// @return 0 on success, negative on failure
+int32_t workerPoolCreate(workerPool_t **ppPool, const char *pName, int32_t workers,
+                         int32_t queueSize, int32_t stackSize, int32_t priority)
+{
+    if (ppPool == NULL || workers <= 0 || queueSize <= 0)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    workerPool_t *pPool = (workerPool_t *)pUPortMalloc(sizeof(workerPool_t));
+    if (pPool == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    memset(pPool, 0, sizeof(workerPool_t));
+    pPool->pName = pName;
+    pPool->workers = workers;
+    pPool->queueSize = queueSize;
+    pPool->stackProfileHandle = U_ERROR_COMMON_NOT_INITIALISED;
+
+    pPool->pJobs = (workerPoolJob_t *)pUPortMalloc(sizeof(workerPoolJob_t) * queueSize);
+    if (pPool->pJobs == NULL) {
+        freePool(pPool);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    int32_t errorCode = uPortMutexCreate(&pPool->mutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the %s pool mutex (%d)", pName, errorCode);
+        freePool(pPool);
+        return errorCode;
+    }
+
+    // one count per queued job, plus one per worker for waking them up to exit
+    errorCode = uPortSemaphoreCreate(&pPool->jobSemaphore, 0, queueSize + workers);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the %s pool semaphore (%d)", pName, errorCode);
+        freePool(pPool);
+        return errorCode;
+    }
+
+    for (int i=0; i<workers; i++) {
+        uPortTaskHandle_t handle;
+        pPool->stackProfileHandle = stackProfileRegister(pName, stackSize);
+        errorCode = uPortTaskCreate(workerTask, pName, stackSize, pPool, priority, &handle);
+        if (errorCode < 0) {
+            writeFatal("Failed to start %s pool worker #%d (%d)", pName, i, errorCode);
+            if (pPool->workersRunning == 0) {
+                freePool(pPool);
+                return errorCode;
+            }
+
+            // carry on with the workers which did start
+            break;
+        }
+
+        pPool->workersRunning++;
+    }
+
+    writeDebug("%s pool started with %d workers and a %d job queue", pName, pPool->workersRunning, queueSize);
+
+    *ppPool = pPool;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Queues a job to run on the next free worker
+/// @param pPool The worker pool
+/// @param pName Name of the job, used for logging
+/// @param job The job function
+/// @param pParam The parameter to pass to the job
+/// @return 0 on success, U_ERROR_COMMON_FULL if the job queue is full, or negative on failure
+int32_t workerPoolSubmit(workerPool_t *pPool, const char *pName, workerJob_t job, void *pParam)
+{
+    if (pPool == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (job == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+
+    uPortMutexLock(pPool->mutex);
+    if (pPool->exitPool) {
+        errorCode = U_ERROR_COMMON_CANCELLED;
+    } else if (pPool->count == pPool->queueSize) {
+        pPool->stats.rejected++;
+        errorCode = U_ERROR_COMMON_FULL;
+    } else {
+        int32_t tail = (pPool->head + pPool->count) % pPool->queueSize;
+        pPool->pJobs[tail].pName = pName;
+        pPool->pJobs[tail].job = job;
+        pPool->pJobs[tail].pParam = pParam;
+        pPool->pJobs[tail].submitTime = uPortGetTickTimeMs();
+        pPool->count++;
+
+        pPool->stats.submitted++;
+        if (pPool->count > pPool->stats.maxQueued)
+            pPool->stats.maxQueued = pPool->count;
+    }
+    uPortMutexUnlock(pPool->mutex);
+
+    if (errorCode == 0)
+        uPortSemaphoreGive(pPool->jobSemaphore);
+    else
+        writeWarn("%s pool did not accept the %s job (%d)", pPool->pName, pName, errorCode);
+
+    return errorCode;
+}
+
+/// @brief Gets a copy of the pool's job statistics
+/// @param pPool The worker pool
+/// @param pStats Where to copy the statistics
+void workerPoolGetStats(workerPool_t *pPool, workerPoolStats_t *pStats)
+{
+    if (pPool == NULL || pStats == NULL)
+        return;
+
+    uPortMutexLock(pPool->mutex);
+    *pStats = pPool->stats;
+    uPortMutexUnlock(pPool->mutex);
+}
+
+/// @brief Logs the pool's job statistics
+/// @param pPool The worker pool
+void workerPoolPrintStats(workerPool_t *pPool)
+{
+    workerPoolStats_t stats;
+
+    if (pPool == NULL)
+        return;
+
+    workerPoolGetStats(pPool, &stats);
+    if (stats.submitted == 0 && stats.rejected == 0)
+        return;
+
+    int32_t avgWaitMs = 0, avgRunMs = 0;
+    if (stats.completed > 0) {
+        avgWaitMs = stats.totalWaitMs / stats.completed;
+        avgRunMs = stats.totalRunMs / stats.completed;
+    }
+
+    printInfo("%s pool: %d jobs submitted, %d completed, %d rejected, max %d queued. Wait avg %d ms, max %d ms. Run avg %d ms, max %d ms",
+            pPool->pName,
+            stats.submitted,
+            stats.completed,
+            stats.rejected,
+            stats.maxQueued,
+            avgWaitMs,
+            stats.maxWaitMs,
+            avgRunMs,
+            stats.maxRunMs);
+}
+
+/// @brief Stops the workers once their current job has finished, and frees
+///        the pool. Jobs still queued are not run.
+/// @param pPool The worker pool
+void workerPoolDestroy(workerPool_t *pPool)
+{
+    if (pPool == NULL)
+        return;
+
+    uPortMutexLock(pPool->mutex);
+    pPool->exitPool = true;
+    if (pPool->count > 0)
+        writeDebug("%s pool dropping %d queued jobs", pPool->pName, pPool->count);
+    uPortMutexUnlock(pPool->mutex);
+
+    for (int i=0; i<pPool->workers; i++)
+        uPortSemaphoreGive(pPool->jobSemaphore);
+
+    int32_t startTime = uPortGetTickTimeMs();
+    while (pPool->workersRunning > 0 && (uPortGetTickTimeMs() - startTime) < WORKER_EXIT_TIMEOUT_MS)
+        uPortTaskBlock(WORKER_EXIT_CHECK_MS);
+
+    if (pPool->workersRunning > 0) {
+        writeWarn("%d %s pool worker(s) still running a job, not freeing the pool", pPool->workersRunning, pPool->pName);
+        return;
+    }
+
+    freePool(pPool);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Worker Pool header - a fixed set of worker threads which run
+ * one-shot jobs from a bounded job queue
+ *
+ */
+
+#ifndef _WORKER_POOL_H_
+#define _WORKER_POOL_H_
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// A job which is run once on one of the pool's workers
+typedef void (*workerJob_t)(void *pParam);
+
+/// The worker pool, created with workerPoolCreate()
+typedef struct WorkerPool workerPool_t;
+
+/// @brief Job statistics for a worker pool
+typedef struct WorkerPoolStats {
+    int32_t submitted;          // Jobs accepted onto the job queue
+    int32_t rejected;           // Jobs rejected as the job queue was full
+    int32_t completed;          // Jobs which have finished running
+    int32_t maxQueued;          // The most jobs waiting on the queue at once
+    int32_t totalWaitMs;        // Total time jobs waited on the queue
+    int32_t maxWaitMs;          // Longest time a job waited on the queue
+    int32_t totalRunMs;         // Total time jobs took to run
+    int32_t maxRunMs;           // Longest time a job took to run
+} workerPoolStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Creates a worker pool and starts its workers
+/// @param ppPool       Where to put the pointer to the new pool
+/// @param pName        Name of the pool, used for the worker threads and logging
+/// @param workers      The number of worker threads
+/// @param queueSize    The maximum number of jobs waiting to run
+/// @param stackSize    The stack size of each worker, which must suit the largest job
+/// @param priority     The priority of the workers
+/// @return             0 on success, negative on failure
+int32_t workerPoolCreate(workerPool_t **ppPool, const char *pName, int32_t workers,
+                         int32_t queueSize, int32_t stackSize, int32_t priority);
+
+/// @brief              Queues a job to run on the next free worker
+/// @param pPool        The worker pool
+/// @param pName        Name of the job, used for logging
+/// @param job          The job function
+/// @param pParam       The parameter to pass to the job
+/// @return             0 on success, U_ERROR_COMMON_FULL if the job queue
+///                     is full, or negative on failure
+int32_t workerPoolSubmit(workerPool_t *pPool, const char *pName, workerJob_t job, void *pParam);
+
+/// @brief              Gets a copy of the pool's job statistics
+/// @param pPool        The worker pool
+/// @param pStats       Where to copy the statistics
+void workerPoolGetStats(workerPool_t *pPool, workerPoolStats_t *pStats);
+
+/// @brief              Logs the pool's job statistics
+/// @param pPool        The worker pool
+void workerPoolPrintStats(workerPool_t *pPool);
+
+/// @brief              Stops the workers once their current job has finished,
+///                     and frees the pool. Jobs still queued are not run.
+/// @param pPool        The worker pool
+void workerPoolDestroy(workerPool_t *pPool);
+
+#endif
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT payload compression benchmark - compresses each recorded payload
+ * of a file, one payload per line, with and without the dictionary of
+ * MQTT_COMPRESS_DICTIONARY. Prints the size each payload is published
+ * at, with the compression header, and the CPU time to compress and
+ * decompress it, after checking it decompresses back to the same bytes.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lzss.h"
+#include "mqttCompress.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define DEFAULT_PAYLOADS_FILENAME   "payloads.txt"
+#define DEFAULT_ITERATIONS          2000
+
+#define MAX_PAYLOAD_SIZE            (12 * 1024)
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    size_t payloads;
+    size_t bytesIn;
+    size_t bytesOut;            // With the dictionary, as published
+    size_t bytesOutNoDict;
+    double compressUs;          // CPU time over all the payloads
+    double decompressUs;
+} benchTotals_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static const uint8_t dictionary[] = MQTT_COMPRESS_DICTIONARY;
+
+static lzssWork_t work;
+static char payload[MAX_PAYLOAD_SIZE + 2];
+static uint8_t compressed[MAX_PAYLOAD_SIZE];
+static uint8_t decompressed[MAX_PAYLOAD_SIZE];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief The published length of a payload, as it is sent without the
+///        header when compressing doesn't make it shorter
+static size_t publishedLength(size_t length, size_t compressedLength)
+{
+    if (compressedLength == 0 || compressedLength + MQTT_COMPRESS_HEADER_LENGTH >= length)
+        return length;
+
+    return compressedLength + MQTT_COMPRESS_HEADER_LENGTH;
+}
+
+/// @brief Gets the CPU time of one call, in microseconds
+static double microsecondsPerCall(clock_t start, int32_t iterations)
+{
+    return (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC / iterations;
+}
+
+/// @brief Compresses and decompresses one payload, adding it to the totals
+/// @return True if the payload decompressed back to the same bytes
+static bool benchPayload(const char *pPayload, size_t length, int32_t iterations, benchTotals_t *pTotals)
+{
+    const uint8_t *pIn = (const uint8_t *)pPayload;
+    size_t dictLength = sizeof(dictionary) - 1;
+
+    clock_t start = clock();
+    size_t compressedLength = 0;
+    for (int32_t i=0; i<iterations; i++)
+        compressedLength = lzssCompress(&work, dictionary, dictLength, pIn, length,
+                                        compressed, sizeof(compressed));
+    double compressUs = microsecondsPerCall(start, iterations);
+
+    start = clock();
+    size_t decompressedLength = 0;
+    for (int32_t i=0; i<iterations; i++)
+        decompressedLength = lzssDecompress(dictionary, dictLength, compressed, compressedLength,
+                                            decompressed, sizeof(decompressed));
+    double decompressUs = microsecondsPerCall(start, iterations);
+
+    if (decompressedLength != length || memcmp(decompressed, pIn, length) != 0) {
+        printf("Payload %zu didn't decompress to the same bytes\n", pTotals->payloads + 1);
+        return false;
+    }
+
+    size_t noDictLength = lzssCompress(&work, NULL, 0, pIn, length, compressed, sizeof(compressed));
+
+    size_t published = publishedLength(length, compressedLength);
+    printf("%4zu %6zu %6zu %5zu%% %6zu %9.2f %9.2f\n",
+            pTotals->payloads + 1,
+            length,
+            published,
+            published * 100 / length,
+            publishedLength(length, noDictLength),
+            compressUs,
+            decompressUs);
+
+    pTotals->payloads++;
+    pTotals->bytesIn += length;
+    pTotals->bytesOut += published;
+    pTotals->bytesOutNoDict += publishedLength(length, noDictLength);
+    pTotals->compressUs += compressUs;
+    pTotals->decompressUs += decompressUs;
+
+    return true;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+    const char *pFilename = argc > 1 ? argv[1] : DEFAULT_PAYLOADS_FILENAME;
+    int32_t iterations = argc > 2 ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        printf("Usage: %s [payloads file] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    FILE *pFile = fopen(pFilename, "r");
+    if (pFile == NULL) {
+        printf("Failed to open %s\n", pFilename);
+        return 1;
+    }
+
+    printf("Dictionary is %zu bytes, version %d, %d iterations each\n\n",
+            sizeof(dictionary) - 1, MQTT_COMPRESS_VERSION, iterations);
+    printf("   #  Bytes   Sent  Ratio NoDict CompressUs DecompUs\n");
+
+    benchTotals_t totals;
+    memset(&totals, 0, sizeof(totals));
+
+    bool ok = true;
+    while (ok && fgets(payload, sizeof(payload), pFile) != NULL) {
+        size_t length = strcspn(payload, "\r\n");
+        if (length > 0)
+            ok = benchPayload(payload, length, iterations, &totals);
+    }
+
+    fclose(pFile);
+
+    if (totals.payloads == 0 || totals.bytesIn == 0) {
+        printf("No payloads in %s\n", pFilename);
+        return 1;
+    }
+
+    printf("\n%zu payloads, %zu bytes sent as %zu bytes (%zu%%), %zu bytes (%zu%%) without the dictionary\n",
+            totals.payloads,
+            totals.bytesIn,
+            totals.bytesOut,
+            totals.bytesOut * 100 / totals.bytesIn,
+            totals.bytesOutNoDict,
+            totals.bytesOutNoDict * 100 / totals.bytesIn);
+    printf("Compressing takes %.2f us per KB, decompressing %.2f us per KB\n",
+            totals.compressUs * 1024 / totals.bytesIn,
+            totals.decompressUs * 1024 / totals.bytesIn);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT downlink dispatch benchmark - dispatches a command message on each
+ * of the topics subscribed to, MQTT_MAX_SUBSCRIPTIONS of them with
+ * COMMANDS_PER_TOPIC commands each, by comparing the topic and the command
+ * with every one in turn, as the MQTT task used to, and with the hash
+ * indexes of common/nameIndex.c, as it does now. Prints the CPU time of
+ * a dispatch for the first and last commands of the first and last
+ * topics, for an unknown command, and on average over all the commands.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "nameIndex.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define DEFAULT_ITERATIONS          2000
+
+// The most topics the tasks can subscribe to, as in mqttSubscriptions.h
+#define MQTT_MAX_SUBSCRIPTIONS      50
+#define COMMANDS_PER_TOPIC          10
+
+#define TOPIC_NAME_SIZE             64
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A command and its callback, laid out like a callbackCommand_t
+typedef struct {
+    const char *command;
+    int32_t (*callback)(void *pParams);
+} benchCommand_t;
+
+/// @brief A topic subscribed to and its commands
+typedef struct {
+    const char *pName;
+    benchCommand_t commands[COMMANDS_PER_TOPIC];
+    nameIndex_t commandIndex;
+    uint8_t slots[COMMANDS_PER_TOPIC * 4];
+} benchTopic_t;
+
+/// @brief Dispatches a command on a topic
+/// @return The command's callback result, or negative if it isn't found
+typedef int32_t (*dispatch_t)(const char *pTopicName, const char *pCommand);
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+// Commands like those of the tasks, numbered so each topic's are different
+static const char *commandNames[COMMANDS_PER_TOPIC] = {
+    "MEASURE_NOW", "START_TASK", "STOP_TASK", "SET_DWELL_TIME", "LOCATION_NOW",
+    "START_CELL_SCAN", "SET_LOG_LEVEL", "DUMP_METRICS", "RUN_EXAMPLE", "RESET_STATS"
+};
+
+static char topicNames[MQTT_MAX_SUBSCRIPTIONS][TOPIC_NAME_SIZE];
+static char commandText[MQTT_MAX_SUBSCRIPTIONS][COMMANDS_PER_TOPIC][TOPIC_NAME_SIZE];
+
+static benchTopic_t topics[MQTT_MAX_SUBSCRIPTIONS];
+static nameIndex_t topicIndex;
+static uint8_t topicSlots[MQTT_MAX_SUBSCRIPTIONS * 4];
+
+// stops the compiler optimising the callbacks away
+static volatile int32_t callbackCount = 0;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static int32_t countCallback(void *pParams)
+{
+    (void)pParams;
+    callbackCount++;
+    return 0;
+}
+
+/// @brief Builds the topics, their commands and the indexes
+static bool buildTopics(void)
+{
+    for (int32_t t=0; t<MQTT_MAX_SUBSCRIPTIONS; t++) {
+        snprintf(topicNames[t], TOPIC_NAME_SIZE, "ubxlib/351234567890123/Task%02dControl", t);
+        topics[t].pName = topicNames[t];
+
+        for (int32_t c=0; c<COMMANDS_PER_TOPIC; c++) {
+            snprintf(commandText[t][c], TOPIC_NAME_SIZE, "%s_%02d", commandNames[c], t);
+            topics[t].commands[c].command = commandText[t][c];
+            topics[t].commands[c].callback = countCallback;
+        }
+
+        if (nameIndexSlots(COMMANDS_PER_TOPIC) > sizeof(topics[t].slots) ||
+                !nameIndexBuild(&topics[t].commandIndex, topics[t].slots,
+                                topics[t].commands, sizeof(benchCommand_t), COMMANDS_PER_TOPIC))
+            return false;
+    }
+
+    return nameIndexSlots(MQTT_MAX_SUBSCRIPTIONS) <= sizeof(topicSlots) &&
+           nameIndexBuild(&topicIndex, topicSlots, topics, sizeof(benchTopic_t), MQTT_MAX_SUBSCRIPTIONS);
+}
+
+/// @brief Dispatches by comparing with every topic and command
+static int32_t dispatchLinear(const char *pTopicName, const char *pCommand)
+{
+    for (int32_t t=0; t<MQTT_MAX_SUBSCRIPTIONS; t++) {
+        if (strcmp(topics[t].pName, pTopicName) != 0)
+            continue;
+
+        for (int32_t c=0; c<COMMANDS_PER_TOPIC; c++) {
+            if (strcmp(topics[t].commands[c].command, pCommand) == 0)
+                return topics[t].commands[c].callback(NULL);
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Dispatches with the topic and command indexes
+static int32_t dispatchHashed(const char *pTopicName, const char *pCommand)
+{
+    int32_t t = nameIndexFind(&topicIndex, pTopicName);
+    if (t < 0)
+        return -1;
+
+    int32_t c = nameIndexFind(&topics[t].commandIndex, pCommand);
+    if (c < 0)
+        return -1;
+
+    return topics[t].commands[c].callback(NULL);
+}
+
+/// @brief Gets the CPU time of one dispatch, in nanoseconds
+static double nanosecondsPerCall(clock_t start, int64_t calls)
+{
+    return (double)(clock() - start) * 1000000000.0 / CLOCKS_PER_SEC / calls;
+}
+
+/// @brief Times dispatching one command
+static double timeOne(dispatch_t dispatch, const char *pTopicName, const char *pCommand, int32_t iterations)
+{
+    clock_t start = clock();
+    for (int32_t i=0; i<iterations * 100; i++)
+        dispatch(pTopicName, pCommand);
+
+    return nanosecondsPerCall(start, (int64_t)iterations * 100);
+}
+
+/// @brief Times dispatching every command of every topic
+static double timeAll(dispatch_t dispatch, int32_t iterations)
+{
+    clock_t start = clock();
+    for (int32_t i=0; i<iterations; i++) {
+        for (int32_t t=0; t<MQTT_MAX_SUBSCRIPTIONS; t++) {
+            for (int32_t c=0; c<COMMANDS_PER_TOPIC; c++)
+                dispatch(topicNames[t], commandText[t][c]);
+        }
+    }
+
+    return nanosecondsPerCall(start, (int64_t)iterations * MQTT_MAX_SUBSCRIPTIONS * COMMANDS_PER_TOPIC);
+}
+
+/// @brief Checks both dispatchers find every command, and not an unknown one
+static bool checkDispatch(void)
+{
+    for (int32_t t=0; t<MQTT_MAX_SUBSCRIPTIONS; t++) {
+        for (int32_t c=0; c<COMMANDS_PER_TOPIC; c++) {
+            if (dispatchLinear(topicNames[t], commandText[t][c]) != 0 ||
+                    dispatchHashed(topicNames[t], commandText[t][c]) != 0)
+                return false;
+        }
+    }
+
+    return dispatchLinear(topicNames[0], "UNKNOWN") < 0 && dispatchHashed(topicNames[0], "UNKNOWN") < 0 &&
+           dispatchHashed(topicNames[0], commandText[1][0]) < 0 &&
+           callbackCount == MQTT_MAX_SUBSCRIPTIONS * COMMANDS_PER_TOPIC * 2;
+}
+
+/// @brief Prints the time of one case for both dispatchers
+static void printCase(const char *pCase, double linearNs, double hashedNs)
+{
+    printf("%-22s %9.1f %9.1f %7.1fx\n", pCase, linearNs, hashedNs, linearNs / hashedNs);
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+    int32_t iterations = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    if (!buildTopics()) {
+        printf("Failed to build the indexes\n");
+        return 1;
+    }
+
+    if (!checkDispatch()) {
+        printf("The dispatchers didn't find the same commands\n");
+        return 1;
+    }
+
+    int32_t last = MQTT_MAX_SUBSCRIPTIONS - 1;
+    int32_t lastCommand = COMMANDS_PER_TOPIC - 1;
+
+    printf("%d topics x %d commands, %d iterations\n\n", MQTT_MAX_SUBSCRIPTIONS, COMMANDS_PER_TOPIC, iterations);
+    printf("Dispatch ns            Linear    Hashed Speedup\n");
+    printCase("First topic, command",
+                timeOne(dispatchLinear, topicNames[0], commandText[0][0], iterations),
+                timeOne(dispatchHashed, topicNames[0], commandText[0][0], iterations));
+    printCase("First topic, last",
+                timeOne(dispatchLinear, topicNames[0], commandText[0][lastCommand], iterations),
+                timeOne(dispatchHashed, topicNames[0], commandText[0][lastCommand], iterations));
+    printCase("Last topic, last",
+                timeOne(dispatchLinear, topicNames[last], commandText[last][lastCommand], iterations),
+                timeOne(dispatchHashed, topicNames[last], commandText[last][lastCommand], iterations));
+    printCase("Unknown command",
+                timeOne(dispatchLinear, topicNames[last], "UNKNOWN_COMMAND", iterations),
+                timeOne(dispatchHashed, topicNames[last], "UNKNOWN_COMMAND", iterations));
+    printCase("Average, all commands", timeAll(dispatchLinear, iterations), timeAll(dispatchHashed, iterations));
+
+    return 0;
+}
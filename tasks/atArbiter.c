@@ -0,0 +1,320 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * AT Channel Arbiter - all the appTasks share the one AT command
+ * channel to the module. ubxlib serialises each AT command, but a long
+ * operation like a network scan holds the channel for minutes. The
+ * arbiter gives the channel to one caller at a time, highest priority
+ * class first, and asks a long preemptible operation to give way when
+ * a higher class is waiting, so MQTT publishing is not held up by a scan.
+ *
+ */
+
+#include "common.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "atArbiter.h"
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A caller waiting for the AT channel, on its own stack
+typedef struct AT_WAITER {
+    uPortSemaphoreHandle_t semaphore;
+    atClass_t atClass;
+    bool preemptible;
+    struct AT_WAITER *pNext;
+} atWaiter_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t arbiterMutex = NULL;
+
+// The waiters of each class, in the order they asked for the channel
+static atWaiter_t *waitersHead[MAX_AT_CLASSES];
+static atWaiter_t *waitersTail[MAX_AT_CLASSES];
+
+// The current holder of the AT channel
+static bool channelBusy = false;
+static atClass_t holderClass = AT_CLASS_CONTROL;
+static uPortTaskHandle_t holderTask = NULL;
+static int32_t holderDepth = 0;
+static bool holderPreemptible = false;
+static bool holderPreempted = false;
+
+static atChannelStats_t classStats[MAX_AT_CLASSES];
+
+static const char *classNames[MAX_AT_CLASSES] = {
+    "Control",
+    "Measurement",
+    "Registration",
+    "Location",
+    "Scan"
+};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS - called with the arbiterMutex locked
+ * -------------------------------------------------------------- */
+static void setHolder(atClass_t atClass, bool preemptible, uPortTaskHandle_t task)
+{
+    channelBusy = true;
+    holderClass = atClass;
+    holderTask = task;
+    holderDepth = 1;
+    holderPreemptible = preemptible;
+    holderPreempted = false;
+
+    classStats[atClass].acquired++;
+}
+
+static void addWaiter(atWaiter_t *pWaiter)
+{
+    atClass_t atClass = pWaiter->atClass;
+
+    pWaiter->pNext = NULL;
+    if (waitersTail[atClass] == NULL)
+        waitersHead[atClass] = pWaiter;
+    else
+        waitersTail[atClass]->pNext = pWaiter;
+
+    waitersTail[atClass] = pWaiter;
+}
+
+/// @brief Takes the first waiter of the highest class waiting
+/// @return The waiter, or NULL if nobody is waiting
+static atWaiter_t *popWaiter(void)
+{
+    for (int32_t c=0; c<MAX_AT_CLASSES; c++) {
+        atWaiter_t *pWaiter = waitersHead[c];
+        if (pWaiter != NULL) {
+            waitersHead[c] = pWaiter->pNext;
+            if (waitersHead[c] == NULL)
+                waitersTail[c] = NULL;
+
+            return pWaiter;
+        }
+    }
+
+    return NULL;
+}
+
+static bool higherClassWaiting(atClass_t atClass)
+{
+    for (int32_t c=0; c<atClass; c++) {
+        if (waitersHead[c] != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the AT channel arbiter
+/// @return 0 on success, negative on failure
+int32_t initAtArbiter(void)
+{
+    int32_t errorCode = uPortMutexCreate(&arbiterMutex);
+    if (errorCode < 0)
+        writeFatal("Failed to create the AT channel arbiter mutex (%d)", errorCode);
+
+    return errorCode;
+}
+
+/// @brief Logs the AT channel statistics of each class
+void finalizeAtArbiter(void)
+{
+    for (int32_t c=0; c<MAX_AT_CLASSES; c++) {
+        atChannelStats_t stats;
+        if (atChannelGetStats(c, &stats) < 0 || stats.acquired == 0)
+            continue;
+
+        printInfo("%s AT channel use: %d times, %d preempted. Wait avg %d ms, max %d ms",
+                classNames[c],
+                stats.acquired,
+                stats.preempted,
+                stats.waits.count == 0 ? 0 : stats.waits.totalMs / stats.waits.count,
+                stats.waits.maxMs);
+    }
+}
+
+/// @brief Waits for the AT channel. When the channel is released it is
+///        given to the highest class waiting, and in the order they asked
+///        within a class. A thread which already holds the channel can
+///        acquire it again.
+/// @param atClass The priority class of the caller
+/// @param preemptible True if the caller checks atChannelShouldYield() and
+///                    cancels its call when a higher class is waiting
+void atChannelAcquire(atClass_t atClass, bool preemptible)
+{
+    if (arbiterMutex == NULL || (uint32_t)atClass >= MAX_AT_CLASSES)
+        return;
+
+    int32_t startTime = uPortGetTickTimeMs();
+    uPortTaskHandle_t thisTask = NULL;
+    uPortTaskGetHandle(&thisTask);
+
+    atWaiter_t waiter = {NULL, atClass, preemptible, NULL};
+    bool acquired = false;
+
+    while (!acquired) {
+        U_PORT_MUTEX_LOCK(arbiterMutex);
+        if (channelBusy && holderTask == thisTask) {
+            holderDepth++;
+            acquired = true;
+        } else if (!channelBusy) {
+            setHolder(atClass, preemptible, thisTask);
+            acquired = true;
+        } else if (waiter.semaphore != NULL || uPortSemaphoreCreate(&waiter.semaphore, 0, 1) == 0) {
+            addWaiter(&waiter);
+        }
+        U_PORT_MUTEX_UNLOCK(arbiterMutex);
+
+        if (acquired)
+            break;
+
+        if (waiter.semaphore == NULL) {
+            // no semaphore to wait on, so check again in a moment
+            uPortTaskBlock(10);
+            continue;
+        }
+
+        // the releasing thread makes this waiter the holder before waking it up
+        uPortSemaphoreTake(waiter.semaphore);
+
+        U_PORT_MUTEX_LOCK(arbiterMutex);
+        holderTask = thisTask;
+        U_PORT_MUTEX_UNLOCK(arbiterMutex);
+
+        acquired = true;
+    }
+
+    if (waiter.semaphore != NULL)
+        uPortSemaphoreDelete(waiter.semaphore);
+
+    // under the arbiter's mutex, as atChannelGetStats() copies it with that
+    U_PORT_MUTEX_LOCK(arbiterMutex);
+    metricsHistogramAdd(&classStats[atClass].waits, uPortGetTickTimeMs() - startTime);
+    U_PORT_MUTEX_UNLOCK(arbiterMutex);
+}
+
+/// @brief Releases the AT channel, giving it to the next waiter
+void atChannelRelease(void)
+{
+    if (arbiterMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(arbiterMutex);
+    if (--holderDepth <= 0) {
+        channelBusy = false;
+        holderTask = NULL;
+
+        // hand the channel straight over, so nobody can take it in between
+        atWaiter_t *pWaiter = popWaiter();
+        if (pWaiter != NULL) {
+            setHolder(pWaiter->atClass, pWaiter->preemptible, NULL);
+            uPortSemaphoreGive(pWaiter->semaphore);
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(arbiterMutex);
+}
+
+/// @brief Checks if the caller's preemptible call should be cancelled so a
+///        higher class can have the AT channel
+/// @return True if a higher class is waiting for the channel
+bool atChannelShouldYield(void)
+{
+    if (arbiterMutex == NULL)
+        return false;
+
+    bool yield = false;
+
+    U_PORT_MUTEX_LOCK(arbiterMutex);
+    if (channelBusy && holderPreemptible && higherClassWaiting(holderClass)) {
+        yield = true;
+        if (!holderPreempted) {
+            holderPreempted = true;
+            classStats[holderClass].preempted++;
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(arbiterMutex);
+
+    return yield;
+}
+
+/// @brief For a preemptible call made of many AT commands, like a GNSS fix,
+///        which can carry on after other commands. If a higher class is
+///        waiting, gives it the AT channel and waits to have it back.
+/// @return True if the channel was given way
+bool atChannelYield(void)
+{
+    if (!atChannelShouldYield())
+        return false;
+
+    uPortTaskHandle_t thisTask = NULL;
+    uPortTaskGetHandle(&thisTask);
+
+    atClass_t atClass = AT_CLASS_CONTROL;
+    bool canYield = false;
+
+    // a nested acquire can't give the channel away
+    U_PORT_MUTEX_LOCK(arbiterMutex);
+    if (channelBusy && holderTask == thisTask && holderDepth == 1) {
+        atClass = holderClass;
+        canYield = true;
+    }
+    U_PORT_MUTEX_UNLOCK(arbiterMutex);
+
+    if (!canYield)
+        return false;
+
+    atChannelRelease();
+    atChannelAcquire(atClass, true);
+
+    return true;
+}
+
+/// @brief Gets a copy of the AT channel statistics of a class
+/// @param atClass The priority class
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t atChannelGetStats(atClass_t atClass, atChannelStats_t *pStats)
+{
+    if (arbiterMutex == NULL || (uint32_t)atClass >= MAX_AT_CLASSES || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(arbiterMutex);
+    *pStats = classStats[atClass];
+    U_PORT_MUTEX_UNLOCK(arbiterMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Gets the name of a priority class
+/// @param atClass The priority class
+/// @return The name of the class
+const char *atChannelClassName(atClass_t atClass)
+{
+    if ((uint32_t)atClass >= MAX_AT_CLASSES)
+        return "Unknown";
+
+    return classNames[atClass];
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * AT Channel Arbiter header - gives the single AT command channel to
+ * the module to the appTasks by priority class
+ *
+ */
+
+#ifndef _AT_ARBITER_H_
+#define _AT_ARBITER_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Runs a blocking ubxlib call once the AT channel has been given to
+// this priority class. Only the call itself, not the wait for the
+// channel, is added to the task's ubxlib call metrics.
+#define AT_CHANNEL_CALL(atClass, call)              {                                       \
+                                                        atChannelAcquire(atClass, false);   \
+                                                        TIMED_UBXLIB_CALL(call);            \
+                                                        atChannelRelease();                 \
+                                                    }
+
+// As AT_CHANNEL_CALL, for a long call with a keepGoing callback which
+// checks atChannelShouldYield(), so it can give way to a higher class
+#define AT_CHANNEL_CALL_PREEMPTIBLE(atClass, call)  {                                       \
+                                                        atChannelAcquire(atClass, true);    \
+                                                        TIMED_UBXLIB_CALL(call);            \
+                                                        atChannelRelease();                 \
+                                                    }
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The priority classes of the AT channel users, highest first
+typedef enum {
+    AT_CLASS_CONTROL,       // MQTT connection, publishing and subscribing, network information
+    AT_CLASS_MEASUREMENT,   // Signal quality measurements
+    AT_CLASS_REGISTRATION,  // Bringing up the network, which gives way to the classes above
+    AT_CLASS_LOCATION,      // GNSS fixes, which give way to the measurements
+    AT_CLASS_SCAN,          // Network scans
+    MAX_AT_CLASSES
+} atClass_t;
+
+/// @brief AT channel statistics for a priority class
+typedef struct AtChannelStats {
+    int32_t acquired;           // Times the channel was given to the class
+    int32_t preempted;          // Preemptible calls asked to give way to a higher class
+    latencyHistogram_t waits;   // Time waited for the channel
+} atChannelStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the AT channel arbiter
+/// @return         0 on success, negative on failure
+int32_t initAtArbiter(void);
+
+/// @brief          Logs the AT channel statistics of each class
+void finalizeAtArbiter(void);
+
+/// @brief              Waits for the AT channel. When the channel is released
+///                     it is given to the highest class waiting, and in the
+///                     order they asked within a class. A thread which already
+///                     holds the channel can acquire it again.
+/// @param atClass      The priority class of the caller
+/// @param preemptible  True if the caller checks atChannelShouldYield() and
+///                     cancels its call when a higher class is waiting
+void atChannelAcquire(atClass_t atClass, bool preemptible);
+
+/// @brief          Releases the AT channel, giving it to the next waiter
+void atChannelRelease(void);
+
+/// @brief          Checks if the caller's preemptible call should be cancelled
+///                 so a higher class can have the AT channel
+/// @return         True if a higher class is waiting for the channel
+bool atChannelShouldYield(void);
+
+/// @brief          For a preemptible call made of many AT commands, like a
+///                 GNSS fix, which can carry on after other commands. If a
+///                 higher class is waiting, gives it the AT channel and waits
+///                 to have it back. Call it between the commands, from the
+///                 call's keepGoing callback.
+/// @return         True if the channel was given way
+bool atChannelYield(void);
+
+/// @brief              Gets a copy of the AT channel statistics of a class
+/// @param atClass      The priority class
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t atChannelGetStats(atClass_t atClass, atChannelStats_t *pStats);
+
+/// @brief              Gets the name of a priority class
+/// @param atClass      The priority class
+/// @return             The name of the class
+const char *atChannelClassName(atClass_t atClass);
+
+#endif
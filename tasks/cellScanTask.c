@@ -22,22 +22,37 @@
 
 #include "common.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
 #include "cellScanTask.h"
 #include "mqttTask.h"
+#include "mqttEncode.h"
+#include "atArbiter.h"
 
 /* ----------------------------------------------------------------
  * DEFINES
  * -------------------------------------------------------------- */
 #define NETWORK_SCAN_TOPIC "NetworkScan"
 
-#define CELL_SCAN_TASK_STACK_SIZE   (3*1024)
-#define CELL_SCAN_TASK_PRIORITY     5
+#define PAYLOAD_BUFFER_SIZE         300
 
-#define CELL_SCAN_QUEUE_STACK_SIZE  QUEUE_STACK_SIZE_DEFAULT
-#define CELL_SCAN_QUEUE_PRIORITY    5
-#define CELL_SCAN_QUEUE_SIZE        2
+// A scan is one long AT command, so it is cancelled whenever a higher
+// class needs the AT channel. It is restarted this many times, after a
+// back off which doubles each time so the higher class's work can
+// finish, before the scan is given up.
+#define MAX_SCAN_RESTARTS           5
+#define SCAN_BACK_OFF_MS            2000
+#define SCAN_BACK_OFF_STEP_MS       100
 
-#define JSON_STRING_LENGTH          300
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A network found by the scan, as published
+typedef struct {
+    const char *pTimestamp;
+    const char *pName;
+    int32_t rat;
+    const char *pMccMnc;
+} scannedNetwork_t;
 
 /* ----------------------------------------------------------------
  * COMMON TASK VARIABLES
@@ -49,11 +64,13 @@ static taskConfig_t *taskConfig = NULL;
  * STATIC VARIABLES
  * -------------------------------------------------------------- */
 static bool stopCellScan = false;
+static bool scanPreempted = false;
 
 static char topicName[MAX_TOPIC_NAME_SIZE];
+static mqttTopicHandle_t topicHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
-/// buffer for the location MQTT JSON message
-static char jsonBuffer[JSON_STRING_LENGTH];
+/// buffer for the network scan MQTT JSON or CBOR message
+static uint8_t payloadBuffer[PAYLOAD_BUFFER_SIZE];
 
 /// callback commands for incoming MQTT control messages
 static callbackCommand_t callbacks[] = {
@@ -77,6 +94,12 @@ static bool isNotExiting(void)
 
 static bool keepGoing(void *pParam)
 {
+    if (atChannelShouldYield()) {
+        writeInfo("Scanning for networks paused, the AT channel is needed");
+        scanPreempted = true;
+        return false;
+    }
+
     bool kg = isNotExiting();
     if (kg) {
         gAppStatus = COPS_QUERY;
@@ -88,6 +111,61 @@ static bool keepGoing(void *pParam)
     return kg;
 }
 
+/// @brief Encodes a scanned network as JSON
+static size_t encodeNetworkJson(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const scannedNetwork_t *network = (const scannedNetwork_t *)pData;
+
+    char format[] = "{"                 \
+            "\"Timestamp\":\"%s\", "    \
+            "\"CellScan\":{"            \
+                "\"Name\":\"%s\", "     \
+                "\"ubxlibRAT\":\"%d\", "     \
+                "\"MCCMNC\":\"%s\"}"   \
+        "}";
+
+    int length = snprintf((char *)pBuffer, size, format, network->pTimestamp,
+                    network->pName,
+                    network->rat,
+                    network->pMccMnc);
+
+    return length < 0 || (size_t)length >= size ? 0 : length;
+}
+
+/// @brief Encodes a scanned network as CBOR, with the same keys and values
+///        as the JSON
+static size_t encodeNetworkCbor(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const scannedNetwork_t *network = (const scannedNetwork_t *)pData;
+
+    char rat[12];
+    snprintf(rat, sizeof(rat), "%d", network->rat);
+
+    cborEncoder_t encoder;
+    cborInit(&encoder, pBuffer, size);
+    cborMap(&encoder, 2);
+    cborKeyText(&encoder, "Timestamp", network->pTimestamp);
+    cborKeyMap(&encoder, "CellScan", 3);
+        cborKeyText(&encoder, "Name", network->pName);
+        cborKeyText(&encoder, "ubxlibRAT", rat);
+        cborKeyText(&encoder, "MCCMNC", network->pMccMnc);
+
+    return cborLength(&encoder);
+}
+
+static const mqttEncoders_t networkEncoders = {encodeNetworkJson, encodeNetworkCbor};
+
+/// @brief Waits before restarting a preempted scan, with the AT channel
+/// free for the other tasks
+/// @return false if the scan was stopped while waiting
+static bool backOff(int32_t backOffMs)
+{
+    for (int32_t waitedMs = 0; waitedMs < backOffMs && isNotExiting(); waitedMs += SCAN_BACK_OFF_STEP_MS)
+        uPortTaskBlock(SCAN_BACK_OFF_STEP_MS);
+
+    return isNotExiting();
+}
+
 static void doCellScan(void *pParams)
 {
     int32_t found = 0;
@@ -105,30 +183,41 @@ static void doCellScan(void *pParams)
     char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
     getTimeStamp(timestamp);
 
-    char format[] = "{"                 \
-            "\"Timestamp\":\"%s\", "    \
-            "\"CellScan\":{"            \
-                "\"Name\":\"%s\", "     \
-                "\"ubxlibRAT\":\"%d\", "     \
-                "\"MCCMNC\":\"%s\"}"   \
-        "}";
-
     writeInfo("Scanning for networks...");
-    for (count = uCellNetScanGetFirst(gCellDeviceHandle, internalBuffer,
-                                            sizeof(internalBuffer), mccMnc, &rat,
-                                            keepGoing);
-            count > 0;
+    int32_t backOffMs = SCAN_BACK_OFF_MS;
+    for (int32_t restarts=0; ; restarts++) {
+        scanPreempted = false;
+
+        AT_CHANNEL_CALL_PREEMPTIBLE(AT_CLASS_SCAN,
+                                    count = uCellNetScanGetFirst(gCellDeviceHandle, internalBuffer,
+                                                                sizeof(internalBuffer), mccMnc, &rat,
+                                                                keepGoing));
+
+        if (!scanPreempted || !isNotExiting())
+            break;
+
+        if (restarts == MAX_SCAN_RESTARTS) {
+            writeWarn("Giving up the network scan, the AT channel was needed %d times", restarts + 1);
+            count = U_ERROR_COMMON_TIMEOUT;
+            break;
+        }
+
+        if (!backOff(backOffMs))
+            break;
+
+        writeInfo("Restarting the network scan (%d of %d)", restarts + 1, MAX_SCAN_RESTARTS);
+        backOffMs *= 2;
+    }
+
+    // the scan results are cached, so reading them needs no AT channel
+    for (; count > 0;
             count = uCellNetScanGetNext(gCellDeviceHandle, internalBuffer, sizeof(internalBuffer), mccMnc, &rat)) {
 
         found++;
 
-        snprintf(jsonBuffer, sizeof(jsonBuffer), format, timestamp,
-                    internalBuffer, 
-                    rat,
-                    mccMnc);
-
-        writeAlways(jsonBuffer);
-        publishMQTTMessage(topicName, jsonBuffer, U_MQTT_QOS_AT_MOST_ONCE, false);
+        scannedNetwork_t network = {timestamp, internalBuffer, rat, mccMnc};
+        mqttPublishEncoded(topicHandle, &networkEncoders, &network, payloadBuffer, sizeof(payloadBuffer),
+                            false, MQTT_LANE_BULK);
     }
 
     if (!gExitApp) {
@@ -155,7 +244,7 @@ static void doCellScan(void *pParams)
 
 static void startCellScan(void)
 {
-    RUN_FUNC(doCellScan, CELL_SCAN_TASK_STACK_SIZE, CELL_SCAN_TASK_PRIORITY);
+    RUN_FUNC(doCellScan);
 }
 
 static void queueHandler(void *pParam, size_t paramLengthBytes)
@@ -188,20 +277,7 @@ static int32_t initMutex()
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(cellScanMsg_t),
-                    CELL_SCAN_QUEUE_STACK_SIZE,
-                    CELL_SCAN_QUEUE_PRIORITY,
-                    CELL_SCAN_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create %s event queue %d", TASK_NAME, eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(cellScanMsg_t));
 }
 
 /* ----------------------------------------------------------------
@@ -213,7 +289,7 @@ static int32_t initQueue()
 int32_t queueNetworkScan(commandParamsList_t *params)
 {
     cellScanMsg_t qMsg;
-    if (TASK_IS_RUNNING) {
+    if (TASK_IS_BUSY) {
         writeInfo("Cell Scan is already in progress, cancelling...");
         qMsg.msgType = STOP_CELL_SCAN;
     } else {
@@ -221,7 +297,7 @@ int32_t queueNetworkScan(commandParamsList_t *params)
         qMsg.msgType = START_CELL_SCAN;
     }
 
-    return sendAppTaskMessage(TASK_ID, &qMsg, sizeof(cellScanMsg_t));
+    return sendAppTaskMessage(CELL_SCAN_TASK, &qMsg, sizeof(cellScanMsg_t));
 }
 
 /// @brief Initialises the network scanning task(s)
@@ -236,6 +312,8 @@ int32_t initCellScanTask(taskConfig_t *config)
     int32_t result = U_ERROR_COMMON_SUCCESS;
 
     CREATE_TOPIC_NAME;
+    topicHandle = mqttTopicRegister(topicName);
+    mqttTopicSetPolicy(topicHandle, MQTT_POLICY_DROP_OLDEST);
 
     writeInfo("Initializing the %s task...", TASK_NAME);
     EXIT_ON_FAILURE(initMutex);
@@ -255,7 +333,7 @@ int32_t startCellScanTaskLoop(commandParamsList_t *params)
     return U_ERROR_COMMON_NOT_IMPLEMENTED;
 }
 
-int32_t stopCellScanTask(commandParamsList_t *params)
+int32_t stopCellScanTaskLoop(commandParamsList_t *params)
 {
     STOP_TASK;
 }
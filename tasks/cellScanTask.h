@@ -28,7 +28,7 @@
  * -------------------------------------------------------------- */
 int32_t initCellScanTask(taskConfig_t *config);
 int32_t startCellScanTaskLoop(commandParamsList_t *params);
-int32_t stopCellScanTask(commandParamsList_t *params);
+int32_t stopCellScanTaskLoop(commandParamsList_t *params);
 int32_t finalizeCellScanTask(void);
 
 /* ----------------------------------------------------------------
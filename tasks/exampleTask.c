@@ -27,17 +27,6 @@
 #include "mqttTask.h"
 // #include "otherheaders...h"
 
-/* ----------------------------------------------------------------
- * DEFINES
- * -------------------------------------------------------------- */
-// not all tasks will have a task loop if it only uses a queue
-#define EXAMPLE_TASK_STACK_SIZE (1 * 1024)
-#define EXAMPLE_TASK_PRIORITY 5
-
-#define EXAMPLE_QUEUE_STACK_SIZE QUEUE_STACK_SIZE_DEFAULT
-#define EXAMPLE_QUEUE_PRIORITY 5
-#define EXAMPLE_QUEUE_SIZE 1
-
 /* ----------------------------------------------------------------
  * TASK COMMON VARIABLES
  * -------------------------------------------------------------- */
@@ -48,6 +37,7 @@ static taskConfig_t *taskConfig = NULL;
  * STATIC VARIABLES
  * -------------------------------------------------------------- */
 static char topicName[MAX_TOPIC_NAME_SIZE];
+static mqttTopicHandle_t topicHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
 /// callback commands for incoming MQTT control messages
 static callbackCommand_t callbacks[] = {
@@ -80,7 +70,7 @@ static void doExampleThing(void *pParams)
 
 static void startExampleThing(void)
 {
-    RUN_FUNC(doExampleThing, EXAMPLE_TASK_STACK_SIZE, EXAMPLE_TASK_PRIORITY);
+    RUN_FUNC(doExampleThing);
 }
 
 static void queueHandler(void *pParam, size_t paramLengthBytes)
@@ -100,33 +90,16 @@ static void queueHandler(void *pParam, size_t paramLengthBytes)
     }
 }
 
-// Task loop where the activity is made and the dwell time is taken
+// Task loop where the activity is made. The scheduler runs this
+// every taskLoopDwellTime seconds, so there is no dwell here.
 static void taskLoop(void *pParameters)
 {
-    while(isNotExiting()) {
-        doExampleThing(NULL);
-        dwellTask(taskConfig, isNotExiting);
-    }
-
-    FINALIZE_TASK;
+    doExampleThing(NULL);
 }
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(exampleMsg_t),
-                    EXAMPLE_QUEUE_STACK_SIZE,
-                    EXAMPLE_QUEUE_PRIORITY,
-                    EXAMPLE_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create %s event queue %d", TASK_NAME, eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(exampleMsg_t));
 }
 
 static int32_t initMutex()
@@ -145,7 +118,7 @@ int32_t queueExampleCommand(commandParamsList_t *params)
     exampleMsg_t qMsg;
     qMsg.msgType = RUN_EXAMPLE;
 
-    return sendAppTaskMessage(TASK_ID, &qMsg, sizeof(exampleMsg_t));
+    return sendAppTaskMessage(EXAMPLE_TASK, &qMsg, sizeof(exampleMsg_t));
 }
 
 /// @brief Initialises the Signal Quality task
@@ -160,6 +133,7 @@ int32_t initExampleTask(taskConfig_t *config)
     int32_t result = U_ERROR_COMMON_SUCCESS;
 
     CREATE_TOPIC_NAME;
+    topicHandle = mqttTopicRegister(topicName);
 
     writeInfo("Initializing the %s task...", TASK_NAME);
     EXIT_ON_FAILURE(initMutex);
@@ -181,7 +155,7 @@ int32_t startExampleTaskLoop(commandParamsList_t *params)
     if (params != NULL)
         taskConfig->taskLoopDwellTime = getParamValue(params, 1, 5, 60, 30);
 
-    START_TASK_LOOP(EXAMPLE_TASK_STACK_SIZE, EXAMPLE_TASK_PRIORITY);
+    SCHEDULE_TASK_LOOP(taskLoop, isNotExiting);
 }
 
 int32_t stopExampleTaskLoop(commandParamsList_t *params)
@@ -23,23 +23,23 @@
 #include <time.h>
 #include "common.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
+#include "messageBus.h"
+#include "atArbiter.h"
 #include "locationTask.h"
 #include "mqttTask.h"
+#include "mqttEncode.h"
 
 /* ----------------------------------------------------------------
  * DEFINES
  * -------------------------------------------------------------- */
-#define LOCATION_TASK_STACK_SIZE    (3 * 1024)
-#define LOCATION_TASK_PRIORITY      5
-
-#define LOCATION_QUEUE_STACK_SIZE QUEUE_STACK_SIZE_DEFAULT
-#define LOCATION_QUEUE_PRIORITY 5
-#define LOCATION_QUEUE_SIZE     5
-
-#define JSON_STRING_LENGTH      300
+#define PAYLOAD_BUFFER_SIZE     300
 
 #define TEN_MILLIONTH           10000000
 
+// Location fixes waiting to be published to MQTT
+#define MQTT_PUBLISHER_QUEUE_LENGTH 2
+
 /* ----------------------------------------------------------------
  * EXTERNAL VARIABLES
  * -------------------------------------------------------------- */
@@ -71,6 +71,7 @@ static uDeviceHandle_t *pGnssHandle;
 static bool stopLocation = false;
 
 static char topicName[MAX_TOPIC_NAME_SIZE];
+static mqttTopicHandle_t topicHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
 /// callback commands for incoming MQTT control messages
 static callbackCommand_t callbacks[] = {
@@ -79,8 +80,8 @@ static callbackCommand_t callbacks[] = {
     {"STOP_TASK", stopLocationTaskLoop}
 };
 
-/// buffer for the location MQTT JSON message
-static char jsonBuffer[JSON_STRING_LENGTH];
+/// buffer for the location MQTT JSON or CBOR message
+static uint8_t payloadBuffer[PAYLOAD_BUFFER_SIZE];
 
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
@@ -94,6 +95,11 @@ static bool isNotExiting(void)
 
 static bool keepGoing(void *pParam)
 {
+    // the fix is polled with one AT command at a time, so the channel can
+    // be given to a higher class in between without losing the fix so far
+    if (atChannelYield())
+        printDebug("GNSS location carried on after giving way on the AT channel");
+
     bool keepGoing = isNotExiting();
     if (keepGoing) {
         printDebug("Waiting for GNSS location...");
@@ -122,15 +128,11 @@ static char fractionConvert(int32_t x1e7,
     return prefix;
 }
 
-static void publishLocation(uLocation_t location)
+/// @brief Encodes a location fix as JSON
+static size_t encodeLocationJson(const void *pData, uint8_t *pBuffer, size_t size)
 {
-    int32_t whole = 0;
-    int32_t fraction = 0;
-
-    gAppStatus = LOCATION_MEAS;
-
-    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
-    getTimeStamp(timestamp);
+    const locationFix_t *fix = (const locationFix_t *)pData;
+    const uLocation_t *location = &fix->location;
 
     char format[] = "{"                     \
             "\"Timestamp\":\"%s\", "        \
@@ -143,34 +145,75 @@ static void publishLocation(uLocation_t location)
                 "\"utcTime\":\"%lld\"}"     \
         "}";
 
-    struct tm *t = gmtime((time_t *)&location.timeUtc);
-
     int32_t latWhole, latFraction, longWhole, longFraction;
-    char latPrefix  = fractionConvert(location.latitudeX1e7,  TEN_MILLIONTH, &latWhole,  &latFraction);
-    char longPrefix = fractionConvert(location.longitudeX1e7,  TEN_MILLIONTH, &longWhole, &longFraction);
+    char latPrefix  = fractionConvert(location->latitudeX1e7,  TEN_MILLIONTH, &latWhole,  &latFraction);
+    char longPrefix = fractionConvert(location->longitudeX1e7,  TEN_MILLIONTH, &longWhole, &longFraction);
 
-    snprintf(jsonBuffer, JSON_STRING_LENGTH, format, timestamp,
-            location.altitudeMillimetres,
+    int length = snprintf((char *)pBuffer, size, format, fix->timestamp,
+            location->altitudeMillimetres,
             latPrefix, latWhole, latFraction,
             longPrefix, longWhole, longFraction,
-            location.radiusMillimetres,
-            location.speedMillimetresPerSecond,
-            location.timeUtc);
+            location->radiusMillimetres,
+            location->speedMillimetresPerSecond,
+            location->timeUtc);
+
+    return length < 0 || (size_t)length >= size ? 0 : length;
+}
+
+/// @brief Encodes a location fix as CBOR, with the same keys as the JSON.
+///        The latitude and longitude are decimal fractions, so they keep
+///        the 7 decimal places of the JSON.
+static size_t encodeLocationCbor(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const locationFix_t *fix = (const locationFix_t *)pData;
+    const uLocation_t *location = &fix->location;
+
+    char utcTime[24];
+    snprintf(utcTime, sizeof(utcTime), "%lld", (long long)location->timeUtc);
+
+    cborEncoder_t encoder;
+    cborInit(&encoder, pBuffer, size);
+    cborMap(&encoder, 2);
+    cborKeyText(&encoder, "Timestamp", fix->timestamp);
+    cborKeyMap(&encoder, "Location", 6);
+        cborKeyInt(&encoder, "Altitude", location->altitudeMillimetres);
+        cborKeyDecimal(&encoder, "Latitude", location->latitudeX1e7, -7);
+        cborKeyDecimal(&encoder, "Longitude", location->longitudeX1e7, -7);
+        cborKeyInt(&encoder, "Accuracy", location->radiusMillimetres);
+        cborKeyInt(&encoder, "Speed", location->speedMillimetresPerSecond);
+        cborKeyText(&encoder, "utcTime", utcTime);
+
+    return cborLength(&encoder);
+}
 
-    writeAlways(jsonBuffer);
-    publishMQTTMessage(topicName, jsonBuffer, U_MQTT_QOS_AT_MOST_ONCE, true);
+static const mqttEncoders_t locationEncoders = {encodeLocationJson, encodeLocationCbor};
+
+/// @brief Message bus handler which publishes a location fix to MQTT
+static void publishLocation(busEventType_t type, const void *pPayload, size_t length, void *pContext)
+{
+    mqttPublishEncoded(topicHandle, &locationEncoders, pPayload, payloadBuffer, sizeof(payloadBuffer),
+                        true, MQTT_LANE_TELEMETRY);
 }
 
 static void getLocation(void *pParams)
 {
     if (uPortMutexTryLock(TASK_MUTEX, 0) == 0) {
-        uLocation_t location;   
+        locationFix_t fix;
         printDebug("Requesting location information...");
-        int32_t errorCode = uLocationGet(*pGnssHandle, U_LOCATION_TYPE_GNSS,
-                                            NULL, NULL, &location, keepGoing);
+        int32_t errorCode;
+        // the GNSS is on the cellular module, so give way to its other users
+        AT_CHANNEL_CALL_PREEMPTIBLE(AT_CLASS_LOCATION,
+                                    errorCode = uLocationGet(*pGnssHandle, U_LOCATION_TYPE_GNSS,
+                                            NULL, NULL, &fix.location, keepGoing));
         if (errorCode == 0) {
-            printDebug("Got location information [%d, %d], publishing", location.latitudeX1e7, location.longitudeX1e7);
-            publishLocation(location);
+            printDebug("Got location information [%d, %d], publishing", fix.location.latitudeX1e7, fix.location.longitudeX1e7);
+            gAppStatus = LOCATION_MEAS;
+            getTimeStamp(fix.timestamp);
+
+            // the MQTT publisher, and any other subscriber, get the fix from the message bus
+            int32_t subscribers = busPublish(BUS_EVENT_LOCATION_FIX, &fix, sizeof(locationFix_t));
+            if (subscribers < 0)
+                writeWarn("Failed to publish the location fix: %d", subscribers);
         } else {
             if (errorCode == U_ERROR_COMMON_TIMEOUT)
                 writeDebug("Timed out getting GNSS location");
@@ -189,7 +232,7 @@ static void getLocation(void *pParams)
 
 static void startGetLocation(void)
 {
-    RUN_FUNC(getLocation, LOCATION_TASK_STACK_SIZE, LOCATION_TASK_PRIORITY);
+    RUN_FUNC(getLocation);
 }
 
 static void queueHandler(void *pParam, size_t paramLengthBytes)
@@ -215,34 +258,17 @@ static void queueHandler(void *pParam, size_t paramLengthBytes)
     }
 }
 
-// Signal Quality task loop for reading the RSRP and RSRQ values
-// and sending these values to the MQTT topic
+// Location task loop for getting the GNSS location and sending it
+// to the MQTT topic. This is run by the scheduler every
+// taskLoopDwellTime seconds.
 static void taskLoop(void *pParameters)
 {
-    while(isNotExiting()) {
-        getLocation(NULL);
-        dwellTask(taskConfig, isNotExiting);
-    }
-
-    FINALIZE_TASK;
+    getLocation(NULL);
 }
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(locationMsg_t),
-                    LOCATION_QUEUE_STACK_SIZE,
-                    LOCATION_QUEUE_PRIORITY,
-                    LOCATION_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create %s event queue %d", TASK_NAME, eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(locationMsg_t));
 }
 
 static int32_t startGNSS(void)
@@ -256,7 +282,8 @@ static int32_t startGNSS(void)
     // set the correct GNSS module type being used
     gNetworkGNSSCfg.moduleType = gnssModuleType;
 
-    errorCode = uNetworkInterfaceUp(*pGnssHandle, U_NETWORK_TYPE_GNSS, &gNetworkGNSSCfg);
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL,
+                    errorCode = uNetworkInterfaceUp(*pGnssHandle, U_NETWORK_TYPE_GNSS, &gNetworkGNSSCfg));
 
     if (errorCode != 0) {
         writeFatal("Failed to bring up the GNSS device: %d", errorCode);
@@ -271,6 +298,16 @@ static int32_t initMutex()
     INIT_MUTEX;
 }
 
+static int32_t initMQTTPublisher()
+{
+    int32_t handle = busSubscribe("LocationMQTT", BUS_EVENT_BIT(BUS_EVENT_LOCATION_FIX),
+                                  publishLocation, NULL, MQTT_PUBLISHER_QUEUE_LENGTH);
+    if (handle < 0)
+        writeFatal("Failed to subscribe the %s MQTT publisher to the message bus: %d", TASK_NAME, handle);
+
+    return handle;
+}
+
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
@@ -283,7 +320,7 @@ int32_t queueLocationNow(commandParamsList_t *params)
     locationMsg_t qMsg;
     qMsg.msgType = GET_LOCATION_NOW;
 
-    return sendAppTaskMessage(TASK_ID, &qMsg, sizeof(locationMsg_t));
+    return sendAppTaskMessage(LOCATION_TASK, &qMsg, sizeof(locationMsg_t));
 }
 
 /// @brief Initialises the Signal Quality task
@@ -298,10 +335,15 @@ int32_t initLocationTask(taskConfig_t *config)
     int32_t result = U_ERROR_COMMON_SUCCESS;
 
     CREATE_TOPIC_NAME;
+    topicHandle = mqttTopicRegister(topicName);
+
+    // only the latest retained value is worth publishing
+    mqttTopicSetPolicy(topicHandle, MQTT_POLICY_KEEP_LATEST);
 
     writeInfo("Initializing the %s task...", TASK_NAME);
     EXIT_ON_FAILURE(initMutex);
     EXIT_ON_FAILURE(initQueue);
+    EXIT_ON_FAILURE(initMQTTPublisher);
 
     result = startGNSS();
     if (result < 0) {
@@ -325,7 +367,7 @@ int32_t startLocationTaskLoop(commandParamsList_t *params)
     if (params != NULL)
         taskConfig->taskLoopDwellTime = getParamValue(params, 1, 5, 60, 30);
 
-    START_TASK_LOOP(LOCATION_TASK_STACK_SIZE, LOCATION_TASK_PRIORITY);
+    SCHEDULE_TASK_LOOP(taskLoop, isNotExiting);
 }
 
 int32_t stopLocationTaskLoop(commandParamsList_t *params)
@@ -54,4 +54,13 @@ typedef struct {
     } msg;
 } locationMsg_t;
 
+/* ----------------------------------------------------------------
+ * MESSAGE BUS EVENT DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A GNSS location fix, published as BUS_EVENT_LOCATION_FIX
+typedef struct {
+    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
+    uLocation_t location;
+} locationFix_t;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,469 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Message Bus - in-process publish/subscribe of typed events between
+ * the appTasks. Each subscriber has a bounded queue of references to
+ * the published events, which is drained on a small shared worker pool,
+ * so a subscriber doesn't need a thread of its own and an event is
+ * only copied once whatever the number of subscribers. The events are
+ * copied in to blocks of a slab pool made when the bus is created, and
+ * only an event which doesn't fit a free block is copied on the heap.
+ *
+ */
+
+#include "common.h"
+#include "workerPool.h"
+#include "slabPool.h"
+#include "messageBus.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define MAX_BUS_SUBSCRIBERS         16
+
+// The bus workers run the subscribers' handlers, which include the
+// appTask command handlers, so the stack must suit the largest one
+#define BUS_WORKERS                 3
+#define BUS_WORKER_STACK_SIZE       (3 * 1024)
+#define BUS_WORKER_PRIORITY         5
+
+// Only one drain job is queued for each subscriber at a time
+#define BUS_JOB_QUEUE_SIZE          MAX_BUS_SUBSCRIBERS
+
+// Events handled before a drain job lets the other subscribers have a worker
+#define BUS_DRAIN_BATCH             4
+
+// Blocks for the events, which are mostly small task commands, with a few
+// larger blocks for the signal samples and location fixes
+#define BUS_EVENT_SMALL_SIZE        64
+#define BUS_EVENT_SMALL_BLOCKS      32
+#define BUS_EVENT_LARGE_SIZE        256
+#define BUS_EVENT_LARGE_BLOCKS      8
+
+// The payload follows the message header, aligned for any type
+#define BUS_MESSAGE_HEADER_SIZE     ((sizeof(busMessage_t) + 7) & ~((size_t)7))
+#define BUS_MESSAGE_PAYLOAD(x)      ((uint8_t *)(x) + BUS_MESSAGE_HEADER_SIZE)
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    busEventType_t type;
+    int32_t refCount;
+    size_t length;
+    slabHandle_t block;         // The event's pool block, or SLAB_NO_HANDLE if it is on the heap
+} busMessage_t;
+
+typedef struct {
+    const char *pName;
+    uint32_t eventMask;
+    busHandler_t handler;
+    void *pContext;
+
+    // ring buffer of events waiting for the handler
+    busMessage_t **ppQueue;
+    int32_t queueLength;
+    int32_t head;
+    int32_t count;
+
+    // true while a drain job is queued or running for this subscriber
+    bool draining;
+
+    busSubscriberStats_t stats;
+} busSubscriber_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+// Protects the subscriber queues and the event reference counts
+static uPortMutexHandle_t busMutex = NULL;
+
+static workerPool_t *busPool = NULL;
+
+static slabPool_t *eventPool = NULL;
+
+// Events copied on the heap as no block was free, or they were too large
+static int32_t heapEvents = 0;
+
+static busSubscriber_t subscribers[MAX_BUS_SUBSCRIBERS];
+static int32_t subscriberCount = 0;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+static busMessage_t *createMessage(busEventType_t type, const void *pPayload, size_t length)
+{
+    size_t size = BUS_MESSAGE_HEADER_SIZE + length;
+    busMessage_t *pMessage = NULL;
+
+    slabHandle_t block = slabAlloc(eventPool, size);
+    if (block >= 0) {
+        pMessage = (busMessage_t *)slabGet(eventPool, block);
+    } else {
+        pMessage = (busMessage_t *)pUPortMalloc(size);
+        if (pMessage == NULL)
+            return NULL;
+
+        U_PORT_MUTEX_LOCK(busMutex);
+        heapEvents++;
+        U_PORT_MUTEX_UNLOCK(busMutex);
+    }
+
+    pMessage->block = block >= 0 ? block : SLAB_NO_HANDLE;
+    pMessage->type = type;
+    pMessage->refCount = 0;
+    pMessage->length = length;
+    if (length > 0)
+        memcpy(BUS_MESSAGE_PAYLOAD(pMessage), pPayload, length);
+
+    return pMessage;
+}
+
+static void freeMessage(busMessage_t *pMessage)
+{
+    if (pMessage->block >= 0)
+        slabFree(eventPool, pMessage->block);
+    else
+        uPortFree(pMessage);
+}
+
+/// @brief Drops a reference to the event, and frees it after the last one
+static void releaseMessage(busMessage_t *pMessage)
+{
+    bool lastReference;
+
+    U_PORT_MUTEX_LOCK(busMutex);
+    lastReference = --pMessage->refCount <= 0;
+    U_PORT_MUTEX_UNLOCK(busMutex);
+
+    if (lastReference)
+        freeMessage(pMessage);
+}
+
+static void drainSubscriber(void *pParam);
+
+/// @brief Queues a drain job for the subscriber if it doesn't have one.
+///        Called with the bus mutex held.
+static void scheduleDrain(busSubscriber_t *pSubscriber)
+{
+    if (pSubscriber->draining)
+        return;
+
+    // if the job isn't accepted, the next event for this subscriber tries again
+    pSubscriber->draining = workerPoolSubmit(busPool, pSubscriber->pName, drainSubscriber, pSubscriber) == 0;
+}
+
+/// @brief Adds a reference to the event to the subscriber's queue.
+///        Called with the bus mutex held.
+/// @return 0 on success, U_ERROR_COMMON_FULL if the queue is full
+static int32_t queueMessage(busSubscriber_t *pSubscriber, busMessage_t *pMessage)
+{
+    if (pSubscriber->count == pSubscriber->queueLength) {
+        pSubscriber->stats.dropped++;
+        return U_ERROR_COMMON_FULL;
+    }
+
+    int32_t tail = (pSubscriber->head + pSubscriber->count) % pSubscriber->queueLength;
+    pSubscriber->ppQueue[tail] = pMessage;
+    pSubscriber->count++;
+    pMessage->refCount++;
+
+    if (pSubscriber->count > pSubscriber->stats.maxQueued)
+        pSubscriber->stats.maxQueued = pSubscriber->count;
+
+    scheduleDrain(pSubscriber);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Bus worker job which passes the subscriber's queued events to its
+///        handler, one at a time. After a batch of events the job is queued
+///        again, so a busy subscriber doesn't hold on to a worker.
+static void drainSubscriber(void *pParam)
+{
+    busSubscriber_t *pSubscriber = (busSubscriber_t *)pParam;
+
+    for (int32_t handled = 0; ; handled++) {
+        busMessage_t *pMessage = NULL;
+
+        U_PORT_MUTEX_LOCK(busMutex);
+        if (pSubscriber->count == 0) {
+            pSubscriber->draining = false;
+        } else if (handled == BUS_DRAIN_BATCH) {
+            pSubscriber->draining = false;
+            scheduleDrain(pSubscriber);
+
+            // carry on with this job if another can't be queued
+            if (!pSubscriber->draining) {
+                pSubscriber->draining = true;
+                handled = 0;
+            }
+        }
+
+        if (pSubscriber->draining && handled < BUS_DRAIN_BATCH) {
+            pMessage = pSubscriber->ppQueue[pSubscriber->head];
+            pSubscriber->head = (pSubscriber->head + 1) % pSubscriber->queueLength;
+            pSubscriber->count--;
+            pSubscriber->stats.delivered++;
+        }
+        U_PORT_MUTEX_UNLOCK(busMutex);
+
+        if (pMessage == NULL)
+            return;
+
+        pSubscriber->handler(pMessage->type, BUS_MESSAGE_PAYLOAD(pMessage), pMessage->length,
+                             pSubscriber->pContext);
+
+        releaseMessage(pMessage);
+    }
+}
+
+static busSubscriber_t *getSubscriber(int32_t handle)
+{
+    if (handle < 0 || handle >= subscriberCount)
+        return NULL;
+
+    return &subscribers[handle];
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the message bus and the workers which run the handlers
+/// @return 0 on success, negative on failure
+int32_t initMessageBus(void)
+{
+    int32_t errorCode = uPortMutexCreate(&busMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the message bus mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    const slabClass_t eventClasses[] = {
+        {BUS_EVENT_SMALL_SIZE, BUS_EVENT_SMALL_BLOCKS},
+        {BUS_EVENT_LARGE_SIZE, BUS_EVENT_LARGE_BLOCKS}
+    };
+
+    heapEvents = 0;
+    errorCode = slabPoolCreate(&eventPool, eventClasses, NUM_ELEMENTS(eventClasses));
+    if (errorCode < 0) {
+        writeFatal("Failed to create the message bus event pool (%d)", errorCode);
+        return errorCode;
+    }
+
+    return workerPoolCreate(&busPool, "MessageBus", BUS_WORKERS, BUS_JOB_QUEUE_SIZE,
+                            BUS_WORKER_STACK_SIZE, BUS_WORKER_PRIORITY);
+}
+
+/// @brief Stops the bus workers and frees any events still queued
+void finalizeMessageBus(void)
+{
+    if (busPool == NULL)
+        return;
+
+    busPrintStats();
+    workerPoolPrintStats(busPool);
+    workerPoolDestroy(busPool);
+    busPool = NULL;
+
+    for (int32_t i=0; i<subscriberCount; i++) {
+        busSubscriber_t *pSubscriber = &subscribers[i];
+        while (pSubscriber->count > 0) {
+            releaseMessage(pSubscriber->ppQueue[pSubscriber->head]);
+            pSubscriber->head = (pSubscriber->head + 1) % pSubscriber->queueLength;
+            pSubscriber->count--;
+        }
+    }
+
+    slabPoolDelete(eventPool);
+    eventPool = NULL;
+}
+
+/// @brief Adds a subscriber to the message bus
+/// @param pName Name of the subscriber, used for logging
+/// @param eventMask The BUS_EVENT_BIT()s of the events published with busPublish()
+///                  which the subscriber receives
+/// @param handler The handler for the events
+/// @param pContext Passed to the handler
+/// @param queueLength The number of events which can wait for the handler
+/// @return The subscriber handle, or negative on failure
+int32_t busSubscribe(const char *pName, uint32_t eventMask, busHandler_t handler,
+                     void *pContext, int32_t queueLength)
+{
+    if (busMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (handler == NULL || queueLength <= 0)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    busMessage_t **ppQueue = (busMessage_t **)pUPortMalloc(sizeof(busMessage_t *) * queueLength);
+    if (ppQueue == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    int32_t handle = U_ERROR_COMMON_NO_MEMORY;
+
+    U_PORT_MUTEX_LOCK(busMutex);
+    if (subscriberCount < MAX_BUS_SUBSCRIBERS) {
+        handle = subscriberCount;
+
+        busSubscriber_t *pSubscriber = &subscribers[handle];
+        memset(pSubscriber, 0, sizeof(busSubscriber_t));
+        pSubscriber->pName = pName;
+        pSubscriber->eventMask = eventMask;
+        pSubscriber->handler = handler;
+        pSubscriber->pContext = pContext;
+        pSubscriber->ppQueue = ppQueue;
+        pSubscriber->queueLength = queueLength;
+
+        subscriberCount++;
+    }
+    U_PORT_MUTEX_UNLOCK(busMutex);
+
+    if (handle < 0) {
+        writeError("Can't subscribe %s to the message bus, already %d subscribers", pName, MAX_BUS_SUBSCRIBERS);
+        uPortFree(ppQueue);
+    }
+
+    return handle;
+}
+
+/// @brief Publishes an event to all the subscribers of its type. The payload
+///        is copied once and shared by the subscribers.
+/// @param type The event type
+/// @param pPayload The event payload
+/// @param length The size of the payload
+/// @return The number of subscribers the event was queued for, or negative on failure
+int32_t busPublish(busEventType_t type, const void *pPayload, size_t length)
+{
+    if (busMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    busMessage_t *pMessage = createMessage(type, pPayload, length);
+    if (pMessage == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    int32_t queued = 0;
+    bool unused;
+
+    U_PORT_MUTEX_LOCK(busMutex);
+    for (int32_t i=0; i<subscriberCount; i++) {
+        busSubscriber_t *pSubscriber = &subscribers[i];
+        if ((pSubscriber->eventMask & BUS_EVENT_BIT(type)) == 0)
+            continue;
+
+        if (queueMessage(pSubscriber, pMessage) == 0)
+            queued++;
+        else
+            printDebug("%s bus queue is full, dropping event type %d", pSubscriber->pName, type);
+    }
+
+    // keep the event if a subscriber's handler is already running with it
+    unused = pMessage->refCount == 0;
+    U_PORT_MUTEX_UNLOCK(busMutex);
+
+    if (unused)
+        freeMessage(pMessage);
+
+    return queued;
+}
+
+/// @brief Sends an event to one subscriber, whatever its event mask
+/// @param handle The subscriber handle
+/// @param type The event type
+/// @param pPayload The event payload, which is copied
+/// @param length The size of the payload
+/// @return 0 on success, U_ERROR_COMMON_FULL if the subscriber's queue is full,
+///         or negative on failure
+int32_t busSend(int32_t handle, busEventType_t type, const void *pPayload, size_t length)
+{
+    busSubscriber_t *pSubscriber = getSubscriber(handle);
+    if (pSubscriber == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    busMessage_t *pMessage = createMessage(type, pPayload, length);
+    if (pMessage == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    int32_t errorCode;
+
+    U_PORT_MUTEX_LOCK(busMutex);
+    errorCode = queueMessage(pSubscriber, pMessage);
+    U_PORT_MUTEX_UNLOCK(busMutex);
+
+    if (errorCode < 0)
+        freeMessage(pMessage);
+
+    return errorCode;
+}
+
+/// @brief Gets the number of events waiting for the subscriber
+/// @param handle The subscriber handle
+/// @return The number of events queued, or negative on failure
+int32_t busGetQueued(int32_t handle)
+{
+    busSubscriber_t *pSubscriber = getSubscriber(handle);
+    if (pSubscriber == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    return pSubscriber->count;
+}
+
+/// @brief Gets a copy of the subscriber's message statistics
+/// @param handle The subscriber handle
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t busGetStats(int32_t handle, busSubscriberStats_t *pStats)
+{
+    busSubscriber_t *pSubscriber = getSubscriber(handle);
+    if (pSubscriber == NULL || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(busMutex);
+    *pStats = pSubscriber->stats;
+    U_PORT_MUTEX_UNLOCK(busMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the message statistics of each subscriber
+void busPrintStats(void)
+{
+    for (int32_t i=0; i<subscriberCount; i++) {
+        busSubscriberStats_t stats;
+        if (busGetStats(i, &stats) < 0 || (stats.delivered == 0 && stats.dropped == 0))
+            continue;
+
+        printInfo("%s bus subscriber: %d events delivered, %d dropped, max %d queued of %d",
+                subscribers[i].pName,
+                stats.delivered,
+                stats.dropped,
+                stats.maxQueued,
+                subscribers[i].queueLength);
+    }
+
+    for (int32_t i=0; i<slabPoolGetClassCount(eventPool); i++) {
+        slabPoolStats_t stats;
+        if (slabPoolGetStats(eventPool, i, &stats) == 0)
+            printInfo("Message bus %d byte events: %d blocks, max %d in use, %d allocated",
+                    stats.size, stats.blocks, stats.highWater, stats.allocs);
+    }
+
+    if (heapEvents > 0)
+        printInfo("Message bus: %d events copied on the heap", heapEvents);
+}
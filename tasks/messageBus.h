@@ -0,0 +1,111 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Message Bus header - in-process publish/subscribe of typed events
+ * between the appTasks
+ *
+ */
+
+#ifndef _MESSAGE_BUS_H_
+#define _MESSAGE_BUS_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+#define BUS_EVENT_BIT(type)     (1UL << (type))
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The types of event on the message bus. The payload of each
+///        event type is defined by the appTask which publishes it.
+typedef enum {
+    BUS_EVENT_TASK_COMMAND,     // A command for one appTask, see sendAppTaskMessage()
+    BUS_EVENT_SIGNAL_SAMPLE,    // signalSample_t from the SignalQuality task
+    BUS_EVENT_LOCATION_FIX,     // locationFix_t from the Location task
+    MAX_BUS_EVENTS
+} busEventType_t;
+
+/// @brief Handles an event from the message bus. The payload is shared with
+///        the other subscribers, so must not be changed, and is only valid
+///        until the handler returns.
+typedef void (*busHandler_t)(busEventType_t type, const void *pPayload, size_t length, void *pContext);
+
+/// @brief Message statistics for a bus subscriber
+typedef struct BusSubscriberStats {
+    int32_t delivered;          // Events passed to the subscriber's handler
+    int32_t dropped;            // Events dropped as the subscriber's queue was full
+    int32_t maxQueued;          // The most events waiting on the subscriber's queue
+} busSubscriberStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the message bus and the workers which run the handlers
+/// @return         0 on success, negative on failure
+int32_t initMessageBus(void);
+
+/// @brief          Stops the bus workers and frees any events still queued
+void finalizeMessageBus(void);
+
+/// @brief              Adds a subscriber to the message bus
+/// @param pName        Name of the subscriber, used for logging
+/// @param eventMask    The BUS_EVENT_BIT()s of the events published with
+///                     busPublish() which the subscriber receives
+/// @param handler      The handler for the events. Each subscriber's events
+///                     are handled one at a time, in the order they were sent.
+/// @param pContext     Passed to the handler
+/// @param queueLength  The number of events which can wait for the handler
+/// @return             The subscriber handle, or negative on failure
+int32_t busSubscribe(const char *pName, uint32_t eventMask, busHandler_t handler,
+                     void *pContext, int32_t queueLength);
+
+/// @brief              Publishes an event to all the subscribers of its type.
+///                     The payload is copied once and shared by the subscribers.
+/// @param type         The event type
+/// @param pPayload     The event payload
+/// @param length       The size of the payload
+/// @return             The number of subscribers the event was queued for,
+///                     or negative on failure
+int32_t busPublish(busEventType_t type, const void *pPayload, size_t length);
+
+/// @brief              Sends an event to one subscriber, whatever its event mask
+/// @param handle       The subscriber handle
+/// @param type         The event type
+/// @param pPayload     The event payload, which is copied
+/// @param length       The size of the payload
+/// @return             0 on success, U_ERROR_COMMON_FULL if the subscriber's
+///                     queue is full, or negative on failure
+int32_t busSend(int32_t handle, busEventType_t type, const void *pPayload, size_t length);
+
+/// @brief              Gets the number of events waiting for the subscriber
+/// @param handle       The subscriber handle
+/// @return             The number of events queued, or negative on failure
+int32_t busGetQueued(int32_t handle);
+
+/// @brief              Gets a copy of the subscriber's message statistics
+/// @param handle       The subscriber handle
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t busGetStats(int32_t handle, busSubscriberStats_t *pStats);
+
+/// @brief              Logs the message statistics of each subscriber
+void busPrintStats(void);
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Batch - each publish is an AT command round trip, which can take
+ * hundreds of milliseconds on Cat-M1 and NB-IoT. The messages of a topic
+ * listed in MQTT_BATCH_TOPICS are collected for a window of time, or
+ * until the batch is full, and are then published as one JSON array. A
+ * topic encoded as CBOR is published as one CBOR array of undefined
+ * length instead, which needs no separators.
+ *
+ */
+
+#include "common.h"
+#include "cbor.h"
+#include "mqttBatch.h"
+#include "mqttPool.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+// The bytes of an MQTT PUBLISH packet which aren't the topic name or the
+// payload: fixed header, topic name length and packet identifier
+#define MQTT_PUBLISH_OVERHEAD           6
+
+// The bytes of an MQTT-SN PUBLISH packet which aren't the payload
+#define MQTTSN_PUBLISH_OVERHEAD         7
+
+// The largest payload the module can publish
+#define MQTT_BATCH_SIZE_MAX             (12 * 1024)
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct MQTT_BATCH {
+    char topic[MQTT_BATCH_TOPIC_LENGTH];
+    int32_t windowMs;
+
+    sendMQTTMsg_t msg;          // The topic, QoS and retain flag of the first message
+    bool cbor;                  // The messages so far are CBOR, not JSON
+    char *pBuffer;              // The messages so far, as an array without its end
+    size_t length;
+    int32_t count;
+    int32_t startTime;          // When the first message was added
+
+    mqttBatchStats_t stats;
+} mqttBatch_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t batchMutex = NULL;
+
+static mqttBatch_t batches[MQTT_BATCH_MAX_TOPICS];
+static int32_t batchCount = 0;
+
+static size_t batchSize = MQTT_BATCH_SIZE_DEFAULT;
+static bool batchMqttSN = false;
+
+static mqttBatchPublish_t publishBatch = NULL;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Frees the pool block of a queued MQTT message
+static void freeMessage(sendMQTTMsg_t *pMsg)
+{
+    mqttPoolFree(pMsg->message);
+}
+
+/// @brief The bytes which start and end an array, and separate its messages.
+///        A CBOR array has no separator.
+static void getArrayBytes(bool cbor, char *pStart, char *pSeparator, char *pEnd)
+{
+    *pStart = cbor ? (char)CBOR_INDEFINITE_ARRAY : '[';
+    *pSeparator = cbor ? 0 : ',';
+    *pEnd = cbor ? (char)CBOR_BREAK : ']';
+}
+
+/// @brief Adds a topic from the MQTT_BATCH_TOPICS list
+/// @param pEntry The "<topic>[:<milliseconds>]" entry
+/// @param length The length of the entry
+/// @param windowMs The window to use if the entry doesn't have one
+static int32_t addTopic(const char *pEntry, size_t length, int32_t windowMs)
+{
+    if (batchCount == MQTT_BATCH_MAX_TOPICS) {
+        writeWarn("Only %d MQTT topics can be batched", MQTT_BATCH_MAX_TOPICS);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    mqttBatch_t *pBatch = &batches[batchCount];
+    memset(pBatch, 0, sizeof(mqttBatch_t));
+
+    const char *pWindow = memchr(pEntry, ':', length);
+    size_t nameLength = pWindow == NULL ? length : (size_t)(pWindow - pEntry);
+    if (nameLength == 0 || nameLength >= MQTT_BATCH_TOPIC_LENGTH) {
+        writeWarn("Invalid MQTT batch topic '%.*s'", (int)length, pEntry);
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+    }
+
+    memcpy(pBatch->topic, pEntry, nameLength);
+    pBatch->windowMs = pWindow == NULL ? windowMs : atoi(pWindow + 1);
+
+    pBatch->pBuffer = pUPortMalloc(batchSize + 1);
+    if (pBatch->pBuffer == NULL) {
+        writeError("Failed to allocate the MQTT batch buffer for %s", pBatch->topic);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    pBatch->stats.pTopic = pBatch->topic;
+    batchCount++;
+
+    writeInfo("Batching MQTT messages on topic %s for %d ms, up to %d bytes",
+                pBatch->topic, pBatch->windowMs, batchSize);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Takes a batch's messages as one message to publish, and empties
+///        the batch. Called with the batchMutex locked.
+/// @return True if there was a batch to publish
+static bool takeBatch(mqttBatch_t *pBatch, sendMQTTMsg_t *pMsg)
+{
+    if (pBatch->count == 0)
+        return false;
+
+    char start, separator, end;
+    getArrayBytes(pBatch->cbor, &start, &separator, &end);
+
+    pBatch->pBuffer[pBatch->length++] = end;
+    pBatch->pBuffer[pBatch->length] = 0;
+
+    *pMsg = pBatch->msg;
+    pMsg->length = pBatch->length;
+    pMsg->message = mqttPoolMemDup(pBatch->pBuffer, pBatch->length + 1);
+    if (pMsg->message < 0) {
+        writeError("No free MQTT pool block for the batch message for %s, dropping %d messages",
+                    pBatch->topic, pBatch->count);
+    } else {
+        // each message after the first saves a publish, a JSON array costs a comma each
+        int32_t publishBytes = batchMqttSN ? MQTTSN_PUBLISH_OVERHEAD :
+                                    MQTT_PUBLISH_OVERHEAD + (int32_t)strlen(mqttTopicName(pMsg->topic));
+        int32_t arrayBytes = pBatch->cbor ? 2 : pBatch->count + 1;
+        pBatch->stats.publishes++;
+        pBatch->stats.bytesSaved += (pBatch->count - 1) * publishBytes - arrayBytes;
+    }
+
+    pBatch->length = 0;
+    pBatch->count = 0;
+
+    return pMsg->message >= 0;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the batched topics from the app.conf file
+/// @param publish The function which publishes a batch
+/// @param mqttSN True if publishing to an MQTT-SN gateway
+/// @return The number of batched topics, or negative on failure
+int32_t initMqttBatch(mqttBatchPublish_t publish, bool mqttSN)
+{
+    const char *pTopics = getConfig("MQTT_BATCH_TOPICS");
+    if (pTopics == NULL)
+        return 0;
+
+    int32_t errorCode = uPortMutexCreate(&batchMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT batch mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    publishBatch = publish;
+    batchMqttSN = mqttSN;
+
+    int32_t windowMs = MQTT_BATCH_WINDOW_DEFAULT;
+    setIntParamFromConfig("MQTT_BATCH_WINDOW", &windowMs);
+
+    int32_t size = MQTT_BATCH_SIZE_DEFAULT;
+    setIntParamFromConfig("MQTT_BATCH_SIZE", &size);
+    if (size < 2 || size > MQTT_BATCH_SIZE_MAX) {
+        writeWarn("MQTT_BATCH_SIZE must be 2 to %d bytes, using %d", MQTT_BATCH_SIZE_MAX, MQTT_BATCH_SIZE_DEFAULT);
+        size = MQTT_BATCH_SIZE_DEFAULT;
+    }
+    batchSize = size;
+
+    const char *pEntry;
+    size_t length;
+    while ((pEntry = nextListEntry(&pTopics, &length)) != NULL)
+        addTopic(pEntry, length, windowMs);
+
+    return batchCount;
+}
+
+/// @brief Logs the batching statistics and drops any batch not published
+void finalizeMqttBatch(void)
+{
+    if (batchMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(batchMutex);
+    for (int32_t i=0; i<batchCount; i++) {
+        mqttBatch_t *pBatch = &batches[i];
+        if (pBatch->count > 0)
+            writeInfo("Dropping %d batched MQTT messages on topic %s", pBatch->count, pBatch->topic);
+
+        if (pBatch->stats.publishes > 0)
+            printInfo("MQTT batch %s: %d messages in %d publishes, %d bytes saved",
+                        pBatch->topic,
+                        pBatch->stats.messages,
+                        pBatch->stats.publishes,
+                        pBatch->stats.bytesSaved);
+
+        uPortFree(pBatch->pBuffer);
+        pBatch->pBuffer = NULL;
+    }
+
+    batchCount = 0;
+    U_PORT_MUTEX_UNLOCK(batchMutex);
+}
+
+/// @brief Finds the batch for a topic, by the last part of the topic name
+/// @param pTopicName The full topic name
+/// @return The batch index, or negative if the topic is not batched
+int32_t mqttBatchFindTopic(const char *pTopicName)
+{
+    if (batchCount == 0 || pTopicName == NULL)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    const char *pName = strrchr(pTopicName, '/');
+    pName = pName == NULL ? pTopicName : pName + 1;
+
+    for (int32_t i=0; i<batchCount; i++) {
+        if (strcmp(batches[i].topic, pName) == 0)
+            return i;
+    }
+
+    return U_ERROR_COMMON_NOT_FOUND;
+}
+
+/// @brief Adds a message to a batch. If the batch is full it is published
+///        first, and a message too large for a batch is published on its
+///        own. The message's memory is then owned by the batch.
+/// @param batch The batch index from mqttBatchFindTopic()
+/// @param msg The message to add
+void mqttBatchAdd(int32_t batch, sendMQTTMsg_t msg)
+{
+    sendMQTTMsg_t fullBatch;
+    bool publishFull = false;
+    bool tooLarge = false;
+    bool dropped = false;
+
+    const char *pMessage = (const char *)mqttPoolGet(msg.message);
+    if (batchMutex == NULL || pMessage == NULL) {
+        freeMessage(&msg);
+        return;
+    }
+
+    size_t length = msg.length;
+    bool cbor = mqttTopicFormat(msg.topic) == MQTT_FORMAT_CBOR;
+
+    char start, separator, end;
+    getArrayBytes(cbor, &start, &separator, &end);
+
+    U_PORT_MUTEX_LOCK(batchMutex);
+    if (batch < 0 || batch >= batchCount) {
+        dropped = true;
+    } else {
+        mqttBatch_t *pBatch = &batches[batch];
+
+        // a message which can't share the batch's publish starts a new batch
+        bool differs = pBatch->count > 0 && (msg.QoS != pBatch->msg.QoS || msg.retain != pBatch->msg.retain);
+        if (differs || pBatch->length + length + 2 > batchSize)
+            publishFull = takeBatch(pBatch, &fullBatch);
+
+        if (length + 2 > batchSize) {
+            // too large to batch, so it is published on its own after the batch
+            tooLarge = true;
+            pBatch->stats.messages++;
+            pBatch->stats.publishes++;
+            pBatch->stats.bytesSaved -= 2;
+        } else {
+            if (pBatch->count == 0) {
+                pBatch->msg = msg;
+                pBatch->msg.message = SLAB_NO_HANDLE;
+                pBatch->cbor = cbor;
+                pBatch->startTime = uPortGetTickTimeMs();
+                pBatch->pBuffer[pBatch->length++] = start;
+            } else if (!cbor) {
+                pBatch->pBuffer[pBatch->length++] = separator;
+            }
+
+            memcpy(pBatch->pBuffer + pBatch->length, pMessage, length);
+            pBatch->length += length;
+            pBatch->count++;
+            pBatch->stats.messages++;
+
+            mqttPoolFree(msg.message);
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(batchMutex);
+
+    if (dropped)
+        freeMessage(&msg);
+
+    if (publishFull)
+        publishBatch(fullBatch);
+
+    if (tooLarge) {
+        // keep the payload an array, like the batches of this topic
+        slabHandle_t array = mqttPoolAlloc(length + 3);
+        if (array < 0) {
+            writeError("No free MQTT pool block for message #%d, dropping it", msg.id);
+            freeMessage(&msg);
+            return;
+        }
+
+        char *pArray = (char *)mqttPoolGet(array);
+        pArray[0] = start;
+        memcpy(pArray + 1, pMessage, length);
+        pArray[length + 1] = end;
+        pArray[length + 2] = 0;
+
+        mqttPoolFree(msg.message);
+        msg.message = array;
+        msg.length = length + 2;
+        publishBatch(msg);
+    }
+}
+
+/// @brief Checks if a batch's window has passed
+/// @return True if a batch is ready to be published
+bool mqttBatchIsDue(void)
+{
+    if (batchMutex == NULL)
+        return false;
+
+    bool due = false;
+    int32_t now = uPortGetTickTimeMs();
+
+    U_PORT_MUTEX_LOCK(batchMutex);
+    for (int32_t i=0; i<batchCount && !due; i++)
+        due = batches[i].count > 0 && now - batches[i].startTime >= batches[i].windowMs;
+    U_PORT_MUTEX_UNLOCK(batchMutex);
+
+    return due;
+}
+
+/// @brief Publishes the batches whose window has passed
+/// @param all True to publish all the batches with messages in them
+void mqttBatchFlush(bool all)
+{
+    if (batchMutex == NULL)
+        return;
+
+    // the batches are published one at a time with the mutex unlocked,
+    // so messages can still be added while the AT command runs
+    for (int32_t i=0; i<MQTT_BATCH_MAX_TOPICS; i++) {
+        sendMQTTMsg_t msg;
+        bool publish = false;
+        int32_t now = uPortGetTickTimeMs();
+
+        U_PORT_MUTEX_LOCK(batchMutex);
+        if (i < batchCount) {
+            mqttBatch_t *pBatch = &batches[i];
+            if (all || now - pBatch->startTime >= pBatch->windowMs)
+                publish = takeBatch(pBatch, &msg);
+        }
+        U_PORT_MUTEX_UNLOCK(batchMutex);
+
+        if (publish)
+            publishBatch(msg);
+    }
+}
+
+/// @brief Gets the number of batched topics
+/// @return The number of batched topics
+int32_t mqttBatchGetCount(void)
+{
+    return batchCount;
+}
+
+/// @brief Gets a copy of a topic's batching statistics
+/// @param batch The batch index, from 0 to mqttBatchGetCount()-1
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttBatchGetStats(int32_t batch, mqttBatchStats_t *pStats)
+{
+    if (batchMutex == NULL || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(batchMutex);
+    if (batch >= 0 && batch < batchCount) {
+        *pStats = batches[batch].stats;
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    U_PORT_MUTEX_UNLOCK(batchMutex);
+
+    return errorCode;
+}
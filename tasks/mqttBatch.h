@@ -0,0 +1,108 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Batch header - coalesces the MQTT messages of a topic into one
+ * JSON or CBOR array publish
+ *
+ */
+
+#ifndef _MQTT_BATCH_H_
+#define _MQTT_BATCH_H_
+
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The maximum number of topics which can be batched
+#define MQTT_BATCH_MAX_TOPICS           8
+
+#define MQTT_BATCH_TOPIC_LENGTH         32
+
+// Default time a batch collects messages for, set with MQTT_BATCH_WINDOW
+// in the app.conf file. Each topic in MQTT_BATCH_TOPICS can have its own
+// window, as "<topic>:<milliseconds>".
+#define MQTT_BATCH_WINDOW_DEFAULT       5000
+
+// Default size limit of a batch's payload, set with MQTT_BATCH_SIZE in
+// the app.conf file
+#define MQTT_BATCH_SIZE_DEFAULT         1024
+
+// How often the MQTT task checks for a batch whose window has passed
+#define MQTT_BATCH_CHECK_MS             500
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// Publishes a batch. The message's memory is then owned by the callee.
+typedef void (*mqttBatchPublish_t)(sendMQTTMsg_t msg);
+
+/// @brief Batching statistics for a topic
+typedef struct MqttBatchStats {
+    const char *pTopic;     // The last part of the topic name, as in MQTT_BATCH_TOPICS
+    int32_t messages;       // Messages added to batches
+    int32_t publishes;      // Batches published
+    int32_t bytesSaved;     // Estimated bytes saved on the air by not publishing each message
+} mqttBatchStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Reads the batched topics from the app.conf file
+/// @param publish      The function which publishes a batch
+/// @param mqttSN       True if publishing to an MQTT-SN gateway, for the
+///                     bytes saved estimate
+/// @return             The number of batched topics, or negative on failure
+int32_t initMqttBatch(mqttBatchPublish_t publish, bool mqttSN);
+
+/// @brief          Logs the batching statistics and drops any batch not published
+void finalizeMqttBatch(void);
+
+/// @brief              Finds the batch for a topic
+/// @param pTopicName   The full topic name
+/// @return             The batch index, or negative if the topic is not batched
+int32_t mqttBatchFindTopic(const char *pTopicName);
+
+/// @brief              Adds a message to a batch. If the batch is full it is
+///                     published first, and a message too large for a batch
+///                     is published on its own. The message's memory is then
+///                     owned by the batch.
+/// @param batch        The batch index from mqttBatchFindTopic()
+/// @param msg          The message to add
+void mqttBatchAdd(int32_t batch, sendMQTTMsg_t msg);
+
+/// @brief              Checks if a batch's window has passed
+/// @return             True if a batch is ready to be published
+bool mqttBatchIsDue(void);
+
+/// @brief              Publishes the batches whose window has passed
+/// @param all          True to publish all the batches with messages in them
+void mqttBatchFlush(bool all);
+
+/// @brief              Gets the number of batched topics
+/// @return             The number of batched topics
+int32_t mqttBatchGetCount(void);
+
+/// @brief              Gets a copy of a topic's batching statistics
+/// @param batch        The batch index, from 0 to mqttBatchGetCount()-1
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttBatchGetStats(int32_t batch, mqttBatchStats_t *pStats);
+
+#endif
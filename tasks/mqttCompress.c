@@ -0,0 +1,253 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Compress - the JSON payloads spend most of their bytes on the key
+ * names, which costs on a metered SIM. The payloads of a topic listed in
+ * MQTT_COMPRESS_TOPICS are compressed with the LZSS codec, using the JSON
+ * keys of MQTT_COMPRESS_DICTIONARY as the history before the payload, and
+ * are published with the MQTT_COMPRESS_MARKER header. A payload which
+ * doesn't get shorter is published as it is.
+ *
+ */
+
+#include "common.h"
+#include "mqttCompress.h"
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct MQTT_COMPRESS_TOPIC {
+    char topic[MQTT_COMPRESS_TOPIC_LENGTH];
+
+    mqttCompressStats_t stats;
+} mqttCompressTopic_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t compressMutex = NULL;
+
+static mqttCompressTopic_t topics[MQTT_COMPRESS_MAX_TOPICS];
+static int32_t topicCount = 0;
+
+static size_t minLength = MQTT_COMPRESS_MIN_DEFAULT;
+
+static const uint8_t dictionary[] = MQTT_COMPRESS_DICTIONARY;
+
+// only allocated when a topic is compressed
+static lzssWork_t *pWork = NULL;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Adds a topic from the MQTT_COMPRESS_TOPICS list
+/// @param pEntry The topic
+/// @param length The length of the entry
+static int32_t addTopic(const char *pEntry, size_t length)
+{
+    if (topicCount == MQTT_COMPRESS_MAX_TOPICS) {
+        writeWarn("Only %d MQTT topics can be compressed", MQTT_COMPRESS_MAX_TOPICS);
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    if (length >= MQTT_COMPRESS_TOPIC_LENGTH) {
+        writeWarn("Invalid MQTT compress topic '%.*s'", (int)length, pEntry);
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+    }
+
+    mqttCompressTopic_t *pTopic = &topics[topicCount];
+    memset(pTopic, 0, sizeof(mqttCompressTopic_t));
+    memcpy(pTopic->topic, pEntry, length);
+    pTopic->stats.pTopic = pTopic->topic;
+    topicCount++;
+
+    writeInfo("Compressing MQTT messages on topic %s of %d bytes or more", pTopic->topic, minLength);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the compressed topics from the app.conf file
+/// @return The number of compressed topics, or negative on failure
+int32_t initMqttCompress(void)
+{
+    const char *pTopics = getConfig("MQTT_COMPRESS_TOPICS");
+    if (pTopics == NULL)
+        return 0;
+
+    int32_t errorCode = uPortMutexCreate(&compressMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT compress mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    int32_t length = MQTT_COMPRESS_MIN_DEFAULT;
+    setIntParamFromConfig("MQTT_COMPRESS_MIN", &length);
+    if (length < MQTT_COMPRESS_HEADER_LENGTH + 1) {
+        writeWarn("MQTT_COMPRESS_MIN must be more than %d bytes, using %d",
+                    MQTT_COMPRESS_HEADER_LENGTH, MQTT_COMPRESS_MIN_DEFAULT);
+        length = MQTT_COMPRESS_MIN_DEFAULT;
+    }
+    minLength = length;
+
+    pWork = (lzssWork_t *)pUPortMalloc(sizeof(lzssWork_t));
+    if (pWork == NULL) {
+        writeError("Failed to allocate the MQTT compress buffer");
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    const char *pEntry;
+    size_t entryLength;
+    while ((pEntry = nextListEntry(&pTopics, &entryLength)) != NULL)
+        addTopic(pEntry, entryLength);
+
+    if (topicCount == 0) {
+        uPortFree(pWork);
+        pWork = NULL;
+    }
+
+    return topicCount;
+}
+
+/// @brief Logs the compression statistics and frees the codec's buffer
+void finalizeMqttCompress(void)
+{
+    if (compressMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(compressMutex);
+    for (int32_t i=0; i<topicCount; i++) {
+        mqttCompressStats_t *pStats = &topics[i].stats;
+        if (pStats->compressed > 0)
+            printInfo("MQTT compress %s: %d messages compressed from %d to %d bytes, %d not compressed",
+                        pStats->pTopic,
+                        pStats->compressed,
+                        pStats->bytesIn,
+                        pStats->bytesOut,
+                        pStats->skipped);
+    }
+
+    topicCount = 0;
+    uPortFree(pWork);
+    pWork = NULL;
+    U_PORT_MUTEX_UNLOCK(compressMutex);
+}
+
+/// @brief Finds the compressed topic entry for a topic, by the last part of
+///        the topic name
+/// @param pTopicName The full topic name
+/// @return The entry's index, or negative if the topic is not compressed
+int32_t mqttCompressFindTopic(const char *pTopicName)
+{
+    if (topicCount == 0 || pTopicName == NULL)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    const char *pName = strrchr(pTopicName, '/');
+    pName = pName == NULL ? pTopicName : pName + 1;
+
+    for (int32_t i=0; i<topicCount; i++) {
+        if (strcmp(topics[i].topic, pName) == 0)
+            return i;
+    }
+
+    return U_ERROR_COMMON_NOT_FOUND;
+}
+
+/// @brief Compresses a payload in to the caller's buffer, if it is long
+///        enough and gets shorter
+/// @param index The entry's index from mqttCompressFindTopic()
+/// @param pMessage The payload
+/// @param pLength The length of the payload, set to the length of the payload to publish
+/// @param pBuffer The buffer for the compressed payload, kept by the caller until it is published
+/// @param bufferSize The size of the buffer
+/// @return The payload to publish, pBuffer or pMessage if it wasn't compressed
+const char *mqttCompressPayload(int32_t index, const char *pMessage, size_t *pLength,
+                                uint8_t *pBuffer, size_t bufferSize)
+{
+    const char *pPayload = pMessage;
+    size_t length = *pLength;
+
+    if (compressMutex == NULL || pBuffer == NULL)
+        return pPayload;
+
+    U_PORT_MUTEX_LOCK(compressMutex);
+    if (index >= 0 && index < topicCount && pWork != NULL) {
+        size_t compressedLength = 0;
+
+        // giving the codec one byte less than the payload stops it as soon
+        // as it is no shorter, so it always fits a buffer the payload fits
+        if (length >= minLength && length <= bufferSize)
+            compressedLength = lzssCompress(pWork,
+                                            dictionary, sizeof(dictionary) - 1,
+                                            (const uint8_t *)pMessage, length,
+                                            pBuffer + MQTT_COMPRESS_HEADER_LENGTH,
+                                            length - MQTT_COMPRESS_HEADER_LENGTH - 1);
+
+        mqttCompressStats_t *pStats = &topics[index].stats;
+        if (compressedLength > 0) {
+            pBuffer[0] = MQTT_COMPRESS_MARKER;
+            pBuffer[1] = MQTT_COMPRESS_VERSION;
+            pBuffer[2] = (uint8_t)(length >> 8);
+            pBuffer[3] = (uint8_t)length;
+
+            pPayload = (const char *)pBuffer;
+            *pLength = compressedLength + MQTT_COMPRESS_HEADER_LENGTH;
+
+            pStats->compressed++;
+            pStats->bytesIn += length;
+            pStats->bytesOut += *pLength;
+        } else {
+            pStats->skipped++;
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(compressMutex);
+
+    return pPayload;
+}
+
+/// @brief Gets the number of compressed topics
+/// @return The number of compressed topics
+int32_t mqttCompressGetCount(void)
+{
+    return topicCount;
+}
+
+/// @brief Gets a copy of a topic's compression statistics
+/// @param index The entry's index, from 0 to mqttCompressGetCount()-1
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttCompressGetStats(int32_t index, mqttCompressStats_t *pStats)
+{
+    int32_t errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
+
+    if (compressMutex == NULL || pStats == NULL)
+        return errorCode;
+
+    U_PORT_MUTEX_LOCK(compressMutex);
+    if (index >= 0 && index < topicCount) {
+        *pStats = topics[index].stats;
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    U_PORT_MUTEX_UNLOCK(compressMutex);
+
+    return errorCode;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Compress header - compresses the payloads of the topics listed in
+ * MQTT_COMPRESS_TOPICS before they are published
+ *
+ */
+
+#ifndef _MQTT_COMPRESS_H_
+#define _MQTT_COMPRESS_H_
+
+#include "lzss.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The maximum number of topics which can be compressed
+#define MQTT_COMPRESS_MAX_TOPICS        8
+
+#define MQTT_COMPRESS_TOPIC_LENGTH      32
+
+// The largest payload the module can publish, and so the size of the
+// buffer for the compressed payload
+#define MQTT_COMPRESS_PAYLOAD_MAX       (12 * 1024)
+
+// Default shortest payload which is compressed, set with MQTT_COMPRESS_MIN
+// in the app.conf file
+#define MQTT_COMPRESS_MIN_DEFAULT       128
+
+// A compressed payload starts with this header. The marker byte is never
+// in UTF-8 text, so it can't be the start of a JSON payload. The version
+// is changed whenever the dictionary or the codec is, as the subscriber
+// has to decompress with the same ones. The length of the payload before
+// it was compressed follows, most significant byte first.
+#define MQTT_COMPRESS_MARKER            0xFF
+#define MQTT_COMPRESS_VERSION           1
+#define MQTT_COMPRESS_HEADER_LENGTH     4
+
+// The dictionary shared with the subscribers, the JSON the tasks publish
+// with the values left out. The messages published most are last, as a
+// match near the end of the dictionary is still in the window for the
+// whole message.
+#define MQTT_COMPRESS_DICTIONARY                                                    \
+    "{\"Count\":0,\"AvgMs\":0,\"MaxMs\":0,\"Hist\":[0,0,0,0,0,0,0,0]},"             \
+    "{\"Name\":\"\",\"Loops\":,\"Ubxlib\":,\"QueueHWM\":,\"QueueSize\":,"           \
+    "\"SendFails\":0,\"PubQueued\":,\"PubDropped\":0},\"Topic\":\"\",\"Messages\":" \
+    "{\"Timestamp\":\"\", \"Module\":{\"Manufacturer\":\"u-blox\", \"Model\":\"\", "\
+    "\"Version\":\"\"},\"SIM\":{\"IMSI\":\"\", \"CCID\":\"\"},"                     \
+    "\"Application\":{\"NetworkUpCounter\":}}"                                      \
+    "{\"Timestamp\":\"\", \"Location\":{\"Altitude\":, \"Latitude\":, "             \
+    "\"Longitude\":, \"Accuracy\":, \"Speed\":, \"utcTime\":\"\"}}"                 \
+    "[{\"Timestamp\":\"\", \"CellScan\":{\"Name\":\"\", \"ubxlibRAT\":\"\", "       \
+    "\"MCCMNC\":\"\"}},"                                                            \
+    "{\"Timestamp\":\"00:00:00.000\", \"CellQuality\":{\"RSRP\":-, \"RSRQ\":-, "    \
+    "\"RSSI\":-, \"SNR\":, \"RxQual\":}, \"CellInfo\":{\"LogicalCellID\":\"0x0"     \
+    "\", \"PhysicalCellID\":, \"EARFCN\":, \"PLMN\":, \"Operator\":\"\"}}"
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Compression statistics for a topic
+typedef struct MqttCompressStats {
+    const char *pTopic;     // The last part of the topic name, as in MQTT_COMPRESS_TOPICS
+    int32_t compressed;     // Payloads published compressed
+    int32_t skipped;        // Payloads too short, or which didn't get shorter
+    int32_t bytesIn;        // Bytes of the compressed payloads before compressing
+    int32_t bytesOut;       // Bytes of the compressed payloads, with the header
+} mqttCompressStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Reads the compressed topics from the app.conf file
+/// @return         The number of compressed topics, or negative on failure
+int32_t initMqttCompress(void);
+
+/// @brief          Logs the compression statistics and frees the codec's buffer
+void finalizeMqttCompress(void);
+
+/// @brief              Finds the compressed topic entry for a topic
+/// @param pTopicName   The full topic name
+/// @return             The entry's index, or negative if the topic is not compressed
+int32_t mqttCompressFindTopic(const char *pTopicName);
+
+/// @brief              Compresses a payload in to the caller's buffer, if it
+///                     is long enough and gets shorter
+/// @param index        The entry's index from mqttCompressFindTopic()
+/// @param pMessage     The payload
+/// @param pLength      The length of the payload, set to the length of
+///                     the payload to publish
+/// @param pBuffer      The buffer for the compressed payload, which the
+///                     caller keeps until the payload is published
+/// @param bufferSize   The size of the buffer, up to MQTT_COMPRESS_PAYLOAD_MAX
+/// @return             The payload to publish, pBuffer or pMessage if it
+///                     wasn't compressed
+const char *mqttCompressPayload(int32_t index, const char *pMessage, size_t *pLength,
+                                uint8_t *pBuffer, size_t bufferSize);
+
+/// @brief              Gets the number of compressed topics
+/// @return             The number of compressed topics
+int32_t mqttCompressGetCount(void);
+
+/// @brief              Gets a copy of a topic's compression statistics
+/// @param index        The entry's index, from 0 to mqttCompressGetCount()-1
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttCompressGetStats(int32_t index, mqttCompressStats_t *pStats);
+
+#endif
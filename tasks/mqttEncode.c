@@ -0,0 +1,188 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Encode - each task which publishes has a JSON and a CBOR encoder
+ * for its message, with the same keys and values, and the topic's format
+ * picks which is used. A message which doesn't fit the task's buffer is
+ * not published, instead of being cut short. The encoding is timed, and
+ * every MQTT_ENCODE_COMPARE_EVERY messages are also encoded in the other
+ * format once published, so the Metrics topic can show what CBOR saves
+ * over JSON, whichever the topic uses.
+ *
+ */
+
+#include "common.h"
+#include "mqttEncode.h"
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t encodeMutex = NULL;
+
+static mqttEncodeStats_t topicStats[MQTT_MAX_TOPICS];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Gets a topic's statistics, or NULL if the handle isn't valid
+static mqttEncodeStats_t *getStats(mqttTopicHandle_t topic)
+{
+    if (topic < 0 || topic >= MQTT_MAX_TOPICS)
+        return NULL;
+
+    return &topicStats[topic];
+}
+
+/// @brief Runs an encoder
+/// @return The length, or 0 if it doesn't fit the buffer
+static size_t timedEncode(mqttEncoder_t encode, const void *pData, uint8_t *pBuffer, size_t size, int32_t *pUs)
+{
+    int64_t startUs = getTimeUs();
+    size_t length = encode(pData, pBuffer, size);
+    *pUs = (int32_t)(getTimeUs() - startUs);
+
+    return length;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the encoding statistics, before the tasks are initialised
+/// @return 0 on success, negative on failure
+int32_t initMqttEncode(void)
+{
+    memset(topicStats, 0, sizeof(topicStats));
+
+    int32_t errorCode = uPortMutexCreate(&encodeMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT encode mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the encoding statistics and frees them
+void finalizeMqttEncode(void)
+{
+    if (encodeMutex == NULL)
+        return;
+
+    for (mqttTopicHandle_t topic=0; topic<mqttTopicGetCount(); topic++) {
+        mqttEncodeStats_t *pStats = &topicStats[topic];
+        if (pStats->compared > 0)
+            printInfo("MQTT %s: %d %s messages, compared %d as JSON %d bytes %d us, as CBOR %d bytes %d us",
+                        mqttTopicName(topic),
+                        pStats->messages,
+                        mqttTopicFormat(topic) == MQTT_FORMAT_CBOR ? "CBOR" : "JSON",
+                        pStats->compared,
+                        pStats->jsonBytes,
+                        pStats->jsonUs,
+                        pStats->cborBytes,
+                        pStats->cborUs);
+    }
+
+    uPortMutexDelete(encodeMutex);
+    encodeMutex = NULL;
+}
+
+/// @brief Encodes a message in the format of its topic, JSON or CBOR, and
+///        publishes it with the topic's QoS
+/// @param topic The topic's handle
+/// @param pEncoders The task's encoders
+/// @param pData The task's data, passed to the encoder
+/// @param pBuffer The buffer to encode in to, which the message is copied from
+/// @param size The size of the buffer
+/// @param retain A flag to indicate whether the message is to be retained
+/// @param lane The priority lane the message waits on
+/// @return 0 on success, U_ERROR_COMMON_TOO_BIG if the message doesn't fit
+///         the buffer, or negative on failure
+int32_t mqttPublishEncoded(mqttTopicHandle_t topic, const mqttEncoders_t *pEncoders, const void *pData,
+                           uint8_t *pBuffer, size_t size, bool retain, mqttLane_t lane)
+{
+    mqttEncodeStats_t *pStats = getStats(topic);
+    if (encodeMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (pStats == NULL || pEncoders == NULL || pEncoders->json == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    bool cbor = mqttTopicFormat(topic) == MQTT_FORMAT_CBOR && pEncoders->cbor != NULL;
+
+    int32_t us;
+    size_t length = timedEncode(cbor ? pEncoders->cbor : pEncoders->json, pData, pBuffer, size, &us);
+    if (length == 0) {
+        writeWarn("%s message for %s is larger than %d bytes, not publishing",
+                    cbor ? "CBOR" : "JSON", mqttTopicName(topic), size);
+        U_PORT_MUTEX_LOCK(encodeMutex);
+        pStats->tooLarge++;
+        U_PORT_MUTEX_UNLOCK(encodeMutex);
+        return U_ERROR_COMMON_TOO_BIG;
+    }
+
+    if (cbor)
+        writeDebug("Publishing %d byte CBOR message on %s", length, mqttTopicName(topic));
+    else
+        writeAlways((const char *)pBuffer);
+
+    int32_t errorCode = publishMQTTDataToTopic(topic, pBuffer, length, mqttTopicQoS(topic), retain, lane);
+
+    bool compare = false;
+    U_PORT_MUTEX_LOCK(encodeMutex);
+    compare = pStats->messages % MQTT_ENCODE_COMPARE_EVERY == 0;
+    pStats->messages++;
+    pStats->bytes += length;
+    pStats->encodeUs += us;
+    U_PORT_MUTEX_UNLOCK(encodeMutex);
+
+    // the message has been copied, so the buffer is free to encode in again
+    if (compare && pEncoders->cbor != NULL) {
+        int32_t otherUs;
+        size_t otherLength = timedEncode(cbor ? pEncoders->json : pEncoders->cbor, pData, pBuffer, size, &otherUs);
+        if (otherLength > 0) {
+            U_PORT_MUTEX_LOCK(encodeMutex);
+            pStats->compared++;
+            pStats->jsonBytes += cbor ? otherLength : length;
+            pStats->jsonUs += cbor ? otherUs : us;
+            pStats->cborBytes += cbor ? length : otherLength;
+            pStats->cborUs += cbor ? us : otherUs;
+            U_PORT_MUTEX_UNLOCK(encodeMutex);
+        }
+    }
+
+    return errorCode;
+}
+
+/// @brief Gets a copy of a topic's encoding statistics
+/// @param topic The topic's handle
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttEncodeGetStats(mqttTopicHandle_t topic, mqttEncodeStats_t *pStats)
+{
+    mqttEncodeStats_t *pTopicStats = getStats(topic);
+    if (encodeMutex == NULL || pTopicStats == NULL || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(encodeMutex);
+    *pStats = *pTopicStats;
+    U_PORT_MUTEX_UNLOCK(encodeMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Encode header - encodes a task's message as JSON or CBOR, as set
+ * for its topic, and publishes it
+ *
+ */
+
+#ifndef _MQTT_ENCODE_H_
+#define _MQTT_ENCODE_H_
+
+#include "cbor.h"
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Every this many messages of a topic are also encoded in the format the
+// topic doesn't use, to compare the sizes and encoding times
+#define MQTT_ENCODE_COMPARE_EVERY       10
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// Encodes a task's data in to a buffer, returning the length, or 0 if
+/// it doesn't fit. A JSON encoder also writes the string's terminator.
+typedef size_t (*mqttEncoder_t)(const void *pData, uint8_t *pBuffer, size_t size);
+
+/// @brief The encoders of a task's message, with the same keys and values
+typedef struct {
+    mqttEncoder_t json;
+    mqttEncoder_t cbor;
+} mqttEncoders_t;
+
+/// @brief Encoding statistics for a topic
+typedef struct MqttEncodeStats {
+    int32_t messages;           // Messages encoded in the topic's format
+    int32_t bytes;              // Their total length
+    int32_t encodeUs;           // Their total encoding time
+    int32_t tooLarge;           // Messages which didn't fit the task's buffer
+
+    int32_t compared;           // Messages also encoded in the other format
+    int32_t jsonBytes;          // Total length of the compared messages as JSON
+    int32_t cborBytes;          // ...and as CBOR
+    int32_t jsonUs;             // Total encoding time of the compared messages as JSON
+    int32_t cborUs;             // ...and as CBOR
+} mqttEncodeStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the encoding statistics, before the tasks are
+///                 initialised
+/// @return         0 on success, negative on failure
+int32_t initMqttEncode(void);
+
+/// @brief          Logs the encoding statistics and frees them
+void finalizeMqttEncode(void);
+
+/// @brief              Encodes a message in the format of its topic, JSON or
+///                     CBOR, and publishes it with the topic's QoS
+/// @param topic        The topic's handle
+/// @param pEncoders    The task's encoders
+/// @param pData        The task's data, passed to the encoder
+/// @param pBuffer      The buffer to encode in to, which the message is
+///                     copied from
+/// @param size         The size of the buffer
+/// @param retain       A flag to indicate whether the message is to be retained
+/// @param lane         The priority lane the message waits on
+/// @return             0 on success, U_ERROR_COMMON_TOO_BIG if the message
+///                     doesn't fit the buffer, or negative on failure
+int32_t mqttPublishEncoded(mqttTopicHandle_t topic, const mqttEncoders_t *pEncoders, const void *pData,
+                           uint8_t *pBuffer, size_t size, bool retain, mqttLane_t lane);
+
+/// @brief              Gets a copy of a topic's encoding statistics
+/// @param topic        The topic's handle
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttEncodeGetStats(mqttTopicHandle_t topic, mqttEncodeStats_t *pStats);
+
+#endif
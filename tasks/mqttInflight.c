@@ -0,0 +1,375 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT In-flight - a QoS 1 or 2 publish only returns success once the
+ * module has the broker's acknowledgement, so a publish which fails
+ * while the MQTT task is still connected is kept in a small window, by
+ * its message id, and sent again after a back off which doubles each
+ * try. A message which runs out of tries, or is still in the window
+ * when the connection is lost, is handed back to the MQTT task to be
+ * journalled like any other message it couldn't publish.
+ *
+ */
+
+#include "common.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "mqttInflight.h"
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    sendMQTTMsg_t msg;
+    int32_t tries;              // Times the message was sent again
+    int32_t nextTryMs;
+} inflightEntry_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t inflightMutex = NULL;
+
+// the messages in the order they were added, oldest first
+static inflightEntry_t *pWindow = NULL;
+static int32_t windowSize = 0;
+static int32_t inflightCount = 0;
+
+static int32_t retryMs = MQTT_RETRY_MS_DEFAULT;
+static int32_t retryCount = MQTT_RETRY_COUNT_DEFAULT;
+
+static mqttInflightStats_t topicStats[MQTT_MAX_TOPICS];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Gets a topic's statistics, or NULL if the handle isn't valid
+static mqttInflightStats_t *getStats(mqttTopicHandle_t topic)
+{
+    if (topic < 0 || topic >= MQTT_MAX_TOPICS)
+        return NULL;
+
+    return &topicStats[topic];
+}
+
+/// @brief Finds a message in the window. Called with the mutex locked.
+/// @return The message's position, or negative if it isn't in the window
+static int32_t findEntry(int32_t id)
+{
+    for (int32_t i=0; i<inflightCount; i++) {
+        if (pWindow[i].msg.id == id)
+            return i;
+    }
+
+    return U_ERROR_COMMON_NOT_FOUND;
+}
+
+/// @brief Takes a message out of the window. Called with the mutex locked.
+static void removeEntry(int32_t index)
+{
+    inflightCount--;
+    memmove(&pWindow[index], &pWindow[index + 1], sizeof(inflightEntry_t) * (inflightCount - index));
+}
+
+static int32_t getBackOff(int32_t tries)
+{
+    int32_t backOffMs = retryMs;
+    for (int32_t i=0; i<tries && backOffMs < MQTT_RETRY_MAX_MS; i++)
+        backOffMs *= 2;
+
+    return backOffMs < MQTT_RETRY_MAX_MS ? backOffMs : MQTT_RETRY_MAX_MS;
+}
+
+/// @brief Records a message being acknowledged. Called with the mutex locked.
+static void recordDelivery(const sendMQTTMsg_t *pMsg)
+{
+    mqttInflightStats_t *pStats = getStats(pMsg->topic);
+    if (pStats == NULL)
+        return;
+
+    pStats->delivered++;
+    metricsHistogramAdd(&pStats->latency, uPortGetTickTimeMs() - pMsg->queuedMs);
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the window size and retry times from the app.conf file
+/// @return 0 on success, negative on failure
+int32_t initMqttInflight(void)
+{
+    int32_t size = MQTT_INFLIGHT_WINDOW_DEFAULT;
+    setIntParamFromConfig("MQTT_INFLIGHT_WINDOW", &size);
+    setIntParamFromConfig("MQTT_RETRY_MS", &retryMs);
+    setIntParamFromConfig("MQTT_RETRY_COUNT", &retryCount);
+
+    if (size < 0)
+        size = 0;
+
+    if (retryMs <= 0)
+        retryMs = MQTT_RETRY_MS_DEFAULT;
+
+    memset(topicStats, 0, sizeof(topicStats));
+
+    int32_t errorCode = uPortMutexCreate(&inflightMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT in-flight mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    if (size > 0) {
+        pWindow = (inflightEntry_t *)pUPortMalloc(sizeof(inflightEntry_t) * size);
+        if (pWindow == NULL) {
+            writeFatal("Failed to create the MQTT in-flight window");
+            uPortMutexDelete(inflightMutex);
+            inflightMutex = NULL;
+            return U_ERROR_COMMON_NO_MEMORY;
+        }
+
+        writeInfo("MQTT QoS 1 and 2 messages are sent again up to %d times, %d at a time", retryCount, size);
+    }
+
+    windowSize = size;
+    inflightCount = 0;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the delivery statistics and frees the window
+void finalizeMqttInflight(void)
+{
+    if (inflightMutex == NULL)
+        return;
+
+    for (int32_t i=0; i<MQTT_MAX_TOPICS; i++) {
+        mqttInflightStats_t *pStats = &topicStats[i];
+        if (pStats->sent > 0)
+            printInfo("MQTT %s: %d QoS messages sent, %d delivered, %d sent again, %d handed back",
+                        mqttTopicName(i),
+                        pStats->sent,
+                        pStats->delivered,
+                        pStats->retransmits,
+                        pStats->handedBack);
+    }
+
+    uPortMutexDelete(inflightMutex);
+    inflightMutex = NULL;
+
+    uPortFree(pWindow);
+    pWindow = NULL;
+    windowSize = 0;
+    inflightCount = 0;
+}
+
+/// @brief Checks if messages are sent again when they aren't acknowledged
+/// @return True if the window size isn't 0
+bool mqttInflightEnabled(void)
+{
+    return windowSize > 0;
+}
+
+/// @brief Records a message acknowledged the first time it was sent
+/// @param pMsg The message
+void mqttInflightDelivered(const sendMQTTMsg_t *pMsg)
+{
+    if (inflightMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    mqttInflightStats_t *pStats = getStats(pMsg->topic);
+    if (pStats != NULL)
+        pStats->sent++;
+
+    recordDelivery(pMsg);
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+}
+
+/// @brief Keeps a message which wasn't acknowledged, to send it again
+/// @param pMsg The message, which is copied with its pool block
+/// @return 0 on success, U_ERROR_COMMON_FULL if the window is full
+int32_t mqttInflightAdd(const sendMQTTMsg_t *pMsg)
+{
+    if (inflightMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t errorCode = U_ERROR_COMMON_FULL;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    mqttInflightStats_t *pStats = getStats(pMsg->topic);
+    if (pStats != NULL)
+        pStats->sent++;
+
+    if (inflightCount < windowSize) {
+        inflightEntry_t *pEntry = &pWindow[inflightCount++];
+        pEntry->msg = *pMsg;
+        pEntry->tries = 0;
+        pEntry->nextTryMs = uPortGetTickTimeMs() + retryMs;
+
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    } else if (pStats != NULL) {
+        pStats->handedBack++;
+    }
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+
+    return errorCode;
+}
+
+/// @brief Gets the oldest message which is due to be sent again
+/// @param pMsg Where to copy the message
+/// @return True if a message is due
+bool mqttInflightNextDue(sendMQTTMsg_t *pMsg)
+{
+    if (inflightMutex == NULL)
+        return false;
+
+    bool due = false;
+    int32_t nowMs = uPortGetTickTimeMs();
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    for (int32_t i=0; i<inflightCount && !due; i++) {
+        if (nowMs - pWindow[i].nextTryMs >= 0) {
+            *pMsg = pWindow[i].msg;
+            due = true;
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+
+    return due;
+}
+
+/// @brief Records a message being acknowledged after it was sent again,
+///        and takes it out of the window
+/// @param id The message's id
+void mqttInflightAcknowledge(int32_t id)
+{
+    if (inflightMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    int32_t index = findEntry(id);
+    if (index >= 0) {
+        mqttInflightStats_t *pStats = getStats(pWindow[index].msg.topic);
+        if (pStats != NULL)
+            pStats->retransmits++;
+
+        recordDelivery(&pWindow[index].msg);
+        removeEntry(index);
+    }
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+}
+
+/// @brief Records a message not being acknowledged after it was sent again,
+///        backing off before the next try
+/// @param id The message's id
+/// @return True if it will be tried again, false if it was the last try and
+///         the message is taken out of the window
+bool mqttInflightFailed(int32_t id)
+{
+    if (inflightMutex == NULL)
+        return false;
+
+    bool tryAgain = false;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    int32_t index = findEntry(id);
+    if (index >= 0) {
+        inflightEntry_t *pEntry = &pWindow[index];
+        mqttInflightStats_t *pStats = getStats(pEntry->msg.topic);
+        if (pStats != NULL)
+            pStats->retransmits++;
+
+        pEntry->tries++;
+        if (pEntry->tries < retryCount) {
+            pEntry->nextTryMs = uPortGetTickTimeMs() + getBackOff(pEntry->tries);
+            tryAgain = true;
+        } else {
+            if (pStats != NULL)
+                pStats->handedBack++;
+
+            removeEntry(index);
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+
+    return tryAgain;
+}
+
+/// @brief Takes the oldest message out of the window, to hand it back when
+///        disconnected or exiting
+/// @param pMsg Where to copy the message
+/// @return True if there was a message
+bool mqttInflightTakeAny(sendMQTTMsg_t *pMsg)
+{
+    if (inflightMutex == NULL)
+        return false;
+
+    bool taken = false;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    if (inflightCount > 0) {
+        *pMsg = pWindow[0].msg;
+
+        mqttInflightStats_t *pStats = getStats(pMsg->topic);
+        if (pStats != NULL)
+            pStats->handedBack++;
+
+        removeEntry(0);
+        taken = true;
+    }
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+
+    return taken;
+}
+
+/// @brief Gets the number of messages waiting to be acknowledged
+/// @return The number of messages in the window
+int32_t mqttInflightCount(void)
+{
+    return inflightCount;
+}
+
+/// @brief Checks if a message is due to be sent again
+/// @return True if a message is due
+bool mqttInflightIsDue(void)
+{
+    sendMQTTMsg_t msg;
+
+    return inflightCount > 0 && mqttInflightNextDue(&msg);
+}
+
+/// @brief Gets a copy of a topic's delivery statistics
+/// @param topic The topic's handle
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttInflightGetStats(mqttTopicHandle_t topic, mqttInflightStats_t *pStats)
+{
+    if (inflightMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    mqttInflightStats_t *pTopicStats = getStats(topic);
+    if (pTopicStats == NULL || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(inflightMutex);
+    *pStats = *pTopicStats;
+    U_PORT_MUTEX_UNLOCK(inflightMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT In-flight header - the QoS 1 and 2 messages waiting to be
+ * acknowledged, which are sent again until they are
+ *
+ */
+
+#ifndef _MQTT_INFLIGHT_H_
+#define _MQTT_INFLIGHT_H_
+
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Default number of messages which can wait to be sent again, set with
+// MQTT_INFLIGHT_WINDOW in the app.conf file. 0 turns off sending again.
+#define MQTT_INFLIGHT_WINDOW_DEFAULT    4
+
+// Default time before a message is first sent again, doubling for each
+// try after, set with MQTT_RETRY_MS in the app.conf file
+#define MQTT_RETRY_MS_DEFAULT           2000
+
+// Default number of times a message is sent again before it is handed
+// back, set with MQTT_RETRY_COUNT in the app.conf file
+#define MQTT_RETRY_COUNT_DEFAULT        5
+
+// The longest time between sending a message again
+#define MQTT_RETRY_MAX_MS               60000
+
+// How often the MQTT task checks for messages to send again
+#define MQTT_INFLIGHT_CHECK_MS          500
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Delivery statistics of the QoS 1 and 2 messages of a topic
+typedef struct MqttInflightStats {
+    int32_t sent;               // Messages sent the first time
+    int32_t delivered;          // Messages acknowledged
+    int32_t retransmits;        // Times messages were sent again
+    int32_t handedBack;         // Messages not acknowledged after all the tries, or when disconnected
+    latencyHistogram_t latency; // Time from publishing to the acknowledgement
+} mqttInflightStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Reads the window size and retry times from the app.conf file
+/// @return         0 on success, negative on failure
+int32_t initMqttInflight(void);
+
+/// @brief          Logs the delivery statistics and frees the window. Take
+///                 the messages out with mqttInflightTakeAny() first.
+void finalizeMqttInflight(void);
+
+/// @brief          Checks if messages are sent again when they aren't
+///                 acknowledged
+/// @return         True if the window size isn't 0
+bool mqttInflightEnabled(void);
+
+/// @brief              Records a message acknowledged the first time it was sent
+/// @param pMsg         The message
+void mqttInflightDelivered(const sendMQTTMsg_t *pMsg);
+
+/// @brief              Keeps a message which wasn't acknowledged, to send it again
+/// @param pMsg         The message, which is copied with its pool block
+/// @return             0 on success, U_ERROR_COMMON_FULL if the window is full
+int32_t mqttInflightAdd(const sendMQTTMsg_t *pMsg);
+
+/// @brief              Gets the oldest message which is due to be sent again.
+///                     It stays in the window until it is acknowledged or
+///                     fails.
+/// @param pMsg         Where to copy the message
+/// @return             True if a message is due
+bool mqttInflightNextDue(sendMQTTMsg_t *pMsg);
+
+/// @brief              Records a message being acknowledged after it was
+///                     sent again, and takes it out of the window
+/// @param id           The message's id
+void mqttInflightAcknowledge(int32_t id);
+
+/// @brief              Records a message not being acknowledged after it was
+///                     sent again, backing off before the next try
+/// @param id           The message's id
+/// @return             True if it will be tried again, false if it was the
+///                     last try and the message is taken out of the window
+bool mqttInflightFailed(int32_t id);
+
+/// @brief              Takes the oldest message out of the window, to hand
+///                     it back when disconnected or exiting
+/// @param pMsg         Where to copy the message
+/// @return             True if there was a message
+bool mqttInflightTakeAny(sendMQTTMsg_t *pMsg);
+
+/// @brief          Gets the number of messages waiting to be acknowledged
+/// @return         The number of messages in the window
+int32_t mqttInflightCount(void);
+
+/// @brief          Checks if a message is due to be sent again
+/// @return         True if a message is due
+bool mqttInflightIsDue(void);
+
+/// @brief              Gets a copy of a topic's delivery statistics
+/// @param topic        The topic's handle
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttInflightGetStats(mqttTopicHandle_t topic, mqttInflightStats_t *pStats);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Journal - while the network or the broker connection is down,
+ * the MQTT messages are kept in a journal file instead of being dropped.
+ * Once the MQTT task is connected again they are replayed in the order
+ * they were journalled, a few each second so the replay doesn't hold up
+ * the new messages. When the journal is full the oldest messages are
+ * dropped. The journal file survives a crash or restart of the
+ * application, and the messages in it are replayed after it starts.
+ *
+ */
+
+#include "common.h"
+#include "fileSystem.h"
+#include "journal.h"
+#include "mqttJournal.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+// A record is the QoS and retain flag, the terminated topic name and the
+// message, whose length is what is left of the record
+#define RECORD_FLAGS_SIZE           2
+#define RECORD_MAX_TOPIC_SIZE       256
+#define RECORD_MAX_MESSAGE_SIZE     (12 * 1024)
+#define RECORD_MAX_SIZE             (RECORD_FLAGS_SIZE + RECORD_MAX_TOPIC_SIZE + 1 + RECORD_MAX_MESSAGE_SIZE + 1)
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static journal_t *pJournal = NULL;
+static uPortMutexHandle_t journalMutex = NULL;
+
+static int32_t replayRate = MQTT_JOURNAL_RATE_DEFAULT;
+
+// The replayed record, only used by the MQTT task
+static char *pReplayBuffer = NULL;
+
+static int32_t replayed = 0;
+static int32_t replayMs = 0;
+static int32_t backlogStartTime = -1;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Gets the number of records evicted from the journal
+/// @return The number of records evicted
+static int32_t getEvicted(void)
+{
+    journalStats_t stats;
+    journalGetStats(pJournal, &stats);
+
+    return stats.evicted;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Opens the journal file set with MQTT_JOURNAL_FILE in the app.conf
+///        file. The journal is disabled if it isn't set.
+/// @return 0 on success, negative on failure
+int32_t initMqttJournal(void)
+{
+    const char *pFileName = getConfig("MQTT_JOURNAL_FILE");
+    if (pFileName == NULL)
+        return U_ERROR_COMMON_SUCCESS;
+
+    int32_t sizeKb = MQTT_JOURNAL_SIZE_DEFAULT;
+    setIntParamFromConfig("MQTT_JOURNAL_SIZE", &sizeKb);
+
+    setIntParamFromConfig("MQTT_JOURNAL_RATE", &replayRate);
+    if (replayRate <= 0)
+        replayRate = MQTT_JOURNAL_RATE_DEFAULT;
+
+    int32_t errorCode = uPortMutexCreate(&journalMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT journal mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    pReplayBuffer = pUPortMalloc(RECORD_MAX_SIZE + 1);
+    if (pReplayBuffer == NULL) {
+        writeError("Failed to allocate the MQTT journal replay buffer");
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    errorCode = journalOpen(&pJournal, fsPath(pFileName), sizeKb * 1024);
+    if (errorCode < 0) {
+        writeError("Failed to open the MQTT journal %s (%d), messages will not be kept offline",
+                    pFileName, errorCode);
+        uPortFree(pReplayBuffer);
+        pReplayBuffer = NULL;
+        return errorCode;
+    }
+
+    int32_t count = journalCount(pJournal);
+    writeInfo("MQTT journal %s opened, %d kB, %d messages to replay at %d a second",
+                pFileName, sizeKb, count, replayRate);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the journal statistics and closes the journal file
+void finalizeMqttJournal(void)
+{
+    if (pJournal == NULL)
+        return;
+
+    mqttJournalStats_t stats;
+    mqttJournalGetStats(&stats);
+    printInfo("MQTT journal: %d stored, %d evicted, %d replayed in %d ms, %d left in the journal",
+                stats.journal.appended,
+                stats.journal.evicted,
+                stats.replayed,
+                stats.replayMs,
+                stats.journal.records);
+
+    U_PORT_MUTEX_LOCK(journalMutex);
+    journalClose(pJournal);
+    pJournal = NULL;
+    U_PORT_MUTEX_UNLOCK(journalMutex);
+
+    uPortFree(pReplayBuffer);
+    pReplayBuffer = NULL;
+}
+
+/// @brief Checks if the MQTT journal is enabled
+/// @return True if messages can be journalled
+bool mqttJournalEnabled(void)
+{
+    return pJournal != NULL;
+}
+
+/// @brief Keeps a message in the journal, to be replayed later
+/// @param pTopicName The full topic name
+/// @param pMessage The message
+/// @param messageLength The length of the message, which may not be text
+/// @param QoS QoS value for the publishing to use
+/// @param retain If the message is to be retained
+/// @return 0 on success, negative on failure
+int32_t mqttJournalStore(const char *pTopicName, const void *pMessage, size_t messageLength, uMqttQos_t QoS, bool retain)
+{
+    if (pJournal == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (pTopicName == NULL || pMessage == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    size_t topicLength = strlen(pTopicName);
+    if (topicLength > RECORD_MAX_TOPIC_SIZE || messageLength > RECORD_MAX_MESSAGE_SIZE)
+        return U_ERROR_COMMON_TOO_BIG;
+
+    // the record is written from its pieces, without copying the message
+    char flags[RECORD_FLAGS_SIZE] = {(char)QoS, retain ? 1 : 0};
+    journalPart_t parts[] = {
+        {flags, RECORD_FLAGS_SIZE},
+        {pTopicName, topicLength + 1},
+        {pMessage, messageLength}
+    };
+
+    int32_t errorCode = U_ERROR_COMMON_NOT_INITIALISED;
+
+    U_PORT_MUTEX_LOCK(journalMutex);
+    if (pJournal != NULL)
+        errorCode = journalAppendParts(pJournal, parts, NUM_ELEMENTS(parts));
+    U_PORT_MUTEX_UNLOCK(journalMutex);
+
+    if (errorCode < 0)
+        writeWarn("Failed to journal the MQTT message for %s (%d)", pTopicName, errorCode);
+
+    return errorCode;
+}
+
+/// @brief Gets the number of messages waiting in the journal
+/// @return The number of messages
+int32_t mqttJournalCount(void)
+{
+    return journalCount(pJournal);
+}
+
+/// @brief Replays the oldest journalled messages, up to the MQTT_JOURNAL_RATE,
+///        stopping at the first which can't be published
+/// @param publish The function which publishes a message
+/// @return The number of messages replayed
+int32_t mqttJournalReplay(mqttJournalPublish_t publish)
+{
+    int32_t count = 0;
+
+    if (pJournal == NULL || pReplayBuffer == NULL)
+        return 0;
+
+    if (backlogStartTime < 0 && journalCount(pJournal) > 0) {
+        writeInfo("Replaying %d journalled MQTT messages", journalCount(pJournal));
+        backlogStartTime = uPortGetTickTimeMs();
+    }
+
+    while (count < replayRate) {
+        // other tasks journal messages while the record is published, which
+        // can evict it, so it is only consumed if nothing was evicted
+        int32_t length;
+        int32_t evicted;
+        U_PORT_MUTEX_LOCK(journalMutex);
+        length = journalPeek(pJournal, pReplayBuffer, RECORD_MAX_SIZE);
+        // if the journal can't be read at all, try again on the next replay
+        if (length < 0 && journalConsume(pJournal) < 0)
+            length = 0;
+        evicted = getEvicted();
+        U_PORT_MUTEX_UNLOCK(journalMutex);
+
+        if (length == 0)
+            break;
+
+        if (length < 0) {
+            writeWarn("Failed to read the journalled MQTT message (%d), dropping it", length);
+            continue;
+        }
+
+        pReplayBuffer[length] = 0;
+
+        // the topic name is terminated, so the message starts after it
+        const char *pTopicName = pReplayBuffer + RECORD_FLAGS_SIZE;
+        if (length <= RECORD_FLAGS_SIZE ||
+                RECORD_FLAGS_SIZE + strlen(pTopicName) >= (size_t)length) {
+            writeWarn("Journalled MQTT message is not valid, dropping it");
+            U_PORT_MUTEX_LOCK(journalMutex);
+            if (getEvicted() == evicted)
+                journalConsume(pJournal);
+            U_PORT_MUTEX_UNLOCK(journalMutex);
+            continue;
+        }
+
+        const char *pMessage = pTopicName + strlen(pTopicName) + 1;
+        size_t messageLength = pReplayBuffer + length - pMessage;
+        if (publish(pTopicName, pMessage, messageLength, (uMqttQos_t)pReplayBuffer[0], pReplayBuffer[1] != 0) != 0)
+            break;
+
+        U_PORT_MUTEX_LOCK(journalMutex);
+        if (getEvicted() == evicted)
+            journalConsume(pJournal);
+        U_PORT_MUTEX_UNLOCK(journalMutex);
+        count++;
+    }
+
+    U_PORT_MUTEX_LOCK(journalMutex);
+    replayed += count;
+    if (backlogStartTime >= 0 && journalCount(pJournal) == 0) {
+        replayMs += uPortGetTickTimeMs() - backlogStartTime;
+        backlogStartTime = -1;
+        writeInfo("Finished replaying the journalled MQTT messages");
+    }
+    U_PORT_MUTEX_UNLOCK(journalMutex);
+
+    return count;
+}
+
+/// @brief Gets a copy of the journal statistics
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative if the journal is disabled
+int32_t mqttJournalGetStats(mqttJournalStats_t *pStats)
+{
+    if (pJournal == NULL || pStats == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t errorCode = U_ERROR_COMMON_NOT_INITIALISED;
+
+    U_PORT_MUTEX_LOCK(journalMutex);
+    if (pJournal != NULL) {
+        journalGetStats(pJournal, &pStats->journal);
+        pStats->replayed = replayed;
+
+        // a backlog still being replayed counts up to now
+        pStats->replayMs = replayMs;
+        if (backlogStartTime >= 0)
+            pStats->replayMs += uPortGetTickTimeMs() - backlogStartTime;
+
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    U_PORT_MUTEX_UNLOCK(journalMutex);
+
+    return errorCode;
+}
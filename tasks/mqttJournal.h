@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Journal header - keeps the MQTT messages which can't be published
+ * in a journal file, and replays them when the connection is back
+ *
+ */
+
+#ifndef _MQTT_JOURNAL_H_
+#define _MQTT_JOURNAL_H_
+
+#include "journal.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Default size of the journal file in kilobytes, set with
+// MQTT_JOURNAL_SIZE in the app.conf file
+#define MQTT_JOURNAL_SIZE_DEFAULT       64
+
+// Default number of journalled messages replayed each second, set with
+// MQTT_JOURNAL_RATE in the app.conf file
+#define MQTT_JOURNAL_RATE_DEFAULT       5
+
+// How often the journalled messages are replayed
+#define MQTT_JOURNAL_REPLAY_PERIOD_MS   1000
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// Publishes a replayed message, returning 0 on success. The message is
+/// terminated, but may not be text.
+typedef int32_t (*mqttJournalPublish_t)(const char *pTopicName, const char *pMessage, size_t length,
+                                        uMqttQos_t QoS, bool retain);
+
+/// @brief MQTT journal statistics
+typedef struct MqttJournalStats {
+    journalStats_t journal;
+    int32_t replayed;           // Messages replayed and published
+    int32_t replayMs;           // Time taken to replay the backlogs
+} mqttJournalStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Opens the journal file set with MQTT_JOURNAL_FILE in the
+///                 app.conf file. The journal is disabled if it isn't set.
+/// @return         0 on success, negative on failure
+int32_t initMqttJournal(void);
+
+/// @brief          Logs the journal statistics and closes the journal file
+void finalizeMqttJournal(void);
+
+/// @brief          Checks if the MQTT journal is enabled
+/// @return         True if messages can be journalled
+bool mqttJournalEnabled(void);
+
+/// @brief              Keeps a message in the journal, to be replayed later
+/// @param pTopicName   The full topic name
+/// @param pMessage     The message
+/// @param length       The length of the message, which may not be text
+/// @param QoS          QoS value for the publishing to use
+/// @param retain       If the message is to be retained
+/// @return             0 on success, negative on failure
+int32_t mqttJournalStore(const char *pTopicName, const void *pMessage, size_t length, uMqttQos_t QoS, bool retain);
+
+/// @brief          Gets the number of messages waiting in the journal
+/// @return         The number of messages
+int32_t mqttJournalCount(void);
+
+/// @brief              Replays the oldest journalled messages, up to the
+///                     MQTT_JOURNAL_RATE, stopping at the first which
+///                     can't be published
+/// @param publish      The function which publishes a message
+/// @return             The number of messages replayed
+int32_t mqttJournalReplay(mqttJournalPublish_t publish);
+
+/// @brief              Gets a copy of the journal statistics
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative if the journal is disabled
+int32_t mqttJournalGetStats(mqttJournalStats_t *pStats);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Lanes - the messages the tasks publish wait on one of a few
+ * priority lanes, each a ring buffer of its own size, instead of the MQTT
+ * task's message bus queue. A burst on a bulk topic then only fills its
+ * own lane, and the MQTT task always publishes the control messages
+ * first. The message bus only carries a request for the MQTT task to
+ * take the messages off the lanes, and only one is waiting at a time.
+ *
+ * Each topic's policy says what happens when its lane is full: the new
+ * message is rejected, or the oldest message on the lane is dropped to
+ * make room. A keep-latest topic's message also replaces the message of
+ * the topic still waiting on the lane, in its place in the queue, as
+ * only the newest value of the topic is worth publishing.
+ *
+ */
+
+#include "common.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "mqttPool.h"
+#include "mqttLanes.h"
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    sendMQTTMsg_t msg;
+    int32_t queuedMs;
+} laneEntry_t;
+
+typedef struct {
+    laneEntry_t *pEntries;
+    int32_t size;
+    int32_t head;
+    int32_t count;
+
+    mqttLaneStats_t stats;
+} mqttLaneQueue_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t lanesMutex = NULL;
+
+static mqttLaneQueue_t lanes[MQTT_LANE_COUNT];
+
+// true from a request being sent to the MQTT task until it starts
+// taking the messages off the lanes
+static bool wakePending = false;
+
+static const char *laneNames[MQTT_LANE_COUNT] = {"Control", "Telemetry", "Bulk"};
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the comma separated lane sizes, control first
+/// @return 0 on success, negative if the list isn't valid
+static int32_t parseSizes(const char *pList, int32_t *pSizes)
+{
+    int32_t count = 0;
+
+    const char *pEntry;
+    size_t length;
+    while ((pEntry = nextListEntry(&pList, &length)) != NULL) {
+        int size;
+        if (count == MQTT_LANE_COUNT || sscanf(pEntry, "%d", &size) != 1 || size <= 0)
+            return U_ERROR_COMMON_INVALID_PARAMETER;
+
+        pSizes[count++] = size;
+    }
+
+    return count == MQTT_LANE_COUNT ? U_ERROR_COMMON_SUCCESS : U_ERROR_COMMON_INVALID_PARAMETER;
+}
+
+/// @brief Finds the newest message of a topic waiting on a lane, with the
+///        lanes locked
+/// @return The message's entry, or NULL if the topic has none waiting
+static laneEntry_t *findQueued(mqttLaneQueue_t *pLane, mqttTopicHandle_t topic)
+{
+    for (int32_t i=pLane->count-1; i>=0; i--) {
+        laneEntry_t *pEntry = &pLane->pEntries[(pLane->head + i) % pLane->size];
+        if (pEntry->msg.topic == topic)
+            return pEntry;
+    }
+
+    return NULL;
+}
+
+static void freeLanes(void)
+{
+    for (int32_t i=0; i<MQTT_LANE_COUNT; i++) {
+        uPortFree(lanes[i].pEntries);
+        lanes[i].pEntries = NULL;
+    }
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the lanes with the sizes set with MQTT_LANE_SIZES in the
+///        app.conf file
+/// @return 0 on success, negative on failure
+int32_t initMqttLanes(void)
+{
+    int32_t sizes[MQTT_LANE_COUNT];
+
+    const char *pList = getConfig("MQTT_LANE_SIZES");
+    if (pList == NULL || parseSizes(pList, sizes) < 0) {
+        if (pList != NULL)
+            writeWarn("MQTT_LANE_SIZES is not valid, using %s", MQTT_LANE_SIZES_DEFAULT);
+
+        parseSizes(MQTT_LANE_SIZES_DEFAULT, sizes);
+    }
+
+    memset(lanes, 0, sizeof(lanes));
+    for (int32_t i=0; i<MQTT_LANE_COUNT; i++) {
+        lanes[i].pEntries = (laneEntry_t *)pUPortMalloc(sizeof(laneEntry_t) * sizes[i]);
+        if (lanes[i].pEntries == NULL) {
+            writeFatal("Failed to create the MQTT %s lane", laneNames[i]);
+            freeLanes();
+            return U_ERROR_COMMON_NO_MEMORY;
+        }
+
+        lanes[i].size = sizes[i];
+        lanes[i].stats.size = sizes[i];
+    }
+
+    int32_t errorCode = uPortMutexCreate(&lanesMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT lanes mutex (%d)", errorCode);
+        freeLanes();
+        return errorCode;
+    }
+
+    writeInfo("MQTT publish lanes hold %d control, %d telemetry and %d bulk messages",
+                sizes[MQTT_LANE_CONTROL], sizes[MQTT_LANE_TELEMETRY], sizes[MQTT_LANE_BULK]);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Frees the lanes
+void finalizeMqttLanes(void)
+{
+    if (lanesMutex == NULL)
+        return;
+
+    for (int32_t i=0; i<MQTT_LANE_COUNT; i++) {
+        mqttLaneStats_t *pStats = &lanes[i].stats;
+        if (pStats->published > 0 || pStats->dropped > 0 || pStats->evicted > 0)
+            printInfo("MQTT %s lane: %d messages published, %d replaced, %d evicted, %d dropped, max %d queued of %d",
+                        laneNames[i],
+                        pStats->published,
+                        pStats->replaced,
+                        pStats->evicted,
+                        pStats->dropped,
+                        pStats->highWater,
+                        pStats->size);
+    }
+
+    uPortMutexDelete(lanesMutex);
+    lanesMutex = NULL;
+    freeLanes();
+}
+
+/// @brief Queues a message on a lane, following the policy of its topic.
+///        The pool block of a message it replaces or drops is freed.
+/// @param lane The lane
+/// @param pMsg The message, which is copied
+/// @param pWake Set true if the MQTT task needs to be asked to take the
+///        messages off the lanes
+/// @return 0 on success, U_ERROR_COMMON_FULL if the lane is full, or
+///         negative on failure
+int32_t mqttLanePush(mqttLane_t lane, const sendMQTTMsg_t *pMsg, bool *pWake)
+{
+    if (lanesMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (lane < 0 || lane >= MQTT_LANE_COUNT || pMsg == NULL || pWake == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    mqttLaneQueue_t *pLane = &lanes[lane];
+    mqttTopicPolicy_t policy = mqttTopicPolicy(pMsg->topic);
+    slabHandle_t superseded = SLAB_NO_HANDLE;
+    laneEntry_t *pQueued = NULL;
+    int32_t errorCode = U_ERROR_COMMON_FULL;
+
+    U_PORT_MUTEX_LOCK(lanesMutex);
+    if (policy == MQTT_POLICY_KEEP_LATEST)
+        pQueued = findQueued(pLane, pMsg->topic);
+
+    if (pQueued == NULL && pLane->count == pLane->size && policy != MQTT_POLICY_REJECT) {
+        superseded = pLane->pEntries[pLane->head].msg.message;
+        pLane->head = (pLane->head + 1) % pLane->size;
+        pLane->count--;
+        pLane->stats.evicted++;
+    }
+
+    if (pQueued != NULL) {
+        // the request to take the message off the lane is already waiting
+        superseded = pQueued->msg.message;
+        pQueued->msg = *pMsg;
+        pLane->stats.replaced++;
+
+        *pWake = false;
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    } else if (pLane->count < pLane->size) {
+        laneEntry_t *pEntry = &pLane->pEntries[(pLane->head + pLane->count) % pLane->size];
+        pEntry->msg = *pMsg;
+        pEntry->queuedMs = uPortGetTickTimeMs();
+
+        pLane->count++;
+        pLane->stats.queued = pLane->count;
+        if (pLane->count > pLane->stats.highWater)
+            pLane->stats.highWater = pLane->count;
+
+        *pWake = !wakePending;
+        wakePending = true;
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    } else {
+        pLane->stats.dropped++;
+        *pWake = false;
+    }
+    U_PORT_MUTEX_UNLOCK(lanesMutex);
+
+    mqttPoolFree(superseded);
+
+    return errorCode;
+}
+
+/// @brief Takes the oldest message off the highest lane which has one
+/// @param pMsg Where to copy the message
+/// @return True if there was a message
+bool mqttLanePop(sendMQTTMsg_t *pMsg)
+{
+    if (lanesMutex == NULL)
+        return false;
+
+    mqttLaneQueue_t *pLane = NULL;
+    int32_t waitMs = 0;
+
+    U_PORT_MUTEX_LOCK(lanesMutex);
+    for (int32_t i=0; i<MQTT_LANE_COUNT && pLane == NULL; i++) {
+        if (lanes[i].count > 0)
+            pLane = &lanes[i];
+    }
+
+    if (pLane != NULL) {
+        laneEntry_t *pEntry = &pLane->pEntries[pLane->head];
+        *pMsg = pEntry->msg;
+        waitMs = uPortGetTickTimeMs() - pEntry->queuedMs;
+
+        pLane->head = (pLane->head + 1) % pLane->size;
+        pLane->count--;
+        pLane->stats.queued = pLane->count;
+        pLane->stats.published++;
+
+        // under the lanes' mutex, as mqttLaneGetStats() copies it with that
+        metricsHistogramAdd(&pLane->stats.waits, waitMs);
+    }
+    U_PORT_MUTEX_UNLOCK(lanesMutex);
+
+    return pLane != NULL;
+}
+
+/// @brief Marks the MQTT task as taking the messages off the lanes, so the
+///        next message pushed asks it again
+void mqttLaneStartDrain(void)
+{
+    if (lanesMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(lanesMutex);
+    wakePending = false;
+    U_PORT_MUTEX_UNLOCK(lanesMutex);
+}
+
+/// @brief Gets the name of a lane
+/// @param lane The lane
+/// @return The lane's name
+const char *mqttLaneName(mqttLane_t lane)
+{
+    if (lane < 0 || lane >= MQTT_LANE_COUNT)
+        return "Unknown";
+
+    return laneNames[lane];
+}
+
+/// @brief Gets a copy of a lane's statistics
+/// @param lane The lane
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttLaneGetStats(mqttLane_t lane, mqttLaneStats_t *pStats)
+{
+    if (lanesMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (lane < 0 || lane >= MQTT_LANE_COUNT || pStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(lanesMutex);
+    *pStats = lanes[lane].stats;
+    U_PORT_MUTEX_UNLOCK(lanesMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
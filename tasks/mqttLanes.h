@@ -0,0 +1,100 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Lanes header - the priority lanes of the MQTT publish queue
+ *
+ */
+
+#ifndef _MQTT_LANES_H_
+#define _MQTT_LANES_H_
+
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Default number of messages each lane holds, control first, set with
+// MQTT_LANE_SIZES in the app.conf file
+#define MQTT_LANE_SIZES_DEFAULT     "8,16,16"
+
+// The most messages the MQTT task publishes before letting its other
+// queued work run
+#define MQTT_LANE_DRAIN_BATCH       8
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Statistics of a lane
+typedef struct MqttLaneStats {
+    int32_t size;               // The messages the lane holds
+    int32_t queued;             // Messages waiting now
+    int32_t highWater;          // Most messages waiting
+    int32_t published;          // Messages taken off the lane
+    int32_t replaced;           // Messages replaced by a newer message of a keep-latest topic
+    int32_t evicted;            // Oldest messages dropped to make room on the full lane
+    int32_t dropped;            // Messages not queued as the lane was full
+    latencyHistogram_t waits;   // Time the messages waited on the lane
+} mqttLaneStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the lanes with the sizes set with MQTT_LANE_SIZES
+///                 in the app.conf file
+/// @return         0 on success, negative on failure
+int32_t initMqttLanes(void);
+
+/// @brief          Frees the lanes. Any messages left on them are lost, so
+///                 take them off with mqttLanePop() first.
+void finalizeMqttLanes(void);
+
+/// @brief              Queues a message on a lane, following the policy of its
+///                     topic. The pool block of a message it replaces or
+///                     drops is freed.
+/// @param lane         The lane
+/// @param pMsg         The message, which is copied
+/// @param pWake        Set true if the MQTT task needs to be asked to take
+///                     the messages off the lanes, as it hasn't been asked
+///                     since it last started
+/// @return             0 on success, U_ERROR_COMMON_FULL if the lane is full,
+///                     or negative on failure
+int32_t mqttLanePush(mqttLane_t lane, const sendMQTTMsg_t *pMsg, bool *pWake);
+
+/// @brief              Takes the oldest message off the highest lane which
+///                     has one
+/// @param pMsg         Where to copy the message
+/// @return             True if there was a message
+bool mqttLanePop(sendMQTTMsg_t *pMsg);
+
+/// @brief          Marks the MQTT task as taking the messages off the lanes,
+///                 so the next message pushed asks it again
+void mqttLaneStartDrain(void);
+
+/// @brief              Gets the name of a lane
+/// @param lane         The lane
+/// @return             The lane's name
+const char *mqttLaneName(mqttLane_t lane);
+
+/// @brief              Gets a copy of a lane's statistics
+/// @param lane         The lane
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttLaneGetStats(mqttLane_t lane, mqttLaneStats_t *pStats);
+
+#endif
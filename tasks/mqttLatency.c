@@ -0,0 +1,151 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Latency - splits the time from a task publishing a message to it
+ * being sent in two, for each topic: the time the message waits, on its
+ * lane, in a batch or behind other messages, until the MQTT task takes
+ * it, and the time the MQTT client's publish call takes, which is mostly
+ * the modem. A long queue wait with a short publish means the MQTT task
+ * is the bottleneck, and a long publish means the modem or the network
+ * is. The p50, p95 and p99 of each are estimated from the histograms.
+ *
+ */
+
+#include "common.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "mqttLatency.h"
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t latencyMutex = NULL;
+
+static mqttLatencyStats_t topicStats[MQTT_MAX_TOPICS];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static mqttLatencyStats_t *getStats(mqttTopicHandle_t topic)
+{
+    if (topic < 0 || topic >= MQTT_MAX_TOPICS)
+        return NULL;
+
+    return &topicStats[topic];
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the latency statistics
+/// @return 0 on success, negative on failure
+int32_t initMqttLatency(void)
+{
+    memset(topicStats, 0, sizeof(topicStats));
+
+    int32_t errorCode = uPortMutexCreate(&latencyMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT latency mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the percentiles of each topic's latencies
+void finalizeMqttLatency(void)
+{
+    if (latencyMutex == NULL)
+        return;
+
+    for (int32_t i=0; i<MQTT_MAX_TOPICS; i++) {
+        mqttLatencyStats_t *pStats = &topicStats[i];
+        if (pStats->published == 0 && pStats->failed == 0)
+            continue;
+
+        printInfo("MQTT %s: %d published, %d failed, queue wait p50/p95/p99 %d/%d/%d ms, publish p50/p95/p99 %d/%d/%d ms",
+                    mqttTopicName(i),
+                    pStats->published,
+                    pStats->failed,
+                    metricsPercentile(&pStats->queueWait, 50),
+                    metricsPercentile(&pStats->queueWait, 95),
+                    metricsPercentile(&pStats->queueWait, 99),
+                    metricsPercentile(&pStats->publish, 50),
+                    metricsPercentile(&pStats->publish, 95),
+                    metricsPercentile(&pStats->publish, 99));
+    }
+
+    uPortMutexDelete(latencyMutex);
+    latencyMutex = NULL;
+}
+
+/// @brief Records the time a message waited to be published
+/// @param pMsg The message, with the time it was queued
+void mqttLatencyQueueWait(const sendMQTTMsg_t *pMsg)
+{
+    mqttLatencyStats_t *pStats = getStats(pMsg->topic);
+    if (latencyMutex == NULL || pStats == NULL)
+        return;
+
+    // under the mutex, as mqttLatencyGetStats() copies the histograms with it
+    U_PORT_MUTEX_LOCK(latencyMutex);
+    metricsHistogramAdd(&pStats->queueWait, uPortGetTickTimeMs() - pMsg->queuedMs);
+    U_PORT_MUTEX_UNLOCK(latencyMutex);
+}
+
+/// @brief Records the time the MQTT client's publish call took
+/// @param topic The topic published to
+/// @param publishMs The time the call took
+/// @param success True if the publish succeeded
+void mqttLatencyPublish(mqttTopicHandle_t topic, int32_t publishMs, bool success)
+{
+    mqttLatencyStats_t *pStats = getStats(topic);
+    if (latencyMutex == NULL || pStats == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(latencyMutex);
+    if (success)
+        pStats->published++;
+    else
+        pStats->failed++;
+
+    metricsHistogramAdd(&pStats->publish, publishMs);
+    U_PORT_MUTEX_UNLOCK(latencyMutex);
+}
+
+/// @brief Gets a copy of the latency statistics of a topic
+/// @param topic The topic
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttLatencyGetStats(mqttTopicHandle_t topic, mqttLatencyStats_t *pStats)
+{
+    mqttLatencyStats_t *pTopicStats = getStats(topic);
+    if (latencyMutex == NULL || pStats == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (pTopicStats == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    U_PORT_MUTEX_LOCK(latencyMutex);
+    *pStats = *pTopicStats;
+    U_PORT_MUTEX_UNLOCK(latencyMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Latency header - the time each topic's messages wait to be
+ * published, and the time publishing them takes
+ *
+ */
+
+#ifndef _MQTT_LATENCY_H_
+#define _MQTT_LATENCY_H_
+
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Publish latency statistics of a topic
+typedef struct MqttLatencyStats {
+    int32_t published;              // Publishes which succeeded
+    int32_t failed;                 // Publishes which failed
+    latencyHistogram_t queueWait;   // Time from publishMQTTMessage() to the MQTT task publishing it
+    latencyHistogram_t publish;     // Time the MQTT client's publish call takes
+} mqttLatencyStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Creates the latency statistics
+/// @return             0 on success, negative on failure
+int32_t initMqttLatency(void);
+
+/// @brief              Logs the percentiles of each topic's latencies
+void finalizeMqttLatency(void);
+
+/// @brief              Records the time a message waited to be published,
+///                     from when it was queued to the MQTT task taking it
+/// @param pMsg         The message, with the time it was queued
+void mqttLatencyQueueWait(const sendMQTTMsg_t *pMsg);
+
+/// @brief              Records the time the MQTT client's publish call took
+/// @param topic        The topic published to
+/// @param publishMs    The time the call took
+/// @param success      True if the publish succeeded
+void mqttLatencyPublish(mqttTopicHandle_t topic, int32_t publishMs, bool success);
+
+/// @brief              Gets a copy of the latency statistics of a topic
+/// @param topic        The topic
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttLatencyGetStats(mqttTopicHandle_t topic, mqttLatencyStats_t *pStats);
+
+#endif
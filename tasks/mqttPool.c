@@ -0,0 +1,182 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Pool - each message the tasks publish is copied, so the MQTT task
+ * can send it later. The copies come from a slab pool made when the MQTT
+ * task starts, instead of the heap, so publishing doesn't keep
+ * allocating and freeing heap memory.
+ *
+ */
+
+#include "common.h"
+#include "mqttPool.h"
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static slabPool_t *pPool = NULL;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the "<size>:<blocks>" size classes
+/// @return The number of size classes, or negative if the list isn't valid
+static int32_t parseClasses(const char *pList, slabClass_t *pClasses)
+{
+    int32_t count = 0;
+
+    const char *pEntry;
+    size_t length;
+    while ((pEntry = nextListEntry(&pList, &length)) != NULL) {
+        int size, blocks;
+        if (count == SLAB_MAX_CLASSES || sscanf(pEntry, "%d:%d", &size, &blocks) != 2 ||
+                size <= 0 || blocks <= 0)
+            return U_ERROR_COMMON_INVALID_PARAMETER;
+
+        // a block also holds the string's terminator
+        pClasses[count].size = size + 1;
+        pClasses[count].blocks = blocks;
+        count++;
+    }
+
+    return count > 0 ? count : U_ERROR_COMMON_INVALID_PARAMETER;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the pool with the size classes set with MQTT_POOL_CLASSES
+///        in the app.conf file
+/// @return 0 on success, negative on failure
+int32_t initMqttPool(void)
+{
+    slabClass_t classes[SLAB_MAX_CLASSES];
+
+    const char *pList = getConfig("MQTT_POOL_CLASSES");
+    int32_t count = pList == NULL ? U_ERROR_COMMON_NOT_FOUND : parseClasses(pList, classes);
+    if (count < 0) {
+        if (pList != NULL)
+            writeWarn("MQTT_POOL_CLASSES is not valid, using %s", MQTT_POOL_CLASSES_DEFAULT);
+
+        count = parseClasses(MQTT_POOL_CLASSES_DEFAULT, classes);
+    }
+
+    int32_t errorCode = slabPoolCreate(&pPool, classes, count);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT message pool (%d)", errorCode);
+        return errorCode;
+    }
+
+    size_t total = 0;
+    for (int32_t i=0; i<count; i++)
+        total += classes[i].size * classes[i].blocks;
+
+    writeInfo("MQTT message pool has %d size classes, %d bytes", count, total);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the pool statistics and frees the pool
+void finalizeMqttPool(void)
+{
+    if (pPool == NULL)
+        return;
+
+    for (int32_t i=0; i<mqttPoolGetClassCount(); i++) {
+        slabPoolStats_t stats;
+        if (mqttPoolGetStats(i, &stats) == 0)
+            printInfo("MQTT pool %d bytes: %d of %d blocks used at most, %d allocations, %d spilled, %d failed",
+                        stats.size,
+                        stats.highWater,
+                        stats.blocks,
+                        stats.allocs,
+                        stats.spilled,
+                        stats.failures);
+    }
+
+    slabPool_t *pDelete = pPool;
+    pPool = NULL;
+    slabPoolDelete(pDelete);
+}
+
+/// @brief Allocates a block
+/// @param size The bytes needed
+/// @return The block's handle, or negative if no block is free
+slabHandle_t mqttPoolAlloc(size_t size)
+{
+    return slabAlloc(pPool, size);
+}
+
+/// @brief Copies a string in to a block
+/// @param pString The string
+/// @return The block's handle, or negative if no block is free
+slabHandle_t mqttPoolStrDup(const char *pString)
+{
+    return mqttPoolMemDup(pString, strlen(pString) + 1);
+}
+
+/// @brief Copies data in to a block
+/// @param pData The data
+/// @param length The length of the data
+/// @return The block's handle, or negative if no block is free
+slabHandle_t mqttPoolMemDup(const void *pData, size_t length)
+{
+    slabHandle_t handle = slabAlloc(pPool, length);
+    if (handle >= 0)
+        memcpy(slabGet(pPool, handle), pData, length);
+
+    return handle;
+}
+
+/// @brief Gets the memory of a block
+/// @param handle The block's handle
+/// @return The block's memory, or NULL if the handle isn't valid
+void *mqttPoolGet(slabHandle_t handle)
+{
+    return slabGet(pPool, handle);
+}
+
+/// @brief Frees a block. A negative handle is ignored.
+/// @param handle The block's handle
+void mqttPoolFree(slabHandle_t handle)
+{
+    slabFree(pPool, handle);
+}
+
+/// @brief Gets the number of size classes
+/// @return The number of size classes, 0 if there is no pool
+int32_t mqttPoolGetClassCount(void)
+{
+    return slabPoolGetClassCount(pPool);
+}
+
+/// @brief Gets a copy of a size class's statistics, with the size being
+///        the longest string a block holds
+/// @param sizeClass The size class, smallest first
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttPoolGetStats(int32_t sizeClass, slabPoolStats_t *pStats)
+{
+    int32_t errorCode = slabPoolGetStats(pPool, sizeClass, pStats);
+    if (errorCode == 0)
+        pStats->size--;
+
+    return errorCode;
+}
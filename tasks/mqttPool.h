@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Pool header - the slab pool the outgoing MQTT messages are
+ * copied in to
+ *
+ */
+
+#ifndef _MQTT_POOL_H_
+#define _MQTT_POOL_H_
+
+#include "slabPool.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Default size classes of the pool, as "<size>:<blocks>" separated by
+// commas, set with MQTT_POOL_CLASSES in the app.conf file. The size is
+// the longest message a block holds.
+#define MQTT_POOL_CLASSES_DEFAULT   "256:32,1024:16,12288:2"
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the pool with the size classes set with
+///                 MQTT_POOL_CLASSES in the app.conf file
+/// @return         0 on success, negative on failure
+int32_t initMqttPool(void);
+
+/// @brief          Logs the pool statistics and frees the pool
+void finalizeMqttPool(void);
+
+/// @brief              Allocates a block
+/// @param size         The bytes needed
+/// @return             The block's handle, or negative if no block is free
+slabHandle_t mqttPoolAlloc(size_t size);
+
+/// @brief              Copies a string in to a block
+/// @param pString      The string
+/// @return             The block's handle, or negative if no block is free
+slabHandle_t mqttPoolStrDup(const char *pString);
+
+/// @brief              Copies data in to a block
+/// @param pData        The data
+/// @param length       The length of the data
+/// @return             The block's handle, or negative if no block is free
+slabHandle_t mqttPoolMemDup(const void *pData, size_t length);
+
+/// @brief              Gets the memory of a block
+/// @param handle       The block's handle
+/// @return             The block's memory, or NULL if the handle isn't valid
+void *mqttPoolGet(slabHandle_t handle);
+
+/// @brief              Frees a block. A negative handle is ignored.
+/// @param handle       The block's handle
+void mqttPoolFree(slabHandle_t handle);
+
+/// @brief              Gets the number of size classes
+/// @return             The number of size classes, 0 if there is no pool
+int32_t mqttPoolGetClassCount(void);
+
+/// @brief              Gets a copy of a size class's statistics
+/// @param sizeClass    The size class, smallest first
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttPoolGetStats(int32_t sizeClass, slabPoolStats_t *pStats);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Reconnect - the broker connection parameters are read from the
+ * app.conf file once, when the MQTT task is initialised, instead of on
+ * every connection attempt. After a failed attempt the MQTT task waits
+ * a back off which doubles for each failure in a row, up to
+ * MQTT_RECONNECT_MAX_MS, and half of which is random. The random part is
+ * seeded from the client ID, so devices which lost the broker at the
+ * same time spread their attempts out. The time from losing the
+ * connection to connecting again is kept in a histogram.
+ *
+ */
+
+#include "common.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "mqttReconnect.h"
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t reconnectMutex = NULL;
+
+static uMqttClientConnection_t connection = U_MQTT_CLIENT_CONNECTION_DEFAULT;
+
+static int32_t reconnectMs = MQTT_RECONNECT_MS_DEFAULT;
+static int32_t reconnectMaxMs = MQTT_RECONNECT_MAX_MS_DEFAULT;
+
+static int32_t failuresInARow = 0;
+static uint32_t jitterState = 0;
+
+// tick time the connection was lost, if it hasn't been made again yet
+static bool connectionLost = false;
+static int32_t lostTickMs = 0;
+
+static mqttReconnectStats_t reconnectStats;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Seeds the random part of the back off, from the client ID, or
+///        the serial number, and the tick time
+static void seedJitter(void)
+{
+    const char *pId = connection.pClientIdStr != NULL ? connection.pClientIdStr : gModuleSerial;
+
+    // FNV-1a
+    jitterState = 2166136261u;
+    for (const char *p = pId; p != NULL && *p != '\0'; p++)
+        jitterState = (jitterState ^ (uint8_t)*p) * 16777619u;
+
+    jitterState ^= (uint32_t)uPortGetTickTimeMs();
+    if (jitterState == 0)
+        jitterState = 1;
+}
+
+/// @brief Gets the next random number, xorshift32. Called with the mutex locked.
+static uint32_t nextJitter(void)
+{
+    jitterState ^= jitterState << 13;
+    jitterState ^= jitterState >> 17;
+    jitterState ^= jitterState << 5;
+
+    return jitterState;
+}
+
+/// @brief Gets the back off for the failures in a row. Called with the mutex locked.
+static int32_t getBackOff(void)
+{
+    int32_t backOffMs = reconnectMs;
+    for (int32_t i=1; i<failuresInARow && backOffMs < reconnectMaxMs; i++)
+        backOffMs *= 2;
+
+    if (backOffMs > reconnectMaxMs)
+        backOffMs = reconnectMaxMs;
+
+    // half fixed, so a device doesn't try again straight away, and half random
+    return backOffMs / 2 + (int32_t)(nextJitter() % (uint32_t)(backOffMs / 2 + 1));
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Reads the connection parameters and the back off times from the
+///        app.conf file, once
+/// @return 0 on success, negative on failure
+int32_t initMqttReconnect(void)
+{
+    connection.pBrokerNameStr = getConfig("MQTT_BROKER_NAME");
+    connection.pUserNameStr = getConfig("MQTT_USERNAME");
+    connection.pPasswordStr = getConfig("MQTT_PASSWORD");
+    connection.pClientIdStr = getConfig("MQTT_CLIENTID");
+
+    setBoolParamFromConfig("MQTT_TYPE", "MQTT-SN", &connection.mqttSn);
+    setIntParamFromConfig("MQTT_TIMEOUT", &connection.inactivityTimeoutSeconds);
+    setBoolParamFromConfig("MQTT_KEEPALIVE", "TRUE", &connection.keepAlive);
+
+    setIntParamFromConfig("MQTT_RECONNECT_MS", &reconnectMs);
+    setIntParamFromConfig("MQTT_RECONNECT_MAX_MS", &reconnectMaxMs);
+
+    if (reconnectMs <= 0)
+        reconnectMs = MQTT_RECONNECT_MS_DEFAULT;
+
+    if (reconnectMaxMs < reconnectMs)
+        reconnectMaxMs = reconnectMs;
+
+    memset(&reconnectStats, 0, sizeof(reconnectStats));
+    seedJitter();
+
+    int32_t errorCode = uPortMutexCreate(&reconnectMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT reconnect mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the connection statistics
+void finalizeMqttReconnect(void)
+{
+    if (reconnectMutex == NULL)
+        return;
+
+    latencyHistogram_t *pRecovery = &reconnectStats.recovery;
+    printInfo("MQTT connections: %d attempts, %d failed, %d reconnects, average %d ms, longest %d ms",
+                reconnectStats.attempts,
+                reconnectStats.failures,
+                reconnectStats.reconnects,
+                pRecovery->count == 0 ? 0 : pRecovery->totalMs / pRecovery->count,
+                pRecovery->maxMs);
+
+    uPortMutexDelete(reconnectMutex);
+    reconnectMutex = NULL;
+}
+
+/// @brief Gets the connection parameters read by initMqttReconnect()
+/// @return The connection parameters
+const uMqttClientConnection_t *mqttReconnectConnection(void)
+{
+    return &connection;
+}
+
+/// @brief Records the connection being lost, the start of the time to
+///        reconnect. Later calls before connecting again are ignored.
+void mqttReconnectLost(void)
+{
+    if (reconnectMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(reconnectMutex);
+    if (!connectionLost) {
+        connectionLost = true;
+        lostTickMs = uPortGetTickTimeMs();
+    }
+    U_PORT_MUTEX_UNLOCK(reconnectMutex);
+}
+
+/// @brief Records a connection attempt failing
+/// @return The time to wait before the next attempt
+int32_t mqttReconnectFailed(void)
+{
+    int32_t backOffMs = reconnectMs;
+    if (reconnectMutex == NULL)
+        return backOffMs;
+
+    U_PORT_MUTEX_LOCK(reconnectMutex);
+    failuresInARow++;
+    backOffMs = getBackOff();
+
+    reconnectStats.attempts++;
+    reconnectStats.failures++;
+    reconnectStats.backOffMs = backOffMs;
+    U_PORT_MUTEX_UNLOCK(reconnectMutex);
+
+    return backOffMs;
+}
+
+/// @brief Records a connection attempt succeeding, and the time it took to
+///        reconnect if the connection was lost
+void mqttReconnectConnected(void)
+{
+    if (reconnectMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(reconnectMutex);
+    failuresInARow = 0;
+    reconnectStats.attempts++;
+
+    // under the mutex, as mqttReconnectGetStats() copies the histogram with it
+    if (connectionLost) {
+        connectionLost = false;
+        reconnectStats.reconnects++;
+        metricsHistogramAdd(&reconnectStats.recovery, uPortGetTickTimeMs() - lostTickMs);
+    }
+    U_PORT_MUTEX_UNLOCK(reconnectMutex);
+}
+
+/// @brief Records the network coming up waking the MQTT task
+void mqttReconnectNetworkUp(void)
+{
+    if (reconnectMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(reconnectMutex);
+    reconnectStats.networkWakeups++;
+    U_PORT_MUTEX_UNLOCK(reconnectMutex);
+}
+
+/// @brief Gets a copy of the connection statistics
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttReconnectGetStats(mqttReconnectStats_t *pStats)
+{
+    if (reconnectMutex == NULL || pStats == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    U_PORT_MUTEX_LOCK(reconnectMutex);
+    *pStats = reconnectStats;
+    U_PORT_MUTEX_UNLOCK(reconnectMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Reconnect header - the broker connection parameters, and the back
+ * off between failed connections
+ *
+ */
+
+#ifndef _MQTT_RECONNECT_H_
+#define _MQTT_RECONNECT_H_
+
+#include "taskControl.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// Default time to wait after the first failed connection, doubling for
+// each failure after, set with MQTT_RECONNECT_MS in the app.conf file
+#define MQTT_RECONNECT_MS_DEFAULT       1000
+
+// Default longest time to wait between connections, set with
+// MQTT_RECONNECT_MAX_MS in the app.conf file
+#define MQTT_RECONNECT_MAX_MS_DEFAULT   60000
+
+// While the network is down the MQTT task waits for the registration
+// task to say it is up again, and checks this often in case the network
+// becomes available without it saying so
+#define MQTT_NETWORK_CHECK_MS           10000
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Connection statistics of the MQTT task
+typedef struct MqttReconnectStats {
+    int32_t attempts;               // Times the task tried to connect
+    int32_t failures;               // ...and failed
+    int32_t reconnects;             // Connections made after the connection was lost
+    int32_t networkWakeups;         // Times the network coming up woke the task
+    int32_t backOffMs;              // The last wait after a failure
+    latencyHistogram_t recovery;    // Time from losing the connection to connecting again
+} mqttReconnectStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Reads the connection parameters and the back off times
+///                 from the app.conf file, once
+/// @return         0 on success, negative on failure
+int32_t initMqttReconnect(void);
+
+/// @brief          Logs the connection statistics
+void finalizeMqttReconnect(void);
+
+/// @brief          Gets the connection parameters read by initMqttReconnect()
+/// @return         The connection parameters
+const uMqttClientConnection_t *mqttReconnectConnection(void);
+
+/// @brief          Records the connection being lost, the start of the
+///                 time to reconnect. Later calls before connecting again
+///                 are ignored.
+void mqttReconnectLost(void);
+
+/// @brief          Records a connection attempt failing
+/// @return         The time to wait before the next attempt, which doubles
+///                 for each failure in a row, with a random part so a
+///                 fleet of devices which lost the broker together don't
+///                 all connect again at the same time
+int32_t mqttReconnectFailed(void);
+
+/// @brief          Records a connection attempt succeeding, and the time
+///                 it took to reconnect if the connection was lost
+void mqttReconnectConnected(void);
+
+/// @brief          Records the network coming up waking the MQTT task
+void mqttReconnectNetworkUp(void);
+
+/// @brief              Gets a copy of the connection statistics
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttReconnectGetStats(mqttReconnectStats_t *pStats);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Subscriptions - the set of topics the tasks want to subscribe to.
+ * The tasks add their command topics when they are initialised, and the
+ * MQTT task subscribes to all of them each time it connects to the broker
+ * or gateway, as a new session doesn't keep the subscriptions of the last
+ * one. A topic which fails is tried again after MQTT_SUBSCRIBE_RETRY_MS.
+ * The time from connecting to every topic being subscribed to is kept in
+ * a histogram.
+ *
+ * The callbacks subscribed to a topic are found by the topic's handle,
+ * and a command's callback with the subscription's command index. A
+ * subscription is linked in to its topic's list before it is added to
+ * the list's head, and is never removed until the set is freed, so the
+ * MQTT task dispatches the downlink messages without the mutex.
+ *
+ */
+
+#include "common.h"
+#include "nameIndex.h"
+#include "taskControl.h"
+#include "taskMetrics.h"
+#include "mqttSubscriptions.h"
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct MQTT_SUBSCRIPTION {
+    mqttTopicHandle_t topic;
+    uMqttQos_t qos;
+
+    int32_t numCallbacks;
+    callbackCommand_t *callbacks;
+    nameIndex_t commands;                       // The callbacks by their command
+
+    bool subscribed;                            // Subscribed to on this connection
+    bool announced;                             // The commands have been logged
+    bool failed;                                // The last subscribe failed...
+    int32_t failedTickMs;                       // ...at this tick time
+
+    struct MQTT_SUBSCRIPTION *pNextForTopic;    // Another subscription to the same topic
+} mqttSubscription_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t subscriptionsMutex = NULL;
+
+static int32_t subscriptionCount = 0;
+static mqttSubscription_t *subscriptions[MQTT_MAX_SUBSCRIPTIONS];
+
+/// @brief The subscriptions to each topic, by the topic's handle
+static mqttSubscription_t *topicSubscriptions[MQTT_MAX_TOPICS];
+
+// tick time of connecting, while waiting for every topic to be subscribed to
+static bool waitingForAll = false;
+static int32_t connectedTickMs = 0;
+
+static mqttSubscriptionStats_t stats;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Gets the next subscription to subscribe to, which isn't
+///        subscribed to and hasn't just failed. Called with the mutex locked.
+static mqttSubscription_t *nextToSubscribe(int32_t *pIndex, int32_t nowMs)
+{
+    for (; *pIndex < subscriptionCount; (*pIndex)++) {
+        mqttSubscription_t *pSubscription = subscriptions[*pIndex];
+        if (pSubscription->subscribed)
+            continue;
+
+        if (pSubscription->failed && nowMs - pSubscription->failedTickMs < MQTT_SUBSCRIBE_RETRY_MS)
+            continue;
+
+        return pSubscription;
+    }
+
+    return NULL;
+}
+
+/// @brief Logs the commands of a subscription, the first time it is subscribed to
+static void announceSubscription(mqttSubscription_t *pSubscription)
+{
+    writeInfo("Subscribed to callback topic: %s", mqttTopicName(pSubscription->topic));
+    if (pSubscription->numCallbacks > 0) {
+        printInfo("With these commands:");
+        for(int i=0; i<pSubscription->numCallbacks; i++)
+            printInfo("    %d: %s", i+1, pSubscription->callbacks[i].command);
+        printInfo("");
+    } else {
+        printWarn("Warning - there are no commands to listen to on this subscription!");
+    }
+}
+
+/// @brief Runs the callback of the command in a message, found with the
+///        subscription's command index
+/// @param pSubscription The subscription to the message's topic
+/// @param pMessage The message, the command and its parameters
+/// @return The callback's result, or negative if the command isn't found
+static int32_t runCommandCallback(mqttSubscription_t *pSubscription, char *pMessage)
+{
+    int32_t errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
+    commandParamsList_t *params = NULL;
+    size_t count = getParams(pMessage, &params);
+    if (count == 0) {
+        writeError("No command/param found in message: '%s'", pMessage);
+        goto cleanUp;
+    }
+
+    char *command = params->parameter;
+    if (command == NULL) {
+        writeError("Parsed MQTT command, but no command was set.");
+        goto cleanUp;
+    }
+
+    int32_t i = nameIndexFind(&pSubscription->commands, command);
+    if (i >= 0) {
+        errorCode = pSubscription->callbacks[i].callback(params);
+        goto cleanUp;
+    }
+
+    writeWarn("Didn't find command '%s' in callbacks", command);
+    errorCode = U_ERROR_COMMON_NOT_FOUND;
+
+cleanUp:
+    freeParams(params);
+    return errorCode;
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the subscription set, before the tasks are initialised
+/// @return 0 on success, negative on failure
+int32_t initMqttSubscriptions(void)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    int32_t errorCode = uPortMutexCreate(&subscriptionsMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT subscriptions mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Logs the subscription statistics and frees the set
+void finalizeMqttSubscriptions(void)
+{
+    if (subscriptionsMutex == NULL)
+        return;
+
+    latencyHistogram_t *pFully = &stats.fullySubscribed;
+    printInfo("MQTT subscriptions: %d topics, %d requests, %d failed, %d connections, average %d ms, longest %d ms",
+                subscriptionCount,
+                stats.requests,
+                stats.failures,
+                stats.connections,
+                pFully->count == 0 ? 0 : pFully->totalMs / pFully->count,
+                pFully->maxMs);
+
+    // forget the subscriptions first, so a late message doesn't find one
+    int32_t count = subscriptionCount;
+    subscriptionCount = 0;
+    memset(topicSubscriptions, 0, sizeof(topicSubscriptions));
+
+    for (int32_t i=0; i<count; i++) {
+        uPortFree(subscriptions[i]);
+        subscriptions[i] = NULL;
+    }
+
+    uPortMutexDelete(subscriptionsMutex);
+    subscriptionsMutex = NULL;
+    waitingForAll = false;
+}
+
+/// @brief Adds a topic to subscribe to, with the callbacks of its commands
+/// @param topic The topic's handle
+/// @param qos The QoS to subscribe with
+/// @param callbacks The command callbacks, which must last as long as the application
+/// @param numCallbacks The number of callbacks
+/// @return 0 on success, negative on failure
+int32_t mqttSubscriptionAdd(mqttTopicHandle_t topic, uMqttQos_t qos,
+                            callbackCommand_t *callbacks, int32_t numCallbacks)
+{
+    if (subscriptionsMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (topic < 0 || topic >= MQTT_MAX_TOPICS ||
+            numCallbacks < 0 || numCallbacks > NAME_INDEX_MAX_ITEMS ||
+            (callbacks == NULL && numCallbacks > 0))
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    // the command index's slots follow the subscription
+    size_t slots = nameIndexSlots(numCallbacks);
+    mqttSubscription_t *pSubscription = (mqttSubscription_t *)pUPortMalloc(sizeof(mqttSubscription_t) + slots);
+    if (pSubscription == NULL) {
+        writeError("Failed to create the subscription to %s - not enough memory", mqttTopicName(topic));
+        return U_ERROR_COMMON_NO_MEMORY;
+    }
+
+    memset(pSubscription, 0, sizeof(mqttSubscription_t));
+    pSubscription->topic = topic;
+    pSubscription->qos = qos;
+    pSubscription->numCallbacks = numCallbacks;
+    pSubscription->callbacks = callbacks;
+    nameIndexBuild(&pSubscription->commands, (uint8_t *)(pSubscription + 1),
+                    callbacks, sizeof(callbackCommand_t), numCallbacks);
+
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+
+    U_PORT_MUTEX_LOCK(subscriptionsMutex);
+    if (subscriptionCount == MQTT_MAX_SUBSCRIPTIONS) {
+        errorCode = U_ERROR_COMMON_NO_MEMORY;
+    } else {
+        subscriptions[subscriptionCount++] = pSubscription;
+        stats.subscriptions = subscriptionCount;
+
+        // linked in before it is the head, for the dispatch which doesn't lock
+        pSubscription->pNextForTopic = topicSubscriptions[topic];
+        topicSubscriptions[topic] = pSubscription;
+
+        // a topic added while connected delays being fully subscribed
+        if (stats.connections > 0 && !waitingForAll) {
+            waitingForAll = true;
+            connectedTickMs = uPortGetTickTimeMs();
+        }
+    }
+    U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+
+    if (errorCode < 0) {
+        writeError("Can't subscribe to %s, the most subscriptions is %d", mqttTopicName(topic), MQTT_MAX_SUBSCRIPTIONS);
+        uPortFree(pSubscription);
+    }
+
+    return errorCode;
+}
+
+/// @brief Records connecting to the broker or gateway, after which every
+///        topic has to be subscribed to again
+void mqttSubscriptionsConnected(void)
+{
+    if (subscriptionsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(subscriptionsMutex);
+    for (int32_t i=0; i<subscriptionCount; i++) {
+        subscriptions[i]->subscribed = false;
+        subscriptions[i]->failed = false;
+    }
+
+    stats.connections++;
+    waitingForAll = true;
+    connectedTickMs = uPortGetTickTimeMs();
+    U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+}
+
+/// @brief Subscribes to the topics which aren't subscribed to on this
+///        connection yet. The mutex isn't held while subscribing, so the
+///        tasks can add topics meanwhile.
+/// @param subscribe The function which subscribes to a topic
+/// @return The number of topics still not subscribed to
+int32_t mqttSubscriptionsSubscribe(mqttSubscribe_t subscribe)
+{
+    if (subscriptionsMutex == NULL || subscribe == NULL)
+        return 0;
+
+    int32_t index = 0;
+    int32_t pending = 0;
+    int32_t fullyMs = -1;
+
+    while (!gExitApp) {
+        mqttSubscription_t *pSubscription;
+
+        U_PORT_MUTEX_LOCK(subscriptionsMutex);
+        pSubscription = nextToSubscribe(&index, uPortGetTickTimeMs());
+        U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+
+        if (pSubscription == NULL)
+            break;
+
+        int32_t errorCode = subscribe(pSubscription->topic, pSubscription->qos);
+        bool announce = false;
+
+        U_PORT_MUTEX_LOCK(subscriptionsMutex);
+        stats.requests++;
+        if (errorCode < 0) {
+            stats.failures++;
+            pSubscription->failed = true;
+            pSubscription->failedTickMs = uPortGetTickTimeMs();
+        } else {
+            pSubscription->subscribed = true;
+            pSubscription->failed = false;
+            announce = !pSubscription->announced;
+            pSubscription->announced = true;
+        }
+        U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+
+        if (errorCode < 0)
+            writeWarn("Failed to subscribe to %s: %d", mqttTopicName(pSubscription->topic), errorCode);
+        else if (announce)
+            announceSubscription(pSubscription);
+
+        index++;
+    }
+
+    U_PORT_MUTEX_LOCK(subscriptionsMutex);
+    for (int32_t i=0; i<subscriptionCount; i++) {
+        if (!subscriptions[i]->subscribed)
+            pending++;
+    }
+
+    // under the mutex, as mqttSubscriptionsGetStats() copies the histogram with it
+    if (pending == 0 && waitingForAll) {
+        waitingForAll = false;
+        fullyMs = uPortGetTickTimeMs() - connectedTickMs;
+        metricsHistogramAdd(&stats.fullySubscribed, fullyMs);
+    }
+    U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+
+    if (fullyMs >= 0)
+        writeInfo("Subscribed to all %d topics, %d ms after connecting", subscriptionCount, fullyMs);
+
+    return pending;
+}
+
+/// @brief Runs the callback of the command in a downlink message, for each
+///        subscription to its topic
+/// @param topic The topic's handle
+/// @param pMessage The message, the command and its parameters
+/// @return The last callback's result, or U_ERROR_COMMON_NOT_FOUND if the
+///         topic or the command isn't found
+int32_t mqttSubscriptionDispatch(mqttTopicHandle_t topic, char *pMessage)
+{
+    int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
+    if (topic < 0 || topic >= MQTT_MAX_TOPICS || pMessage == NULL)
+        return errorCode;
+
+    for (mqttSubscription_t *pSubscription = topicSubscriptions[topic];
+            pSubscription != NULL;
+            pSubscription = pSubscription->pNextForTopic)
+        errorCode = runCommandCallback(pSubscription, pMessage);
+
+    return errorCode;
+}
+
+/// @brief Gets a copy of the subscription statistics
+/// @param pStats Where to copy the statistics
+/// @return 0 on success, negative on failure
+int32_t mqttSubscriptionsGetStats(mqttSubscriptionStats_t *pStats)
+{
+    if (subscriptionsMutex == NULL || pStats == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    U_PORT_MUTEX_LOCK(subscriptionsMutex);
+    *pStats = stats;
+    pStats->subscribed = 0;
+    for (int32_t i=0; i<subscriptionCount; i++) {
+        if (subscriptions[i]->subscribed)
+            pStats->subscribed++;
+    }
+    U_PORT_MUTEX_UNLOCK(subscriptionsMutex);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Subscriptions header - the command topics the tasks subscribe to,
+ * which the MQTT task subscribes to each time it connects, and their
+ * command callbacks
+ *
+ */
+
+#ifndef _MQTT_SUBSCRIPTIONS_H_
+#define _MQTT_SUBSCRIPTIONS_H_
+
+#include "mqttTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The most topics the tasks can subscribe to
+#define MQTT_MAX_SUBSCRIPTIONS          50
+
+// Time to wait before subscribing to a topic again after it failed
+#define MQTT_SUBSCRIBE_RETRY_MS         5000
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// Subscribes to a topic with the broker or gateway
+typedef int32_t (*mqttSubscribe_t)(mqttTopicHandle_t topic, uMqttQos_t qos);
+
+/// @brief Subscription statistics
+typedef struct MqttSubscriptionStats {
+    int32_t subscriptions;              // Topics the tasks subscribe to
+    int32_t subscribed;                 // ...which are subscribed to on this connection
+    int32_t requests;                   // Subscribe requests sent
+    int32_t failures;                   // ...which failed
+    int32_t connections;                // Connections the topics were subscribed to again after
+    latencyHistogram_t fullySubscribed; // Time from connecting to every topic being subscribed to
+} mqttSubscriptionStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief              Creates the subscription set, before the tasks are
+///                     initialised
+/// @return             0 on success, negative on failure
+int32_t initMqttSubscriptions(void);
+
+/// @brief              Logs the subscription statistics and frees the set
+void finalizeMqttSubscriptions(void);
+
+/// @brief              Adds a topic to subscribe to, with the callbacks of
+///                     its commands. The callbacks aren't copied, so must
+///                     last as long as the application.
+/// @param topic        The topic's handle
+/// @param qos          The QoS to subscribe with
+/// @param callbacks    The command callbacks
+/// @param numCallbacks The number of callbacks
+/// @return             0 on success, negative on failure
+int32_t mqttSubscriptionAdd(mqttTopicHandle_t topic, uMqttQos_t qos,
+                            callbackCommand_t *callbacks, int32_t numCallbacks);
+
+/// @brief              Records connecting to the broker or gateway, after
+///                     which every topic has to be subscribed to again
+void mqttSubscriptionsConnected(void);
+
+/// @brief              Subscribes to the topics which aren't subscribed to
+///                     on this connection yet, other than those which
+///                     failed in the last MQTT_SUBSCRIBE_RETRY_MS
+/// @param subscribe    The function which subscribes to a topic
+/// @return             The number of topics still not subscribed to
+int32_t mqttSubscriptionsSubscribe(mqttSubscribe_t subscribe);
+
+/// @brief              Runs the callback of the command in a downlink
+///                     message, for each subscription to its topic
+/// @param topic        The topic's handle
+/// @param pMessage     The message, the command and its parameters
+/// @return             The last callback's result, or U_ERROR_COMMON_NOT_FOUND
+///                     if the topic or the command isn't found
+int32_t mqttSubscriptionDispatch(mqttTopicHandle_t topic, char *pMessage);
+
+/// @brief              Gets a copy of the subscription statistics
+/// @param pStats       Where to copy the statistics
+/// @return             0 on success, negative on failure
+int32_t mqttSubscriptionsGetStats(mqttSubscriptionStats_t *pStats);
+
+#endif
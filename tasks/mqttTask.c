@@ -21,29 +21,31 @@
  */
 #include "common.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
+#include "messageBus.h"
+#include "atArbiter.h"
+#include "taskScheduler.h"
+#include "mqttBatch.h"
+#include "mqttCompress.h"
+#include "mqttInflight.h"
+#include "mqttJournal.h"
+#include "mqttLatency.h"
+#include "mqttLanes.h"
+#include "mqttPool.h"
+#include "mqttReconnect.h"
+#include "mqttSubscriptions.h"
 #include "mqttTask.h"
+#include "registrationTask.h"
 
 /* ----------------------------------------------------------------
  * DEFINES
  * -------------------------------------------------------------- */
-#define MQTT_TASK_STACK_SIZE 1024
-#define MQTT_TASK_PRIORITY 5
-
-#define MQTT_QUEUE_STACK_SIZE QUEUE_STACK_SIZE_DEFAULT
-#define MQTT_QUEUE_PRIORITY 5
-#define MQTT_QUEUE_SIZE 10
-
-#define STRCOPYTO(x, y)         (failed ? true : ((x = uStrDup(y))==NULL) ? true : false)
-#define MEMCOPYTO(x, y, len)    (failed ? true : ((x = uMemDup(y, len))==NULL) ? true : false)
-
 #define MAX_TOPIC_SIZE 256
 #define MAX_MESSAGE_SIZE (12 * 1024 + 1)    // set this to 12KB as this
                                             // is the same buffer size
                                             // in the modules plus 1
                                             // for the null
 
-#define MAX_TOPIC_CALLBACKS 50
-
 #define TEMP_TOPIC_NAME_SIZE 256
 
 #define MQTT_TYPE_NAME (mqttSN ? "MQTT-SN Gateway" : "MQTT Broker")
@@ -54,48 +56,53 @@
 static bool exitTask = false;
 static taskConfig_t *taskConfig = NULL;
 
-/* ----------------------------------------------------------------
- * TYPE DEFINITIONS
- * -------------------------------------------------------------- */
-typedef struct TOPIC_CALLBACK {
-    char *topicName;
-    uMqttSnTopicName_t *snShortName;
-    uMqttQos_t qos;
-
-    int32_t numCallbacks;
-    callbackCommand_t *callbacks;
-} topicCallback_t;
-
-typedef struct MQTTSN_TOPIC_NAME_NODE {
-    char *topicName;
-    uMqttSnTopicName_t *snShortName;
-    struct MQTTSN_TOPIC_NAME_NODE *next;
-} mqttSNTopicNameNode_t;
-
 /* ----------------------------------------------------------------
  * STATIC VARIABLES
  * -------------------------------------------------------------- */
 static uMqttClientContext_t *pContext = NULL;
+
+/// @brief Guards pContext against being closed by the task loop while the
+///        bus handlers and timers are still publishing or checking it
+static uPortMutexHandle_t contextMutex = NULL;
+
+/// @brief The compressed payload being published, only allocated when a
+///        topic is compressed, and used with the contextMutex locked
+static uint8_t *pCompressBuffer = NULL;
 static uSecurityTlsSettings_t tlsSettings = U_SECURITY_TLS_SETTINGS_DEFAULT;
 static uSecurityTlsCipherSuites_t cipherSuites;
 
 static int32_t messagesToRead = 0;
 static char topicString[MAX_TOPIC_SIZE+1];
+static mqttTopicHandle_t downlinkTopic = U_ERROR_COMMON_NOT_FOUND;
 static char *downlinkMessage;
 
-static int32_t topicCallbackCount = 0;
-static topicCallback_t *topicCallbackRegister[MAX_TOPIC_CALLBACKS];
-
-static char tempTopicName[TEMP_TOPIC_NAME_SIZE+1];
-
 static bool mqttSN = false;
-static mqttSNTopicNameNode_t *mqttSNTopicNameList = NULL;
 
 static int32_t lastMQTTError = 0;
 
+/// @brief Timer which checks for batches to publish, and if a check is queued
+static int32_t batchTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+static bool batchFlushQueued = false;
+
+/// @brief Timer which replays the journalled messages, and if a replay is queued
+static int32_t journalTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+static bool journalReplayQueued = false;
+
+/// @brief Timer which sends the unacknowledged messages again, and if a retry is queued
+static int32_t inflightTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+static bool inflightRetryQueued = false;
+
 /// @brief Simple flag to exit any dwelling to connect to the broker
 static bool tryToConnectMQTT = false;
 
+/// @brief Flag to end the wait to connect, set when the network comes up
+static bool networkCameUp = false;
+
+/// @brief Flag to subscribe to the topics added since the last subscribe,
+///        and the number of topics not subscribed to yet on this connection
+static bool subscribeRequested = false;
+static int32_t subscriptionsPending = 0;
+
 bool gIsMQTTConnected = false;
 
 /* ----------------------------------------------------------------
@@ -105,6 +112,18 @@ bool gIsMQTTConnected = false;
 /// @brief Disconnects from the MQTT broker or SN gateway
 static int32_t disconnectBroker(void);
 
+/// @brief Publishes a message replayed from the journal
+static int32_t publishJournalled(const char *pTopicName, const char *pMessage, size_t length, uMqttQos_t QoS, bool retain);
+
+/// @brief Keeps a message which couldn't be published in the journal
+static void journalMessage(const char *pMessage, const sendMQTTMsg_t *pMsg);
+
+/// @brief Gets the MQTT-SN short name of a topic, registering it the first time
+static int32_t getTopicShortName(mqttTopicHandle_t topic, uMqttSnTopicName_t *pShortName);
+
+/// @brief Subscribes to a topic with the broker or gateway
+static int32_t subscribeTopic(mqttTopicHandle_t topic, uMqttQos_t qos);
+
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
  * -------------------------------------------------------------- */
@@ -121,36 +140,64 @@ static void handlePublishError(void)
     // Error 34 is "No Network Service" - which shouldn't be if the network is available
     if (lastMQTTError == 34 && IS_NETWORK_AVAILABLE) {
         writeWarn("Last publish failed, but the cellular network is available. Reconnecting to %s", MQTT_TYPE_NAME);
+        mqttReconnectLost();
         disconnectBroker();
         tryToConnectMQTT = true;
+        signalTask(taskConfig);
     }
 }
 
-/// @brief Publishes an MQTT Message - remember to FREE the msg memory!!!!
-/// @param msg The message to send.
-static void mqttPublishMessage(sendMQTTMsg_t msg)
+/// @brief Publishes an MQTT Message to the broker or gateway, compressing
+///        it first if its topic is in MQTT_COMPRESS_TOPICS
+/// @param topic The registered topic
+/// @param pMessage The message
+/// @param length The length of the message
+/// @param QoS The Quality of Service value for this message
+/// @param retain If the message should be retained
+/// @param id The message's id, for logging
+/// @return 0 on success, negative on failure
+static int32_t publishToBroker(mqttTopicHandle_t topic, const char *pMessage, size_t length,
+                               uMqttQos_t QoS, bool retain, int32_t id)
 {
-    if (!isNotExiting()) return;
-
     int32_t errorCode = U_ERROR_COMMON_NOT_INITIALISED;
 
-    bool mqttConnected = uMqttClientIsConnected(pContext);
-    if (pContext != NULL && mqttConnected && IS_NETWORK_AVAILABLE) {
+    // when the publish call started, not counting the wait for the AT channel
+    int32_t publishStartMs = -1;
+
+    bool mqttConnected = false;
+
+    U_PORT_MUTEX_LOCK(contextMutex);
+
+    mqttConnected = pContext != NULL && uMqttClientIsConnected(pContext);
+    if (mqttConnected && IS_NETWORK_AVAILABLE) {
+        int32_t compress = mqttTopicCompression(topic);
+        if (compress >= 0)
+            pMessage = mqttCompressPayload(compress, pMessage, &length,
+                                           pCompressBuffer, MQTT_COMPRESS_PAYLOAD_MAX);
+
         if (mqttSN) {
-            errorCode = uMqttClientSnPublish(pContext, msg.topic.pShortName, msg.pMessage,
-                                                    strlen(msg.pMessage),
-                                                    msg.QoS,
-                                                    msg.retain);
+            uMqttSnTopicName_t shortName;
+            errorCode = getTopicShortName(topic, &shortName);
+            if (errorCode == 0)
+                AT_CHANNEL_CALL(AT_CLASS_CONTROL, publishStartMs = uPortGetTickTimeMs();
+                                                  errorCode = uMqttClientSnPublish(pContext, &shortName, pMessage,
+                                                    length,
+                                                    QoS,
+                                                    retain));
         } else {
-            errorCode = uMqttClientPublish(pContext, msg.topic.pTopicName, msg.pMessage,
-                                                    strlen(msg.pMessage),
-                                                    msg.QoS,
-                                                    msg.retain);
+            AT_CHANNEL_CALL(AT_CLASS_CONTROL, publishStartMs = uPortGetTickTimeMs();
+                                              errorCode = uMqttClientPublish(pContext, mqttTopicName(topic), pMessage,
+                                                    length,
+                                                    QoS,
+                                                    retain));
         }
 
+        if (publishStartMs >= 0)
+            mqttLatencyPublish(topic, uPortGetTickTimeMs() - publishStartMs, errorCode == 0);
+
         if (errorCode == 0) {
             lastMQTTError = 0;
-            writeDebug("Published MQTT message #%d", msg.id);
+            writeDebug("Published MQTT message #%d", id);
         } else {
             int32_t errValue = uMqttClientGetLastErrorCode(pContext);
             if (errValue < 0)
@@ -163,27 +210,166 @@ static void mqttPublishMessage(sendMQTTMsg_t msg)
         }
 
     } else {
-        writeWarn("Network or MQTT connection not available, not publishing message #id", msg.id);
+        writeWarn("Network or MQTT connection not available, not publishing message #id", id);
     }
 
+    U_PORT_MUTEX_UNLOCK(contextMutex);
+
     gAppStatus = mqttConnected ? MQTT_CONNECTED : MQTT_DISCONNECTED;
 
-    uPortFree(msg.pMessage);
-    if (mqttSN)
-        uPortFree(msg.topic.pShortName);
+    return errorCode;
+}
+
+static bool isConnected(void)
+{
+    bool connected = false;
+
+    if (contextMutex == NULL)
+        return false;
+
+    U_PORT_MUTEX_LOCK(contextMutex);
+    connected = pContext != NULL && uMqttClientIsConnected(pContext);
+    U_PORT_MUTEX_UNLOCK(contextMutex);
+
+    return connected;
+}
+
+/// @brief Keeps a message which couldn't be published in the journal, if
+///        there is one. The message's pool block is freed.
+/// @param msg The message
+static void handBackMessage(sendMQTTMsg_t msg)
+{
+    const char *pMessage = (const char *)mqttPoolGet(msg.message);
+    if (pMessage != NULL && mqttJournalEnabled())
+        journalMessage(pMessage, &msg);
+
+    mqttPoolFree(msg.message);
+}
+
+/// @brief Publishes an MQTT Message, keeping it in the journal if it can't
+///        be published. A QoS 1 or 2 message which isn't acknowledged while
+///        still connected is kept in the in-flight window to send again.
+///        Otherwise the message's pool block is freed.
+/// @param msg The message to send.
+static void mqttPublishMessage(sendMQTTMsg_t msg)
+{
+    const char *pMessage = (const char *)mqttPoolGet(msg.message);
+
+    int32_t errorCode = U_ERROR_COMMON_CANCELLED;
+    if (pMessage == NULL)
+        writeWarn("MQTT message #%d is not in the pool, dropping it", msg.id);
+    else if (isNotExiting()) {
+        mqttLatencyQueueWait(&msg);
+        errorCode = publishToBroker(msg.topic, pMessage, msg.length, msg.QoS, msg.retain, msg.id);
+    }
+
+    if (msg.QoS != U_MQTT_QOS_AT_MOST_ONCE && pMessage != NULL) {
+        if (errorCode == 0)
+            mqttInflightDelivered(&msg);
+        else if (isNotExiting() && isConnected() && mqttInflightAdd(&msg) == 0)
+            return;
+    }
+
+    if (errorCode == 0)
+        mqttPoolFree(msg.message);
     else
-        uPortFree(msg.topic.pTopicName);
+        handBackMessage(msg);
 }
 
-static void queueHandler(void *pParam, size_t paramLengthBytes)
+/// @brief Sends the unacknowledged messages which are due again, or hands
+///        them all back if the connection was lost
+static void retryInflight(void)
+{
+    sendMQTTMsg_t msg;
+
+    // each message tried is either acknowledged or backs off, so isn't due again
+    for (int32_t i=mqttInflightCount(); i>0 && isConnected() && mqttInflightNextDue(&msg); i--) {
+        const char *pMessage = (const char *)mqttPoolGet(msg.message);
+        int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
+        if (pMessage != NULL)
+            errorCode = publishToBroker(msg.topic, pMessage, msg.length, msg.QoS, msg.retain, msg.id);
+
+        if (errorCode == 0) {
+            mqttInflightAcknowledge(msg.id);
+            mqttPoolFree(msg.message);
+        } else if (!mqttInflightFailed(msg.id)) {
+            writeWarn("MQTT message #%d wasn't acknowledged, giving up", msg.id);
+            handBackMessage(msg);
+        }
+    }
+
+    if (!isConnected() || !isNotExiting()) {
+        while (mqttInflightTakeAny(&msg))
+            handBackMessage(msg);
+    }
+}
+
+/// @brief Asks the MQTT task to publish the messages waiting on the lanes
+/// @return 0 on success, negative on failure
+static int32_t wakeLanes(void)
 {
-    if (!isNotExiting()) return;
+    mqttMsg_t qMsg;
+    qMsg.msgType = PUBLISH_MQTT_LANES;
+
+    int32_t errorCode = busSend(TASK_QUEUE, BUS_EVENT_TASK_COMMAND, &qMsg, sizeof(mqttMsg_t));
+    if (errorCode < 0) {
+        // the next message pushed on a lane asks again
+        mqttLaneStartDrain();
+        writeWarn("Failed to ask the MQTT task to publish, errorCode: %d", errorCode);
+    }
+
+    metricsRecordQueueDepth(taskConfig, TASK_QUEUE);
+
+    return errorCode;
+}
+
+/// @brief Publishes the messages waiting on the lanes, highest lane first.
+///        After a few messages the task asks itself again, so the batch
+///        and journal work queued behind isn't held up.
+static void publishLanes(void)
+{
+    mqttLaneStartDrain();
+
+    sendMQTTMsg_t msg;
+    int32_t published = 0;
+    while (published < MQTT_LANE_DRAIN_BATCH && mqttLanePop(&msg)) {
+        if (msg.batch >= 0 && isNotExiting())
+            mqttBatchAdd(msg.batch, msg);
+        else
+            mqttPublishMessage(msg);
+
+        published++;
+    }
+
+    if (published == MQTT_LANE_DRAIN_BATCH)
+        wakeLanes();
+}
 
+static void queueHandler(void *pParam, size_t paramLengthBytes)
+{
     mqttMsg_t *qMsg = (mqttMsg_t *) pParam;
 
+    // when exiting, the messages still queued go in the journal
+    if (!isNotExiting() && qMsg->msgType != PUBLISH_MQTT_LANES) return;
+
     switch(qMsg->msgType) {
-        case SEND_MQTT_MESSAGE:
-            mqttPublishMessage(qMsg->msg.message);
+        case PUBLISH_MQTT_LANES:
+            publishLanes();
+            break;
+
+        case FLUSH_MQTT_BATCHES:
+            batchFlushQueued = false;
+            mqttBatchFlush(false);
+            break;
+
+        case REPLAY_MQTT_JOURNAL:
+            journalReplayQueued = false;
+            mqttJournalReplay(publishJournalled);
+            break;
+
+        case RETRY_MQTT_INFLIGHT:
+            inflightRetryQueued = false;
+            retryInflight();
             break;
 
         default:
@@ -194,8 +380,10 @@ static void queueHandler(void *pParam, size_t paramLengthBytes)
 
 static void disconnectCallback(int32_t lastMqttError, void *param)
 {
+    mqttReconnectLost();
     gAppStatus = MQTT_DISCONNECTED;
     gIsMQTTConnected = false;
+    notifyStateChange();
 
     // don't bother worrying about the last mqtt error - we're disconnected now!
 }
@@ -204,27 +392,20 @@ static void downlinkMessageCallback(int32_t msgCount, void *param)
 {
     printDebug("Got a downlink MQTT message notification: %d", msgCount);
     messagesToRead = msgCount;
+    signalTask(taskConfig);
 }
 
 static int32_t connectBroker(void)
 {
     gAppStatus = MQTT_CONNECTING;
-    
-    uMqttClientConnection_t connection = U_MQTT_CLIENT_CONNECTION_DEFAULT;
-    connection.pBrokerNameStr = getConfig("MQTT_BROKER_NAME");
-    connection.pUserNameStr = getConfig("MQTT_USERNAME");
-    connection.pPasswordStr = getConfig("MQTT_PASSWORD");
-    connection.pClientIdStr = getConfig("MQTT_CLIENTID");
-
-    setBoolParamFromConfig("MQTT_TYPE", "MQTT-SN", &mqttSN);
-    connection.mqttSn = mqttSN;
 
-    setIntParamFromConfig("MQTT_TIMEOUT", &(connection.inactivityTimeoutSeconds));
-    setBoolParamFromConfig("MQTT_KEEPALIVE", "TRUE", &(connection.keepAlive));
+    // read from the app.conf file once, by initMqttReconnect()
+    const uMqttClientConnection_t *pConnection = mqttReconnectConnection();
 
-    writeInfo("Connecting to %s on %s...", MQTT_TYPE_NAME, connection.pBrokerNameStr);
+    writeInfo("Connecting to %s on %s...", MQTT_TYPE_NAME, pConnection->pBrokerNameStr);
 
-    int32_t errorCode = uMqttClientConnect(pContext, &connection);
+    int32_t errorCode;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientConnect(pContext, pConnection));
     if (errorCode != 0) {
         writeError("Failed to connect to the %s: %d", MQTT_TYPE_NAME, errorCode);
         return errorCode;
@@ -244,6 +425,7 @@ static int32_t connectBroker(void)
 
     writeInfo("Connected to %s", MQTT_TYPE_NAME);
     gIsMQTTConnected = true;
+    notifyStateChange();
     gAppStatus = MQTT_CONNECTED;
 
     return 0;
@@ -251,7 +433,8 @@ static int32_t connectBroker(void)
 
 static int32_t disconnectBroker(void)
 {
-    int32_t errorCode = uMqttClientDisconnect(pContext);
+    int32_t errorCode;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientDisconnect(pContext));
     if (errorCode < 0) {
         if (!gExitApp)
             writeError("Failed to disconnect from %s: %d", MQTT_TYPE_NAME, errorCode);
@@ -265,41 +448,64 @@ static int32_t disconnectBroker(void)
     return errorCode;
 }
 
-/// @brief Flag to indicate we can continue to dwell and wait for an event
-/// @return True if we can keep dwelling, false otherwise
-static bool continueToDwell(void)
+/// @brief Registration task callback for the network coming up, which
+///        ends the wait to connect straight away
+static void networkUpHandler(void)
 {
-    return isNotExiting() && (messagesToRead == 0) && (!tryToConnectMQTT);
+    mqttReconnectNetworkUp();
+    networkCameUp = true;
+    signalTask(taskConfig);
 }
 
-static void freeCallbacks(void)
+/// @brief Waits to connect again, until the time is up, the network comes
+///        up or the application is exiting. Publishing doesn't end the
+///        wait, so it doesn't cut the back off short.
+/// @param waitMs The time to wait
+static void waitToConnect(int32_t waitMs)
 {
-    int32_t c = topicCallbackCount;
+    int32_t startTick = uPortGetTickTimeMs();
+    int32_t elapsedMs = 0;
 
-    // Take a copy of the callback count and reset
-    // This is so that any callback that might occur
-    // now is not found
-    topicCallbackCount = 0;
+    while (isNotExiting() && !networkCameUp && elapsedMs < waitMs) {
+        uPortSemaphoreTryTake(taskConfig->handles.wakeupSemaphore, waitMs - elapsedMs);
+        elapsedMs = uPortGetTickTimeMs() - startTick;
+    }
 
-    for(int i=0; i<c; i++) {
-        uPortFree(topicCallbackRegister[i]->topicName);
-        topicCallbackRegister[i]->topicName = NULL;
+    networkCameUp = false;
+}
 
-        uPortFree(topicCallbackRegister[i]);
-        topicCallbackRegister[i] = NULL;
-    }
+/// @brief Flag to indicate we can continue to dwell and wait for an event
+/// @return True if we can keep dwelling, false otherwise
+static bool continueToDwell(void)
+{
+    return isNotExiting() && (messagesToRead == 0) && (!tryToConnectMQTT) && (!subscribeRequested);
 }
 
-static bool getTopicNameFromSnTopicId(uint16_t id, char *topicName)
+/// @brief Subscribes to all the command topics and registers the MQTT-SN
+///        short names of all the known topics, after connecting. A new
+///        session doesn't keep the subscriptions, and the short names, of
+///        an earlier one. Registering the short names here saves
+///        registering each one on its first publish.
+static void registerKnownTopics(void)
 {
-    for(int i=0; i<topicCallbackCount; i++) {
-        if (topicCallbackRegister[i]->snShortName->name.id == id) {
-            memcpy(topicName, topicCallbackRegister[i]->topicName, strlen(topicCallbackRegister[i]->topicName));
-            return true;
-        }
+    mqttTopicClearShortNames();
+
+    subscribeRequested = false;
+    mqttSubscriptionsConnected();
+    subscriptionsPending = mqttSubscriptionsSubscribe(subscribeTopic);
+
+    if (!mqttSN)
+        return;
+
+    int32_t count = mqttTopicGetCount();
+    int32_t registered = 0;
+    for (mqttTopicHandle_t topic=0; topic<count; topic++) {
+        uMqttSnTopicName_t shortName;
+        if (getTopicShortName(topic, &shortName) == 0)
+            registered++;
     }
 
-    return false;
+    writeInfo("Registered %d of %d topics with the %s", registered, count, MQTT_TYPE_NAME);
 }
 
 /// @brief Read an MQTT message
@@ -317,13 +523,17 @@ static int32_t readMessage(void)
     printDebug("Reading MQTT Message...");
     if (mqttSN) {
         uMqttSnTopicName_t snTopicName;
-        errorCode = uMqttClientSnMessageRead(pContext, &snTopicName, downlinkMessage, &msgSize, &QoS);
-        if (!getTopicNameFromSnTopicId(snTopicName.name.id, topicString)) {
+        AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientSnMessageRead(pContext, &snTopicName, downlinkMessage, &msgSize, &QoS));
+        downlinkTopic = mqttTopicFindByShortId(snTopicName.name.id);
+        if (downlinkTopic < 0) {
             printWarn("Failed to find MQTT-SN TopicId: %d", snTopicName.name.id);
             errorCode = U_ERROR_COMMON_NOT_FOUND;
+        } else {
+            snprintf(topicString, sizeof(topicString), "%s", mqttTopicName(downlinkTopic));
         }
     } else {
-        errorCode = uMqttClientMessageRead(pContext, topicString, MAX_TOPIC_SIZE, downlinkMessage, &msgSize, &QoS);
+        AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientMessageRead(pContext, topicString, MAX_TOPIC_SIZE, downlinkMessage, &msgSize, &QoS));
+        downlinkTopic = mqttTopicFind(topicString);
     }
 
     if (errorCode < 0) {
@@ -337,50 +547,11 @@ static int32_t readMessage(void)
     return msgSize;
 }
 
-static int32_t runCommandCallback(callbackCommand_t *callbacks, int32_t numCallbacks, char *message, size_t msgSize)
+/// @brief Find the callbacks for the topic we have just received, by its
+///        handle, and call them
+static void callbackTopic(void)
 {
-    int32_t errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
-    commandParamsList_t *params = NULL;
-    size_t count = getParams(message, &params);
-    if (count == 0) {
-        writeError("No command/param found in message: '%s'", message);
-        goto cleanUp;
-    }
-
-    char *command = params->parameter;
-    if (command == NULL) {
-        writeError("Parsed MQTT command, but no command was set.");
-        goto cleanUp;
-    }
-
-    for(int i=0; i<numCallbacks; i++) {
-        if(strncmp(command, callbacks[i].command, msgSize) == 0) {
-            errorCode = callbacks[i].callback(params);
-            goto cleanUp;
-        }
-    }
-
-    writeWarn("Didn't find command '%s' in callbacks", command);
-    errorCode = U_ERROR_COMMON_NOT_FOUND;
-
-cleanUp:
-    freeParams(params);
-    return errorCode;
-}
-
-/// @brief Find the callback for the topic we have just received, and call it
-/// @param msgSize the size of the message
-static void callbackTopic(size_t msgSize)
-{
-    int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
-    for(int i=0; i<topicCallbackCount; i++) {
-        if (strcmp(topicCallbackRegister[i]->topicName, topicString) == 0) {
-            errorCode = runCommandCallback(topicCallbackRegister[i]->callbacks,
-                                                topicCallbackRegister[i]->numCallbacks,
-                                                downlinkMessage,
-                                                msgSize);
-        }
-    }
+    int32_t errorCode = mqttSubscriptionDispatch(downlinkTopic, downlinkMessage);
 
     if (errorCode == U_ERROR_COMMON_NOT_FOUND)
         printWarn("callbackTopic(): Topic name %s not found", topicString);
@@ -397,7 +568,7 @@ static void readMessages(void)
     for(int i=0; i<count; i++) {
         size_t msgSize = readMessage();
         if (msgSize >= 0) {
-            callbackTopic(msgSize);
+            callbackTopic();
             messagesToRead--;
         } else {
             // failure to read an MQTT message normally means
@@ -413,14 +584,28 @@ static void readMessages(void)
 static void taskLoop(void *pParameters)
 {
     U_PORT_MUTEX_LOCK(TASK_MUTEX);
+    setTaskState(taskConfig, TASK_RUNNING);
     while(isNotExiting())
     {
         if (!uMqttClientIsConnected(pContext)) {
             gAppStatus = MQTT_DISCONNECTED;
+
+            // the connection can be lost with the network, without the disconnect callback
+            if (gIsMQTTConnected) {
+                mqttReconnectLost();
+                gIsMQTTConnected = false;
+                notifyStateChange();
+            }
+
             if (IS_NETWORK_AVAILABLE) {
                 writeInfo("MQTT client disconnected, trying to connect...");
                 if (connectBroker() != U_ERROR_COMMON_SUCCESS) {
-                    uPortTaskBlock(5000);
+                    int32_t backOffMs = mqttReconnectFailed();
+                    writeInfo("Trying to connect to the %s again in %d ms", MQTT_TYPE_NAME, backOffMs);
+                    waitToConnect(backOffMs);
+                } else {
+                    mqttReconnectConnected();
+                    registerKnownTopics();
                 }
 
                 // while trying to connect this flag may have been set
@@ -430,9 +615,15 @@ static void taskLoop(void *pParameters)
                 tryToConnectMQTT = false;
             } else {
                 writeDebug("Can't connect to %s, network is still not available...", MQTT_TYPE_NAME);
-                uPortTaskBlock(2000);
+                waitToConnect(MQTT_NETWORK_CHECK_MS);
             }
         } else {
+            // the topics added since connecting, and those which failed
+            if (subscribeRequested || subscriptionsPending > 0) {
+                subscribeRequested = false;
+                subscriptionsPending = mqttSubscriptionsSubscribe(subscribeTopic);
+            }
+
             if (messagesToRead > 0)
                 readMessages();
 
@@ -442,9 +633,13 @@ static void taskLoop(void *pParameters)
 
     // Application exiting, so disconnect from MQTT broker/SN gateway...
     disconnectBroker();
+
+    // the bus handlers and timers can still be checking the context
+    U_PORT_MUTEX_LOCK(contextMutex);
     uMqttClientClose(pContext);
+    pContext = NULL;
+    U_PORT_MUTEX_UNLOCK(contextMutex);
 
-    freeCallbacks();
     uPortFree(downlinkMessage);
     downlinkMessage = NULL;
 
@@ -454,20 +649,7 @@ static void taskLoop(void *pParameters)
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(mqttMsg_t),
-                    MQTT_QUEUE_STACK_SIZE,
-                    MQTT_QUEUE_PRIORITY,
-                    MQTT_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create MQTT event queue %d.", eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(mqttMsg_t));
 }
 
 static int32_t initMutex()
@@ -475,178 +657,151 @@ static int32_t initMutex()
     INIT_MUTEX;
 }
 
-/// @brief Register a callback based on the topic of the message
-/// @param topicName The topic of interest
-/// @param callbackFunction The callback functaion to call when we received a message
-/// @return 0 on success, negative on failure
-static int32_t registerTopicCallBack(topicCallback_t *topicCallback)
+/// @brief Scheduler callback which asks the MQTT task to publish the
+///        batches whose window has passed, so only the task publishes
+static void checkBatches(void *pParam)
 {
-    if (topicCallbackCount == MAX_TOPIC_CALLBACKS) {
-        writeError("registerTopicCallBack(): max callback count");
-        return U_ERROR_COMMON_NO_MEMORY;
-    }
-
-    if (pContext == NULL || !uMqttClientIsConnected(pContext)) {
-        return U_ERROR_COMMON_NOT_INITIALISED;
-    }
+    if (batchFlushQueued || !mqttBatchIsDue())
+        return;
 
-    int32_t errorCode;
-
-    if (mqttSN) {
-        topicCallback->snShortName = (uMqttSnTopicName_t *)malloc(sizeof(uMqttSnTopicName_t));
-        if (topicCallback->snShortName == NULL) {
-            writeError("registerTopicCallBack(): snShortName memory allocation");
-            return U_ERROR_COMMON_NO_MEMORY;
-        }
+    mqttMsg_t qMsg;
+    qMsg.msgType = FLUSH_MQTT_BATCHES;
 
-        errorCode = uMqttClientSnSubscribeNormalTopic(pContext, topicCallback->topicName,
-                                                                topicCallback->qos,
-                                                                topicCallback->snShortName);
-    } else {
-        errorCode = uMqttClientSubscribe(pContext,  topicCallback->topicName,
-                                                    topicCallback->qos);
-    }
+    batchFlushQueued = busSend(TASK_QUEUE, BUS_EVENT_TASK_COMMAND, &qMsg, sizeof(mqttMsg_t)) == 0;
+}
 
-    if (errorCode < 0) {
-        writeError("registerTopicCallBack(): Subscribe to topic %s", topicCallback->topicName);
-        return errorCode;
-    }
+/// @brief Scheduler callback which asks the MQTT task to replay the next
+///        journalled messages, once it is connected again
+static void checkJournal(void *pParam)
+{
+    if (journalReplayQueued || mqttJournalCount() == 0 || !IS_NETWORK_AVAILABLE || !isConnected())
+        return;
 
-    topicCallbackRegister[topicCallbackCount] = topicCallback;
-    topicCallbackCount++;
+    mqttMsg_t qMsg;
+    qMsg.msgType = REPLAY_MQTT_JOURNAL;
 
-    return U_ERROR_COMMON_SUCCESS;
+    journalReplayQueued = busSend(TASK_QUEUE, BUS_EVENT_TASK_COMMAND, &qMsg, sizeof(mqttMsg_t)) == 0;
 }
 
-static void subscribeToTopic(void *pParam)
+/// @brief Scheduler callback which asks the MQTT task to send the
+///        unacknowledged messages which are due again, or to hand them back
+///        once it is disconnected
+static void checkInflight(void *pParam)
 {
-    topicCallback_t *topicCallback = (topicCallback_t *)pParam;
+    if (inflightRetryQueued || mqttInflightCount() == 0 || (isConnected() && !mqttInflightIsDue()))
+        return;
 
-    // wait until the MQTT has been initialised...
-    while(!TASK_INITIALISED && !gExitApp) {
-        printDebug("Waiting for MQTT Task to be initialised...");
-        uPortTaskBlock(500);
-    }
-
-    // wait until the MQTT Task is up and running...
-    while(!TASK_IS_RUNNING && !gExitApp) {
-        printDebug("Waiting to subscribe to %s...", topicCallback->topicName);
-        uPortTaskBlock(2000);
-    }
+    mqttMsg_t qMsg;
+    qMsg.msgType = RETRY_MQTT_INFLIGHT;
 
-    if (gExitApp)
-        goto cleanUp;
+    inflightRetryQueued = busSend(TASK_QUEUE, BUS_EVENT_TASK_COMMAND, &qMsg, sizeof(mqttMsg_t)) == 0;
+}
 
-    printDebug("Finished waiting for MQTT task to start...");
-    printDebug("Subscribing to topic '%s'...", topicCallback->topicName);
+static int32_t initCompress()
+{
+    int32_t count = initMqttCompress();
+    if (count <= 0)
+        return count;
 
-    // the MQTT task is running, but we might not be connected yet so this can fail
-    // U_ERROR_COMMON_NOT_INITIALISED is the error if the MQTT client isn't connected yet.
-    int32_t errorCode = U_ERROR_COMMON_NOT_INITIALISED;
-    while(errorCode == U_ERROR_COMMON_NOT_INITIALISED && !gExitApp) {
-        errorCode = registerTopicCallBack(topicCallback);
-        if(errorCode == U_ERROR_COMMON_NOT_INITIALISED) {
-            printDebug("Still waiting to subscribe to %s topic", topicCallback->topicName);
-            uPortTaskBlock(5000);
-        }
+    pCompressBuffer = (uint8_t *)pUPortMalloc(MQTT_COMPRESS_PAYLOAD_MAX);
+    if (pCompressBuffer == NULL) {
+        writeError("Failed to allocate the MQTT compressed payload buffer");
+        return U_ERROR_COMMON_NO_MEMORY;
     }
 
-    if (errorCode != 0 ) {
-        if (!gExitApp)
-            writeError("Subscribing a callback to topic %s failed with error code %d", topicCallback->topicName, errorCode);
+    return U_ERROR_COMMON_SUCCESS;
+}
 
-        goto cleanUp;
-    }
+static int32_t initInflight()
+{
+    int32_t errorCode = initMqttInflight();
+    if (errorCode < 0 || !mqttInflightEnabled())
+        return errorCode;
 
-    writeInfo("Subscribed to callback topic: %s", topicCallback->topicName);
-    if (topicCallback->numCallbacks > 0) {
-        printInfo("With these commands:");
-        for(int i=0; i<topicCallback->numCallbacks; i++)
-            printInfo("    %d: %s", i+1, topicCallback->callbacks[i].command);
-        printInfo("");
-    } else {
-        printWarn("Warning - there are no commands to listen to on this subscription!");
-    }
+    inflightTimerHandle = schedulerAdd("MQTTInflight", checkInflight, NULL,
+                                       MQTT_INFLIGHT_CHECK_MS, MQTT_INFLIGHT_CHECK_MS);
+    if (inflightTimerHandle < 0)
+        return inflightTimerHandle;
 
-cleanUp:
-    uPortTaskDelete(NULL);
+    return U_ERROR_COMMON_SUCCESS;
 }
 
-static int32_t registerSNShortName(const char *topicName, uMqttSnTopicName_t **snShortName)
+static int32_t initJournal()
 {
-    int32_t errorCode = U_ERROR_COMMON_NO_MEMORY;
+    // without the journal the messages are dropped while offline, as before
+    if (initMqttJournal() < 0 || !mqttJournalEnabled())
+        return U_ERROR_COMMON_SUCCESS;
 
-    // allocate the memory for the sn Topic Name structure
-    *snShortName = (uMqttSnTopicName_t *)malloc(sizeof(uMqttSnTopicName_t));
-    if (*snShortName == NULL) {
-        writeError("registerSNShortName(): snShortName memory allocation");
-        goto cleanUp;
-    }
+    journalTimerHandle = schedulerAdd("MQTTJournal", checkJournal, NULL,
+                                      MQTT_JOURNAL_REPLAY_PERIOD_MS, MQTT_JOURNAL_REPLAY_PERIOD_MS);
+    if (journalTimerHandle < 0)
+        return journalTimerHandle;
 
-    // register the topic name with the MQTT-SN gateway
-    errorCode = uMqttClientSnRegisterNormalTopic(pContext, topicName, *snShortName);
-    if (errorCode != 0) {
-        writeError("registerSNShortName(): Register Normal Topic '%s': %d", topicName, errorCode);
-        goto cleanUp;
-    }
+    return U_ERROR_COMMON_SUCCESS;
+}
 
-    errorCode = U_ERROR_COMMON_SUCCESS;
+static int32_t initBatching()
+{
+    bool isMqttSN = false;
+    setBoolParamFromConfig("MQTT_TYPE", "MQTT-SN", &isMqttSN);
 
-cleanUp:
-    if (errorCode != 0) {
-        uPortFree(*snShortName);
-        *snShortName = NULL;
-    }
+    int32_t count = initMqttBatch(mqttPublishMessage, isMqttSN);
+    if (count <= 0)
+        return count;
 
-    return errorCode;
+    batchTimerHandle = schedulerAdd("MQTTBatch", checkBatches, NULL, MQTT_BATCH_CHECK_MS, MQTT_BATCH_CHECK_MS);
+    if (batchTimerHandle < 0)
+        return batchTimerHandle;
+
+    return U_ERROR_COMMON_SUCCESS;
 }
 
-static int32_t getMqttSNTopicName(const char *topicName, uMqttSnTopicName_t **snShortName)
+/// @brief Subscribes to a topic, keeping the MQTT-SN short name the
+///        gateway gives it for the downlink messages
+/// @param topic The topic's handle
+/// @param qos The QoS to subscribe with
+/// @return 0 on success, negative on failure
+static int32_t subscribeTopic(mqttTopicHandle_t topic, uMqttQos_t qos)
 {
-    mqttSNTopicNameNode_t *currentNode = mqttSNTopicNameList;
-
-    // check if the short name has already been registered?
-    while(currentNode != NULL) {
-        if(strcmp(currentNode->topicName, topicName) == 0) {
-            *snShortName = currentNode->snShortName;
-            return U_ERROR_COMMON_SUCCESS;
-        }
-
-        currentNode = currentNode->next;
-    }
+    const char *topicName = mqttTopicName(topic);
+    int32_t errorCode;
 
-    // Create a new topicName/shortName node and register the topic with the MQTT-SN gateway
-    int32_t errorCode = U_ERROR_COMMON_NO_MEMORY;
-    mqttSNTopicNameNode_t *newNode = (mqttSNTopicNameNode_t *)malloc(sizeof(mqttSNTopicNameNode_t));
-    if (newNode == NULL) {
-        writeError("getMqttSNTopicName(): newNode memory allocation");
-        goto cleanUp;
-    }
+    if (pContext == NULL || !uMqttClientIsConnected(pContext))
+        return U_ERROR_COMMON_NOT_INITIALISED;
 
-    newNode->topicName = uStrDup(topicName);
-    if (newNode->topicName == NULL) {
-        writeError("getMqttSNTopicName(): topicName memory allocation");
-        goto cleanUp;
+    if (mqttSN) {
+        uMqttSnTopicName_t shortName;
+        AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientSnSubscribeNormalTopic(pContext, topicName,
+                                                                qos, &shortName));
+        if (errorCode >= 0)
+            mqttTopicSetShortName(topic, &shortName);
+    } else {
+        AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientSubscribe(pContext, topicName, qos));
     }
 
-    errorCode = registerSNShortName(topicName, snShortName);
-    if (errorCode < 0)
-        goto cleanUp;
+    return errorCode;
+}
 
-    // add it to the linked list
-    newNode->snShortName = *snShortName;
-    newNode->next = mqttSNTopicNameList;
-    mqttSNTopicNameList = newNode;
+static int32_t getTopicShortName(mqttTopicHandle_t topic, uMqttSnTopicName_t *pShortName)
+{
+    if (mqttTopicGetShortName(topic, pShortName))
+        return U_ERROR_COMMON_SUCCESS;
 
-    errorCode = U_ERROR_COMMON_SUCCESS;
+    const char *topicName = mqttTopicName(topic);
+    if (topicName == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
 
-cleanUp:
+    // register the topic name with the MQTT-SN gateway
+    int32_t errorCode;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uMqttClientSnRegisterNormalTopic(pContext, topicName, pShortName));
     if (errorCode != 0) {
-        uPortFree(newNode->topicName);
-        uPortFree(newNode);
+        writeError("getTopicShortName(): Register Normal Topic '%s': %d", topicName, errorCode);
+        return errorCode;
     }
 
-    return errorCode;
+    mqttTopicSetShortName(topic, pShortName);
+
+    return U_ERROR_COMMON_SUCCESS;
 }
 
 static void setSecuritySettings(void)
@@ -679,6 +834,20 @@ static void setSecuritySettings(void)
     tlsSettings.pSni = server_name_ind;
 }
 
+/// @brief Reads the connection parameters, and asks the registration task
+///        to say when the network comes up
+static int32_t initReconnect(void)
+{
+    int32_t errorCode = initMqttReconnect();
+    if (errorCode < 0)
+        return errorCode;
+
+    mqttSN = mqttReconnectConnection()->mqttSn;
+    registerNetworkUpCallback(networkUpHandler);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
 static int32_t initMQTTClient(void)
 {
     int32_t errorCode = U_ERROR_COMMON_SUCCESS;
@@ -690,6 +859,12 @@ static int32_t initMQTTClient(void)
         goto cleanUp;
     }
 
+    errorCode = uPortMutexCreate(&contextMutex);
+    if (errorCode != 0) {
+        writeFatal("Failed to create the MQTT client mutex: %d", errorCode);
+        goto cleanUp;
+    }
+
     bool security = false;
     setBoolParamFromConfig("MQTT_SECURITY", "TRUE", &security);
     if (security) {
@@ -709,6 +884,11 @@ cleanUp:
     if (errorCode != 0) {
         uPortFree(downlinkMessage);
         downlinkMessage = NULL;
+
+        if (contextMutex != NULL) {
+            uPortMutexDelete(contextMutex);
+            contextMutex = NULL;
+        }
     }
 
     return errorCode;
@@ -722,145 +902,193 @@ static int32_t _getNextId(void)
     return messageCounter++;
 }
 
+static void journalMessage(const char *pMessage, const sendMQTTMsg_t *pMsg)
+{
+    const char *pTopicName = mqttTopicName(pMsg->topic);
+    if (pTopicName == NULL) {
+        writeWarn("Not journalling MQTT message #%d, topic name not found", pMsg->id);
+        return;
+    }
+
+    if (mqttJournalStore(pTopicName, pMessage, pMsg->length, pMsg->QoS, pMsg->retain) == 0)
+        writeDebug("Journalled MQTT message #%d", pMsg->id);
+}
+
+static int32_t publishJournalled(const char *pTopicName, const char *pMessage, size_t length, uMqttQos_t QoS, bool retain)
+{
+    mqttTopicHandle_t topic = mqttTopicRegister(pTopicName);
+    if (topic < 0)
+        return topic;
+
+    return publishToBroker(topic, pMessage, length, QoS, retain, _getNextId());
+}
+
+/// @brief Keeps a message which can't be queued for the MQTT task in the
+///        journal, when it is enabled
+/// @return 0 if the message was journalled, otherwise the error code
+static int32_t storeOffline(const char *pTopicName, const void *pData, size_t length, uMqttQos_t QoS, bool retain, int32_t errorCode)
+{
+    if (mqttJournalEnabled() && mqttJournalStore(pTopicName, pData, length, QoS, retain) == 0)
+        errorCode = U_ERROR_COMMON_SUCCESS;
+
+    metricsRecordPublish(taskConfig, errorCode == 0);
+
+    return errorCode;
+}
+
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
 
-/// @brief Subscribes a callback function to a topic, waiting for the MQTT task to be online first
+/// @brief Adds a topic to the subscriptions, with the callbacks of its
+///        commands. The MQTT task subscribes to it once it is connected,
+///        and again each time it connects.
 /// @param taskTopicName The topic name to subscribe to. Appends the serial number
 /// @param qos The Quality of Service to use for the subscription
 /// @param callbacks The callbacks this topic is going to be used for
 int32_t subscribeToTopicAsync(const char *taskTopicName, uMqttQos_t qos, callbackCommand_t *callbacks, int32_t numCallbacks)
 {
-    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
-    uPortTaskHandle_t handle;
-    topicCallback_t *topicCallbackInfo = NULL;
-    char *topicName = NULL;
-
-    topicCallbackInfo = (topicCallback_t *) pUPortMalloc(sizeof(topicCallback_t));
-    if (topicCallbackInfo == NULL) {
-        writeError("Failed to create topicCallback - not enough memory");
-        errorCode = U_ERROR_COMMON_NO_MEMORY;
-        goto cleanUp;
-    }
+    // the tasks are initialised at the same time, so this can't be a static buffer
+    char tempTopicName[TEMP_TOPIC_NAME_SIZE+1];
 
     snprintf(tempTopicName, TEMP_TOPIC_NAME_SIZE, "%s/%s/%s", gAppTopicHeader, gModuleSerial, taskTopicName);
-    topicName = uStrDup(tempTopicName);
-    if (topicName == NULL) {
-        writeError("Failed to create task topic name - not enough memory");
-        errorCode = U_ERROR_COMMON_NO_MEMORY;
-        goto cleanUp;
+    mqttTopicHandle_t topic = mqttTopicRegister(tempTopicName);
+    if (topic < 0) {
+        writeError("Failed to register task topic name: %d", topic);
+        return topic;
     }
 
-    topicCallbackInfo->topicName = topicName;
-    topicCallbackInfo->qos = qos;
-    topicCallbackInfo->numCallbacks = numCallbacks;
-    topicCallbackInfo->callbacks = callbacks;
-
-    errorCode = uPortTaskCreate(subscribeToTopic, NULL, 2048, (void *)topicCallbackInfo, 5, &handle);
-    if (errorCode != 0) {
-        writeError("Can't start topic subscription on %s: %d", taskTopicName, errorCode);
-        goto cleanUp;
+    int32_t errorCode = mqttSubscriptionAdd(topic, qos, callbacks, numCallbacks);
+    if (errorCode < 0) {
+        writeError("Can't subscribe to %s with %d commands: %d", taskTopicName, numCallbacks, errorCode);
+        return errorCode;
     }
 
-cleanUp:
-    if (errorCode != 0) {
-        uPortFree(topicCallbackInfo);
-        topicCallbackInfo = NULL;
+    // the MQTT task may not be initialised yet, in which case it subscribes when it connects
+    subscribeRequested = true;
+    signalTask(taskConfig);
 
-        uPortFree(topicName);
-        topicName = NULL;
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Puts a message on to the MQTT publish queue, registering the
+///        topic first. Publishing with publishMQTTMessageToTopic() and the
+///        handle of a registered topic saves finding the topic each time.
+/// @param pTopicName a pointer to the topic name
+/// @param pMessage a pointer to the message text which is copied
+/// @param QoS the Quality of Service value for this message
+/// @param retain If the message should be retained
+/// @return 0 if successfully queued for the MQTT task
+int32_t publishMQTTMessage(const char *pTopicName, const char *pMessage, uMqttQos_t QoS, bool retain)
+{
+    mqttTopicHandle_t topic = mqttTopicRegister(pTopicName);
+    if (topic < 0) {
+        writeError("Not publishing MQTT message, failed to register the topic: %d", topic);
+        metricsRecordPublish(taskConfig, false);
+        return topic;
     }
 
-    return errorCode;
+    return publishMQTTMessageToTopic(topic, pMessage, QoS, retain, MQTT_LANE_TELEMETRY);
 }
 
 /// @brief Puts a message on to the MQTT publish queue
-/// @param pTopicName a pointer to the topic name which is copied
+/// @param topic the handle of the registered topic
 /// @param pMessage a pointer to the message text which is copied
 /// @param QoS the Quality of Service value for this message
 /// @param retain If the message should be retained
-/// @return 0 if successfully queued on the event queue
-int32_t publishMQTTMessage(const char *pTopicName, const char *pMessage, uMqttQos_t QoS, bool retain)
+/// @param lane The priority lane the message waits on
+/// @return 0 if successfully queued for the MQTT task
+int32_t publishMQTTMessageToTopic(mqttTopicHandle_t topic, const char *pMessage, uMqttQos_t QoS, bool retain, mqttLane_t lane)
 {
-    // if the event queue handle is not valid, don't send the message
+    return publishMQTTDataToTopic(topic, pMessage, strlen(pMessage), QoS, retain, lane);
+}
+
+/// @brief Puts a message which may not be text, like a CBOR payload, on to
+///        the MQTT publish queue
+/// @param topic the handle of the registered topic
+/// @param pData a pointer to the message which is copied
+/// @param length the length of the message
+/// @param QoS the Quality of Service value for this message
+/// @param retain If the message should be retained
+/// @param lane The priority lane the message waits on
+/// @return 0 if successfully queued for the MQTT task
+int32_t publishMQTTDataToTopic(mqttTopicHandle_t topic, const void *pData, size_t length, uMqttQos_t QoS, bool retain, mqttLane_t lane)
+{
+    // if the message bus handle is not valid, don't send the message
     if (TASK_QUEUE < 0) {
-        writeDebug("Not publishing MQTT message, MQTT Event Queue handle is not valid");
+        writeDebug("Not publishing MQTT message, MQTT message bus handle is not valid");
         return U_ERROR_COMMON_NOT_INITIALISED;
     }
 
+    const char *pTopicName = mqttTopicName(topic);
+    if (pTopicName == NULL) {
+        writeError("Not publishing MQTT message, topic #%d is not registered", topic);
+        metricsRecordPublish(taskConfig, false);
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+    }
+
     if (!TASK_IS_RUNNING) {
         writeDebug("Not publishing MQTT message, MQTT Task not running yet");
-        return U_ERROR_COMMON_NOT_INITIALISED;
+        return storeOffline(pTopicName, pData, length, QoS, retain, U_ERROR_COMMON_NOT_INITIALISED);
     }
 
     if (!IS_NETWORK_AVAILABLE) {
         writeDebug("Not publishing MQTT message, Network is not available at the moment");
-        return U_ERROR_COMMON_TEMPORARY_FAILURE;
+        return storeOffline(pTopicName, pData, length, QoS, retain, U_ERROR_COMMON_TEMPORARY_FAILURE);
     }
 
-    if (pContext == NULL || !uMqttClientIsConnected(pContext)) {
+    if (!isConnected()) {
         writeDebug("Not publishing MQTT message, not connected to %s", MQTT_TYPE_NAME);
         tryToConnectMQTT = true;
-        return U_ERROR_COMMON_NOT_INITIALISED;
+        signalTask(taskConfig);
+        return storeOffline(pTopicName, pData, length, QoS, retain, U_ERROR_COMMON_NOT_INITIALISED);
     }
 
-    if (!isNotExiting()) return U_ERROR_COMMON_BUSY;
+    if (!isNotExiting()) {
+        metricsRecordPublish(taskConfig, false);
+        return U_ERROR_COMMON_BUSY;
+    }
 
     int32_t errorCode = U_ERROR_COMMON_SUCCESS;
 
-    mqttMsg_t qMsg;
-    qMsg.msgType = SEND_MQTT_MESSAGE;
-
-    bool failed = false;
-    failed = STRCOPYTO(qMsg.msg.message.pMessage, pMessage);
-    if (!failed && mqttSN) {
-        uMqttSnTopicName_t *snShortName;
-        if (getMqttSNTopicName(pTopicName, &snShortName) < 0) {
-            writeError("Not publishing MQTT-SN message, failed to get/register MQTT-SN Topic Name.");
-            goto cleanUp;
-        }
+    sendMQTTMsg_t msg;
+    msg.topic = topic;
+    msg.length = length;
 
-        failed = MEMCOPYTO(qMsg.msg.message.topic.pShortName, snShortName, sizeof(uMqttSnTopicName_t));
-    } else {
-        failed = STRCOPYTO(qMsg.msg.message.topic.pTopicName, pTopicName);
-    }
-
-    if (failed) {
+    // the copy is terminated, so a text message can be used as a string
+    msg.message = mqttPoolAlloc(length + 1);
+    if (msg.message < 0) {
         errorCode = U_ERROR_COMMON_NO_MEMORY;
-        writeError("Not publishing MQTT message, failed to allocate memory for message.");
+        writeError("Not publishing MQTT message, no free MQTT pool block for the message.");
         goto cleanUp;
     }
 
-    qMsg.msg.message.QoS = QoS;
-    qMsg.msg.message.retain = retain;
-    qMsg.msg.message.id = _getNextId();
+    char *pCopy = (char *)mqttPoolGet(msg.message);
+    memcpy(pCopy, pData, length);
+    pCopy[length] = 0;
 
-    errorCode = uPortEventQueueSendIrq(TASK_QUEUE, &qMsg, sizeof(mqttMsg_t));
-
-    // On systems which don't support IRQs (Windows/Raspberry PI) try the non-irq version
-    if (errorCode == U_ERROR_COMMON_NOT_SUPPORTED) {
-        errorCode = uPortEventQueueSend(TASK_QUEUE, &qMsg, sizeof(mqttMsg_t));
-    }
+    msg.QoS = QoS;
+    msg.retain = retain;
+    msg.id = _getNextId();
+    msg.batch = mqttTopicBatch(topic);
+    msg.queuedMs = uPortGetTickTimeMs();
 
+    bool wake;
+    errorCode = mqttLanePush(lane, &msg, &wake);
     if (errorCode != 0) {
-        writeInfo("Failed queueing MQTT message #%d, errorCode: %d", qMsg.msg.message.id, errorCode);
+        writeInfo("Failed queueing MQTT message #%d on the %s lane, errorCode: %d", msg.id, mqttLaneName(lane), errorCode);
         goto cleanUp;
     }
 
+    // the message is on the lane, and is published when the task is next asked
+    if (wake)
+        wakeLanes();
+
 cleanUp:
-    if (errorCode != 0) {
-        if (mqttSN) {
-            uPortFree(qMsg.msg.message.topic.pShortName);
-            qMsg.msg.message.topic.pShortName = NULL;
-        } else {
-            uPortFree(qMsg.msg.message.topic.pTopicName);
-            qMsg.msg.message.topic.pTopicName = NULL;
-        }
+    if (errorCode != 0)
+        mqttPoolFree(msg.message);
 
-        uPortFree(qMsg.msg.message.pMessage);
-        qMsg.msg.message.pMessage = NULL;
-    }
+    metricsRecordPublish(taskConfig, errorCode == 0);
 
     return errorCode;
 }
@@ -879,7 +1107,15 @@ int32_t initMQTTTask(taskConfig_t *config)
     writeInfo("Initializing the %s task...", TASK_NAME);
     EXIT_ON_FAILURE(initMutex);
     EXIT_ON_FAILURE(initQueue);
+    EXIT_ON_FAILURE(initReconnect);
     EXIT_ON_FAILURE(initMQTTClient);
+    EXIT_ON_FAILURE(initMqttPool);
+    EXIT_ON_FAILURE(initCompress);
+    EXIT_ON_FAILURE(initMqttLanes);
+    EXIT_ON_FAILURE(initMqttLatency);
+    EXIT_ON_FAILURE(initInflight);
+    EXIT_ON_FAILURE(initBatching);
+    EXIT_ON_FAILURE(initJournal);
 
     return result;
 }
@@ -892,14 +1128,16 @@ int32_t startMQTTTaskLoop(commandParamsList_t *params)
 
     int32_t errorCode = U_ERROR_COMMON_SUCCESS;
 
+    setTaskState(taskConfig, TASK_STARTING);
     errorCode = uPortTaskCreate(runTaskAndDelete,
                                 TASK_NAME,
-                                MQTT_TASK_STACK_SIZE,
+                                TASK_STACK_SIZE,
                                 taskLoop,
-                                MQTT_TASK_PRIORITY,
+                                TASK_PRIORITY,
                                 &TASK_HANDLE);
     if (errorCode != 0) {
         writeError("Failed to start the %s Task (%d).", TASK_NAME, errorCode);
+        setTaskState(taskConfig, TASK_STOPPED);
     }
 
     return errorCode;
@@ -912,5 +1150,55 @@ int32_t stopMQTTTaskLoop(commandParamsList_t *params)
 
 int32_t finalizeMQTTTask(void)
 {
+    if (batchTimerHandle >= 0) {
+        schedulerRemove(batchTimerHandle);
+        batchTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+    }
+
+    if (journalTimerHandle >= 0) {
+        schedulerRemove(journalTimerHandle);
+        journalTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+    }
+
+    if (inflightTimerHandle >= 0) {
+        schedulerRemove(inflightTimerHandle);
+        inflightTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+    }
+
     return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Journals the messages not published yet, and frees the lanes,
+///        in-flight window, batches, journal, compression and message pool.
+///        Called once the message bus, task job pool and scheduler have
+///        stopped, as their handlers, jobs and timers publish.
+void finalizeMqttPublishing(void)
+{
+    // the messages not published yet go in the journal
+    sendMQTTMsg_t msg;
+    while (mqttInflightTakeAny(&msg))
+        handBackMessage(msg);
+
+    finalizeMqttInflight();
+
+    while (mqttLanePop(&msg))
+        mqttPublishMessage(msg);
+
+    finalizeMqttLanes();
+
+    mqttBatchFlush(true);
+    finalizeMqttBatch();
+
+    finalizeMqttLatency();
+    finalizeMqttCompress();
+    uPortFree(pCompressBuffer);
+    pCompressBuffer = NULL;
+    finalizeMqttJournal();
+    finalizeMqttReconnect();
+    finalizeMqttPool();
+
+    if (contextMutex != NULL) {
+        uPortMutexDelete(contextMutex);
+        contextMutex = NULL;
+    }
 }
\ No newline at end of file
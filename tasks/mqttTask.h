@@ -23,6 +23,20 @@
 #define _MQTT_TASK_H_
 
 #include "taskControl.h"
+#include "slabPool.h"
+#include "mqttTopics.h"
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief The priority lanes of the MQTT publish queue. The MQTT task
+///        always publishes the messages of a higher lane first.
+typedef enum {
+    MQTT_LANE_CONTROL,          // Command replies, alerts and status
+    MQTT_LANE_TELEMETRY,        // Periodic measurements
+    MQTT_LANE_BULK,             // Large reports, like cell scans and metrics
+    MQTT_LANE_COUNT
+} mqttLane_t;
 
 /* ----------------------------------------------------------------
  * COMMON TASK FUNCTIONS
@@ -32,11 +46,16 @@ int32_t startMQTTTaskLoop(commandParamsList_t *params);
 int32_t stopMQTTTaskLoop(commandParamsList_t *params);
 int32_t finalizeMQTTTask(void);
 
+/// @brief Journals the messages not published yet and frees the publishing
+///        buffers. Called after the message bus, task job pool and scheduler
+///        have stopped.
+void finalizeMqttPublishing(void);
+
 /* ----------------------------------------------------------------
  * TASK FUNCTIONS
  * -------------------------------------------------------------- */
 
-/// @brief Publishes an MQTT message to a specified topic
+/// @brief Publishes an MQTT message to a specified topic, on the telemetry lane
 /// @param pTopicName   The topic to publish the 
 /// @param pMessage     The message string to publish
 /// @param QoS          QoS value for the publishing to use
@@ -44,7 +63,28 @@ int32_t finalizeMQTTTask(void);
 /// @return             Returns 0 on success, or negative on failure
 int32_t publishMQTTMessage(const char *pTopicName, const char *pMessage, uMqttQos_t QoS, bool retain);
 
-/// @brief Subscribe a callback function to a topic
+/// @brief Publishes an MQTT message to a topic registered with mqttTopicRegister()
+/// @param topic        The topic's handle
+/// @param pMessage     The message string to publish
+/// @param QoS          QoS value for the publishing to use
+/// @param retain       A flag to indicate whether the message is to be retained
+/// @param lane         The priority lane the message waits on
+/// @return             Returns 0 on success, or negative on failure
+int32_t publishMQTTMessageToTopic(mqttTopicHandle_t topic, const char *pMessage, uMqttQos_t QoS, bool retain, mqttLane_t lane);
+
+/// @brief Publishes an MQTT message which may not be text, like a CBOR
+///        payload, to a topic registered with mqttTopicRegister()
+/// @param topic        The topic's handle
+/// @param pData        The message to publish
+/// @param length       The length of the message
+/// @param QoS          QoS value for the publishing to use
+/// @param retain       A flag to indicate whether the message is to be retained
+/// @param lane         The priority lane the message waits on
+/// @return             Returns 0 on success, or negative on failure
+int32_t publishMQTTDataToTopic(mqttTopicHandle_t topic, const void *pData, size_t length, uMqttQos_t QoS, bool retain, mqttLane_t lane);
+
+/// @brief Subscribe a callback function to a topic. The MQTT task
+///        subscribes to it when it connects, and again on every reconnect.
 /// @param taskTopicName    The topic to subscribe to
 /// @param qos              QoS value for the publishing to use
 /// @param callbacks        List of callbacks to be used for this subscription
@@ -56,32 +96,35 @@ int32_t subscribeToTopicAsync(const char *taskTopicName, uMqttQos_t qos, callbac
  * QUEUE MESSAGE TYPE DEFINITIONS
  * -------------------------------------------------------------- */
 typedef enum {
-    SEND_MQTT_MESSAGE,          // Sends a MQTT message
+    PUBLISH_MQTT_LANES,         // Publishes the messages waiting on the lanes
+    FLUSH_MQTT_BATCHES,         // Publishes the batches whose window has passed
+    REPLAY_MQTT_JOURNAL,        // Publishes the next journalled messages
+    RETRY_MQTT_INFLIGHT,        // Sends the unacknowledged messages again, or hands them back
 } mqttMsgType_t;
 
-/// @brief MQTT message to send. Handles both MQTT and MQTT-SN topic name types
+/// @brief MQTT message to send. The topic is resolved to its MQTT topic name
+///        or MQTT-SN short name when it is published.
 typedef struct SEND_MQTT_MESSAGE {
-    union {
-        char *pTopicName;
-        uMqttSnTopicName_t *pShortName;
-    } topic;
+    mqttTopicHandle_t topic;    // The registered topic
 
-    char *pMessage;     // A pointer to the string  of the message
+    slabHandle_t message;       // The pool block with the message, followed by a terminator
+
+    size_t length;              // The length of the message, which may not be text
 
     uMqttQos_t QoS;     // Quality of Service for this message 
 
     bool retain;        // If the message needs to be a retained message on the broker
 
     int32_t id;         // The message id is auto-generated by the PublishMsg API call
+
+    int32_t batch;      // The topic's batch, or negative if the topic is not batched
+
+    int32_t queuedMs;   // When the message was published, for its delivery latency
 } sendMQTTMsg_t;
 
 /// @brief Queue message structure for send any type of message to the MQTT application task
 typedef struct MQTT_QUEUE_MESSAGE {
     mqttMsgType_t msgType;
-
-    union {
-        sendMQTTMsg_t message;
-    } msg;
 } mqttMsg_t;
 
 #endif
\ No newline at end of file
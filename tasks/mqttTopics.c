@@ -0,0 +1,505 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Topics - each task publishes to the same topic every time, so it
+ * registers the topic name once and publishes with the handle it gets
+ * back. The name, the MQTT-SN short name, the MQTT batch and the
+ * compression of a topic are found once and kept with it, so publishing
+ * doesn't copy or compare topic names. A topic's name never changes once
+ * it is registered, so it can be read without locking the registry.
+ * A topic listed in MQTT_CBOR_TOPICS has its payloads encoded as CBOR
+ * instead of JSON, and one listed in MQTT_QOS_TOPICS is published with
+ * the QoS given there instead of QoS 0.
+ *
+ * Topics are found by name, and by MQTT-SN short name id for downlink
+ * messages, with two small open addressed hash indexes of the handles.
+ * The short name ids only last for the gateway session, so they are
+ * all forgotten when the MQTT task connects again and registers them.
+ *
+ */
+
+#include "common.h"
+#include "mqttTopics.h"
+#include "mqttBatch.h"
+#include "mqttCompress.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+// The topic's batch or compression hasn't been looked for yet
+#define BATCH_NOT_FOUND_YET         (-1000)
+#define COMPRESS_NOT_FOUND_YET      (-1000)
+
+// The hash indexes are at most half full, and a power of two in size
+#define INDEX_SIZE                  (MQTT_MAX_TOPICS * 2)
+#define INDEX_MASK                  (INDEX_SIZE - 1)
+
+// An empty slot of a hash index, the slots hold handle + 1
+#define INDEX_EMPTY                 0
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct MQTT_TOPIC {
+    char name[MAX_TOPIC_NAME_SIZE];
+    int32_t batch;
+    int32_t compress;
+    mqttTopicPolicy_t policy;
+    mqttTopicFormat_t format;
+    uMqttQos_t qos;
+    bool qosListed;             // The QoS is from MQTT_QOS_TOPICS, so the task can't change it
+
+    bool hasShortName;
+    bool wasRegistered;         // Had a short name in an earlier session
+    uMqttSnTopicName_t shortName;
+} mqttTopic_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t topicsMutex = NULL;
+
+static mqttTopic_t topics[MQTT_MAX_TOPICS];
+static volatile int32_t topicCount = 0;
+
+static uint8_t nameIndex[INDEX_SIZE];
+static uint8_t shortIdIndex[INDEX_SIZE];
+
+static mqttTopicStats_t stats;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+static mqttTopic_t *getTopic(mqttTopicHandle_t topic)
+{
+    if (topic < 0 || topic >= topicCount)
+        return NULL;
+
+    return &topics[topic];
+}
+
+/// @brief FNV-1a hash of a topic name
+static uint32_t hashName(const char *pTopicName)
+{
+    uint32_t hash = 2166136261u;
+    while (*pTopicName != 0)
+        hash = (hash ^ (uint8_t)*pTopicName++) * 16777619u;
+
+    return hash;
+}
+
+static uint32_t hashShortId(uint16_t id)
+{
+    return (uint32_t)id * 2654435761u >> 16;
+}
+
+/// @brief Finds a topic by name, with the registry locked
+/// @return The topic's handle, or U_ERROR_COMMON_NOT_FOUND
+static mqttTopicHandle_t findByName(const char *pTopicName)
+{
+    for (uint32_t slot = hashName(pTopicName) & INDEX_MASK; nameIndex[slot] != INDEX_EMPTY; slot = (slot + 1) & INDEX_MASK) {
+        mqttTopicHandle_t topic = nameIndex[slot] - 1;
+        if (strcmp(topics[topic].name, pTopicName) == 0)
+            return topic;
+    }
+
+    return U_ERROR_COMMON_NOT_FOUND;
+}
+
+static void addToIndex(uint8_t *pIndex, uint32_t hash, mqttTopicHandle_t topic)
+{
+    uint32_t slot = hash & INDEX_MASK;
+    while (pIndex[slot] != INDEX_EMPTY)
+        slot = (slot + 1) & INDEX_MASK;
+
+    pIndex[slot] = (uint8_t)(topic + 1);
+}
+
+/// @brief Finds the last part of a topic name in a list of the app.conf
+///        file, whose entries can have a value after a colon
+/// @param pList The comma separated list, or NULL
+/// @return The topic's entry in the list, or NULL if it isn't listed
+static const char *findListed(const char *pList, const char *pTopicName)
+{
+    const char *pName = strrchr(pTopicName, '/');
+    pName = pName == NULL ? pTopicName : pName + 1;
+    size_t nameLength = strlen(pName);
+
+    const char *pEntry;
+    size_t length;
+    while ((pEntry = nextListEntry(&pList, &length)) != NULL) {
+        // the name ends at the colon of an entry with a value
+        const char *pColon = memchr(pEntry, ':', length);
+        if (pColon != NULL)
+            length = pColon - pEntry;
+
+        if (length == nameLength && strncmp(pEntry, pName, length) == 0)
+            return pEntry;
+    }
+
+    return NULL;
+}
+
+/// @brief Checks if the last part of a topic name is in a list of the
+///        app.conf file
+/// @param pList The comma separated list, or NULL
+static bool isListed(const char *pList, const char *pTopicName)
+{
+    return findListed(pList, pTopicName) != NULL;
+}
+
+/// @brief Gets the QoS of a topic from MQTT_QOS_TOPICS in the app.conf
+///        file. A topic listed without a QoS, like SignalQuality, is QoS 1.
+/// @return The topic's QoS, or negative if it isn't listed
+static int32_t getListedQoS(const char *pTopicName)
+{
+    const char *pEntry = findListed(getConfig("MQTT_QOS_TOPICS"), pTopicName);
+    if (pEntry == NULL)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    const char *pValue = pEntry + strcspn(pEntry, ":, \t\r");
+    if (*pValue != ':')
+        return U_MQTT_QOS_AT_LEAST_ONCE;
+
+    int32_t qos = atoi(pValue + 1);
+    if (qos < U_MQTT_QOS_AT_MOST_ONCE || qos > U_MQTT_QOS_EXACTLY_ONCE) {
+        writeWarn("MQTT_QOS_TOPICS has QoS %d for %s, using QoS 0", qos, pTopicName);
+        return U_MQTT_QOS_AT_MOST_ONCE;
+    }
+
+    return (uMqttQos_t)qos;
+}
+
+/// @brief Makes the short name id index again, as a topic's id changed
+static void rebuildShortIdIndex(void)
+{
+    memset(shortIdIndex, INDEX_EMPTY, sizeof(shortIdIndex));
+    for (int32_t i=0; i<topicCount; i++) {
+        if (topics[i].hasShortName)
+            addToIndex(shortIdIndex, hashShortId(topics[i].shortName.name.id), i);
+    }
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the topic registry, before the tasks are initialised
+/// @return 0 on success, negative on failure
+int32_t initMqttTopics(void)
+{
+    int32_t errorCode = uPortMutexCreate(&topicsMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the MQTT topics mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Frees the topic registry
+void finalizeMqttTopics(void)
+{
+    if (topicsMutex == NULL)
+        return;
+
+    uPortMutexDelete(topicsMutex);
+    topicsMutex = NULL;
+    topicCount = 0;
+
+    memset(nameIndex, INDEX_EMPTY, sizeof(nameIndex));
+    memset(shortIdIndex, INDEX_EMPTY, sizeof(shortIdIndex));
+    memset(&stats, 0, sizeof(stats));
+}
+
+/// @brief Registers a topic, or finds it if it is already registered
+/// @param pTopicName The full topic name, which is copied
+/// @return The topic's handle, or negative on failure
+mqttTopicHandle_t mqttTopicRegister(const char *pTopicName)
+{
+    if (topicsMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (pTopicName == NULL || strlen(pTopicName) >= MAX_TOPIC_NAME_SIZE)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    mqttTopicHandle_t topic = U_ERROR_COMMON_NOT_FOUND;
+    bool cbor = isListed(getConfig("MQTT_CBOR_TOPICS"), pTopicName);
+    int32_t qos = getListedQoS(pTopicName);
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    topic = findByName(pTopicName);
+    if (topic < 0 && topicCount < MQTT_MAX_TOPICS) {
+        mqttTopic_t *pTopic = &topics[topicCount];
+        memset(pTopic, 0, sizeof(mqttTopic_t));
+        strcpy(pTopic->name, pTopicName);
+        pTopic->batch = BATCH_NOT_FOUND_YET;
+        pTopic->compress = COMPRESS_NOT_FOUND_YET;
+        pTopic->policy = MQTT_POLICY_REJECT;
+        pTopic->format = cbor ? MQTT_FORMAT_CBOR : MQTT_FORMAT_JSON;
+        pTopic->qos = qos < 0 ? U_MQTT_QOS_AT_MOST_ONCE : (uMqttQos_t)qos;
+        pTopic->qosListed = qos >= 0;
+
+        // the topic is filled in before it is counted, for the readers
+        topic = topicCount++;
+        addToIndex(nameIndex, hashName(pTopicName), topic);
+    }
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+
+    if (topic < 0)
+        writeError("Only %d MQTT topics can be registered, not registering %s", MQTT_MAX_TOPICS, pTopicName);
+
+    return topic < 0 ? U_ERROR_COMMON_NO_MEMORY : topic;
+}
+
+/// @brief Finds a registered topic by name, without registering it
+/// @param pTopicName The full topic name
+/// @return The topic's handle, or negative if it isn't registered
+mqttTopicHandle_t mqttTopicFind(const char *pTopicName)
+{
+    if (topicsMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (pTopicName == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    mqttTopicHandle_t topic;
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    topic = findByName(pTopicName);
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+
+    return topic;
+}
+
+/// @brief Finds a topic by the id of its MQTT-SN short name
+/// @param id The short name's id, from a downlink message
+/// @return The topic's handle, or negative if no topic has the id
+mqttTopicHandle_t mqttTopicFindByShortId(uint16_t id)
+{
+    if (topicsMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    mqttTopicHandle_t topic = U_ERROR_COMMON_NOT_FOUND;
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    for (uint32_t slot = hashShortId(id) & INDEX_MASK; shortIdIndex[slot] != INDEX_EMPTY && topic < 0; slot = (slot + 1) & INDEX_MASK) {
+        if (topics[shortIdIndex[slot] - 1].shortName.name.id == id)
+            topic = shortIdIndex[slot] - 1;
+    }
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+
+    return topic;
+}
+
+/// @brief Gets the number of registered topics, the handles are 0 to
+///        one less than this
+/// @return The number of registered topics
+int32_t mqttTopicGetCount(void)
+{
+    return topicCount;
+}
+
+/// @brief Gets the name of a topic
+/// @param topic The topic's handle
+/// @return The full topic name, or NULL if the handle isn't valid
+const char *mqttTopicName(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+
+    return pTopic == NULL ? NULL : pTopic->name;
+}
+
+/// @brief Sets what happens to the topic's messages when its lane is full
+/// @param topic The topic's handle
+/// @param policy The policy
+/// @return 0 on success, negative if the handle isn't valid
+int32_t mqttTopicSetPolicy(mqttTopicHandle_t topic, mqttTopicPolicy_t policy)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    pTopic->policy = policy;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Gets what happens to the topic's messages when its lane is full
+/// @param topic The topic's handle
+/// @return The policy, MQTT_POLICY_REJECT if the handle isn't valid
+mqttTopicPolicy_t mqttTopicPolicy(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+
+    return pTopic == NULL ? MQTT_POLICY_REJECT : pTopic->policy;
+}
+
+/// @brief Gets how the topic's payloads are encoded
+/// @param topic The topic's handle
+/// @return The format, MQTT_FORMAT_JSON if the handle isn't valid
+mqttTopicFormat_t mqttTopicFormat(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+
+    return pTopic == NULL ? MQTT_FORMAT_JSON : pTopic->format;
+}
+
+/// @brief Sets the QoS the topic's messages are published with, unless the
+///        topic is listed in MQTT_QOS_TOPICS, which takes precedence
+/// @param topic The topic's handle
+/// @param qos The QoS
+/// @return 0 on success, negative if the handle isn't valid
+int32_t mqttTopicSetQoS(mqttTopicHandle_t topic, uMqttQos_t qos)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    if (!pTopic->qosListed)
+        pTopic->qos = qos;
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Gets the QoS the topic's messages are published with
+/// @param topic The topic's handle
+/// @return The QoS, U_MQTT_QOS_AT_MOST_ONCE if the handle isn't valid
+uMqttQos_t mqttTopicQoS(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+
+    return pTopic == NULL ? U_MQTT_QOS_AT_MOST_ONCE : pTopic->qos;
+}
+
+/// @brief Gets the MQTT batch of a topic, finding it the first time. The
+///        batches are read from the app.conf when the MQTT task starts, so
+///        this must not be called before then.
+/// @param topic The topic's handle
+/// @return The batch index, or negative if the topic is not batched
+int32_t mqttTopicBatch(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    // finding it twice at the same time gives the same answer
+    if (pTopic->batch == BATCH_NOT_FOUND_YET)
+        pTopic->batch = mqttBatchFindTopic(pTopic->name);
+
+    return pTopic->batch;
+}
+
+/// @brief Gets the compression entry of a topic, finding it the first time.
+///        Like the batches, the compressed topics are read when the MQTT
+///        task starts.
+/// @param topic The topic's handle
+/// @return The entry's index, or negative if the topic is not compressed
+int32_t mqttTopicCompression(mqttTopicHandle_t topic)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    if (pTopic->compress == COMPRESS_NOT_FOUND_YET)
+        pTopic->compress = mqttCompressFindTopic(pTopic->name);
+
+    return pTopic->compress;
+}
+
+/// @brief Gets the MQTT-SN short name registered for a topic
+/// @param topic The topic's handle
+/// @param pShortName Where to copy the short name
+/// @return True if the topic has a short name
+bool mqttTopicGetShortName(mqttTopicHandle_t topic, uMqttSnTopicName_t *pShortName)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return false;
+
+    bool hasShortName;
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    hasShortName = pTopic->hasShortName;
+    if (hasShortName) {
+        *pShortName = pTopic->shortName;
+        stats.roundTripsSaved++;
+    }
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+
+    return hasShortName;
+}
+
+/// @brief Keeps the MQTT-SN short name registered for a topic
+/// @param topic The topic's handle
+/// @param pShortName The short name
+void mqttTopicSetShortName(mqttTopicHandle_t topic, const uMqttSnTopicName_t *pShortName)
+{
+    mqttTopic_t *pTopic = getTopic(topic);
+    if (pTopic == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    bool newId = !pTopic->hasShortName;
+    bool changedId = !newId && pTopic->shortName.name.id != pShortName->name.id;
+    pTopic->shortName = *pShortName;
+    pTopic->hasShortName = true;
+
+    if (changedId) {
+        rebuildShortIdIndex();
+    } else if (newId) {
+        addToIndex(shortIdIndex, hashShortId(pShortName->name.id), topic);
+
+        stats.registrations++;
+        if (pTopic->wasRegistered)
+            stats.reRegistrations++;
+        pTopic->wasRegistered = true;
+    }
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+}
+
+/// @brief Forgets the MQTT-SN short names of all the topics, as they are
+///        only valid for the gateway session they were registered in
+void mqttTopicClearShortNames(void)
+{
+    if (topicsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    for (int32_t i=0; i<topicCount; i++)
+        topics[i].hasShortName = false;
+
+    memset(shortIdIndex, INDEX_EMPTY, sizeof(shortIdIndex));
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+}
+
+/// @brief Gets a copy of the registry's statistics
+/// @param pStats Where to copy the statistics
+void mqttTopicGetStats(mqttTopicStats_t *pStats)
+{
+    if (topicsMutex == NULL) {
+        memset(pStats, 0, sizeof(mqttTopicStats_t));
+        return;
+    }
+
+    U_PORT_MUTEX_LOCK(topicsMutex);
+    *pStats = stats;
+    pStats->topics = topicCount;
+    U_PORT_MUTEX_UNLOCK(topicsMutex);
+}
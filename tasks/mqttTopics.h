@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * MQTT Topics header - the registry of the topics the tasks publish to,
+ * each with a small integer handle
+ *
+ */
+
+#ifndef _MQTT_TOPICS_H_
+#define _MQTT_TOPICS_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The most topics which can be registered, published or subscribed to
+#define MQTT_MAX_TOPICS             32
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// A registered topic, or negative if it isn't one
+typedef int32_t mqttTopicHandle_t;
+
+/// @brief What happens to a topic's message when it is published while its
+///        lane of the MQTT publish queue is full, or still has an older
+///        message of the topic
+typedef enum {
+    MQTT_POLICY_REJECT,         // A message for a full lane isn't queued
+    MQTT_POLICY_DROP_OLDEST,    // The oldest message on a full lane is dropped to make room
+    MQTT_POLICY_KEEP_LATEST,    // The message replaces the topic's message still on the lane,
+                                // or drops the oldest message if the lane is full
+} mqttTopicPolicy_t;
+
+/// @brief How a topic's payloads are encoded, set with MQTT_CBOR_TOPICS in
+///        the app.conf file
+typedef enum {
+    MQTT_FORMAT_JSON,
+    MQTT_FORMAT_CBOR,           // The same keys and values as the JSON, as CBOR
+} mqttTopicFormat_t;
+
+typedef struct {
+    int32_t topics;
+    int32_t registrations;      // MQTT-SN short names registered or subscribed
+    int32_t reRegistrations;    // Of those, again after connecting again
+    int32_t roundTripsSaved;    // Publishes which used a kept short name
+} mqttTopicStats_t;
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the topic registry, before the tasks are initialised
+/// @return         0 on success, negative on failure
+int32_t initMqttTopics(void);
+
+/// @brief          Frees the topic registry
+void finalizeMqttTopics(void);
+
+/// @brief              Registers a topic, or finds it if it is already registered
+/// @param pTopicName   The full topic name, which is copied
+/// @return             The topic's handle, or negative on failure
+mqttTopicHandle_t mqttTopicRegister(const char *pTopicName);
+
+/// @brief              Finds a registered topic by name, without registering it
+/// @param pTopicName   The full topic name
+/// @return             The topic's handle, or negative if it isn't registered
+mqttTopicHandle_t mqttTopicFind(const char *pTopicName);
+
+/// @brief              Finds a topic by the id of its MQTT-SN short name
+/// @param id           The short name's id, from a downlink message
+/// @return             The topic's handle, or negative if no topic has the id
+mqttTopicHandle_t mqttTopicFindByShortId(uint16_t id);
+
+/// @brief          Gets the number of registered topics, the handles are 0
+///                 to one less than this
+/// @return         The number of registered topics
+int32_t mqttTopicGetCount(void);
+
+/// @brief              Gets the name of a topic
+/// @param topic        The topic's handle
+/// @return             The full topic name, or NULL if the handle isn't valid
+const char *mqttTopicName(mqttTopicHandle_t topic);
+
+/// @brief              Sets what happens to the topic's messages when its
+///                     lane is full. A topic starts as MQTT_POLICY_REJECT.
+/// @param topic        The topic's handle
+/// @param policy       The policy
+/// @return             0 on success, negative if the handle isn't valid
+int32_t mqttTopicSetPolicy(mqttTopicHandle_t topic, mqttTopicPolicy_t policy);
+
+/// @brief              Gets what happens to the topic's messages when its
+///                     lane is full
+/// @param topic        The topic's handle
+/// @return             The policy, MQTT_POLICY_REJECT if the handle isn't valid
+mqttTopicPolicy_t mqttTopicPolicy(mqttTopicHandle_t topic);
+
+/// @brief              Gets how the topic's payloads are encoded
+/// @param topic        The topic's handle
+/// @return             The format, MQTT_FORMAT_JSON if the handle isn't valid
+mqttTopicFormat_t mqttTopicFormat(mqttTopicHandle_t topic);
+
+/// @brief              Sets the QoS the topic's messages are published with.
+///                     A topic starts as U_MQTT_QOS_AT_MOST_ONCE, and one
+///                     listed in MQTT_QOS_TOPICS in the app.conf file keeps
+///                     the QoS given there.
+/// @param topic        The topic's handle
+/// @param qos          The QoS
+/// @return             0 on success, negative if the handle isn't valid
+int32_t mqttTopicSetQoS(mqttTopicHandle_t topic, uMqttQos_t qos);
+
+/// @brief              Gets the QoS the topic's messages are published with,
+///                     set with MQTT_QOS_TOPICS in the app.conf file
+/// @param topic        The topic's handle
+/// @return             The QoS, U_MQTT_QOS_AT_MOST_ONCE if the topic isn't
+///                     listed or the handle isn't valid
+uMqttQos_t mqttTopicQoS(mqttTopicHandle_t topic);
+
+/// @brief              Gets the MQTT batch of a topic, finding it the first time
+/// @param topic        The topic's handle
+/// @return             The batch index, or negative if the topic is not batched
+int32_t mqttTopicBatch(mqttTopicHandle_t topic);
+
+/// @brief              Gets the compression entry of a topic, finding it the
+///                     first time
+/// @param topic        The topic's handle
+/// @return             The entry's index, or negative if the topic is not
+///                     compressed
+int32_t mqttTopicCompression(mqttTopicHandle_t topic);
+
+/// @brief              Gets the MQTT-SN short name registered for a topic
+/// @param topic        The topic's handle
+/// @param pShortName   Where to copy the short name
+/// @return             True if the topic has a short name
+bool mqttTopicGetShortName(mqttTopicHandle_t topic, uMqttSnTopicName_t *pShortName);
+
+/// @brief              Keeps the MQTT-SN short name registered for a topic
+/// @param topic        The topic's handle
+/// @param pShortName   The short name
+void mqttTopicSetShortName(mqttTopicHandle_t topic, const uMqttSnTopicName_t *pShortName);
+
+/// @brief          Forgets the MQTT-SN short names of all the topics, as they
+///                 are only valid for the gateway session they were
+///                 registered in
+void mqttTopicClearShortNames(void);
+
+/// @brief              Gets a copy of the registry's statistics
+/// @param pStats       Where to copy the statistics
+void mqttTopicGetStats(mqttTopicStats_t *pStats);
+
+#endif
@@ -23,8 +23,10 @@
 
 #include "common.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
 #include "configUtils.h"
 #include "registrationTask.h"
+#include "atArbiter.h"
 #include "NTPClient.h"
 
 /* ----------------------------------------------------------------
@@ -33,12 +35,8 @@
 #define BEGINNING_2023 ((int64_t) 1672531200)
 #define BEGINNING_2050 ((int64_t) 2524608000)
 
-#define REG_TASK_STACK_SIZE 1024
-#define REG_TASK_PRIORITY 5
-
-#define REG_QUEUE_STACK_SIZE QUEUE_STACK_SIZE_DEFAULT
-#define REG_QUEUE_PRIORITY 5
-#define REG_QUEUE_SIZE 5
+// The application and the MQTT task handle the network coming up
+#define MAX_NETWORK_UP_CALLBACKS 4
 
 /* ----------------------------------------------------------------
  * TASK COMMON VARIABLES
@@ -94,9 +92,10 @@ char pOperatorName[OPERATOR_NAME_SIZE] = "Unknown";
 int32_t operatorMcc = 0;
 int32_t operatorMnc = 0;
 
-// our callback for the application to hanlde when
-// the network comes up. 
-networkUpHandler_cb networkUpCallback = NULL;
+// the callbacks of the application and the tasks to handle
+// when the network comes up.
+static networkUpHandler_cb networkUpCallbacks[MAX_NETWORK_UP_CALLBACKS];
+static int32_t networkUpCallbackCount = 0;
 
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
@@ -130,6 +129,10 @@ static bool keepGoing(void *pParam)
     if (keepGoing) {
         gAppStatus = REGISTRATION_UNKNOWN;
         printDebug("Still trying to register on a network...");
+
+        // the bring-up can take minutes, so let the higher classes in
+        // between its registration polls
+        atChannelYield();
     } else {
         printDebug("Network registration cancelled");
     }
@@ -140,11 +143,12 @@ static bool keepGoing(void *pParam)
 static int32_t getNetworkInfo(void)
 {
     // request the PLMN / network operator information
-    int32_t errorCode = uCellNetGetOperatorStr(gCellDeviceHandle, pOperatorName, OPERATOR_NAME_SIZE);
+    int32_t errorCode;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uCellNetGetOperatorStr(gCellDeviceHandle, pOperatorName, OPERATOR_NAME_SIZE));
     if (errorCode < 0) {
         writeWarn("Failed to get operator name: %d", errorCode);
     } else {
-        errorCode = uCellNetGetMccMnc(gCellDeviceHandle, &operatorMcc, &operatorMnc);
+        AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uCellNetGetMccMnc(gCellDeviceHandle, &operatorMcc, &operatorMnc));
         if (errorCode < 0) {
             writeWarn("Failed to get MCC/MNC: %d", errorCode);
         }
@@ -185,9 +189,9 @@ static void handleNetworkIsUp()
     gIsNetworkSignalValid = true;
     networkUpCounter++;
     
-    if(networkUpCallback != NULL) {
+    for (int32_t i=0; i<networkUpCallbackCount; i++) {
         printDebug("Calling network back up callback...");
-        networkUpCallback();
+        networkUpCallbacks[i]();
     }
 }
 
@@ -195,6 +199,7 @@ static void checkNetworkIsBackUp(bool isUp)
 {
     bool prevNetworkUp = gIsNetworkUp;
     gIsNetworkUp = isUp;
+    notifyStateChange();
 
     // Handle the network going up 
     if (!prevNetworkUp && gIsNetworkUp) {
@@ -234,7 +239,8 @@ static bool usingRestrictedAPN(void)
 static void getNetworkOrNTPTime(void)
 {
     // try and get the network time from the cellular network
-    int64_t time = uCellInfoGetTimeUtc(gCellDeviceHandle);
+    int64_t time;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, time = uCellInfoGetTimeUtc(gCellDeviceHandle));
 
     // some modules return "80/01/06" for the date if the cellular
     // network don't return the clock. This will become year 2080!
@@ -267,7 +273,9 @@ static int32_t startNetworkRegistration(void)
 
     gAppStatus = REGISTERING;
     writeInfo("Bringing up the cellular network...");
-    int32_t errorCode = uNetworkInterfaceUp(gCellDeviceHandle, gNetworkType, &gNetworkCfg);
+    int32_t errorCode;
+    AT_CHANNEL_CALL_PREEMPTIBLE(AT_CLASS_REGISTRATION,
+                                errorCode = uNetworkInterfaceUp(gCellDeviceHandle, gNetworkType, &gNetworkCfg));
     if (gExitApp) return U_ERROR_COMMON_SUCCESS;
 
     if (errorCode != 0) {
@@ -275,13 +283,15 @@ static int32_t startNetworkRegistration(void)
         return errorCode;
     }
 
-    errorCode = uNetworkSetStatusCallback(gCellDeviceHandle, gNetworkType, networkStatusCallback, NULL);
+    AT_CHANNEL_CALL(AT_CLASS_REGISTRATION,
+                    errorCode = uNetworkSetStatusCallback(gCellDeviceHandle, gNetworkType, networkStatusCallback, NULL));
     if (errorCode != 0) {
         writeError("Failed to set the network status callback: %d", errorCode);
         return errorCode;
     }
 
     gIsNetworkUp = true;            // Yep, we've just connected.
+    notifyStateChange();
     handleNetworkIsUp();
 
     return 0;
@@ -294,12 +304,14 @@ static int32_t deRegisterFromNetwork(void)
 
     gAppStatus = REGISTERING;
     writeInfo("De-registering from the network...");
-    int32_t errorCode = uNetworkInterfaceDown(gCellDeviceHandle, gNetworkType);
+    int32_t errorCode;
+    AT_CHANNEL_CALL(AT_CLASS_CONTROL, errorCode = uNetworkInterfaceDown(gCellDeviceHandle, gNetworkType));
     if (errorCode != 0) {
         writeWarn("Failed to de-register from the cellular network: %d", errorCode);
     } else {
         writeInfo("Deregistered from cellular network");
         gIsNetworkUp = false;
+        notifyStateChange();
     }
 
     return errorCode;
@@ -314,6 +326,7 @@ static void queueHandler(void *pParam, size_t paramLengthBytes)
 static void taskLoop(void *pParameters)
 {
     U_PORT_MUTEX_LOCK(TASK_MUTEX);
+    setTaskState(taskConfig, TASK_RUNNING);
 
     // We won't exit this task loop until we are specifically told to
     // as other tasks may need to close their cloud connections and when
@@ -356,20 +369,7 @@ static void taskLoop(void *pParameters)
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(registrationMsg_t),
-                    REG_QUEUE_STACK_SIZE,
-                    REG_QUEUE_PRIORITY,
-                    REG_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create %s event queue %d", TASK_NAME, eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(registrationMsg_t));
 }
 
 
@@ -382,11 +382,16 @@ static int32_t initMutex()
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
 
-// Register the callback for when the network comes back up
+// Register a callback for when the network comes back up
 void registerNetworkUpCallback(networkUpHandler_cb callback)
 {
+    if (networkUpCallbackCount == MAX_NETWORK_UP_CALLBACKS) {
+        writeError("Too many Network is back up callbacks, not adding another");
+        return;
+    }
+
     printDebug("Set callback for Network is back up");
-    networkUpCallback = callback;
+    networkUpCallbacks[networkUpCallbackCount++] = callback;
 }
 
 /// @brief Initialises the registration task
@@ -416,7 +421,7 @@ int32_t initNetworkRegistrationTask(taskConfig_t *config)
 int32_t startNetworkRegistrationTaskLoop(commandParamsList_t *params)
 {
     EXIT_IF_CANT_RUN_TASK;
-    START_TASK_LOOP(REG_TASK_STACK_SIZE, REG_TASK_PRIORITY);
+    START_TASK_LOOP;
 }
 
 int32_t stopNetworkRegistrationTaskLoop(commandParamsList_t *params)
@@ -18,24 +18,51 @@
  *
  * Signal Quality Task to monitor the signal quality of the network connection
  *
+ * A stationary device measures much the same signal every time, so once
+ * SIGNAL_HEARTBEAT is set only every that many samples are published in
+ * full. In between, the cell quality fields which have moved by more than
+ * their deadband since they were last published go out on the
+ * SignalQualityDelta topic, and a sample with no such change isn't
+ * published at all. A change of cell publishes a full sample straight away.
+ *
  */
 
+#include <stddef.h>
 #include "common.h"
 #include "taskControl.h"
+#include "taskMetrics.h"
+#include "messageBus.h"
+#include "atArbiter.h"
 #include "signalQualityTask.h"
 #include "mqttTask.h"
+#include "mqttEncode.h"
 
 /* ----------------------------------------------------------------
  * DEFINES
  * -------------------------------------------------------------- */
-#define SIGNAL_QUALITY_TASK_STACK_SIZE 1024
-#define SIGNAL_QUALITY_TASK_PRIORITY 5
+#define PAYLOAD_BUFFER_SIZE 300
+
+// Signal samples waiting to be published to MQTT
+#define MQTT_PUBLISHER_QUEUE_LENGTH 2
 
-#define SIGNAL_QUALITY_QUEUE_STACK_SIZE QUEUE_STACK_SIZE_DEFAULT
-#define SIGNAL_QUALITY_QUEUE_PRIORITY 5
-#define SIGNAL_QUALITY_QUEUE_SIZE 5
+#define DELTA_TOPIC_SUFFIX "Delta"
 
-#define JSON_STRING_LENGTH 300
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A cell quality field of the signal sample, and how far it has
+/// to move from its published value before it is published again
+typedef struct {
+    const char *pName;
+    size_t offset;
+    int32_t deadband;
+} signalField_t;
+
+/// @brief The fields of a sample to publish on the delta topic
+typedef struct {
+    const signalSample_t *pSample;
+    uint32_t fields;                // Bit n set for signalFields[n]
+} signalDelta_t;
 
 /* ----------------------------------------------------------------
  * PUBLIC VARIABLES
@@ -57,6 +84,8 @@ static taskConfig_t *taskConfig = NULL;
  * STATIC VARIABLES
  * -------------------------------------------------------------- */
 static char topicName[MAX_TOPIC_NAME_SIZE];
+static mqttTopicHandle_t topicHandle = U_ERROR_COMMON_NOT_INITIALISED;
+static mqttTopicHandle_t deltaTopicHandle = U_ERROR_COMMON_NOT_INITIALISED;
 
 /// callback commands for incoming MQTT control messages
 static callbackCommand_t callbacks[] = {
@@ -65,8 +94,33 @@ static callbackCommand_t callbacks[] = {
     {"STOP_TASK", stopSignalQualityTaskLoop}
 };
 
-/// @brief buffer for the cell signal quality MQTT JSON message
-static char jsonBuffer[JSON_STRING_LENGTH];
+/// @brief buffer for the cell signal quality MQTT JSON or CBOR message
+static uint8_t payloadBuffer[PAYLOAD_BUFFER_SIZE];
+
+/// The deadbands, in dB apart from RxQual, are set by SIGNAL_DEADBAND_<name>
+static signalField_t signalFields[] = {
+    {"RSRP", offsetof(signalSample_t, rsrp), 3},
+    {"RSRQ", offsetof(signalSample_t, rsrq), 2},
+    {"RSSI", offsetof(signalSample_t, rssi), 3},
+    {"SNR", offsetof(signalSample_t, snr), 3},
+    {"RxQual", offsetof(signalSample_t, rxqual), 1}
+};
+
+/// Every this many samples are published in full, 0 publishes them all
+static int32_t heartbeatSamples = 0;
+static bool publishOnCellChange = true;
+
+/// The fields as they were last published, which the deadbands are from
+static signalSample_t published;
+static bool havePublished = false;
+static int32_t samplesSinceFull = 0;
+
+/// The last sample, whatever was published, which the cell changes are counted from
+static signalSample_t lastSample;
+static bool haveLastSample = false;
+
+static uPortMutexHandle_t publishMutex = NULL;
+static signalPublishStats_t publishStats;
 
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
@@ -78,6 +132,217 @@ static bool isNotExiting(void)
     return !gExitApp && !exitTask;
 }
 
+/// @brief The PLMN as one number, the MCC followed by the MNC
+static int32_t plmnValue(const signalSample_t *sample)
+{
+    return sample->mcc * (sample->mnc > 99 ? 1000 : 100) + sample->mnc;
+}
+
+/// @brief Encodes a signal sample as JSON
+static size_t encodeSignalJson(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const signalSample_t *sample = (const signalSample_t *)pData;
+
+    char format[] = "{" \
+        "\"Timestamp\":\"%s\", "                \
+        "\"CellQuality\":{"                     \
+            "\"RSRP\":%d, "                     \
+            "\"RSRQ\":%d, "                     \
+            "\"RSSI\":%d, "                     \
+            "\"SNR\":%d, "                      \
+            "\"RxQual\":%d}, "                  \
+        "\"CellInfo\":{"                        \
+            "\"LogicalCellID\":\"0x%08x\", "    \
+            "\"PhysicalCellID\":%d, "           \
+            "\"EARFCN\":%d, "                   \
+            "\"PLMN\":%03d%02d, "               \
+            "\"Operator\":\"%s\"}"              \
+    "}";
+
+    int length = snprintf((char *)pBuffer, size, format, sample->timestamp,
+                            sample->rsrp, sample->rsrq, sample->rssi, sample->snr, sample->rxqual,
+                            sample->logicalCellId, sample->physicalCellId, sample->earfcn,
+                            sample->mcc, sample->mnc, sample->operatorName);
+
+    return length < 0 || (size_t)length >= size ? 0 : length;
+}
+
+/// @brief Encodes a signal sample as CBOR, with the same keys as the JSON
+static size_t encodeSignalCbor(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const signalSample_t *sample = (const signalSample_t *)pData;
+
+    char cellId[11];
+    snprintf(cellId, sizeof(cellId), "0x%08x", sample->logicalCellId);
+
+    cborEncoder_t encoder;
+    cborInit(&encoder, pBuffer, size);
+    cborMap(&encoder, 3);
+    cborKeyText(&encoder, "Timestamp", sample->timestamp);
+    cborKeyMap(&encoder, "CellQuality", 5);
+        cborKeyInt(&encoder, "RSRP", sample->rsrp);
+        cborKeyInt(&encoder, "RSRQ", sample->rsrq);
+        cborKeyInt(&encoder, "RSSI", sample->rssi);
+        cborKeyInt(&encoder, "SNR", sample->snr);
+        cborKeyInt(&encoder, "RxQual", sample->rxqual);
+    cborKeyMap(&encoder, "CellInfo", 5);
+        cborKeyText(&encoder, "LogicalCellID", cellId);
+        cborKeyInt(&encoder, "PhysicalCellID", sample->physicalCellId);
+        cborKeyInt(&encoder, "EARFCN", sample->earfcn);
+        cborKeyInt(&encoder, "PLMN", plmnValue(sample));
+        cborKeyText(&encoder, "Operator", sample->operatorName);
+
+    return cborLength(&encoder);
+}
+
+static const mqttEncoders_t signalEncoders = {encodeSignalJson, encodeSignalCbor};
+
+/// @brief Gets a cell quality field of a sample
+static int32_t fieldValue(const signalSample_t *sample, const signalField_t *field)
+{
+    return *(const int32_t *)((const uint8_t *)sample + field->offset);
+}
+
+/// @brief Gets the fields which have moved by more than their deadband
+/// since they were last published
+/// @return Bit n set for each changed signalFields[n]
+static uint32_t changedFields(const signalSample_t *sample)
+{
+    uint32_t fields = 0;
+
+    for (size_t i=0; i<NUM_ELEMENTS(signalFields); i++) {
+        int32_t change = fieldValue(sample, &signalFields[i]) - fieldValue(&published, &signalFields[i]);
+        if (change > signalFields[i].deadband || change < -signalFields[i].deadband)
+            fields |= 1 << i;
+    }
+
+    return fields;
+}
+
+/// @brief Checks if the sample is from another cell or network than an
+/// earlier one
+static bool isNewCell(const signalSample_t *sample, const signalSample_t *earlier)
+{
+    return sample->logicalCellId != earlier->logicalCellId ||
+           sample->physicalCellId != earlier->physicalCellId ||
+           sample->earfcn != earlier->earfcn ||
+           plmnValue(sample) != plmnValue(earlier);
+}
+
+/// @brief Encodes the changed fields of a signal sample as JSON
+static size_t encodeDeltaJson(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const signalDelta_t *delta = (const signalDelta_t *)pData;
+    char *pJson = (char *)pBuffer;
+
+    int length = snprintf(pJson, size, "{\"Timestamp\":\"%s\", \"CellQuality\":{", delta->pSample->timestamp);
+    const char *separator = "";
+
+    for (size_t i=0; i<NUM_ELEMENTS(signalFields) && length >= 0 && (size_t)length < size; i++) {
+        if ((delta->fields & (1 << i)) == 0)
+            continue;
+
+        int fieldLength = snprintf(pJson + length, size - length, "%s\"%s\":%d",
+                                    separator,
+                                    signalFields[i].pName,
+                                    fieldValue(delta->pSample, &signalFields[i]));
+        length = fieldLength < 0 ? -1 : length + fieldLength;
+        separator = ", ";
+    }
+
+    if (length >= 0 && (size_t)length < size) {
+        int endLength = snprintf(pJson + length, size - length, "}}");
+        length = endLength < 0 ? -1 : length + endLength;
+    }
+
+    return length < 0 || (size_t)length >= size ? 0 : length;
+}
+
+/// @brief Encodes the changed fields of a signal sample as CBOR, with the
+///        same keys as the JSON
+static size_t encodeDeltaCbor(const void *pData, uint8_t *pBuffer, size_t size)
+{
+    const signalDelta_t *delta = (const signalDelta_t *)pData;
+
+    size_t count = 0;
+    for (size_t i=0; i<NUM_ELEMENTS(signalFields); i++)
+        count += (delta->fields >> i) & 1;
+
+    cborEncoder_t encoder;
+    cborInit(&encoder, pBuffer, size);
+    cborMap(&encoder, 2);
+    cborKeyText(&encoder, "Timestamp", delta->pSample->timestamp);
+    cborKeyMap(&encoder, "CellQuality", count);
+    for (size_t i=0; i<NUM_ELEMENTS(signalFields); i++) {
+        if ((delta->fields & (1 << i)) != 0)
+            cborKeyInt(&encoder, signalFields[i].pName, fieldValue(delta->pSample, &signalFields[i]));
+    }
+
+    return cborLength(&encoder);
+}
+
+static const mqttEncoders_t deltaEncoders = {encodeDeltaJson, encodeDeltaCbor};
+
+/// @brief Message bus handler which publishes a signal sample to MQTT,
+/// in full, as the fields which have changed, or not at all
+static void publishSignalSample(busEventType_t type, const void *pPayload, size_t length, void *pContext)
+{
+    const signalSample_t *sample = (const signalSample_t *)pPayload;
+
+    // a new cell is published in full until that succeeds, but each change
+    // of cell is only counted once
+    bool newCell = havePublished && isNewCell(sample, &published);
+    bool cellChanged = haveLastSample && isNewCell(sample, &lastSample);
+    lastSample = *sample;
+    haveLastSample = true;
+
+    bool full = heartbeatSamples <= 0 || !havePublished ||
+                samplesSinceFull + 1 >= heartbeatSamples ||
+                (newCell && publishOnCellChange);
+    uint32_t fields = full ? 0 : changedFields(sample);
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+
+    if (full) {
+        errorCode = mqttPublishEncoded(topicHandle, &signalEncoders, sample, payloadBuffer, sizeof(payloadBuffer),
+                                        true, MQTT_LANE_TELEMETRY);
+        if (errorCode == 0) {
+            published = *sample;
+            havePublished = true;
+            samplesSinceFull = 0;
+        }
+    } else {
+        samplesSinceFull++;
+
+        if (fields != 0) {
+            signalDelta_t delta = {sample, fields};
+            errorCode = mqttPublishEncoded(deltaTopicHandle, &deltaEncoders, &delta, payloadBuffer, sizeof(payloadBuffer),
+                                            false, MQTT_LANE_TELEMETRY);
+
+            // the deadband of each field published starts again from its new value
+            for (size_t i=0; errorCode == 0 && i<NUM_ELEMENTS(signalFields); i++) {
+                if ((fields & (1 << i)) != 0)
+                    memcpy((uint8_t *)&published + signalFields[i].offset,
+                           (const uint8_t *)sample + signalFields[i].offset, sizeof(int32_t));
+            }
+        }
+    }
+
+    U_PORT_MUTEX_LOCK(publishMutex);
+    publishStats.samples++;
+    if (cellChanged)
+        publishStats.cellChanges++;
+
+    if (errorCode != 0)
+        publishStats.failed++;
+    else if (full)
+        publishStats.full++;
+    else if (fields != 0)
+        publishStats.deltas++;
+    else
+        publishStats.suppressed++;
+    U_PORT_MUTEX_UNLOCK(publishMutex);
+}
+
 static void measureSignalQuality(void)
 {
     int32_t errorCode;
@@ -91,48 +356,33 @@ static void measureSignalQuality(void)
         printDebug("Fetching signal quality measurements...");
         gAppStatus = START_SIGNAL_QUALITY;
 
-        char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
-        getTimeStamp(timestamp);
-        errorCode = uCellInfoRefreshRadioParameters(gCellDeviceHandle);
+        signalSample_t sample;
+        getTimeStamp(sample.timestamp);
+        AT_CHANNEL_CALL(AT_CLASS_MEASUREMENT, errorCode = uCellInfoRefreshRadioParameters(gCellDeviceHandle));
 
         if (errorCode == 0) {
-            int32_t rsrp = uCellInfoGetRsrpDbm(gCellDeviceHandle);
-            int32_t rsrq = uCellInfoGetRsrqDb(gCellDeviceHandle);
-            int32_t rssi = uCellInfoGetRssiDbm(gCellDeviceHandle);
-            int32_t rxqual = uCellInfoGetRxQual(gCellDeviceHandle);
-            int32_t snr;
-            uCellInfoGetSnrDb(gCellDeviceHandle, &snr);
-            int32_t logicalCellId = uCellInfoGetCellIdLogical(gCellDeviceHandle);
-            int32_t physicalCellId = uCellInfoGetCellIdPhysical(gCellDeviceHandle);
-            int32_t earfcn = uCellInfoGetEarfcn(gCellDeviceHandle);
-
-            char format[] = "{" \
-                "\"Timestamp\":\"%s\", "                \
-                "\"CellQuality\":{"                     \
-                    "\"RSRP\":%d, "                     \
-                    "\"RSRQ\":%d, "                     \
-                    "\"RSSI\":%d, "                     \
-                    "\"SNR\":%d, "                      \
-                    "\"RxQual\":%d}, "                  \
-                "\"CellInfo\":{"                        \
-                    "\"LogicalCellID\":\"0x%08x\", "    \
-                    "\"PhysicalCellID\":%d, "           \
-                    "\"EARFCN\":%d, "                   \
-                    "\"PLMN\":%03d%02d, "               \
-                    "\"Operator\":\"%s\"}"              \
-            "}";
+            sample.rsrp = uCellInfoGetRsrpDbm(gCellDeviceHandle);
+            sample.rsrq = uCellInfoGetRsrqDb(gCellDeviceHandle);
+            sample.rssi = uCellInfoGetRssiDbm(gCellDeviceHandle);
+            sample.rxqual = uCellInfoGetRxQual(gCellDeviceHandle);
+            uCellInfoGetSnrDb(gCellDeviceHandle, &sample.snr);
+            sample.logicalCellId = uCellInfoGetCellIdLogical(gCellDeviceHandle);
+            sample.physicalCellId = uCellInfoGetCellIdPhysical(gCellDeviceHandle);
+            sample.earfcn = uCellInfoGetEarfcn(gCellDeviceHandle);
+            sample.mcc = operatorMcc;
+            sample.mnc = operatorMnc;
+            strncpy(sample.operatorName, pOperatorName, OPERATOR_NAME_SIZE - 1);
+            sample.operatorName[OPERATOR_NAME_SIZE - 1] = '\0';
 
             // Checking if some radio parameters are not zero is a good way
             // to determine if the network is visible and useable.
             // See macro "IS_NETWORK_AVAILABLE"
-            gIsNetworkSignalValid = (rsrp != 0) && (rsrq != 2147483647) && (rssi != 0);
-
-            snprintf(jsonBuffer, JSON_STRING_LENGTH, format, timestamp, 
-                                    rsrp, rsrq, rssi, snr, rxqual, 
-                                    logicalCellId, physicalCellId, earfcn, operatorMcc, operatorMnc, pOperatorName);
+            gIsNetworkSignalValid = (sample.rsrp != 0) && (sample.rsrq != 2147483647) && (sample.rssi != 0);
 
-            writeAlways(jsonBuffer);
-            publishMQTTMessage(topicName, jsonBuffer, U_MQTT_QOS_AT_MOST_ONCE, true);
+            // the MQTT publisher, and any other subscriber, get the sample from the message bus
+            int32_t subscribers = busPublish(BUS_EVENT_SIGNAL_SAMPLE, &sample, sizeof(signalSample_t));
+            if (subscribers < 0)
+                writeWarn("Failed to publish the signal quality sample: %d", subscribers);
         } else {
             if (errorCode == U_CELL_ERROR_NOT_REGISTERED) {
                 writeInfo("SignalQualityTask: Not registered - can't read cell info");
@@ -170,33 +420,16 @@ static void queueHandler(void *pParam, size_t paramLengthBytes)
 }
 
 // Signal Quality task loop for reading the RSRP and RSRQ values
-// and sending these values to the MQTT topic
+// and sending these values to the MQTT topic. This is run by the
+// scheduler every taskLoopDwellTime seconds.
 static void taskLoop(void *pParameters)
 {
-    while(isNotExiting()) {
-        measureSignalQuality();
-        dwellTask(taskConfig, isNotExiting);
-    }
-
-    FINALIZE_TASK;
+    measureSignalQuality();
 }
 
 static int32_t initQueue()
 {
-    int32_t eventQueueHandle = uPortEventQueueOpen(&queueHandler,
-                    TASK_NAME,
-                    sizeof(signalQualityMsg_t),
-                    SIGNAL_QUALITY_QUEUE_STACK_SIZE,
-                    SIGNAL_QUALITY_QUEUE_PRIORITY,
-                    SIGNAL_QUALITY_QUEUE_SIZE);
-
-    if (eventQueueHandle < 0) {
-        writeFatal("Failed to create %s event queue %d", TASK_NAME, eventQueueHandle);
-    }
-
-    TASK_QUEUE = eventQueueHandle;
-
-    return eventQueueHandle;
+    return initTaskQueue(taskConfig, &queueHandler, sizeof(signalQualityMsg_t));
 }
 
 static int32_t initMutex()
@@ -204,6 +437,43 @@ static int32_t initMutex()
     INIT_MUTEX;
 }
 
+/// @brief Reads the heartbeat, the deadbands and whether a change of cell
+/// publishes a full sample from the configuration
+static void readPublishConfig(void)
+{
+    char key[32];
+
+    setIntParamFromConfig("SIGNAL_HEARTBEAT", &heartbeatSamples);
+    setBoolParamFromConfig("SIGNAL_CELL_CHANGE", "TRUE", &publishOnCellChange);
+
+    for (size_t i=0; i<NUM_ELEMENTS(signalFields); i++) {
+        snprintf(key, sizeof(key), "SIGNAL_DEADBAND_%s", signalFields[i].pName);
+        for (char *p = key; *p != '\0'; p++)
+            *p = toupper((unsigned char)*p);
+
+        setIntParamFromConfig(key, &signalFields[i].deadband);
+    }
+
+    if (heartbeatSamples > 0)
+        writeInfo("Publishing signal quality in full every %d samples, and the changes in between", heartbeatSamples);
+}
+
+static int32_t initMQTTPublisher()
+{
+    int32_t errorCode = uPortMutexCreate(&publishMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the %s publish mutex (%d)", TASK_NAME, errorCode);
+        return errorCode;
+    }
+
+    int32_t handle = busSubscribe("SignalQualityMQTT", BUS_EVENT_BIT(BUS_EVENT_SIGNAL_SAMPLE),
+                                  publishSignalSample, NULL, MQTT_PUBLISHER_QUEUE_LENGTH);
+    if (handle < 0)
+        writeFatal("Failed to subscribe the %s MQTT publisher to the message bus: %d", TASK_NAME, handle);
+
+    return handle;
+}
+
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
@@ -215,7 +485,7 @@ int32_t queueMeasureNow(commandParamsList_t *params)
     signalQualityMsg_t qMsg;
     qMsg.msgType = MEASURE_SIGNAL_QUALTY_NOW;
 
-    return sendAppTaskMessage(TASK_ID, &qMsg, sizeof(signalQualityMsg_t));
+    return sendAppTaskMessage(SIGNAL_QUALITY_TASK, &qMsg, sizeof(signalQualityMsg_t));
 }
 
 /// @brief Initialises the Signal Quality task
@@ -230,10 +500,22 @@ int32_t initSignalQualityTask(taskConfig_t *config)
     int32_t result = U_ERROR_COMMON_SUCCESS;
 
     CREATE_TOPIC_NAME;
+    topicHandle = mqttTopicRegister(topicName);
+
+    // only the latest retained value is worth publishing
+    mqttTopicSetPolicy(topicHandle, MQTT_POLICY_KEEP_LATEST);
+
+    // a delta replacing another on the lane would lose its changes
+    strncat(topicName, DELTA_TOPIC_SUFFIX, MAX_TOPIC_NAME_SIZE - strlen(topicName) - 1);
+    deltaTopicHandle = mqttTopicRegister(topicName);
+    mqttTopicSetPolicy(deltaTopicHandle, MQTT_POLICY_DROP_OLDEST);
+
+    readPublishConfig();
 
     writeInfo("Initializing the %s task...", TASK_NAME);
     EXIT_ON_FAILURE(initMutex);
     EXIT_ON_FAILURE(initQueue);
+    EXIT_ON_FAILURE(initMQTTPublisher);
 
     char tp[MAX_TOPIC_NAME_SIZE];
     snprintf(tp, MAX_TOPIC_NAME_SIZE, "%sControl", TASK_NAME);
@@ -251,7 +533,7 @@ int32_t startSignalQualityTaskLoop(commandParamsList_t *params)
     if (params != NULL)
         taskConfig->taskLoopDwellTime = getParamValue(params, 1, 5, 60, 30);
 
-    START_TASK_LOOP(SIGNAL_QUALITY_TASK_STACK_SIZE, SIGNAL_QUALITY_TASK_PRIORITY);
+    SCHEDULE_TASK_LOOP(taskLoop, isNotExiting);
 }
 
 int32_t stopSignalQualityTaskLoop(commandParamsList_t *params)
@@ -261,5 +543,21 @@ int32_t stopSignalQualityTaskLoop(commandParamsList_t *params)
 
 int32_t finalizeSignalQualityTask(void)
 {
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Gets a copy of the counts of the signal samples published in
+/// full, as changes, and not at all
+/// @param pStats Where to copy the counts
+/// @return zero if successful, a negative number otherwise
+int32_t getSignalPublishStats(signalPublishStats_t *pStats)
+{
+    if (publishMutex == NULL || pStats == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    U_PORT_MUTEX_LOCK(publishMutex);
+    *pStats = publishStats;
+    U_PORT_MUTEX_UNLOCK(publishMutex);
+
     return U_ERROR_COMMON_SUCCESS;
 }
\ No newline at end of file
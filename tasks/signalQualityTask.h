@@ -31,10 +31,24 @@ int32_t startSignalQualityTaskLoop(commandParamsList_t *params);
 int32_t stopSignalQualityTaskLoop(commandParamsList_t *params);
 int32_t finalizeSignalQualityTask(void);
 
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief Counts of the signal samples and how they were published
+typedef struct {
+    int32_t samples;
+    int32_t full;               // Published in full, as the heartbeat or on a new cell
+    int32_t deltas;             // Published as the fields which changed
+    int32_t suppressed;         // Not published, as nothing changed beyond its deadband
+    int32_t failed;             // Failed to publish
+    int32_t cellChanges;
+} signalPublishStats_t;
+
 /* ----------------------------------------------------------------
  * PUBLIC TASK FUNCTIONS
  * -------------------------------------------------------------- */
 int32_t queueMeasureNow(commandParamsList_t *cmd);
+int32_t getSignalPublishStats(signalPublishStats_t *pStats);
 
 /* ----------------------------------------------------------------
  * QUEUE MESSAGE TYPE DEFINITIONS
@@ -53,4 +67,23 @@ typedef struct {
     } msg;
 } signalQualityMsg_t;
 
+/* ----------------------------------------------------------------
+ * MESSAGE BUS EVENT DEFINITIONS
+ * -------------------------------------------------------------- */
+/// @brief A signal quality measurement, published as BUS_EVENT_SIGNAL_SAMPLE
+typedef struct {
+    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
+    int32_t rsrp;
+    int32_t rsrq;
+    int32_t rssi;
+    int32_t snr;
+    int32_t rxqual;
+    int32_t logicalCellId;
+    int32_t physicalCellId;
+    int32_t earfcn;
+    int32_t mcc;
+    int32_t mnc;
+    char operatorName[OPERATOR_NAME_SIZE];
+} signalSample_t;
+
 #endif
\ No newline at end of file
@@ -20,61 +20,111 @@
 
 #include "common.h"
 #include "taskControl.h"
+#include "taskScheduler.h"
+#include "taskMetrics.h"
+#include "workerPool.h"
+#include "messageBus.h"
+#include "stackProfile.h"
+#include "atArbiter.h"
 #include "mqttTask.h"
+#include "mqttTopics.h"
+#include "mqttEncode.h"
+#include "mqttSubscriptions.h"
 #include "registrationTask.h"
 #include "signalQualityTask.h"
 #include "cellScanTask.h"
 #include "locationTask.h"
 #include "exampleTask.h"
+#include "appTasks.h"
 
 static void setRedLED(void *param);
 
 /* ----------------------------------------------------------------
- * Task Runner Definitions for each appTask. These task runners 
- * define the application. Here we specify what tasks are to run, 
- * and what configuration they are to use
+ * DEFINES
  * -------------------------------------------------------------- */
+// The task job pool runs the RUN_FUNC() one-shot functions, like the
+// cell scan and get location, and the iterations of the scheduled task
+// loops, so the stack must suit the largest job. A GNSS fix and a cell
+// scan can each keep a worker for minutes.
+#define TASK_JOB_POOL_WORKERS       4
+#define TASK_JOB_POOL_QUEUE_SIZE    8
+#define TASK_JOB_POOL_STACK_SIZE    (3 * 1024)
+#define TASK_JOB_POOL_PRIORITY      5
+
+// How often waitForAllTasksToStop() logs the tasks it is waiting for
+#define STOP_WAIT_LOG_MS            5000
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef struct {
+    taskRunner_t *runner;
+    taskWork_t job;
+    void *pParam;
+} taskJob_t;
+
+typedef struct {
+    taskRunner_t *runner;
+    taskState_t state;
+} taskStateWait_t;
+
+/// @brief The progress of one task's init when the tasks are initialised together
+typedef struct {
+    taskRunner_t *runner;
+    uPortSemaphoreHandle_t finishedSemaphore;
+    bool started;
+    bool joined;
+    volatile bool finished;
+    int32_t result;
+    int32_t timeMs;
+} taskInitProgress_t;
+
+/* ----------------------------------------------------------------
+ * Task Runners for each appTask, built from the application's task
+ * list in its config/appTasks.h file
+ * -------------------------------------------------------------- */
+#define TASK_RUNNER(id, func, name, explicitStop, initDependsOn, dwellTime,                             \
+                    taskStack, taskPriority, queueLength)                                               \
+            {init##func##Task, start##func##TaskLoop, stop##func##TaskLoop, finalize##func##Task,       \
+                explicitStop, initDependsOn,                                                            \
+                {id, name, dwellTime,                                                                   \
+                    {taskStack, taskPriority, queueLength},                                             \
+                    false, BLANK_TASK_HANDLES, NULL}},
 
 taskRunner_t taskRunners[] = {
-    // Registration - Looks after the cellular registration process
-    {initNetworkRegistrationTask, startNetworkRegistrationTaskLoop, stopNetworkRegistrationTaskLoop, finalizeNetworkRegistrationTask, true,
-            {NETWORK_REG_TASK, "Registration", 30, false, BLANK_TASK_HANDLES, NULL}},
-
-    // MQTT - Handles the MQTT broker connection, publishing messages and handling downlink messages
-    {initMQTTTask, startMQTTTaskLoop, stopMQTTTaskLoop, finalizeMQTTTask, false,
-            {MQTT_TASK, "MQTT", 30, false, BLANK_TASK_HANDLES, NULL}},
-            
-    // CellScan - Performs the +COPS=? Query for seeing what cells are available and publishes the results
-    {initCellScanTask, startCellScanTaskLoop, stopCellScanTask, finalizeCellScanTask, false,
-            {CELL_SCAN_TASK, "CellScan", -1, false, BLANK_TASK_HANDLES, NULL}},
-
-    // SignalQuality - Measures the Signal Quality and other network parameters and publishes the results
-    {initSignalQualityTask, startSignalQualityTaskLoop, stopSignalQualityTaskLoop, finalizeSignalQualityTask, false,
-            {SIGNAL_QUALITY_TASK, "SignalQuality", 30, false, BLANK_TASK_HANDLES, NULL}},
-
-    // Location - Periodically gets the GNSS location of the device and publishes the results
-    {initLocationTask, startLocationTaskLoop, stopLocationTaskLoop, finalizeLocationTask, false,
-            {LOCATION_TASK, "Location", 30, false, BLANK_TASK_HANDLES, NULL}},
-
-    // Example - Simple example task that does "nothing"
-    {initExampleTask, startExampleTaskLoop, stopExampleTaskLoop, finalizeExampleTask, false,
-            {EXAMPLE_TASK, "Example", 30, false, BLANK_TASK_HANDLES, NULL}},
+    APP_TASK_LIST(TASK_RUNNER)
+};
+
+// The position of each appTask in the task runners list
+#define TASK_RUNNER_INDEX(id, ...)      TASK_RUNNER_INDEX_##id,
+enum {
+    APP_TASK_LIST(TASK_RUNNER_INDEX)
+    NUM_TASK_RUNNERS
 };
 
+// The task runners by taskTypeId_t, NULL for tasks not in this application
+#define TASK_RUNNER_BY_ID(id, ...)      [id] = &taskRunners[TASK_RUNNER_INDEX_##id],
+static taskRunner_t *const taskRunnersById[MAX_TASKS] = {
+    APP_TASK_LIST(TASK_RUNNER_BY_ID)
+};
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static workerPool_t *taskJobPool = NULL;
+
+// Serialises the writes of the task lifecycle states and job counts
+static uPortMutexHandle_t lifecycleMutex = NULL;
+
 /* ----------------------------------------------------------------
  * STATIC FUNCTIONS
  * -------------------------------------------------------------- */
 static taskRunner_t *getTaskRunner(taskTypeId_t id)
 {
-    if (taskRunners == NULL)
+    if ((uint32_t)id >= MAX_TASKS)
         return NULL;
 
-    for(size_t i=0; i<NUM_ELEMENTS(taskRunners); i++) {
-        if (taskRunners[i].config.id == id)
-            return &taskRunners[i];
-    }
-
-    return NULL;
+    return taskRunnersById[id];
 }
 
 static taskConfig_t *getTaskConfig(taskTypeId_t id)
@@ -86,7 +136,8 @@ static taskConfig_t *getTaskConfig(taskTypeId_t id)
 }
 
 /// @brief Blocking function while waiting for the task to finish
-/// @param taskConfig The task Configuration to wait for
+/// @param id The ID of the task to wait for
+/// @param timeout The timeout in seconds
 static int32_t waitForTaskToStop(taskTypeId_t id, int32_t timeout)
 {
     taskRunner_t *taskRunner = getTaskRunner(id);
@@ -95,17 +146,55 @@ static int32_t waitForTaskToStop(taskTypeId_t id, int32_t timeout)
         return U_ERROR_COMMON_NOT_FOUND;
     }
 
-    int32_t count = timeout;
-    while(isMutexLocked(taskRunner->config.handles.mutexHandle)) {
-        writeInfo("Waiting for %s task to stop [%d]...", taskRunner->config.name, count);
-        uPortTaskBlock(2000);
-        if (count-- == 0)
-            return U_ERROR_COMMON_TIMEOUT;
-    }
+    if (taskRunner->state != TASK_STOPPED)
+        writeInfo("Waiting up to %d seconds for %s task to stop...", timeout, taskRunner->config.name);
+
+    if (!waitForTaskState(id, TASK_STOPPED, timeout * 1000))
+        return U_ERROR_COMMON_TIMEOUT;
 
     return U_ERROR_COMMON_SUCCESS;
 }
 
+/// @brief Checks if all the tasks which don't need an explicit stop have
+///        stopped their loops and have no jobs in flight
+static bool allTasksStopped(void *pParam)
+{
+    for(int i=0; i<NUM_ELEMENTS(taskRunners); i++) {
+        taskRunner_t *taskRunner = &taskRunners[i];
+        if (taskRunner->explicit_stop)
+            continue;
+
+        if (taskRunner->state != TASK_STOPPED || taskRunner->jobsInFlight > 0)
+            return false;
+    }
+
+    return true;
+}
+
+static bool taskInState(void *pParam)
+{
+    taskStateWait_t *stateWait = (taskStateWait_t *)pParam;
+
+    return stateWait->runner->state == stateWait->state;
+}
+
+/// @brief Pool job which runs a RUN_FUNC() function and keeps the
+///        task's count of jobs in flight
+static void runTaskJob(void *pParam)
+{
+    taskJob_t *taskJob = (taskJob_t *)pParam;
+    taskRunner_t *runner = taskJob->runner;
+
+    taskJob->job(taskJob->pParam);
+    uPortFree(taskJob);
+
+    U_PORT_MUTEX_LOCK(lifecycleMutex);
+    runner->jobsInFlight--;
+    U_PORT_MUTEX_UNLOCK(lifecycleMutex);
+
+    notifyStateChange();
+}
+
 static int32_t stopTask(taskTypeId_t id)
 {
     taskRunner_t *runner = getTaskRunner(id);
@@ -128,6 +217,253 @@ static int32_t stopTask(taskTypeId_t id)
     return U_ERROR_COMMON_SUCCESS;
 }
 
+/// @brief Logs how many times the task woke up while dwelling, compared to the
+///        number of wakeups the old 100ms polling would have needed
+static void printDwellStats(taskConfig_t *taskConfig)
+{
+    taskDwellStats_t *stats = &taskConfig->dwellStats;
+    if (stats->wakeups == 0)
+        return;
+
+    int32_t avgLatencyMs = 0;
+    if (stats->signalledWakeups > 0)
+        avgLatencyMs = stats->totalSignalLatencyMs / stats->signalledWakeups;
+
+    printInfo("%s dwell: %d wakeups (%d signalled), 100ms polling would have been %d. Signal latency avg %d ms, max %d ms",
+            taskConfig->name,
+            stats->wakeups,
+            stats->signalledWakeups,
+            stats->totalDwellMs / 100,
+            avgLatencyMs,
+            stats->maxSignalLatencyMs);
+}
+
+/// @brief Queues a job for the task on the task job pool, and keeps the
+///        task's count of jobs in flight
+/// @return 0 on success, U_ERROR_COMMON_FULL if the job queue is full, or negative on failure
+static int32_t submitJob(taskRunner_t *runner, taskWork_t job, void *pParam)
+{
+    if (runner == NULL)
+        return U_ERROR_COMMON_NOT_FOUND;
+
+    taskJob_t *taskJob = (taskJob_t *)pUPortMalloc(sizeof(taskJob_t));
+    if (taskJob == NULL)
+        return U_ERROR_COMMON_NO_MEMORY;
+
+    taskJob->runner = runner;
+    taskJob->job = job;
+    taskJob->pParam = pParam;
+
+    U_PORT_MUTEX_LOCK(lifecycleMutex);
+    runner->jobsInFlight++;
+    U_PORT_MUTEX_UNLOCK(lifecycleMutex);
+
+    int32_t errorCode = workerPoolSubmit(taskJobPool, runner->config.name, runTaskJob, taskJob);
+    if (errorCode < 0) {
+        uPortFree(taskJob);
+
+        U_PORT_MUTEX_LOCK(lifecycleMutex);
+        runner->jobsInFlight--;
+        U_PORT_MUTEX_UNLOCK(lifecycleMutex);
+    }
+
+    return errorCode;
+}
+
+/// @brief Task job which runs one iteration of a scheduled task loop
+static void runScheduledWork(void *pParam)
+{
+    taskConfig_t *taskConfig = (taskConfig_t *)pParam;
+
+    metricsRecordLoop(taskConfig);
+    taskConfig->scheduledWork(NULL);
+
+    taskConfig->scheduledBusy = false;
+}
+
+/// @brief Scheduler callback which starts one iteration of a scheduled task
+///        loop on the task job pool. The work can wait minutes for the AT
+///        channel or a GNSS fix, which would hold up the other timers on
+///        the scheduler's few workers.
+static void runScheduledTaskLoop(void *pParam)
+{
+    taskConfig_t *taskConfig = (taskConfig_t *)pParam;
+
+    if (!taskConfig->scheduledCanRun()) {
+        schedulerRemove(taskConfig->handles.scheduleHandle);
+        taskConfig->handles.scheduleHandle = U_ERROR_COMMON_UNKNOWN;
+        FINALIZE_TASK;
+        return;
+    }
+
+    // only one iteration of a task loop runs at a time
+    if (taskConfig->scheduledBusy) {
+        writeDebug("%s task loop is still running, skipping this iteration", TASK_NAME);
+        return;
+    }
+
+    taskConfig->scheduledBusy = true;
+    int32_t errorCode = submitJob(getTaskRunner(TASK_ID), runScheduledWork, taskConfig);
+    if (errorCode < 0) {
+        taskConfig->scheduledBusy = false;
+        writeWarn("Failed to run the %s task loop: %d", TASK_NAME, errorCode);
+    }
+}
+
+/// @brief Registers the task loop threads for stack profiling. The
+///        scheduled task loops run on the task job pool's workers instead.
+static void registerTaskStacks(void)
+{
+    for (int32_t i=0; i<NUM_TASK_RUNNERS; i++) {
+        taskConfig_t *taskConfig = &taskRunners[i].config;
+
+        if (TASK_STACK_SIZE > 0)
+            taskConfig->stackProfileHandle = stackProfileRegister(TASK_NAME, TASK_STACK_SIZE);
+        else
+            taskConfig->stackProfileHandle = U_ERROR_COMMON_NOT_FOUND;
+    }
+}
+
+/// @brief Message bus handler which passes a sendAppTaskMessage() message
+///        to the task's queue handler. The message was sent to this task
+///        only, so it isn't shared with another subscriber.
+static void runTaskCommand(busEventType_t type, const void *pPayload, size_t length, void *pContext)
+{
+    taskConfig_t *taskConfig = (taskConfig_t *)pContext;
+
+    taskConfig->queueHandler((void *)pPayload, length);
+}
+
+/// @brief Pool job which initialises one task and times it
+static void runTaskInit(void *pParam)
+{
+    taskInitProgress_t *taskInit = (taskInitProgress_t *)pParam;
+    int32_t startTime = uPortGetTickTimeMs();
+
+    taskInit->result = initSingleTask(taskInit->runner->config.id);
+    taskInit->timeMs = uPortGetTickTimeMs() - startTime;
+    taskInit->finished = true;
+
+    uPortSemaphoreGive(taskInit->finishedSemaphore);
+}
+
+/// @brief Checks the task's init dependencies are all in the task list
+static bool initDependenciesExist(taskRunner_t *runner)
+{
+    for (int32_t id=0; id<MAX_TASKS; id++) {
+        if ((runner->initDependencies & TASK_BIT(id)) != 0 && getTaskRunner(id) == NULL) {
+            writeFatal("%s task depends on task #%d, which is not in the application", runner->config.name, id);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/// @brief Checks the task's init dependencies have all been initialised
+static bool canInitTask(taskRunner_t *runner)
+{
+    for (int32_t id=0; id<MAX_TASKS; id++) {
+        if ((runner->initDependencies & TASK_BIT(id)) != 0 && !getTaskRunner(id)->config.initialised)
+            return false;
+    }
+
+    return true;
+}
+
+/// @brief Logs how long each task took to initialise, and the saving
+///        over initialising them one after the other
+static void printInitTimes(taskInitProgress_t *inits, int32_t totalMs)
+{
+    int32_t sequentialMs = 0;
+    taskInitProgress_t *slowest = NULL;
+
+    for (int i=0; i<NUM_TASK_RUNNERS; i++) {
+        if (!inits[i].finished)
+            continue;
+
+        writeInfo("  %s task init took %d ms", inits[i].runner->config.name, inits[i].timeMs);
+        sequentialMs += inits[i].timeMs;
+        if (slowest == NULL || inits[i].timeMs > slowest->timeMs)
+            slowest = &inits[i];
+    }
+
+    if (slowest != NULL)
+        writeInfo("Task init took %d ms, %d ms one after the other. %s task init was the slowest.",
+                totalMs, sequentialMs, slowest->runner->config.name);
+}
+
+/// @brief Initialises the tasks on the task job pool, starting each one
+///        as soon as the tasks it depends on have been initialised, and
+///        waits for them all to finish
+static int32_t initAllTasks(void)
+{
+    taskInitProgress_t inits[NUM_TASK_RUNNERS];
+    uPortSemaphoreHandle_t finishedSemaphore;
+
+    for (int i=0; i<NUM_TASK_RUNNERS; i++) {
+        if (!initDependenciesExist(&taskRunners[i]))
+            return U_ERROR_COMMON_INVALID_PARAMETER;
+    }
+
+    int32_t errorCode = uPortSemaphoreCreate(&finishedSemaphore, 0, NUM_TASK_RUNNERS);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the task init semaphore (%d)", errorCode);
+        return errorCode;
+    }
+
+    memset(inits, 0, sizeof(inits));
+    for (int i=0; i<NUM_TASK_RUNNERS; i++) {
+        inits[i].runner = &taskRunners[i];
+        inits[i].finishedSemaphore = finishedSemaphore;
+    }
+
+    int32_t startTime = uPortGetTickTimeMs();
+    int32_t initsRunning = 0;
+    int32_t initsLeft = NUM_TASK_RUNNERS;
+
+    while (initsLeft > 0) {
+        // start every task which is ready, unless a task has already failed
+        for (int i=0; i<NUM_TASK_RUNNERS && errorCode == 0; i++) {
+            if (inits[i].started || !canInitTask(inits[i].runner))
+                continue;
+
+            inits[i].started = true;
+            errorCode = workerPoolSubmit(taskJobPool, inits[i].runner->config.name, runTaskInit, &inits[i]);
+            if (errorCode == 0)
+                initsRunning++;
+        }
+
+        if (initsRunning == 0) {
+            if (errorCode == 0) {
+                writeFatal("Task init dependencies can't be met, check the task list for a loop");
+                errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
+            }
+
+            break;
+        }
+
+        uPortSemaphoreTake(finishedSemaphore);
+
+        for (int i=0; i<NUM_TASK_RUNNERS; i++) {
+            if (!inits[i].finished || inits[i].joined)
+                continue;
+
+            inits[i].joined = true;
+            initsRunning--;
+            initsLeft--;
+            if (inits[i].result < 0 && errorCode == 0)
+                errorCode = inits[i].result;
+        }
+    }
+
+    printInitTimes(inits, uPortGetTickTimeMs() - startTime);
+
+    uPortSemaphoreDelete(finishedSemaphore);
+
+    return errorCode;
+}
+
 static int32_t finalizeTask(taskTypeId_t id)
 {
     taskRunner_t *runner = getTaskRunner(id);
@@ -136,6 +472,8 @@ static int32_t finalizeTask(taskTypeId_t id)
         return U_ERROR_COMMON_UNKNOWN;
     }
 
+    printDwellStats(&runner->config);
+
     int32_t errorCode = runner->finalizeFunc();
     if (errorCode < 0) {
         printError("Failed to finalize task %s, error: %d", runner->config.name, errorCode);
@@ -149,34 +487,32 @@ static int32_t finalizeTask(taskTypeId_t id)
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
 
-/// @brief Checks the "isTaskRunningxxxx()" functions and returns when the tasks have all stopped.
+/// @brief Waits for the task loops to stop and their jobs to finish, and
+///        returns when the tasks have all stopped.
 void waitForAllTasksToStop()
 {
-    bool stillWaiting;
-
     writeInfo("Waiting for app tasks to stop... This can take sometime if waiting for AT commands to timeout...");
-    do
-    {
-        stillWaiting = false;
-
+    while (!waitForCondition(allTasksStopped, NULL, STOP_WAIT_LOG_MS)) {
         for(int i=0; i<NUM_ELEMENTS(taskRunners); i++) {
             taskRunner_t *taskRunner = &taskRunners[i];
-            
-            // some tasks need to stopped on their own
-            if (taskRunner->explicit_stop) 
+            if (taskRunner->explicit_stop)
                 continue;
 
-            if (isMutexLocked(taskRunner->config.handles.mutexHandle)) {
-                printTrace("...still waiting for %s task to finish", taskRunner->config.name);
-                stillWaiting = true;
-            }
+            if (taskRunner->state != TASK_STOPPED || taskRunner->jobsInFlight > 0)
+                printDebug("...still waiting for %s task to finish", taskRunner->config.name);
         }
+    }
 
-        if (stillWaiting)
-            printDebug("...still waiting for tasks to finish");
+    // Work from an event queue, like a measure now command, holds the
+    // task mutex but isn't a job, so wait for that to finish as well
+    for(int i=0; i<NUM_ELEMENTS(taskRunners); i++) {
+        taskRunner_t *taskRunner = &taskRunners[i];
+        if (taskRunner->explicit_stop || taskRunner->config.handles.mutexHandle == NULL)
+            continue;
 
-        uPortTaskBlock(500);
-    } while (stillWaiting);
+        U_PORT_MUTEX_LOCK(taskRunner->config.handles.mutexHandle);
+        U_PORT_MUTEX_UNLOCK(taskRunner->config.handles.mutexHandle);
+    }
 
     writeInfo("All tasks have now finished...");
 }
@@ -201,7 +537,13 @@ int32_t initSingleTask(taskTypeId_t id)
     taskConfig_t *taskConfig = &taskRunner->config;
 
     if (!taskConfig->initialised) {
-        int32_t errorCode = taskRunner->initFunc(taskConfig);
+        int32_t errorCode = uPortSemaphoreCreate(&taskConfig->handles.wakeupSemaphore, 0, 1);
+        if (errorCode < 0) {
+            writeFatal("* Failed to create the %s task wakeup semaphore (%d)", taskConfig->name, errorCode);
+            return errorCode;
+        }
+
+        errorCode = taskRunner->initFunc(taskConfig);
         if (errorCode < 0) {
             writeFatal("* Failed to initialise the %s task (%d)", taskConfig->name, errorCode);
             return errorCode;
@@ -217,18 +559,57 @@ int32_t initSingleTask(taskTypeId_t id)
 
 int32_t initTasks()
 {
-    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
-    taskRunner_t *runner = taskRunners;
+    int32_t errorCode = initStateNotify();
+    if (errorCode < 0)
+        return errorCode;
 
-    for(int i=0; i<NUM_ELEMENTS(taskRunners); i++) {
-        errorCode = initSingleTask(runner->config.id);
-        if (errorCode < 0)
-            break;
+    errorCode = initStackProfile();
+    if (errorCode < 0)
+        return errorCode;
 
-        runner++;
+    registerTaskStacks();
+
+    errorCode = uPortMutexCreate(&lifecycleMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the task lifecycle mutex (%d)", errorCode);
+        return errorCode;
     }
 
-    return errorCode;
+    errorCode = initScheduler();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initMetrics();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initAtArbiter();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initMqttTopics();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initMqttEncode();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initMqttSubscriptions();
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = workerPoolCreate(&taskJobPool, "TaskJobs", TASK_JOB_POOL_WORKERS,
+                                 TASK_JOB_POOL_QUEUE_SIZE, TASK_JOB_POOL_STACK_SIZE,
+                                 TASK_JOB_POOL_PRIORITY);
+    if (errorCode < 0)
+        return errorCode;
+
+    errorCode = initMessageBus();
+    if (errorCode < 0)
+        return errorCode;
+
+    return initAllTasks();
 }
 
 int32_t runTask(taskTypeId_t id, bool (*waitForFunc)(void))
@@ -247,12 +628,13 @@ int32_t runTask(taskTypeId_t id, bool (*waitForFunc)(void))
         return errorCode;
     }
 
-    if (waitForFunc != NULL)
+    if (waitForFunc != NULL) {
         printDebug("Waiting for task %s to complete its startup", runner->config.name);
         if (!waitFor(waitForFunc)) {
             printDebug("Exiting application, so not waiting for task %s anymore.", runner->config.name);
             return U_ERROR_COMMON_UNKNOWN;
-        } 
+        }
+    }
 
     return U_ERROR_COMMON_SUCCESS;
 }
@@ -277,29 +659,234 @@ int32_t finalizeAllTasks()
         runner++;
     }
 
+    finalizeMetrics();
+    finalizeAtArbiter();
+
+    // the bus handlers can start jobs on the task job pool, so stop them first
+    finalizeMessageBus();
+
+    workerPoolPrintStats(taskJobPool);
+    workerPoolDestroy(taskJobPool);
+    taskJobPool = NULL;
+
+    finalizeScheduler();
+
+    // the bus handlers, jobs and timers publish, and use the topics and
+    // subscriptions, so they are only freed once nothing else is running
+    finalizeMqttPublishing();
+    finalizeMqttSubscriptions();
+    finalizeMqttEncode();
+    finalizeMqttTopics();
+
+    finalizeStackProfile();
+
     return errorCode;
 }
 
 /// @brief Waits for a period of time and exits if the task is requested to exit/stop
+///        The dwell blocks on the task's wakeup semaphore, so it only wakes up
+///        at the end of the dwell time or when the task is signalled.
 /// @param taskConfig The task configuration that holds the dwell time
-/// @param exitFunc The function that checks if the task should exit/stop
+/// @param canDoDwell The function that checks if the task should exit/stop
 void dwellTask(taskConfig_t *taskConfig, bool (*canDoDwell)(void))
 {
-    // Always do a task block to give other tasks a run
-    uPortTaskBlock(100);
+    taskDwellStats_t *stats = &taskConfig->dwellStats;
 
+    metricsRecordLoop(taskConfig);
+    stackProfileSample(taskConfig->stackProfileHandle);
     writeDebug("%s dwelling for %d seconds...", taskConfig->name, taskConfig->taskLoopDwellTime);
 
-    // multiply by 10 as the TaskBlock is 100ms
-    int32_t count = taskConfig->taskLoopDwellTime * 10;
-    int i = 0;
-    do {
-        uPortTaskBlock(100);
-        i++;
-    } while (canDoDwell() && i < count);
+    int32_t dwellTimeMs = taskConfig->taskLoopDwellTime * 1000;
+    int32_t startTick = uPortGetTickTimeMs();
+    int32_t elapsedMs = 0;
+
+    while (canDoDwell() && elapsedMs < dwellTimeMs) {
+        int32_t errorCode = uPortSemaphoreTryTake(taskConfig->handles.wakeupSemaphore,
+                                                  dwellTimeMs - elapsedMs);
+        stats->wakeups++;
+
+        // a signal which ends the dwell is counted for the command latency
+        if (errorCode == 0 && !canDoDwell()) {
+            int32_t latencyMs = uPortGetTickTimeMs() - stats->lastSignalTick;
+            stats->signalledWakeups++;
+            stats->totalSignalLatencyMs += latencyMs;
+            if (latencyMs > stats->maxSignalLatencyMs)
+                stats->maxSignalLatencyMs = latencyMs;
+        }
+
+        elapsedMs = uPortGetTickTimeMs() - startTick;
+    }
+
+    stats->totalDwellMs += elapsedMs;
+}
+
+/// @brief Runs the task loop's work function on the shared scheduler every
+///        taskLoopDwellTime seconds. If the loop is already scheduled the
+///        period is updated from the taskLoopDwellTime instead.
+/// @param taskConfig The task configuration that holds the dwell time
+/// @param work One iteration of the task loop
+/// @param canRun Returns false when the task loop should stop
+/// @return 0 on success, negative on failure
+int32_t scheduleTaskLoop(taskConfig_t *taskConfig, taskWork_t work, bool (*canRun)(void))
+{
+    int32_t periodMs = taskConfig->taskLoopDwellTime * 1000;
+
+    if (taskConfig->handles.scheduleHandle >= 0) {
+        int32_t errorCode = schedulerSetPeriod(taskConfig->handles.scheduleHandle, periodMs);
+        if (errorCode == 0) {
+            writeInfo("%s task loop now runs every %d seconds", TASK_NAME, taskConfig->taskLoopDwellTime);
+            setTaskState(taskConfig, TASK_RUNNING);
+        }
+
+        return errorCode;
+    }
+
+    taskConfig->scheduledWork = work;
+    taskConfig->scheduledCanRun = canRun;
+
+    int32_t handle = schedulerAdd(TASK_NAME, runScheduledTaskLoop, taskConfig, periodMs, 0);
+    if (handle < 0) {
+        writeError("Failed to schedule the %s task loop (%d).", TASK_NAME, handle);
+        return handle;
+    }
+
+    taskConfig->handles.scheduleHandle = handle;
+    setTaskState(taskConfig, TASK_RUNNING);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Subscribes the task to the message bus for the messages sent
+///        with sendAppTaskMessage(), with the queue length from the
+///        application's task list, and records its size for the metrics
+/// @param taskConfig The task configuration to set the bus handle of
+/// @param pFunction The task's message handler
+/// @param paramLength The size of the task's message
+/// @return The bus handle, or negative on failure
+int32_t initTaskQueue(taskConfig_t *taskConfig, taskQueueHandler_t pFunction,
+                      size_t paramLength)
+{
+    taskConfig->queueHandler = pFunction;
+    taskConfig->queueMessageSize = paramLength;
+
+    // Only messages sent directly to the task are wanted, not published events
+    int32_t busHandle = busSubscribe(TASK_NAME, 0, runTaskCommand, taskConfig,
+                                     taskConfig->resources.queueLength);
+
+    if (busHandle < 0) {
+        writeFatal("Failed to subscribe %s to the message bus %d", TASK_NAME, busHandle);
+    }
+
+    TASK_QUEUE = busHandle;
+    taskConfig->metrics.queueSize = taskConfig->resources.queueLength;
+
+    return busHandle;
+}
+
+/// @brief Gets the number of appTasks
+/// @return The number of appTasks in the task runner list
+int32_t getTaskCount(void)
+{
+    return NUM_TASK_RUNNERS;
+}
+
+/// @brief Gets the task configuration by its position in the task runner list
+/// @param index The position in the task runner list
+/// @return The task configuration, or NULL if the index is out of range
+taskConfig_t *getTaskConfigAt(int32_t index)
+{
+    if (index < 0 || index >= getTaskCount())
+        return NULL;
+
+    return &taskRunners[index].config;
+}
+
+/// @brief Runs a one-shot task function on the shared task job pool
+/// @param taskConfig The task configuration of the task running the job
+/// @param job The function to run
+/// @return 0 on success, U_ERROR_COMMON_FULL if the job queue is full, or negative on failure
+int32_t submitTaskJob(taskConfig_t *taskConfig, taskWork_t job)
+{
+    return submitJob(getTaskRunner(TASK_ID), job, NULL);
+}
+
+/// @brief Gets the lifecycle state of the task's loop
+/// @param id The ID of the appTask
+/// @return The state of the task loop, TASK_STOPPED if the task is not found
+taskState_t getTaskState(taskTypeId_t id)
+{
+    taskRunner_t *runner = getTaskRunner(id);
+    if (runner == NULL)
+        return TASK_STOPPED;
+
+    return runner->state;
+}
+
+/// @brief Sets the lifecycle state of the task's loop and wakes up anything
+///        waiting on it. TASK_STOPPING is ignored if the task is already stopped.
+/// @param taskConfig The task configuration of the task
+/// @param state The new state
+void setTaskState(taskConfig_t *taskConfig, taskState_t state)
+{
+    taskRunner_t *runner = getTaskRunner(TASK_ID);
+    if (runner == NULL || lifecycleMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(lifecycleMutex);
+    if (state != TASK_STOPPING || runner->state != TASK_STOPPED)
+        runner->state = state;
+    U_PORT_MUTEX_UNLOCK(lifecycleMutex);
+
+    notifyStateChange();
+}
+
+/// @brief Blocks until the task's loop reaches the state
+/// @param id The ID of the appTask
+/// @param state The state to wait for
+/// @param timeoutMs How long to wait, or negative to wait forever
+/// @return true if the task reached the state, false on timeout
+bool waitForTaskState(taskTypeId_t id, taskState_t state, int32_t timeoutMs)
+{
+    taskStateWait_t stateWait;
+    stateWait.runner = getTaskRunner(id);
+    stateWait.state = state;
+
+    if (stateWait.runner == NULL)
+        return false;
+
+    return waitForCondition(taskInState, &stateWait, timeoutMs);
+}
+
+/// @brief Wakes up the task if it is dwelling, so it can re-check its state.
+///        A scheduled task loop is run straight away instead.
+/// @param taskConfig The task configuration of the task to wake up
+void signalTask(taskConfig_t *taskConfig)
+{
+    if (taskConfig == NULL || taskConfig->handles.wakeupSemaphore == NULL)
+        return;
+
+    taskConfig->dwellStats.lastSignalTick = uPortGetTickTimeMs();
+
+    if (taskConfig->handles.scheduleHandle >= 0)
+        schedulerTrigger(taskConfig->handles.scheduleHandle);
+
+    // The semaphore is binary, so a second signal before the
+    // task wakes up is simply ignored by the port layer
+    uPortSemaphoreGive(taskConfig->handles.wakeupSemaphore);
+}
+
+/// @brief Wakes up all the tasks and scheduled work, used when the application is exiting
+void signalAllTasks(void)
+{
+    for(int i=0; i<NUM_ELEMENTS(taskRunners); i++) {
+        signalTask(&taskRunners[i].config);
+    }
+
+    schedulerTriggerAll();
+    notifyStateChange();
 }
 
-/// @brief Sends a task a message via its event queue
+/// @brief Sends a task a message via the message bus
 /// @param taskId The TaskId (based on the taskTypeId_t)
 /// @param message pointer to the message to send
 /// @param msgSize the size of the message to send
@@ -320,15 +907,15 @@ int32_t sendAppTaskMessage(int32_t taskId, void *pMessage, size_t msgSize)
         return U_ERROR_COMMON_NOT_INITIALISED;
     }
 
-    int32_t errorCode = uPortEventQueueSendIrq(taskConfig->handles.eventQueueHandle, pMessage, msgSize);
-
-    // On systems which don't support IRQs (Windows/Raspberry PI) try the non-irq version
-    if (errorCode == U_ERROR_COMMON_NOT_SUPPORTED) {
-        errorCode = uPortEventQueueSend(taskConfig->handles.eventQueueHandle, pMessage, msgSize);
-    }
+    int32_t errorCode = U_ERROR_COMMON_INVALID_PARAMETER;
+    if (msgSize <= taskConfig->queueMessageSize)
+        errorCode = busSend(taskConfig->handles.busHandle, BUS_EVENT_TASK_COMMAND, pMessage, msgSize);
 
     if (errorCode < 0) {
-        writeDebug("SendAppTaskMessage(): Failed to send message to %s task event queue, ErrorCode: %d", taskConfig->name, errorCode);
+        writeDebug("SendAppTaskMessage(): Failed to send message to %s task, ErrorCode: %d", taskConfig->name, errorCode);
+        metricsRecordSendFailure(taskConfig);
+    } else {
+        metricsRecordQueueDepth(taskConfig, taskConfig->handles.busHandle);
     }
 
     return errorCode;
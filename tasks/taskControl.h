@@ -26,7 +26,11 @@
 /* ----------------------------------------------------------------
  * DEFINITIONS
  * -------------------------------------------------------------- */
-#define BLANK_TASK_HANDLES {NULL, NULL, U_ERROR_COMMON_UNKNOWN}
+#define BLANK_TASK_HANDLES {NULL, NULL, U_ERROR_COMMON_UNKNOWN, NULL, U_ERROR_COMMON_UNKNOWN}
+
+// Task init dependencies, see the application's task list
+#define TASK_BIT(id)            (1UL << (id))
+#define NO_TASK_DEPENDENCIES    0
 
 #define EXIT_ON_FAILURE(x)      result = x(); if (result < 0) return result
 #define CLEANUP_ON_ERROR(x)     if (errorCode == 0)     \
@@ -36,13 +40,19 @@
 
 #define TASK_MUTEX  taskConfig->handles.mutexHandle
 #define TASK_HANDLE taskConfig->handles.taskHandle
-#define TASK_QUEUE  taskConfig->handles.eventQueueHandle
+#define TASK_QUEUE  taskConfig->handles.busHandle
 #define TASK_NAME   taskConfig->name
 #define TASK_ID     taskConfig->id
 
+#define TASK_STACK_SIZE         taskConfig->resources.taskStackSize
+#define TASK_PRIORITY           taskConfig->resources.taskPriority
+
 #define TASK_INITIALISED        ((taskConfig != NULL) && taskConfig->initialised)
 
-#define TASK_IS_RUNNING         isMutexLocked(TASK_MUTEX)
+#define TASK_IS_RUNNING         (getTaskState(TASK_ID) == TASK_RUNNING)
+
+// The task mutex is held while the task is doing something, like a cell scan
+#define TASK_IS_BUSY            isMutexLocked(TASK_MUTEX)
 
 #define CREATE_TOPIC_NAME       snprintf(topicName, MAX_TOPIC_NAME_SIZE, "%s/%s/%s", gAppTopicHeader, gModuleSerial, TASK_NAME)
 
@@ -73,6 +83,8 @@
                                     return U_ERROR_COMMON_NOT_INITIALISED;                              \
                                 }                                                                       \
                                 exitTask = true;                                                        \
+                                setTaskState(taskConfig, TASK_STOPPING);                                \
+                                signalTask(taskConfig);                                                 \
                                 writeInfo("Stop %s task requested...", taskConfig->name);               \
                                 return U_ERROR_COMMON_SUCCESS;
 
@@ -83,43 +95,109 @@
                                 }                                                                       \
                                 return errorCode;
 
-#define RUN_FUNC(func, stackSize, priority)                                                             \
-                                uPortTaskHandle_t taskHandle;                                           \
-                                int32_t errorCode = uPortTaskCreate(runTaskAndDelete, TASK_NAME,        \
-                                            stackSize, func, priority, &taskHandle);                    \
+// Runs the function once on the shared task job pool
+#define RUN_FUNC(func)          int32_t errorCode = submitTaskJob(taskConfig, func);                    \
                                 if (errorCode < 0) {                                                    \
                                     writeError("Failed to start %s task function: %d",                  \
                                             TASK_NAME, errorCode); }
 
-#define START_TASK_LOOP(stackSize, priority)                                                            \
+// Starts the task loop on its own thread, using the task's stack size
+// and priority from the application's task list
+#define START_TASK_LOOP         setTaskState(taskConfig, TASK_STARTING);                                \
                                 int32_t errorCode = uPortTaskCreate(runTaskAndDelete, TASK_NAME,        \
-                                            stackSize, taskLoop, priority, &TASK_HANDLE);               \
+                                            TASK_STACK_SIZE, taskLoop, TASK_PRIORITY, &TASK_HANDLE);    \
                                 if (errorCode != 0) {                                                   \
                                     writeError("Failed to start the %s Task (%d).",                     \
                                             TASK_NAME, errorCode);                                      \
+                                    setTaskState(taskConfig, TASK_STOPPED);                             \
                                 }                                                                       \
                                 return errorCode;
 
+// The task loop's work function is run by the shared scheduler every
+// taskLoopDwellTime seconds, instead of on its own thread
+#define SCHEDULE_TASK_LOOP(work, canRun)                                                                \
+                                exitTask = false;                                                       \
+                                return scheduleTaskLoop(taskConfig, work, canRun);
+
 #define FINALIZE_TASK           writeDebug("%s task loop has stopped", TASK_NAME);                      \
                                 if (taskConfig->taskStoppedCallback != NULL) {                          \
                                         writeDebug("Running %s task stopped callback...", TASK_NAME);   \
                                         taskConfig->taskStoppedCallback(NULL);                          \
                                 }                                                                       \
-                                TASK_HANDLE = NULL;
+                                TASK_HANDLE = NULL;                                                     \
+                                setTaskState(taskConfig, TASK_STOPPED);
 
 /* ----------------------------------------------------------------
  * PUBLIC TYPE DEFINITIONS
  * -------------------------------------------------------------- */
 
+/// @brief The lifecycle state of an appTask's loop
+typedef enum {
+    TASK_STOPPED,
+    TASK_STARTING,
+    TASK_RUNNING,
+    TASK_STOPPING
+} taskState_t;
+
 typedef struct TaskHandles {
     uPortTaskHandle_t taskHandle;
     uPortMutexHandle_t mutexHandle;
-    int32_t eventQueueHandle;
+    int32_t busHandle;
+    uPortSemaphoreHandle_t wakeupSemaphore;
+    int32_t scheduleHandle;
 } taskHandles_t;
 
+/// @brief Statistics on how the task loop dwelled, used to show the
+///        saving over the old 100ms polling of the dwell time
+typedef struct TaskDwellStats {
+    int32_t wakeups;                // Number of times the dwell woke up
+    int32_t signalledWakeups;       // Wakeups which ended the dwell early because of a signal
+    int32_t totalDwellMs;           // Total time spent dwelling
+    int32_t totalSignalLatencyMs;   // Total time from signalTask() to the dwell ending
+    int32_t maxSignalLatencyMs;     // Worst time from signalTask() to the dwell ending
+    int32_t lastSignalTick;         // Tick time of the last signalTask() call
+} taskDwellStats_t;
+
+// Number of log2 buckets in a latency histogram, the last bucket
+// is for anything longer than 16 seconds
+#define METRICS_HISTOGRAM_BUCKETS   16
+
+/// @brief A latency histogram with log2 millisecond buckets. Bucket 0 is
+///        under 1ms, bucket n is from 2^(n-1) to 2^n - 1 ms.
+typedef struct LatencyHistogram {
+    int32_t count;
+    int32_t totalMs;
+    int32_t maxMs;
+    int32_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} latencyHistogram_t;
+
+/// @brief Runtime metrics for an appTask, published on the Metrics topic
+typedef struct TaskMetrics {
+    int32_t loopIterations;             // Task loop iterations
+    latencyHistogram_t ubxlibCalls;     // Time spent in blocking ubxlib calls
+    int32_t queueSize;                  // Size of the task's message bus queue
+    int32_t queueHighWater;             // Most messages waiting on the message bus queue
+    int32_t sendFailures;               // Failed sendAppTaskMessage() calls
+    int32_t publishesQueued;            // MQTT messages queued for publishing
+    int32_t publishesDropped;           // MQTT messages which could not be queued
+} taskMetrics_t;
+
+/// @brief The OS resources of an appTask, set in the application's task list
+typedef struct TaskResources {
+    int32_t taskStackSize;              // Stack size of the task loop's thread, 0 if it has no thread
+    int32_t taskPriority;               // Priority of the task loop's thread
+    int32_t queueLength;                // Number of messages the task's queue on the message bus can hold
+} taskResources_t;
+
 /// Callback for setting what happens after the task has stopped
 typedef void (*taskStoppedCallback_t)(void *);
 
+/// One iteration of a scheduled task loop
+typedef void (*taskWork_t)(void *);
+
+/// Handles a message sent to the task with sendAppTaskMessage()
+typedef void (*taskQueueHandler_t)(void *pParam, size_t paramLengthBytes);
+
 typedef struct TaskConfig {
     /// @brief The task ID which is taken from the task list enum
     taskTypeId_t id;
@@ -130,14 +208,43 @@ typedef struct TaskConfig {
     /// @brief How long the task loop should dwell for
     int32_t taskLoopDwellTime;
 
+    /// @brief The stack size, priority and queue length of the appTask
+    taskResources_t resources;
+
     /// @brief Flag to denote the appTask has been initialized and can be start/stop/finialized
     bool initialised;
 
-    /// @brief The handles for the appTask's Task, Mutex and EventQueue
+    /// @brief The handles for the appTask's Task, Mutex, message bus subscription, wakeup Semaphore and scheduler timer
     taskHandles_t handles;
 
     /// @brief callback function for when the appTask's loop has stopped.
     taskStoppedCallback_t taskStoppedCallback;
+
+    /// @brief Dwell/wakeup statistics for this appTask's loop
+    taskDwellStats_t dwellStats;
+
+    /// @brief The work function of a scheduled task loop
+    taskWork_t scheduledWork;
+
+    /// @brief Returns false when the scheduled task loop should stop
+    bool (*scheduledCanRun)(void);
+
+    /// @brief True while an iteration of the scheduled task loop is queued
+    ///        or running on the task job pool
+    volatile bool scheduledBusy;
+
+    /// @brief Runtime metrics for this appTask
+    taskMetrics_t metrics;
+
+    /// @brief Handles the messages sent to this appTask on the message bus
+    taskQueueHandler_t queueHandler;
+
+    /// @brief The largest message the queue handler takes
+    size_t queueMessageSize;
+
+    /// @brief The stack profile of the task loop's thread, negative if it
+    ///        has no thread or stack profiling is disabled
+    int32_t stackProfileHandle;
 } taskConfig_t;
 
 typedef int32_t (*taskInit_t)(taskConfig_t *taskConfig);
@@ -161,13 +268,26 @@ typedef struct TaskRunner {
     /// @brief This flag denotes the appTask must be stopped.
     bool explicit_stop;
 
+    /// @brief The TASK_BIT()s of the appTasks which must be initialised before this one
+    uint32_t initDependencies;
+
     /// @brief Contains the configuration for the appTask (see above)
     taskConfig_t config;
+
+    /// @brief The lifecycle state of the appTask's loop. This is only written
+    ///        with the lifecycle mutex held, but can be read at any time.
+    volatile taskState_t state;
+
+    /// @brief Number of RUN_FUNC() jobs queued or running for this appTask
+    volatile int32_t jobsInFlight;
 } taskRunner_t;
 
 /* ----------------------------------------------------------------
  * PUBLIC FUNCTIONS
  * -------------------------------------------------------------- */
+/// @brief Initialises all the appTasks. Tasks which do not depend on each
+///        other are initialised at the same time on the task job pool.
+/// @return 0 if successful, or negative on failure.
 int32_t initTasks();
 int32_t initSingleTask(taskTypeId_t id);
 
@@ -177,11 +297,74 @@ int32_t initSingleTask(taskTypeId_t id);
 /// @return 0 if successful, or negative on failure.
 int32_t runTask(taskTypeId_t id, bool (*waitForFunc)(void));
 
-void dwellTask(taskConfig_t *taskConfig, bool (*exitFunc)(void));
+/// @brief Blocks until the task's dwell time has passed, or the task is signalled
+/// @param taskConfig   The task configuration that holds the dwell time
+/// @param canDoDwell   Returns false when the dwell should end
+void dwellTask(taskConfig_t *taskConfig, bool (*canDoDwell)(void));
+
+/// @brief Runs the task loop's work function on the shared scheduler every
+///        taskLoopDwellTime seconds. If the loop is already scheduled the
+///        period is updated from the taskLoopDwellTime instead.
+/// @param taskConfig   The task configuration that holds the dwell time
+/// @param work         One iteration of the task loop
+/// @param canRun       Returns false when the task loop should stop
+/// @return             0 on success, negative on failure
+int32_t scheduleTaskLoop(taskConfig_t *taskConfig, taskWork_t work, bool (*canRun)(void));
+
+/// @brief Subscribes the task to the message bus for the messages sent
+///        with sendAppTaskMessage(), with the queue length from the
+///        application's task list, and records its size for the metrics
+/// @param taskConfig   The task configuration to set the bus handle of
+/// @param pFunction    The task's message handler
+/// @param paramLength  The size of the task's message
+/// @return             The bus handle, or negative on failure
+int32_t initTaskQueue(taskConfig_t *taskConfig, taskQueueHandler_t pFunction,
+                      size_t paramLength);
+
+/// @brief Gets the number of appTasks
+/// @return The number of appTasks in the task runner list
+int32_t getTaskCount(void);
+
+/// @brief Gets the task configuration by its position in the task runner list
+/// @param index    The position in the task runner list
+/// @return         The task configuration, or NULL if the index is out of range
+taskConfig_t *getTaskConfigAt(int32_t index);
+
+/// @brief Runs a one-shot task function on the shared task job pool
+/// @param taskConfig   The task configuration of the task running the job
+/// @param job          The function to run
+/// @return             0 on success, U_ERROR_COMMON_FULL if the job queue
+///                     is full, or negative on failure
+int32_t submitTaskJob(taskConfig_t *taskConfig, taskWork_t job);
+
+/// @brief Wakes up the task if it is dwelling, so it can re-check its state
+/// @param taskConfig   The task configuration of the task to wake up
+void signalTask(taskConfig_t *taskConfig);
+
+/// @brief Wakes up all the tasks, used when the application is exiting
+void signalAllTasks(void);
+
+/// @brief Gets the lifecycle state of the task's loop
+/// @param id       The ID of the appTask
+/// @return         The state of the task loop, TASK_STOPPED if the task is not found
+taskState_t getTaskState(taskTypeId_t id);
+
+/// @brief Sets the lifecycle state of the task's loop and wakes up anything
+///        waiting on it. TASK_STOPPING is ignored if the task is already stopped.
+/// @param taskConfig   The task configuration of the task
+/// @param state        The new state
+void setTaskState(taskConfig_t *taskConfig, taskState_t state);
+
+/// @brief Blocks until the task's loop reaches the state
+/// @param id           The ID of the appTask
+/// @param state        The state to wait for
+/// @param timeoutMs    How long to wait, or negative to wait forever
+/// @return             true if the task reached the state, false on timeout
+bool waitForTaskState(taskTypeId_t id, taskState_t state, int32_t timeoutMs);
 
 /// @brief Stops and then waits for the task to finish
 /// @param id       The ID of the appTask to stop
-/// @param timeout  The loop counter timeout
+/// @param timeout  The timeout in seconds
 /// @return         0 on success, negative on failure
 int32_t stopAndWait(taskTypeId_t id, int32_t timeout);
 
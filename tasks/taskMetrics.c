@@ -0,0 +1,850 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Task Metrics - runtime counters and latency histograms for each
+ * appTask. These are published periodically as JSON on the
+ * <header>/<IMEI>/Metrics topic, and on the DUMP_METRICS AppControl
+ * command. When they don't fit in one message the rest are published
+ * in parts on the Metrics/2, Metrics/3... topics.
+ *
+ */
+
+#include <stdarg.h>
+#include "common.h"
+#include "taskControl.h"
+#include "taskScheduler.h"
+#include "taskMetrics.h"
+#include "messageBus.h"
+#include "stackProfile.h"
+#include "atArbiter.h"
+#include "mqttTask.h"
+#include "mqttBatch.h"
+#include "mqttCompress.h"
+#include "mqttEncode.h"
+#include "mqttInflight.h"
+#include "mqttJournal.h"
+#include "mqttLatency.h"
+#include "mqttLanes.h"
+#include "mqttPool.h"
+#include "mqttReconnect.h"
+#include "mqttSubscriptions.h"
+#include "signalQualityTask.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define METRICS_JSON_LENGTH     3072
+
+// Parts the metrics message is split into when it doesn't fit in one
+#define METRICS_MAX_PARTS       4
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static uPortMutexHandle_t metricsMutex = NULL;
+
+// Serialises the use of the jsonBuffer
+static uPortMutexHandle_t jsonMutex = NULL;
+
+static int32_t metricsTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+
+static mqttTopicHandle_t metricsTopics[METRICS_MAX_PARTS];
+
+// with room for the closing brace and terminator after a full part
+static char jsonBuffer[METRICS_JSON_LENGTH + 2];
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS
+ * -------------------------------------------------------------- */
+static int32_t getBucket(int32_t timeMs)
+{
+    int32_t bucket = 0;
+    while (timeMs > 0 && bucket < METRICS_HISTOGRAM_BUCKETS-1) {
+        timeMs >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/// @brief Appends formatted text to the JSON buffer
+/// @return false if the buffer is full and the text was truncated
+static bool appendJson(size_t *pOffset, const char *format, ...)
+{
+    if (*pOffset >= METRICS_JSON_LENGTH)
+        return false;
+
+    va_list args;
+    va_start(args, format);
+    int count = vsnprintf(jsonBuffer + *pOffset, METRICS_JSON_LENGTH - *pOffset, format, args);
+    va_end(args);
+
+    if (count < 0 || (size_t)count >= METRICS_JSON_LENGTH - *pOffset) {
+        *pOffset = METRICS_JSON_LENGTH;
+        return false;
+    }
+
+    *pOffset += count;
+
+    return true;
+}
+
+static bool appendHistogram(size_t *pOffset, latencyHistogram_t *pHistogram)
+{
+    int32_t avgMs = pHistogram->count > 0 ? pHistogram->totalMs / pHistogram->count : 0;
+
+    // only include the buckets up to the last one used
+    int32_t lastBucket = METRICS_HISTOGRAM_BUCKETS-1;
+    while (lastBucket > 0 && pHistogram->buckets[lastBucket] == 0)
+        lastBucket--;
+
+    bool ok = appendJson(pOffset, "{\"Count\":%d,\"AvgMs\":%d,\"MaxMs\":%d,\"Hist\":[",
+                            pHistogram->count, avgMs, pHistogram->maxMs);
+
+    for (int32_t i=0; ok && i<=lastBucket; i++)
+        ok = appendJson(pOffset, i == 0 ? "%d" : ",%d", pHistogram->buckets[i]);
+
+    return ok && appendJson(pOffset, "]}");
+}
+
+/// @brief Appends the AT channel use and wait time histogram of each priority class
+static bool appendAtChannelStats(size_t *pOffset)
+{
+    bool ok = appendJson(pOffset, ",\"AtChannel\":[");
+
+    for (int32_t c=0; ok && c<MAX_AT_CLASSES; c++) {
+        atChannelStats_t stats;
+        if (atChannelGetStats(c, &stats) < 0)
+            break;
+
+        ok = appendJson(pOffset, "%s{\"Class\":\"%s\",\"Acquired\":%d,\"Preempted\":%d,\"Wait\":",
+                            c == 0 ? "" : ",",
+                            atChannelClassName(c),
+                            stats.acquired,
+                            stats.preempted) &&
+             appendHistogram(pOffset, &stats.waits) &&
+             appendJson(pOffset, "}");
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends how the signal samples were published, and the percentage
+/// of them which weren't published in full
+static bool appendSignalPublishStats(size_t *pOffset)
+{
+    signalPublishStats_t stats;
+    if (getSignalPublishStats(&stats) < 0 || stats.samples == 0)
+        return true;
+
+    int32_t percent = ((stats.deltas + stats.suppressed) * 100) / stats.samples;
+
+    return appendJson(pOffset, ",\"SignalPublish\":{\"Samples\":%d,\"Full\":%d,\"Deltas\":%d,\"Suppressed\":%d,\"Failed\":%d,\"CellChanges\":%d,\"Saved\":%d}",
+                        stats.samples,
+                        stats.full,
+                        stats.deltas,
+                        stats.suppressed,
+                        stats.failed,
+                        stats.cellChanges,
+                        percent);
+}
+
+/// @brief Appends the messages per publish and bytes saved of each batched topic
+static bool appendMqttBatchStats(size_t *pOffset)
+{
+    if (mqttBatchGetCount() == 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttBatch\":[");
+
+    for (int32_t i=0; ok && i<mqttBatchGetCount(); i++) {
+        mqttBatchStats_t stats;
+        if (mqttBatchGetStats(i, &stats) < 0)
+            break;
+
+        // messages per publish, to two decimal places
+        int32_t perPublish = stats.publishes == 0 ? 0 : (stats.messages * 100) / stats.publishes;
+
+        ok = appendJson(pOffset, "%s{\"Topic\":\"%s\",\"Messages\":%d,\"Publishes\":%d,\"PerPublish\":%d.%02d,\"BytesSaved\":%d}",
+                            i == 0 ? "" : ",",
+                            stats.pTopic,
+                            stats.messages,
+                            stats.publishes,
+                            perPublish / 100, perPublish % 100,
+                            stats.bytesSaved);
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the bytes before and after compressing of each compressed topic
+static bool appendMqttCompressStats(size_t *pOffset)
+{
+    if (mqttCompressGetCount() == 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttCompress\":[");
+
+    for (int32_t i=0; ok && i<mqttCompressGetCount(); i++) {
+        mqttCompressStats_t stats;
+        if (mqttCompressGetStats(i, &stats) < 0)
+            break;
+
+        // the compressed size as a percentage of the original
+        int32_t percent = stats.bytesIn == 0 ? 0 : (int32_t)(((int64_t)stats.bytesOut * 100) / stats.bytesIn);
+
+        ok = appendJson(pOffset, "%s{\"Topic\":\"%s\",\"Compressed\":%d,\"Skipped\":%d,\"BytesIn\":%d,\"BytesOut\":%d,\"Percent\":%d}",
+                            i == 0 ? "" : ",",
+                            stats.pTopic,
+                            stats.compressed,
+                            stats.skipped,
+                            stats.bytesIn,
+                            stats.bytesOut,
+                            percent);
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the occupancy of each size class of the MQTT message pool
+static bool appendMqttPoolStats(size_t *pOffset)
+{
+    if (mqttPoolGetClassCount() == 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttPool\":[");
+
+    for (int32_t i=0; ok && i<mqttPoolGetClassCount(); i++) {
+        slabPoolStats_t stats;
+        if (mqttPoolGetStats(i, &stats) < 0)
+            break;
+
+        ok = appendJson(pOffset, "%s{\"Size\":%d,\"Blocks\":%d,\"InUse\":%d,\"HighWater\":%d,\"Allocs\":%d,\"Spilled\":%d,\"Failures\":%d}",
+                            i == 0 ? "" : ",",
+                            stats.size,
+                            stats.blocks,
+                            stats.inUse,
+                            stats.highWater,
+                            stats.allocs,
+                            stats.spilled,
+                            stats.failures);
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the depth, waits and drops of each MQTT publish lane
+static bool appendMqttLaneStats(size_t *pOffset)
+{
+    mqttLaneStats_t laneStats;
+    if (mqttLaneGetStats(MQTT_LANE_CONTROL, &laneStats) < 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttLanes\":[");
+
+    for (int32_t i=0; ok && i<MQTT_LANE_COUNT; i++) {
+        mqttLaneStats_t stats;
+        if (mqttLaneGetStats(i, &stats) < 0)
+            continue;
+
+        ok = appendJson(pOffset, "%s{\"Lane\":\"%s\",\"Size\":%d,\"Queued\":%d,\"HighWater\":%d,\"Published\":%d,\"Replaced\":%d,\"Evicted\":%d,\"Dropped\":%d,\"Wait\":",
+                            i == 0 ? "" : ",",
+                            mqttLaneName(i),
+                            stats.size,
+                            stats.queued,
+                            stats.highWater,
+                            stats.published,
+                            stats.replaced,
+                            stats.evicted,
+                            stats.dropped) &&
+             appendHistogram(pOffset, &stats.waits) &&
+             appendJson(pOffset, "}");
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the delivery of the QoS 1 and 2 messages of each topic
+static bool appendMqttInflightStats(size_t *pOffset)
+{
+    mqttInflightStats_t inflightStats;
+    if (mqttInflightGetStats(0, &inflightStats) < 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttQoS\":{\"InFlight\":%d,\"Topics\":[", mqttInflightCount());
+    bool first = true;
+
+    for (mqttTopicHandle_t topic=0; ok && topic<mqttTopicGetCount(); topic++) {
+        mqttInflightStats_t stats;
+        if (mqttInflightGetStats(topic, &stats) < 0 || stats.sent == 0)
+            continue;
+
+        // the last part of the topic name, after the serial number
+        const char *pName = strrchr(mqttTopicName(topic), '/');
+        pName = pName == NULL ? mqttTopicName(topic) : pName + 1;
+
+        // messages sent again for each message sent, to two decimal places
+        int32_t retransmitRate = (stats.retransmits * 100) / stats.sent;
+
+        ok = appendJson(pOffset, "%s{\"Topic\":\"%s\",\"Sent\":%d,\"Delivered\":%d,\"Retransmits\":%d,\"HandedBack\":%d,"
+                                    "\"RetransmitRate\":%d.%02d,\"Latency\":",
+                            first ? "" : ",",
+                            pName,
+                            stats.sent,
+                            stats.delivered,
+                            stats.retransmits,
+                            stats.handedBack,
+                            retransmitRate / 100, retransmitRate % 100) &&
+             appendHistogram(pOffset, &stats.latency) &&
+             appendJson(pOffset, "}");
+        first = false;
+    }
+
+    return ok && appendJson(pOffset, "]}");
+}
+
+/// @brief Appends the p50, p95 and p99 of the time each topic's messages
+/// waited to be published, and of the time publishing them took
+static bool appendMqttLatencyStats(size_t *pOffset)
+{
+    mqttLatencyStats_t latencyStats;
+    if (mqttLatencyGetStats(0, &latencyStats) < 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttLatency\":[");
+    bool first = true;
+
+    for (mqttTopicHandle_t topic=0; ok && topic<mqttTopicGetCount(); topic++) {
+        mqttLatencyStats_t stats;
+        if (mqttLatencyGetStats(topic, &stats) < 0 || (stats.published == 0 && stats.failed == 0))
+            continue;
+
+        // the last part of the topic name, after the serial number
+        const char *pName = strrchr(mqttTopicName(topic), '/');
+        pName = pName == NULL ? mqttTopicName(topic) : pName + 1;
+
+        ok = appendJson(pOffset, "%s{\"Topic\":\"%s\",\"Published\":%d,\"Failed\":%d,"
+                                    "\"QueueMs\":[%d,%d,%d],\"PublishMs\":[%d,%d,%d]}",
+                            first ? "" : ",",
+                            pName,
+                            stats.published,
+                            stats.failed,
+                            metricsPercentile(&stats.queueWait, 50),
+                            metricsPercentile(&stats.queueWait, 95),
+                            metricsPercentile(&stats.queueWait, 99),
+                            metricsPercentile(&stats.publish, 50),
+                            metricsPercentile(&stats.publish, 95),
+                            metricsPercentile(&stats.publish, 99));
+        first = false;
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the format, length and encoding time of each topic's
+/// messages, and what CBOR saves over JSON on the messages compared
+static bool appendMqttEncodeStats(size_t *pOffset)
+{
+    mqttEncodeStats_t encodeStats;
+    if (mqttEncodeGetStats(0, &encodeStats) < 0)
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"MqttEncode\":[");
+    bool first = true;
+
+    for (mqttTopicHandle_t topic=0; ok && topic<mqttTopicGetCount(); topic++) {
+        mqttEncodeStats_t stats;
+        if (mqttEncodeGetStats(topic, &stats) < 0 || stats.messages == 0)
+            continue;
+
+        // the last part of the topic name, after the serial number
+        const char *pName = strrchr(mqttTopicName(topic), '/');
+        pName = pName == NULL ? mqttTopicName(topic) : pName + 1;
+
+        int32_t bytesSaved = stats.jsonBytes == 0 ? 0 : ((stats.jsonBytes - stats.cborBytes) * 100) / stats.jsonBytes;
+        int32_t timeSaved = stats.jsonUs == 0 ? 0 : ((stats.jsonUs - stats.cborUs) * 100) / stats.jsonUs;
+
+        ok = appendJson(pOffset, "%s{\"Topic\":\"%s\",\"Format\":\"%s\",\"Messages\":%d,\"AvgBytes\":%d,\"AvgUs\":%d,\"TooLarge\":%d,"
+                                    "\"Compared\":%d,\"JsonBytes\":%d,\"CborBytes\":%d,\"JsonUs\":%d,\"CborUs\":%d,"
+                                    "\"BytesSaved\":%d,\"TimeSaved\":%d}",
+                            first ? "" : ",",
+                            pName,
+                            mqttTopicFormat(topic) == MQTT_FORMAT_CBOR ? "CBOR" : "JSON",
+                            stats.messages,
+                            stats.bytes / stats.messages,
+                            stats.encodeUs / stats.messages,
+                            stats.tooLarge,
+                            stats.compared,
+                            stats.jsonBytes,
+                            stats.cborBytes,
+                            stats.jsonUs,
+                            stats.cborUs,
+                            bytesSaved,
+                            timeSaved);
+        first = false;
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the registered topics and the MQTT-SN short names registered
+static bool appendMqttTopicStats(size_t *pOffset)
+{
+    mqttTopicStats_t stats;
+    mqttTopicGetStats(&stats);
+    if (stats.topics == 0)
+        return true;
+
+    return appendJson(pOffset, ",\"MqttTopics\":{\"Topics\":%d,\"Registrations\":%d,\"ReRegistrations\":%d,\"RoundTripsSaved\":%d}",
+                        stats.topics,
+                        stats.registrations,
+                        stats.reRegistrations,
+                        stats.roundTripsSaved);
+}
+
+/// @brief Appends the offline journal use and its replay throughput
+static bool appendMqttJournalStats(size_t *pOffset)
+{
+    mqttJournalStats_t stats;
+    if (mqttJournalGetStats(&stats) < 0)
+        return true;
+
+    // messages replayed a second, to two decimal places
+    int32_t replayRate = stats.replayMs == 0 ? 0 : (int32_t)(((int64_t)stats.replayed * 100000) / stats.replayMs);
+
+    return appendJson(pOffset, ",\"Journal\":{\"Records\":%d,\"Bytes\":%d,\"Capacity\":%d,\"Recovered\":%d,"
+                                "\"Stored\":%d,\"Evicted\":%d,\"Replayed\":%d,\"ReplayMs\":%d,\"ReplayRate\":%d.%02d}",
+                        stats.journal.records,
+                        stats.journal.bytes,
+                        stats.journal.capacity,
+                        stats.journal.recovered,
+                        stats.journal.appended,
+                        stats.journal.evicted,
+                        stats.replayed,
+                        stats.replayMs,
+                        replayRate / 100, replayRate % 100);
+}
+
+/// @brief Appends the connection attempts and the time to connect again
+/// after the MQTT connection was lost
+static bool appendMqttReconnectStats(size_t *pOffset)
+{
+    mqttReconnectStats_t stats;
+    if (mqttReconnectGetStats(&stats) < 0)
+        return true;
+
+    return appendJson(pOffset, ",\"MqttReconnect\":{\"Attempts\":%d,\"Failures\":%d,\"Reconnects\":%d,"
+                                "\"NetworkWakeups\":%d,\"BackOffMs\":%d,\"Recovery\":",
+                        stats.attempts,
+                        stats.failures,
+                        stats.reconnects,
+                        stats.networkWakeups,
+                        stats.backOffMs) &&
+           appendHistogram(pOffset, &stats.recovery) &&
+           appendJson(pOffset, "}");
+}
+
+/// @brief Appends the subscriptions and the time from connecting to being
+/// subscribed to every topic
+static bool appendMqttSubscriptionStats(size_t *pOffset)
+{
+    mqttSubscriptionStats_t stats;
+    if (mqttSubscriptionsGetStats(&stats) < 0 || stats.subscriptions == 0)
+        return true;
+
+    return appendJson(pOffset, ",\"MqttSubscriptions\":{\"Topics\":%d,\"Subscribed\":%d,\"Requests\":%d,"
+                                "\"Failures\":%d,\"Connections\":%d,\"FullySubscribed\":",
+                        stats.subscriptions,
+                        stats.subscribed,
+                        stats.requests,
+                        stats.failures,
+                        stats.connections) &&
+           appendHistogram(pOffset, &stats.fullySubscribed) &&
+           appendJson(pOffset, "}");
+}
+
+/// @brief Appends the measured stack use and recommended size of each thread
+static bool appendStackProfile(size_t *pOffset)
+{
+    if (!stackProfileEnabled())
+        return true;
+
+    bool ok = appendJson(pOffset, ",\"Stacks\":[");
+
+    for (int32_t i=0; ok && i<stackProfileGetCount(); i++) {
+        stackProfileEntry_t entry;
+        if (stackProfileGet(i, &entry) < 0)
+            continue;
+
+        ok = appendJson(pOffset, "%s{\"Name\":\"%s\",\"Threads\":%d,\"Size\":%d,\"MinFree\":%d,\"Recommended\":%d}",
+                            i == 0 ? "" : ",",
+                            entry.pName,
+                            entry.threads,
+                            entry.stackSize,
+                            entry.minFree,
+                            stackProfileRecommendedSize(&entry));
+    }
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief Appends the counters and ubxlib call times of each task
+static bool appendTaskMetrics(size_t *pOffset)
+{
+    bool ok = appendJson(pOffset, ",\"Tasks\":[");
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    for (int32_t i=0; ok && i<getTaskCount(); i++) {
+        taskConfig_t *taskConfig = getTaskConfigAt(i);
+        taskMetrics_t *metrics = &taskConfig->metrics;
+
+        ok = appendJson(pOffset, "%s{\"Name\":\"%s\",\"Loops\":%d,\"Ubxlib\":",
+                            i == 0 ? "" : ",", TASK_NAME, metrics->loopIterations) &&
+             appendHistogram(pOffset, &metrics->ubxlibCalls) &&
+             appendJson(pOffset, ",\"QueueHWM\":%d,\"QueueSize\":%d,\"SendFails\":%d,\"PubQueued\":%d,\"PubDropped\":%d}",
+                            metrics->queueHighWater,
+                            metrics->queueSize,
+                            metrics->sendFailures,
+                            metrics->publishesQueued,
+                            metrics->publishesDropped);
+    }
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+
+    return ok && appendJson(pOffset, "]");
+}
+
+/// @brief The sections of the metrics message, in the order they are added
+static const struct {
+    const char *pName;
+    bool (*append)(size_t *pOffset);
+} metricsSections[] = {
+    {"Tasks", appendTaskMetrics},
+    {"AtChannel", appendAtChannelStats},
+    {"SignalPublish", appendSignalPublishStats},
+    {"MqttPool", appendMqttPoolStats},
+    {"MqttLanes", appendMqttLaneStats},
+    {"MqttBatch", appendMqttBatchStats},
+    {"MqttCompress", appendMqttCompressStats},
+    {"MqttQoS", appendMqttInflightStats},
+    {"MqttEncode", appendMqttEncodeStats},
+    {"MqttLatency", appendMqttLatencyStats},
+    {"MqttTopics", appendMqttTopicStats},
+    {"Journal", appendMqttJournalStats},
+    {"MqttReconnect", appendMqttReconnectStats},
+    {"MqttSubscriptions", appendMqttSubscriptionStats},
+    {"Stacks", appendStackProfile}
+};
+
+/// @brief Starts a part of the metrics message in the jsonBuffer
+static bool startMetricsPart(size_t *pOffset, const char *pTimestamp, int32_t part)
+{
+    *pOffset = 0;
+
+    return appendJson(pOffset, "{\"Timestamp\":\"%s\",\"Part\":%d", pTimestamp, part);
+}
+
+/// @brief Gets the topic of a part of the metrics message, registering it
+/// the first time. The first part is published on the Metrics topic and the
+/// others on Metrics/<part>, so a part never replaces another while waiting.
+static mqttTopicHandle_t getMetricsTopic(int32_t part)
+{
+    mqttTopicHandle_t *pTopic = &metricsTopics[part - 1];
+    if (*pTopic >= 0)
+        return *pTopic;
+
+    char topicName[MAX_TOPIC_NAME_SIZE];
+    if (part == 1)
+        snprintf(topicName, MAX_TOPIC_NAME_SIZE, "%s/%s/%s", gAppTopicHeader, gModuleSerial, METRICS_TOPIC);
+    else
+        snprintf(topicName, MAX_TOPIC_NAME_SIZE, "%s/%s/%s/%d", gAppTopicHeader, gModuleSerial, METRICS_TOPIC, part);
+
+    *pTopic = mqttTopicRegister(topicName);
+    mqttTopicSetPolicy(*pTopic, MQTT_POLICY_KEEP_LATEST);
+
+    return *pTopic;
+}
+
+/// @brief Closes the part of the metrics message in the jsonBuffer and
+/// publishes it, and optionally logs it
+/// @return 0 on success, negative on failure
+static int32_t publishMetricsPart(size_t offset, int32_t part, bool logMetrics)
+{
+    // the buffer has room for the closing brace past METRICS_JSON_LENGTH
+    jsonBuffer[offset++] = '}';
+    jsonBuffer[offset] = 0;
+
+    if (logMetrics)
+        writeAlways(jsonBuffer);
+
+    // the message is copied when it is queued
+    mqttTopicHandle_t topic = getMetricsTopic(part);
+    int32_t errorCode = publishMQTTMessageToTopic(topic, jsonBuffer, mqttTopicQoS(topic), false, MQTT_LANE_BULK);
+    if (errorCode < 0)
+        printDebug("Not able to publish the metrics part %d at the moment: %d", part, errorCode);
+
+    return errorCode;
+}
+
+/// @brief Builds and publishes the metrics, and optionally logs them. The
+/// sections are added to the message until the next one doesn't fit, when
+/// the message is published as a part and the section starts the next part.
+/// @return 0 on success, negative on failure
+static int32_t publishMetricsJson(bool logMetrics)
+{
+    int32_t errorCode = U_ERROR_COMMON_SUCCESS;
+    char timestamp[TIMESTAMP_MAX_LENGTH_BYTES];
+    size_t offset = 0;
+    int32_t part = 1;
+    int32_t sectionsInPart = 0;
+
+    getTimeStamp(timestamp);
+
+    U_PORT_MUTEX_LOCK(jsonMutex);
+    bool ok = startMetricsPart(&offset, timestamp, part);
+    for (size_t i=0; ok && i<NUM_ELEMENTS(metricsSections); i++) {
+        size_t sectionStart = offset;
+        if (metricsSections[i].append(&offset)) {
+            sectionsInPart++;
+            continue;
+        }
+
+        offset = sectionStart;
+        if (sectionsInPart == 0) {
+            writeWarn("Metrics %s are larger than %d bytes, not publishing them", metricsSections[i].pName, METRICS_JSON_LENGTH);
+            continue;
+        }
+
+        if (part == METRICS_MAX_PARTS) {
+            writeWarn("Metrics need more than %d parts, not publishing the %s and after", METRICS_MAX_PARTS, metricsSections[i].pName);
+            break;
+        }
+
+        int32_t partError = publishMetricsPart(offset, part, logMetrics);
+        if (errorCode == 0)
+            errorCode = partError;
+
+        ok = startMetricsPart(&offset, timestamp, ++part);
+        sectionsInPart = 0;
+
+        // try the section again in the empty part
+        i--;
+    }
+
+    int32_t partError = publishMetricsPart(offset, part, logMetrics);
+    if (errorCode == 0)
+        errorCode = partError;
+
+    if (logMetrics && stackProfileEnabled())
+        stackProfilePrintReport();
+    U_PORT_MUTEX_UNLOCK(jsonMutex);
+
+    return errorCode;
+}
+
+static void publishMetrics(void *pParam)
+{
+    publishMetricsJson(false);
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the metrics registry and schedules the periodic publish
+/// @return 0 on success, negative on failure
+int32_t initMetrics(void)
+{
+    int32_t errorCode = uPortMutexCreate(&metricsMutex);
+    if (errorCode == 0)
+        errorCode = uPortMutexCreate(&jsonMutex);
+
+    if (errorCode < 0) {
+        writeFatal("Failed to create the metrics mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    for (int32_t i=0; i<METRICS_MAX_PARTS; i++)
+        metricsTopics[i] = U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t intervalSeconds = METRICS_INTERVAL_DEFAULT;
+    setIntParamFromConfig("METRICS_INTERVAL", &intervalSeconds);
+    if (intervalSeconds <= 0) {
+        writeInfo("Periodic metrics publishing is disabled");
+        return U_ERROR_COMMON_SUCCESS;
+    }
+
+    int32_t intervalMs = intervalSeconds * 1000;
+    metricsTimerHandle = schedulerAdd(METRICS_TOPIC, publishMetrics, NULL, intervalMs, intervalMs);
+    if (metricsTimerHandle < 0)
+        return metricsTimerHandle;
+
+    writeInfo("Publishing metrics every %d seconds", intervalSeconds);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Stops the periodic metrics publish
+void finalizeMetrics(void)
+{
+    if (metricsTimerHandle >= 0) {
+        schedulerRemove(metricsTimerHandle);
+        metricsTimerHandle = U_ERROR_COMMON_NOT_INITIALISED;
+    }
+}
+
+/// @brief Adds a time to a latency histogram
+/// @param pHistogram The histogram
+/// @param timeMs The time to add
+void metricsRecordLatency(latencyHistogram_t *pHistogram, int32_t timeMs)
+{
+    if (metricsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    metricsHistogramAdd(pHistogram, timeMs);
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+}
+
+/// @brief Adds a time to a latency histogram without locking the metrics,
+///        for a histogram the caller keeps under its own mutex
+/// @param pHistogram The histogram
+/// @param timeMs The time to add
+void metricsHistogramAdd(latencyHistogram_t *pHistogram, int32_t timeMs)
+{
+    pHistogram->count++;
+    pHistogram->totalMs += timeMs;
+    if (timeMs > pHistogram->maxMs)
+        pHistogram->maxMs = timeMs;
+
+    pHistogram->buckets[getBucket(timeMs)]++;
+}
+
+/// @brief Estimates a percentile of a latency histogram. The buckets only
+///        give the log2 of the time, so the time is interpolated between
+///        the bucket's bounds, and is never more than the longest time.
+/// @param pHistogram The histogram
+/// @param percent The percentile, 1 to 100
+/// @return The estimated time in ms, 0 if the histogram is empty
+int32_t metricsPercentile(const latencyHistogram_t *pHistogram, int32_t percent)
+{
+    if (pHistogram == NULL || pHistogram->count <= 0)
+        return 0;
+
+    // the rank of the time, rounded up, so p100 is the longest
+    int32_t rank = (pHistogram->count * percent + 99) / 100;
+    if (rank < 1)
+        rank = 1;
+
+    int32_t below = 0;
+    for (int32_t i=0; i<METRICS_HISTOGRAM_BUCKETS; i++) {
+        int32_t inBucket = pHistogram->buckets[i];
+        if (below + inBucket < rank) {
+            below += inBucket;
+            continue;
+        }
+
+        // bucket 0 is under 1ms, bucket n is from 2^(n-1) to 2^n - 1 ms
+        if (i == 0)
+            return 0;
+
+        int32_t lowMs = 1 << (i - 1);
+        int32_t highMs = i == METRICS_HISTOGRAM_BUCKETS-1 ? pHistogram->maxMs : (1 << i) - 1;
+        int32_t timeMs = lowMs + (int32_t)((int64_t)(highMs - lowMs) * (rank - below) / inBucket);
+
+        return timeMs < pHistogram->maxMs ? timeMs : pHistogram->maxMs;
+    }
+
+    return pHistogram->maxMs;
+}
+
+/// @brief Records one iteration of the task's loop
+/// @param taskConfig The task configuration
+void metricsRecordLoop(taskConfig_t *taskConfig)
+{
+    if (metricsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    taskConfig->metrics.loopIterations++;
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+}
+
+/// @brief Records the time spent in a blocking ubxlib call
+/// @param taskConfig The task configuration
+/// @param timeMs The time the call took
+void metricsRecordUbxlibCall(taskConfig_t *taskConfig, int32_t timeMs)
+{
+    metricsRecordLatency(&taskConfig->metrics.ubxlibCalls, timeMs);
+}
+
+/// @brief Records the number of messages waiting on the task's message bus queue
+/// @param taskConfig The task configuration
+/// @param busHandle The task's message bus handle
+void metricsRecordQueueDepth(taskConfig_t *taskConfig, int32_t busHandle)
+{
+    if (metricsMutex == NULL)
+        return;
+
+    int32_t depth = busGetQueued(busHandle);
+    if (depth < 0)
+        return;
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    if (depth > taskConfig->metrics.queueHighWater)
+        taskConfig->metrics.queueHighWater = depth;
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+}
+
+/// @brief Records a failed sendAppTaskMessage() call
+/// @param taskConfig The task configuration of the task the message was for
+void metricsRecordSendFailure(taskConfig_t *taskConfig)
+{
+    if (metricsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    taskConfig->metrics.sendFailures++;
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+}
+
+/// @brief Records an MQTT message being queued or dropped
+/// @param taskConfig The task configuration of the MQTT task
+/// @param queued True if the message was queued, false if it was dropped
+void metricsRecordPublish(taskConfig_t *taskConfig, bool queued)
+{
+    if (metricsMutex == NULL)
+        return;
+
+    U_PORT_MUTEX_LOCK(metricsMutex);
+    if (queued)
+        taskConfig->metrics.publishesQueued++;
+    else
+        taskConfig->metrics.publishesDropped++;
+    U_PORT_MUTEX_UNLOCK(metricsMutex);
+}
+
+/// @brief Logs the metrics and publishes them on the Metrics topic
+/// @param params Not used
+/// @return 0 on success, negative on failure
+int32_t dumpMetrics(commandParamsList_t *params)
+{
+    if (metricsMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    return publishMetricsJson(true);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Task Metrics header - runtime counters and latency histograms for
+ * each appTask, published on the <header>/<IMEI>/Metrics topic
+ *
+ */
+
+#ifndef _TASK_METRICS_H_
+#define _TASK_METRICS_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+#define METRICS_TOPIC               "Metrics"
+
+// Default period of the metrics publish, set with METRICS_INTERVAL
+// in the app.conf file. Zero disables the periodic publish.
+#define METRICS_INTERVAL_DEFAULT    300
+
+// Times a blocking ubxlib call and adds it to the task's metrics
+#define TIMED_UBXLIB_CALL(call)     {                                                           \
+                                        int32_t _callStartTime = uPortGetTickTimeMs();          \
+                                        call;                                                   \
+                                        metricsRecordUbxlibCall(taskConfig,                     \
+                                            uPortGetTickTimeMs() - _callStartTime);             \
+                                    }
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the metrics registry and schedules the periodic publish
+/// @return         0 on success, negative on failure
+int32_t initMetrics(void);
+
+/// @brief          Stops the periodic metrics publish
+void finalizeMetrics(void);
+
+/// @brief              Adds a time to a latency histogram
+/// @param pHistogram   The histogram
+/// @param timeMs       The time to add
+void metricsRecordLatency(latencyHistogram_t *pHistogram, int32_t timeMs);
+
+/// @brief              Adds a time to a latency histogram without locking
+///                     the metrics, for a histogram the caller keeps under
+///                     its own mutex, so it is copied whole with the rest
+///                     of the caller's statistics
+/// @param pHistogram   The histogram
+/// @param timeMs       The time to add
+void metricsHistogramAdd(latencyHistogram_t *pHistogram, int32_t timeMs);
+
+/// @brief              Estimates a percentile of a latency histogram, by
+///                     interpolating within the bucket it falls in
+/// @param pHistogram   The histogram
+/// @param percent      The percentile, 1 to 100
+/// @return             The estimated time in ms, 0 if the histogram is empty
+int32_t metricsPercentile(const latencyHistogram_t *pHistogram, int32_t percent);
+
+/// @brief              Records one iteration of the task's loop
+/// @param taskConfig   The task configuration
+void metricsRecordLoop(taskConfig_t *taskConfig);
+
+/// @brief              Records the time spent in a blocking ubxlib call
+/// @param taskConfig   The task configuration
+/// @param timeMs       The time the call took
+void metricsRecordUbxlibCall(taskConfig_t *taskConfig, int32_t timeMs);
+
+/// @brief              Records the number of messages waiting on the task's message bus queue
+/// @param taskConfig   The task configuration
+/// @param busHandle    The task's message bus handle
+void metricsRecordQueueDepth(taskConfig_t *taskConfig, int32_t busHandle);
+
+/// @brief              Records a failed sendAppTaskMessage() call
+/// @param taskConfig   The task configuration of the task the message was for
+void metricsRecordSendFailure(taskConfig_t *taskConfig);
+
+/// @brief              Records an MQTT message being queued or dropped
+/// @param taskConfig   The task configuration of the MQTT task
+/// @param queued       True if the message was queued, false if it was dropped
+void metricsRecordPublish(taskConfig_t *taskConfig, bool queued);
+
+/// @brief              Logs the metrics and publishes them on the Metrics topic
+/// @param params       Not used
+/// @return             0 on success, negative on failure
+int32_t dumpMetrics(commandParamsList_t *params);
+
+#endif
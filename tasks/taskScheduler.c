@@ -0,0 +1,575 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Task Scheduler - a hierarchical timer wheel which runs the periodic
+ * work of the appTasks on a small set of shared worker threads.
+ *
+ * There is no separate tick thread. An idle worker advances the wheel
+ * and then blocks until the next occupied slot (or cascade) is due,
+ * so an idle scheduler does not wake up every tick.
+ *
+ */
+
+#include "common.h"
+#include "taskScheduler.h"
+#include "stackProfile.h"
+
+/* ----------------------------------------------------------------
+ * DEFINES
+ * -------------------------------------------------------------- */
+#define SCHEDULER_WORKER_COUNT          2
+#define SCHEDULER_WORKER_STACK_SIZE     (3 * 1024)
+#define SCHEDULER_WORKER_PRIORITY       5
+
+// Three levels of 64 slots at 100ms gives 6.4s, 6.8min and 7.3hrs
+#define WHEEL_LEVELS        3
+#define WHEEL_SLOT_BITS     6
+#define WHEEL_SLOTS         (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK     (WHEEL_SLOTS - 1)
+#define WHEEL_MAX_TICKS     ((1 << (WHEEL_SLOT_BITS * WHEEL_LEVELS)) - 1)
+
+#define MS_TO_TICKS(ms)     (((ms) + SCHEDULER_TICK_MS - 1) / SCHEDULER_TICK_MS)
+
+// How long finalizeScheduler() waits for a worker to finish its callback
+#define WORKER_EXIT_TIMEOUT_MS  5000
+
+/* ----------------------------------------------------------------
+ * TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+typedef enum {
+    TIMER_FREE,
+    TIMER_ARMED,        // Waiting in a wheel slot
+    TIMER_READY,        // Expired, waiting for a worker
+    TIMER_RUNNING       // The callback is running on a worker
+} timerState_t;
+
+typedef struct SCHEDULER_TIMER {
+    const char *pName;
+    schedulerCallback_t callback;
+    void *pParam;
+    int32_t periodMs;
+    uint32_t expiryTick;
+    timerState_t state;
+
+    // Removed or triggered while the callback was ready/running
+    bool removed;
+    bool triggered;
+
+    // The wheel slot (or ready list) this timer is in
+    struct SCHEDULER_TIMER **ppList;
+    struct SCHEDULER_TIMER *pPrev;
+    struct SCHEDULER_TIMER *pNext;
+} schedulerTimer_t;
+
+/* ----------------------------------------------------------------
+ * STATIC VARIABLES
+ * -------------------------------------------------------------- */
+static schedulerTimer_t timers[SCHEDULER_MAX_TIMERS];
+static schedulerTimer_t *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+// Expired timers in the order they expired
+static schedulerTimer_t *readyHead = NULL;
+static schedulerTimer_t *readyTail = NULL;
+
+static uint32_t wheelTick = 0;
+static uint32_t lastAdvanceMs = 0;
+
+// number of timers in the wheel slots
+static int32_t armedCount = 0;
+
+static uPortMutexHandle_t schedulerMutex = NULL;
+static uPortSemaphoreHandle_t workerSemaphore = NULL;
+
+static int32_t workersRunning = 0;
+static bool exitScheduler = false;
+
+// the workers share a stack profile entry
+static int32_t stackProfileHandle = U_ERROR_COMMON_NOT_INITIALISED;
+
+/* ----------------------------------------------------------------
+ * STATIC FUNCTIONS - called with the schedulerMutex locked
+ * -------------------------------------------------------------- */
+static void linkTimer(schedulerTimer_t **ppList, schedulerTimer_t *timer)
+{
+    timer->ppList = ppList;
+    timer->pPrev = NULL;
+    timer->pNext = *ppList;
+    if (*ppList != NULL)
+        (*ppList)->pPrev = timer;
+
+    *ppList = timer;
+}
+
+static void unlinkTimer(schedulerTimer_t *timer)
+{
+    if (timer->pPrev != NULL)
+        timer->pPrev->pNext = timer->pNext;
+    else
+        *(timer->ppList) = timer->pNext;
+
+    if (timer->pNext != NULL)
+        timer->pNext->pPrev = timer->pPrev;
+
+    timer->ppList = NULL;
+    timer->pPrev = NULL;
+    timer->pNext = NULL;
+}
+
+static void addReady(schedulerTimer_t *timer)
+{
+    timer->state = TIMER_READY;
+    timer->ppList = NULL;
+    timer->pPrev = NULL;
+    timer->pNext = NULL;
+
+    if (readyTail == NULL)
+        readyHead = timer;
+    else
+        readyTail->pNext = timer;
+
+    readyTail = timer;
+}
+
+static schedulerTimer_t *popReady(void)
+{
+    schedulerTimer_t *timer = readyHead;
+    if (timer != NULL) {
+        readyHead = timer->pNext;
+        if (readyHead == NULL)
+            readyTail = NULL;
+
+        timer->pNext = NULL;
+    }
+
+    return timer;
+}
+
+static void freeTimer(schedulerTimer_t *timer)
+{
+    memset(timer, 0, sizeof(schedulerTimer_t));
+    timer->state = TIMER_FREE;
+}
+
+/// @brief Puts the timer in the wheel slot for its expiry tick, or on
+///        the ready list if it has already expired
+static void insertTimer(schedulerTimer_t *timer)
+{
+    int32_t delta = (int32_t)(timer->expiryTick - wheelTick);
+    if (delta <= 0) {
+        addReady(timer);
+        return;
+    }
+
+    // Timers beyond the top level are placed at the furthest slot
+    // and are re-inserted when they cascade down to level 0
+    uint32_t position = timer->expiryTick;
+    if (delta > WHEEL_MAX_TICKS) {
+        delta = WHEEL_MAX_TICKS;
+        position = wheelTick + WHEEL_MAX_TICKS;
+    }
+
+    int32_t level = 0;
+    while (level < WHEEL_LEVELS-1 && delta >= (1 << (WHEEL_SLOT_BITS * (level+1))))
+        level++;
+
+    int32_t slot = (position >> (WHEEL_SLOT_BITS * level)) & WHEEL_SLOT_MASK;
+
+    timer->state = TIMER_ARMED;
+    linkTimer(&wheel[level][slot], timer);
+    armedCount++;
+}
+
+static void cascade(int32_t level, int32_t slot)
+{
+    schedulerTimer_t *timer = wheel[level][slot];
+    wheel[level][slot] = NULL;
+
+    while (timer != NULL) {
+        schedulerTimer_t *next = timer->pNext;
+        armedCount--;
+        insertTimer(timer);
+        timer = next;
+    }
+}
+
+static void advanceOneTick(void)
+{
+    wheelTick++;
+
+    // when level 0 wraps, bring the next level's slot down
+    if ((wheelTick & WHEEL_SLOT_MASK) == 0) {
+        if (((wheelTick >> WHEEL_SLOT_BITS) & WHEEL_SLOT_MASK) == 0)
+            cascade(2, (wheelTick >> (WHEEL_SLOT_BITS * 2)) & WHEEL_SLOT_MASK);
+
+        cascade(1, (wheelTick >> WHEEL_SLOT_BITS) & WHEEL_SLOT_MASK);
+    }
+
+    cascade(0, wheelTick & WHEEL_SLOT_MASK);
+}
+
+/// @brief Moves the wheel on to the current time
+static void advanceWheel(void)
+{
+    uint32_t nowMs = (uint32_t) uPortGetTickTimeMs();
+    uint32_t ticks = (nowMs - lastAdvanceMs) / SCHEDULER_TICK_MS;
+    lastAdvanceMs += ticks * SCHEDULER_TICK_MS;
+
+    // An empty wheel has nothing to expire or cascade
+    if (armedCount == 0) {
+        wheelTick += ticks;
+        return;
+    }
+
+    while (ticks-- > 0)
+        advanceOneTick();
+}
+
+/// @brief Works out how long an idle worker can block for
+/// @return The time in ms until the next slot or cascade, or -1 for forever
+static int32_t msToNextEvent(void)
+{
+    if (armedCount == 0)
+        return -1;
+
+    int32_t ticks = 1;
+    for (; ticks < WHEEL_SLOTS; ticks++) {
+        uint32_t tick = wheelTick + ticks;
+        if ((tick & WHEEL_SLOT_MASK) == 0 || wheel[0][tick & WHEEL_SLOT_MASK] != NULL)
+            break;
+    }
+
+    int32_t waitMs = (ticks * SCHEDULER_TICK_MS) - (int32_t)((uint32_t) uPortGetTickTimeMs() - lastAdvanceMs);
+    return waitMs < 0 ? 0 : waitMs;
+}
+
+/// @brief Puts the timer back into the wheel after its callback has run
+static void rearmTimer(schedulerTimer_t *timer)
+{
+    if (timer->removed || (timer->periodMs == 0 && !timer->triggered)) {
+        freeTimer(timer);
+        return;
+    }
+
+    advanceWheel();
+    if (timer->triggered) {
+        timer->triggered = false;
+        timer->expiryTick = wheelTick;
+    } else {
+        timer->expiryTick = wheelTick + MS_TO_TICKS(timer->periodMs);
+    }
+
+    insertTimer(timer);
+}
+
+static schedulerTimer_t *getTimer(int32_t handle)
+{
+    if (handle < 0 || handle >= SCHEDULER_MAX_TIMERS)
+        return NULL;
+
+    schedulerTimer_t *timer = &timers[handle];
+    if (timer->state == TIMER_FREE || timer->removed)
+        return NULL;
+
+    return timer;
+}
+
+/// @brief Wakes up an idle worker to re-check the wheel
+static void wakeWorker(void)
+{
+    uPortSemaphoreGive(workerSemaphore);
+}
+
+/* ----------------------------------------------------------------
+ * WORKER TASK
+ * -------------------------------------------------------------- */
+static void workerTask(void *pParam)
+{
+    uPortMutexLock(schedulerMutex);
+    while (!exitScheduler) {
+        advanceWheel();
+
+        schedulerTimer_t *timer = popReady();
+        if (timer != NULL) {
+            if (timer->removed) {
+                freeTimer(timer);
+                continue;
+            }
+
+            // let another idle worker pick up the rest of the ready list
+            if (readyHead != NULL)
+                wakeWorker();
+
+            timer->state = TIMER_RUNNING;
+            uPortMutexUnlock(schedulerMutex);
+
+            printTrace("Scheduler running %s", timer->pName);
+            timer->callback(timer->pParam);
+
+            stackProfileSample(stackProfileHandle);
+
+            uPortMutexLock(schedulerMutex);
+            rearmTimer(timer);
+        } else {
+            int32_t waitMs = msToNextEvent();
+            uPortMutexUnlock(schedulerMutex);
+
+            if (waitMs < 0)
+                uPortSemaphoreTake(workerSemaphore);
+            else
+                uPortSemaphoreTryTake(workerSemaphore, waitMs);
+
+            uPortMutexLock(schedulerMutex);
+        }
+    }
+
+    workersRunning--;
+    uPortMutexUnlock(schedulerMutex);
+
+    uPortTaskDelete(NULL);
+}
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief Creates the timer wheel and starts the scheduler workers
+/// @return 0 on success, negative on failure
+int32_t initScheduler(void)
+{
+    if (schedulerMutex != NULL)
+        return U_ERROR_COMMON_SUCCESS;
+
+    int32_t errorCode = uPortMutexCreate(&schedulerMutex);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the scheduler mutex (%d)", errorCode);
+        return errorCode;
+    }
+
+    errorCode = uPortSemaphoreCreate(&workerSemaphore, 0, SCHEDULER_WORKER_COUNT);
+    if (errorCode < 0) {
+        writeFatal("Failed to create the scheduler semaphore (%d)", errorCode);
+        return errorCode;
+    }
+
+    for (int i=0; i<SCHEDULER_MAX_TIMERS; i++)
+        freeTimer(&timers[i]);
+
+    exitScheduler = false;
+    lastAdvanceMs = (uint32_t) uPortGetTickTimeMs();
+
+    for (int i=0; i<SCHEDULER_WORKER_COUNT; i++) {
+        uPortTaskHandle_t handle;
+        stackProfileHandle = stackProfileRegister("Scheduler", SCHEDULER_WORKER_STACK_SIZE);
+        errorCode = uPortTaskCreate(workerTask, "Scheduler", SCHEDULER_WORKER_STACK_SIZE,
+                                    NULL, SCHEDULER_WORKER_PRIORITY, &handle);
+        if (errorCode < 0) {
+            writeFatal("Failed to start scheduler worker #%d (%d)", i, errorCode);
+            return errorCode;
+        }
+
+        uPortMutexLock(schedulerMutex);
+        workersRunning++;
+        uPortMutexUnlock(schedulerMutex);
+    }
+
+    writeDebug("Scheduler started with %d workers", SCHEDULER_WORKER_COUNT);
+
+    return U_ERROR_COMMON_SUCCESS;
+}
+
+/// @brief Stops the scheduler workers and removes all the timers
+void finalizeScheduler(void)
+{
+    if (schedulerMutex == NULL)
+        return;
+
+    uPortMutexLock(schedulerMutex);
+    exitScheduler = true;
+    uPortMutexUnlock(schedulerMutex);
+
+    for (int i=0; i<SCHEDULER_WORKER_COUNT; i++)
+        wakeWorker();
+
+    int32_t startTime = uPortGetTickTimeMs();
+    while (workersRunning > 0 && (uPortGetTickTimeMs() - startTime) < WORKER_EXIT_TIMEOUT_MS)
+        uPortTaskBlock(SCHEDULER_TICK_MS);
+
+    if (workersRunning > 0) {
+        writeWarn("%d scheduler worker(s) still running a callback, not freeing scheduler", workersRunning);
+        return;
+    }
+
+    uPortSemaphoreDelete(workerSemaphore);
+    workerSemaphore = NULL;
+    uPortMutexDelete(schedulerMutex);
+    schedulerMutex = NULL;
+}
+
+/// @brief Adds a timer to the scheduler
+/// @param pName The name of the timer, used for logging
+/// @param callback The function to run when the timer expires
+/// @param pParam The parameter to pass to the callback
+/// @param periodMs The time between the end of one run and the start of the next, or zero for one-shot
+/// @param firstDelayMs The delay before the first run
+/// @return The timer handle on success, negative on failure
+int32_t schedulerAdd(const char *pName, schedulerCallback_t callback, void *pParam,
+                     int32_t periodMs, int32_t firstDelayMs)
+{
+    if (schedulerMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (callback == NULL || periodMs < 0 || firstDelayMs < 0)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t handle = U_ERROR_COMMON_NO_MEMORY;
+
+    uPortMutexLock(schedulerMutex);
+    for (int i=0; i<SCHEDULER_MAX_TIMERS; i++) {
+        if (timers[i].state == TIMER_FREE) {
+            schedulerTimer_t *timer = &timers[i];
+            timer->pName = pName;
+            timer->callback = callback;
+            timer->pParam = pParam;
+            timer->periodMs = periodMs;
+
+            advanceWheel();
+            timer->expiryTick = wheelTick + MS_TO_TICKS(firstDelayMs);
+            insertTimer(timer);
+
+            handle = i;
+            break;
+        }
+    }
+    uPortMutexUnlock(schedulerMutex);
+
+    if (handle < 0) {
+        writeError("Failed to schedule %s, no free timers", pName);
+        return handle;
+    }
+
+    wakeWorker();
+
+    return handle;
+}
+
+/// @brief Changes the period of a timer. The new period starts now.
+/// @param handle The timer handle
+/// @param periodMs The new period of the timer
+/// @return 0 on success, negative on failure
+int32_t schedulerSetPeriod(int32_t handle, int32_t periodMs)
+{
+    if (schedulerMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    if (periodMs < 0)
+        return U_ERROR_COMMON_INVALID_PARAMETER;
+
+    int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
+
+    uPortMutexLock(schedulerMutex);
+    schedulerTimer_t *timer = getTimer(handle);
+    if (timer != NULL) {
+        timer->periodMs = periodMs;
+        if (timer->state == TIMER_ARMED) {
+            unlinkTimer(timer);
+            armedCount--;
+
+            advanceWheel();
+            timer->expiryTick = wheelTick + MS_TO_TICKS(periodMs);
+            insertTimer(timer);
+        }
+
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    uPortMutexUnlock(schedulerMutex);
+
+    if (errorCode == 0)
+        wakeWorker();
+
+    return errorCode;
+}
+
+/// @brief Runs the timer's callback as soon as a worker is free
+/// @param handle The timer handle
+/// @return 0 on success, negative on failure
+int32_t schedulerTrigger(int32_t handle)
+{
+    if (schedulerMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
+
+    uPortMutexLock(schedulerMutex);
+    schedulerTimer_t *timer = getTimer(handle);
+    if (timer != NULL) {
+        if (timer->state == TIMER_ARMED) {
+            unlinkTimer(timer);
+            armedCount--;
+            addReady(timer);
+        } else if (timer->state == TIMER_RUNNING) {
+            timer->triggered = true;
+        }
+
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    uPortMutexUnlock(schedulerMutex);
+
+    if (errorCode == 0)
+        wakeWorker();
+
+    return errorCode;
+}
+
+/// @brief Runs all the timers' callbacks as soon as possible
+void schedulerTriggerAll(void)
+{
+    for (int i=0; i<SCHEDULER_MAX_TIMERS; i++) {
+        if (timers[i].state != TIMER_FREE)
+            schedulerTrigger(i);
+    }
+}
+
+/// @brief Removes a timer. If the callback is running it will complete,
+///        but the timer will not run again.
+/// @param handle The timer handle
+/// @return 0 on success, negative on failure
+int32_t schedulerRemove(int32_t handle)
+{
+    if (schedulerMutex == NULL)
+        return U_ERROR_COMMON_NOT_INITIALISED;
+
+    int32_t errorCode = U_ERROR_COMMON_NOT_FOUND;
+
+    uPortMutexLock(schedulerMutex);
+    schedulerTimer_t *timer = getTimer(handle);
+    if (timer != NULL) {
+        if (timer->state == TIMER_ARMED) {
+            unlinkTimer(timer);
+            armedCount--;
+            freeTimer(timer);
+        } else {
+            // the worker frees it once it has finished with it
+            timer->removed = true;
+        }
+
+        errorCode = U_ERROR_COMMON_SUCCESS;
+    }
+    uPortMutexUnlock(schedulerMutex);
+
+    return errorCode;
+}
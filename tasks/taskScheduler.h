@@ -0,0 +1,84 @@
+/*
+ * Copyright 2024 u-blox
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ *
+ * Task Scheduler header - hierarchical timer wheel which runs the
+ * periodic work of the appTasks on a small set of shared workers
+ *
+ */
+
+#ifndef _TASK_SCHEDULER_H_
+#define _TASK_SCHEDULER_H_
+
+/* ----------------------------------------------------------------
+ * DEFINITIONS
+ * -------------------------------------------------------------- */
+// The resolution of the timer wheel
+#define SCHEDULER_TICK_MS           100
+
+// The maximum number of timers which can be scheduled at once
+#define SCHEDULER_MAX_TIMERS        16
+
+/* ----------------------------------------------------------------
+ * PUBLIC TYPE DEFINITIONS
+ * -------------------------------------------------------------- */
+/// Callback which is run on a scheduler worker when the timer expires
+typedef void (*schedulerCallback_t)(void *pParam);
+
+/* ----------------------------------------------------------------
+ * PUBLIC FUNCTIONS
+ * -------------------------------------------------------------- */
+
+/// @brief          Creates the timer wheel and starts the scheduler workers
+/// @return         0 on success, negative on failure
+int32_t initScheduler(void);
+
+/// @brief          Stops the scheduler workers and removes all the timers
+void finalizeScheduler(void);
+
+/// @brief              Adds a timer to the scheduler
+/// @param pName        Name of the timer, used for logging
+/// @param callback     The function to run when the timer expires
+/// @param pParam       The parameter to pass to the callback
+/// @param periodMs     The time between the end of one run and the start of
+///                     the next, or zero for a one-shot timer
+/// @param firstDelayMs The delay before the first run
+/// @return             The timer handle on success, negative on failure
+int32_t schedulerAdd(const char *pName, schedulerCallback_t callback, void *pParam,
+                     int32_t periodMs, int32_t firstDelayMs);
+
+/// @brief              Changes the period of a timer. The new period starts now.
+/// @param handle       The timer handle
+/// @param periodMs     The new period of the timer
+/// @return             0 on success, negative on failure
+int32_t schedulerSetPeriod(int32_t handle, int32_t periodMs);
+
+/// @brief              Runs the timer's callback as soon as a worker is free
+/// @param handle       The timer handle
+/// @return             0 on success, negative on failure
+int32_t schedulerTrigger(int32_t handle);
+
+/// @brief              Runs all the timers' callbacks as soon as possible
+void schedulerTriggerAll(void);
+
+/// @brief              Removes a timer. If the callback is running it will
+///                     complete, but the timer will not run again.
+/// @param handle       The timer handle
+/// @return             0 on success, negative on failure
+int32_t schedulerRemove(int32_t handle);
+
+#endif